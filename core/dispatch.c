@@ -154,6 +154,7 @@ dispatch(dcontext_t *dcontext)
 {
     fragment_t *targetf;
     fragment_t coarse_f;
+    IF_LINUX_KERNEL(DEBUG_DECLARE(bool built_bb;))
 
 #ifdef HAVE_TLS
     ASSERT(dcontext == get_thread_private_dcontext());
@@ -214,6 +215,7 @@ dispatch(dcontext_t *dcontext)
         ASSERT(!RUNNING_WITHOUT_CODE_CACHE());
         targetf = fragment_lookup_fine_and_coarse(dcontext, dcontext->next_tag,
                                                   &coarse_f, dcontext->last_exit);
+        IF_LINUX_KERNEL(DODEBUG({ built_bb = false; });)
         do {
             if (targetf != NULL) {
                 KSTART(monitor_enter);
@@ -226,13 +228,26 @@ dispatch(dcontext_t *dcontext)
             if (targetf != NULL)
                 break;
             if (USE_BB_BUILDING_LOCK()) {
-                mutex_lock(&bb_building_lock);
+                /* The lock is the build queue for shared bbs: a thread that
+                 * misses on a tag someone else is building waits here and then
+                 * finds that builder's bb, rather than building its own copy.
+                 */
+                if (!mutex_trylock(&bb_building_lock)) {
+                    STATS_INC(num_bb_build_waits);
+                    KSTART(bb_building_wait);
+                    mutex_lock(&bb_building_lock);
+                    KSTOP(bb_building_wait);
+                }
                 /* must re-lookup while holding lock and keep the lock until we've
                  * built the bb and added it to the lookup table
                  * FIXME: optimize away redundant lookup: flags to know why came out?
                  */
                 targetf = fragment_lookup_fine_and_coarse(dcontext, dcontext->next_tag,
                                                           &coarse_f, dcontext->last_exit);
+                DOSTATS({
+                    if (targetf != NULL)
+                        STATS_INC(num_bb_builds_deduped);
+                });
             }
             if (targetf == NULL) {
                 SELF_PROTECT_LOCAL(dcontext, WRITABLE);
@@ -242,6 +257,7 @@ dispatch(dcontext_t *dcontext)
                                                _IF_CLIENT(false/*!for_trace*/)
                                                _IF_CLIENT(NULL));
                 SELF_PROTECT_LOCAL(dcontext, READONLY);
+                IF_LINUX_KERNEL(DODEBUG({ built_bb = true; });)
                 if (dcontext->emulating_interrupt_return) {
                     STATS_INC(num_fragment_tails_iret);
                 }
@@ -263,8 +279,12 @@ dispatch(dcontext_t *dcontext)
                 mutex_unlock(&bb_building_lock);
             /* loop around and re-do monitor check */
         } while (true);
+#ifdef LINUX_KERNEL
+        DOSTATS({ os_note_dispatch_exit(dcontext, built_bb); });
+#endif
 
         dcontext->emulating_interrupt_return = false;
+        FCACHE_MARK_RECENTLY_USED(targetf);
 
         if (dispatch_enter_fcache(dcontext, targetf)) {
             /* won't reach here: will re-enter dispatch() with a clean stack */
@@ -835,6 +855,15 @@ dispatch_enter_dynamorio(dcontext_t *dcontext)
             
             dcontext->next_tag = EXIT_TARGET_TAG(dcontext, dcontext->last_fragment,
                                                  dcontext->last_exit);
+#ifdef INLINE_SIGNAL_CHECKS
+            /* mangle_insert_signal_check() exits with the app's xcx still
+             * in its tls spill slot
+             */
+            if (TEST(LINK_SIGNAL_CHECK, dcontext->last_exit->flags)) {
+                get_mcontext(dcontext)->xcx = *(reg_t *)
+                    (((byte *)&dcontext->local_state->spill_space) + TLS_XCX_SLOT);
+            }
+#endif
         } else if (dcontext->last_exit == get_ibl_unlinked_found_linkstub()) {
             fragment_t *ibl_target, wrapper;
             ASSERT(in_fcache(dcontext->next_tag));
@@ -911,6 +940,12 @@ dispatch_enter_dynamorio(dcontext_t *dcontext)
         ASSERT(LINKSTUB_FAKE(dcontext->last_exit));
     }
 
+#ifdef LINUX_KERNEL
+    /* -prof_pcs samples in the cache are only translated once we're out */
+    if (INTERNAL_OPTION(profile_pcs))
+        pcprofile_translate_pending(dcontext);
+#endif
+
     if (wherewasi != WHERE_APP) { /* if not first entrance */
         /* now fully process the last cache exit as couldbelinking */
         dispatch_exit_fcache(dcontext);
@@ -1047,6 +1082,10 @@ dispatch_exit_fcache(dcontext_t *dcontext)
          * Probably best to get bb2bb to work better and
          * not worry about optimizing DR code.
          */
+        if (DYNAMO_OPTION(speculate_last_exit)) {
+            monitor_profile_ibl_target(dcontext, dcontext->last_fragment,
+                                       dcontext->last_exit, dcontext->next_tag);
+        }
         fragment_add_ibl_target(dcontext, dcontext->next_tag, 
                                 extract_branchtype(dcontext->last_exit->flags));
         /* FIXME: optimize this to stay writable if we're going to
@@ -1103,6 +1142,15 @@ dispatch_exit_fcache(dcontext_t *dcontext)
     if (has_pending_interrupt(dcontext)) {
         receive_pending_interrupt(dcontext);
     }
+    /* synch point for synch_with_all_threads(), whose IPI brings us here: we
+     * hold no locks and no target fragment yet, so a flush or reset can free
+     * anything without having to relocate us
+     */
+    if (should_wait_at_safe_spot(dcontext)) {
+        enter_nolinking(dcontext, NULL, false);
+        check_wait_at_safe_spot(dcontext, THREAD_SYNCH_NO_LOCKS_NO_XFER);
+        enter_couldbelinking(dcontext, NULL, false);
+    }
 #endif
 
 #ifdef CLIENT_INTERFACE
@@ -1386,7 +1434,7 @@ dispatch_exit_fcache_stats(dcontext_t *dcontext)
     else if (dcontext->last_exit == get_syscall_entry_linkstub()) {
         LOG(THREAD, LOG_DISPATCH, 2,
             "Returning to kernel via syscall (i.e., exit from usermode)\n");
-        STATS_INC(num_syscalls);
+        STATS_INC_CPU(num_syscalls);
         if (DYNAMO_OPTION(optimize_sys_call_ret)) {
             KSTOP_NOT_PROPAGATED(fcache_default);
         } else {
@@ -1397,13 +1445,13 @@ dispatch_exit_fcache_stats(dcontext_t *dcontext)
     else if (dcontext->last_exit == get_user_interrupt_entry_linkstub()) {
         LOG(THREAD, LOG_DISPATCH, 2,
             "Entry from userspace through an interrupt\n");
-        STATS_INC(num_exits_interrupts);
+        STATS_INC_CPU(num_exits_interrupts);
         KSTOP_NOT_PROPAGATED(user_interrupt_handling);
         return;
     } else if (dcontext->last_exit == get_kernel_interrupt_entry_linkstub()) {
         LOG(THREAD, LOG_DISPATCH, 2,
             "Entry from kernel through an interrupt\n");
-        STATS_INC(num_exits_interrupts);
+        STATS_INC_CPU(num_exits_interrupts);
         KSTOP_NOT_MATCHING_NOT_PROPAGATED(kernel_interrupt_handling);
         return;
     }
@@ -166,6 +166,15 @@ int exiting_thread_count VAR_IN_SECTION(NEVER_PROTECTED_SECTION) = 0;
 static dr_statistics_t nonshared_stats VAR_IN_SECTION(NEVER_PROTECTED_SECTION)
      = {{0},};
 
+#if defined(LINUX_KERNEL) && defined(DEBUG)
+/* Backing for the CPU_STATS() blocks, with a line of slack for aligning them.
+ * Unprotected like nonshared_stats.
+ */
+static byte cpu_stats_buf[(KERNEL_MAX_CPUS + 1) * CPU_STATS_STRIDE]
+     VAR_IN_SECTION(NEVER_PROTECTED_SECTION) = {0};
+byte *cpu_stats_base VAR_IN_SECTION(NEVER_PROTECTED_SECTION) = NULL;
+#endif
+
 /* Each lock protects its corresponding datasec_start, datasec_end, and
  * datasec_writable variables.
  */
@@ -349,6 +358,27 @@ statistics_init(void)
 #undef RSTATS_DEF
 }
 
+#if defined(LINUX_KERNEL) && defined(DEBUG)
+/* Sets the global value of each of cpustatsx.h's stats to its sum over the
+ * CPUs. Racy reads of other CPUs' counts are fine for stats.
+ */
+void
+cpu_stats_aggregate(void)
+{
+    uint cpu;
+    if (!GLOBAL_STATS_ON())
+        return;
+# define CPU_STATS_DEF(name) GLOBAL_STAT(name) = 0;
+# include "cpustatsx.h"
+# undef CPU_STATS_DEF
+    for (cpu = 0; cpu < get_num_processors(); cpu++) {
+# define CPU_STATS_DEF(name) GLOBAL_STAT(name) += CPU_STATS(cpu)->name;
+# include "cpustatsx.h"
+# undef CPU_STATS_DEF
+    }
+}
+#endif
+
 static void
 statistics_exit(void)
 {
@@ -376,6 +406,20 @@ dr_pre_smp_init(dr_exports_t *exports, const char *options)
 {
     exports->stats_data = &nonshared_stats;
     exports->stats_size = sizeof(dr_statistics_t);
+#ifdef DEBUG
+    cpu_stats_base = (byte *) ALIGN_FORWARD(cpu_stats_buf, CPU_STATS_LINE);
+    ASSERT(get_num_processors() <= KERNEL_MAX_CPUS);
+    exports->cpu_stats_data = cpu_stats_base;
+    exports->cpu_stats_stride = CPU_STATS_STRIDE;
+    exports->num_cpu_stats = sizeof(cpu_stats_t) / sizeof(stats_int_t);
+    exports->num_cpus = get_num_processors();
+#else
+    exports->cpu_stats_data = NULL;
+    exports->cpu_stats_stride = 0;
+    exports->num_cpu_stats = 0;
+    exports->num_cpus = 0;
+#endif
+    kernel_persist_set_exports(exports);
     kernel_setenv(DYNAMORIO_VAR_OPTIONS, options); 
     barrier_init(&before_dynamo_app_init, get_num_processors());
     barrier_init(&after_dynamo_app_init, get_num_processors());
@@ -398,6 +442,14 @@ cpu_exports_init(dcontext_t *dcontext, dr_cpu_exports_t *exports)
 # ifdef KSTATS
     }
 # endif
+    if (INTERNAL_OPTION(profile_pcs)) {
+        size_t size;
+        exports->pcprofile_data = pcprofile_get_data(dcontext, &size);
+        exports->pcprofile_size = size;
+    } else {
+        exports->pcprofile_data = NULL;
+        exports->pcprofile_size = 0;
+    }
 }
 
 void
@@ -433,6 +485,10 @@ dr_smp_exit(void)
 {
     DEBUG_DECLARE(int res;)
     static bool main_thread_exited = false;
+    /* Every thread records its bbs before any thread starts exiting, so the
+     * main thread can write the persisted image from all of them.
+     */
+    kernel_persist_thread_exit(get_thread_private_dcontext());
     if (barrier_wait(&main_thread_exit)) {
         barrier_wait(&other_threads_exit);
         barrier_destroy(&before_dynamo_app_init);
@@ -413,6 +413,7 @@ emit_fragment_common(dcontext_t *dcontext, app_pc tag,
     linkstub_t  *l;
     uint      len;
     uint      offset = 0;
+    uint      hot_size = 0; /* body up to any trailing cold code */
     uint      copy_sz = 0;
     uint      extra_jmp_padding_body = 0;
     uint      extra_jmp_padding_stubs = 0;
@@ -464,8 +465,13 @@ emit_fragment_common(dcontext_t *dcontext, app_pc tag,
              * the note field (used by instr_encode) */
             instr_set_note(inst, (void *)(ptr_uint_t)offset);
         }
-        if (instr_ok_to_emit(inst))
-            offset += instr_length(dcontext, inst);
+        if (instr_ok_to_emit(inst)) {
+            offset += instr_length_for_emit(dcontext, inst);
+#ifdef CLIENT_INTERFACE
+            if (!instr_is_cold(inst))
+#endif
+                hot_size = offset;
+        }
         ASSERT_NOT_IMPLEMENTED(!TEST(INSTR_HOT_PATCHABLE, inst->flags));
         if (instr_is_exit_cti(inst)) {
             target = instr_get_branch_target_pc(inst);
@@ -581,7 +587,7 @@ emit_fragment_common(dcontext_t *dcontext, app_pc tag,
                              * instr_encode */
                             instr_set_note(in, offset);
                         }
-                        offset += instr_length(dcontext, in);
+                        offset += instr_length_for_emit(dcontext, in);
                     }
                 }
                 target = instr_get_branch_target_pc(inst);
@@ -875,6 +881,17 @@ emit_fragment_common(dcontext_t *dcontext, app_pc tag,
     ASSERT(pc - f->start_pc <= f->size);
     STATS_TRACK_MAX(max_fragment_size, pc - f->start_pc);
     STATS_PAD_JMPS_ADD(flags, sum_fragment_bytes_ever, pc - f->start_pc);
+    /* i-cache footprint: the lines from the prefix through the hot path,
+     * leaving out the cold code and stubs past the final exit
+     */
+    DOSTATS({
+        size_t line = proc_get_cache_line_size();
+        cache_pc hot_end = FCACHE_ENTRY_PC(f) + hot_size;
+        STATS_FCACHE_ADD(flags, cold, offset - copy_sz - hot_size);
+        STATS_FCACHE_ADD(flags, hot_lines,
+                         (ALIGN_FORWARD(hot_end, line) -
+                          ALIGN_BACKWARD(f->start_pc, line)) / line);
+    });
 
     /* if we don't give the extra space back to fcache, need to nop out the
      * rest of the memory to avoid problems with shifting fcache pointers */
@@ -394,6 +394,19 @@ struct _fcache;
 
 #define UNIT_RESERVED_SIZE(u) ((size_t)((u)->reserved_end_pc - (u)->start_pc))
 
+/* To map a cache pc to its fragment without walking every fragment header from
+ * the start of the unit, each unit of a non-coarse cache keeps an index with
+ * one byte per PCLOOKUP_GRANULE bytes of its reservation: the offset within
+ * that granule of the first live fragment header starting in it, or
+ * PCLOOKUP_NONE.  A lookup starts its header walk from the nearest entry at or
+ * below the target pc, so it reads only the few headers around the target.
+ * The index is updated by place_fragment() and fcache_remove_fragment().
+ */
+#define PCLOOKUP_GRANULE_BITS 6
+#define PCLOOKUP_GRANULE (1 << PCLOOKUP_GRANULE_BITS)
+#define PCLOOKUP_NONE 0xff
+#define PCLOOKUP_INDEX_SIZE(u) (UNIT_RESERVED_SIZE(u) >> PCLOOKUP_GRANULE_BITS)
+
 typedef struct _fcache_unit_t {
     cache_pc start_pc;         /* start address of fcache storage */
     cache_pc end_pc;           /* end address of committed storage, open-ended */
@@ -406,6 +419,9 @@ typedef struct _fcache_unit_t {
     dcontext_t *dcontext;
 #endif
     bool writable;             /* remember state of cache memory protection */
+#if defined(LINUX) && !defined(LINUX_KERNEL)
+    bool huge;                 /* from heap_mmap_huge(): unguarded, never resized */
+#endif
 #ifdef WINDOWS_PC_SAMPLE
     /* We cache these values for units_to_{flush,free} units whose cache
      * field has been invalidated
@@ -414,6 +430,7 @@ typedef struct _fcache_unit_t {
     bool was_shared;
     profile_t *profile;
 #endif
+    byte *pclookup_index;      /* PCLOOKUP_INDEX_SIZE bytes, NULL for coarse */
     bool pending_free;         /* was entire unit flushed and slated for free? */
 #ifdef DEBUG
     bool pending_flush;        /* indicates in-limbo unit pre-flush is still live */
@@ -903,6 +920,89 @@ fcache_unit_profile_stop(fcache_unit_t *u)
 }
 #endif
 
+/* Allocates u's pc lookup index if it doesn't have one and empties it. */
+static void
+pclookup_index_reset(fcache_unit_t *u)
+{
+    if (u->pclookup_index == NULL) {
+        u->pclookup_index = (byte *)
+            nonpersistent_heap_alloc(GLOBAL_DCONTEXT, PCLOOKUP_INDEX_SIZE(u)
+                                     HEAPACCT(ACCT_MEM_MGT));
+    }
+    memset(u->pclookup_index, PCLOOKUP_NONE, PCLOOKUP_INDEX_SIZE(u));
+}
+
+static void
+pclookup_index_free(fcache_unit_t *u)
+{
+    if (u->pclookup_index != NULL) {
+        nonpersistent_heap_free(GLOBAL_DCONTEXT, u->pclookup_index,
+                                PCLOOKUP_INDEX_SIZE(u) HEAPACCT(ACCT_MEM_MGT));
+        u->pclookup_index = NULL;
+    }
+}
+
+/* Records a live fragment header placed at header_pc. */
+static inline void
+pclookup_index_add(fcache_unit_t *u, cache_pc header_pc)
+{
+    size_t offs = header_pc - u->start_pc;
+    byte *entry = &u->pclookup_index[offs >> PCLOOKUP_GRANULE_BITS];
+    byte granule_offs = (byte) (offs & (PCLOOKUP_GRANULE - 1));
+    if (*entry == PCLOOKUP_NONE || granule_offs < *entry)
+        *entry = granule_offs;
+}
+
+/* Called while f is still in place: if f's header is its granule's entry, the
+ * entry moves to the next live header in the granule, if any.
+ */
+static void
+pclookup_index_remove(fcache_unit_t *u, fragment_t *f)
+{
+    cache_pc pc = FRAG_HDR_START(f);
+    size_t offs = pc - u->start_pc;
+    byte *entry = &u->pclookup_index[offs >> PCLOOKUP_GRANULE_BITS];
+    cache_pc granule_end = u->start_pc +
+        ((offs >> PCLOOKUP_GRANULE_BITS) + 1) * PCLOOKUP_GRANULE;
+    if (*entry != (byte) (offs & (PCLOOKUP_GRANULE - 1)))
+        return;
+    *entry = PCLOOKUP_NONE;
+    pc += FRAG_SIZE(f);
+    while (pc < granule_end && pc < u->cur_pc) {
+        fragment_t *next = *((fragment_t **)pc);
+        if (!USE_FIFO_FOR_CACHE(u->cache) && FRAG_IS_FREE_LIST(next)) {
+            pc += ((free_list_header_t *) pc)->size;
+            continue;
+        }
+        ASSERT(next != NULL);
+        if (!FRAG_EMPTY(next)) {
+            *entry = (byte) ((pc - u->start_pc) & (PCLOOKUP_GRANULE - 1));
+            return;
+        }
+        pc += FRAG_SIZE(next);
+    }
+}
+
+/* Returns the header from which to walk the unit to find the fragment
+ * containing lookup_pc, or NULL if no live fragment starts at or below it.
+ */
+static inline cache_pc
+pclookup_index_start(fcache_unit_t *u, cache_pc lookup_pc)
+{
+    size_t offs = lookup_pc - u->start_pc;
+    ptr_int_t granule = offs >> PCLOOKUP_GRANULE_BITS;
+    /* a header past lookup_pc in its own granule doesn't count */
+    if (u->pclookup_index[granule] > (offs & (PCLOOKUP_GRANULE - 1)))
+        granule--;
+    for (; granule >= 0; granule--) {
+        if (u->pclookup_index[granule] != PCLOOKUP_NONE) {
+            return u->start_pc + (granule << PCLOOKUP_GRANULE_BITS) +
+                u->pclookup_index[granule];
+        }
+    }
+    return NULL;
+}
+
 static inline void
 remove_unit_from_cache(fcache_unit_t *u)
 {
@@ -950,9 +1050,16 @@ fcache_really_free_unit(fcache_unit_t *u, bool on_dead_list, bool dealloc_unit)
      * being re-used and not showing up in in_fcache
      */
     vmvector_remove(fcache_unit_areas, u->start_pc, u->reserved_end_pc);
-    if (dealloc_unit)
-        heap_munmap((void*)u->start_pc, UNIT_RESERVED_SIZE(u));
+    if (dealloc_unit) {
+#if defined(LINUX) && !defined(LINUX_KERNEL)
+        if (u->huge)
+            heap_munmap_ex((void*)u->start_pc, UNIT_RESERVED_SIZE(u), false/*unguarded*/);
+        else
+#endif
+            heap_munmap((void*)u->start_pc, UNIT_RESERVED_SIZE(u));
+    }
     /* always dealloc the metadata */
+    pclookup_index_free(u);
     nonpersistent_heap_free(GLOBAL_DCONTEXT, u, sizeof(fcache_unit_t)
                             HEAPACCT(ACCT_MEM_MGT));
 }
@@ -1148,8 +1255,8 @@ fcache_fragment_pclookup(dcontext_t *dcontext, cache_pc lookup_pc, fragment_t *w
             return fragment_pclookup_by_htable(dcontext, lookup_pc, wrapper);
         }
     });
-    pc = unit->start_pc;
-    while (pc < unit->cur_pc && pc < lookup_pc) {
+    pc = pclookup_index_start(unit, lookup_pc);
+    while (pc != NULL && pc < unit->cur_pc && pc < lookup_pc) {
         f = *((fragment_t **)pc);
         LOG(THREAD, LOG_CACHE, 6, "\treading "PFX" -> "PFX"\n", pc, f);
         if (!USE_FIFO_FOR_CACHE(unit->cache)) {
@@ -1253,6 +1360,26 @@ in_fcache(void * pc)
 }
 
 
+#if defined(LINUX) && !defined(LINUX_KERNEL)
+/* For -cache_huge_pages: allocates a unit of *size rounded up to whole huge
+ * pages and updates *size.  Returns NULL if that would take cache past its
+ * maximum size or if the allocation fails.
+ */
+static cache_pc
+fcache_mmap_huge(fcache_t *cache, size_t *size)
+{
+    size_t huge_size = ALIGN_FORWARD(*size, HUGE_PAGE_SIZE);
+    cache_pc pc;
+    if (!DYNAMO_OPTION(cache_huge_pages) ||
+        (cache->max_size != 0 && cache->size + huge_size > cache->max_size))
+        return NULL;
+    pc = (cache_pc) heap_mmap_huge(huge_size);
+    if (pc != NULL)
+        *size = huge_size;
+    return pc;
+}
+#endif
+
 /* Pass NULL for pc if this routine should allocate the cache space.
  * If pc is non-NULL, this routine assumes that size is fully
  * committed and initializes accordingly.
@@ -1312,6 +1439,10 @@ fcache_create_unit(dcontext_t *dcontext, fcache_t *cache, cache_pc pc, size_t si
         u = (fcache_unit_t *)
             nonpersistent_heap_alloc(GLOBAL_DCONTEXT, sizeof(fcache_unit_t)
                                      HEAPACCT(ACCT_MEM_MGT));
+#if defined(LINUX) && !defined(LINUX_KERNEL)
+        u->huge = false;
+#endif
+        u->pclookup_index = NULL;
         if (pc != NULL) {
             u->start_pc = pc;
             commit_size = size;
@@ -1321,7 +1452,14 @@ fcache_create_unit(dcontext_t *dcontext, fcache_t *cache, cache_pc pc, size_t si
             /* allocate new unit */
             commit_size = DYNAMO_OPTION(cache_commit_increment);
             ASSERT(commit_size <= size);
-            u->start_pc = (cache_pc) heap_mmap_reserve(size, commit_size);
+#if defined(LINUX) && !defined(LINUX_KERNEL)
+            u->start_pc = fcache_mmap_huge(cache, &size);
+            if (u->start_pc != NULL) {
+                u->huge = true;
+                commit_size = size;
+            } else
+#endif
+                u->start_pc = (cache_pc) heap_mmap_reserve(size, commit_size);
         }
         ASSERT(u->start_pc != NULL);
         ASSERT(proc_is_cache_aligned((void *)u->start_pc));
@@ -1350,6 +1488,8 @@ fcache_create_unit(dcontext_t *dcontext, fcache_t *cache, cache_pc pc, size_t si
     u->cur_pc = u->start_pc;
     u->full = false;
     u->cache = cache;
+    if (!cache->is_coarse)
+        pclookup_index_reset(u);
 #if defined(SIDELINE) || defined(WINDOWS_PC_SAMPLE)
     u->dcontext = dcontext;
 #endif
@@ -1869,6 +2009,8 @@ fcache_increase_size(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
     ssize_t shift;
     size_t new_size = unit->size;
     size_t commit_size;
+    byte *old_index;
+    size_t old_index_size;
     /* we shouldn't come here if we have reservation room */
     ASSERT(unit->reserved_end_pc == unit->end_pc);
     if (new_size*4 <= cache->max_quadrupled_unit_size)
@@ -1954,6 +2096,7 @@ fcache_increase_size(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
                  * here and re-add down below
                  */
                 vmvector_remove(fcache_unit_areas, u->start_pc, u->reserved_end_pc);
+                pclookup_index_free(u);
                 nonpersistent_heap_free(GLOBAL_DCONTEXT, u, sizeof(fcache_unit_t)
                                         HEAPACCT(ACCT_MEM_MGT));
                 break;
@@ -2023,11 +2166,21 @@ fcache_increase_size(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
      */
     cache->size -= unit->size;
     cache->size += commit_size;
+    /* fragments kept their offsets, so the old index is still good: it just
+     * needs to cover the larger reservation
+     */
+    old_index = unit->pclookup_index;
+    old_index_size = PCLOOKUP_INDEX_SIZE(unit);
+    unit->pclookup_index = NULL;
     unit->cur_pc += shift;
     unit->start_pc = new_memory;
     unit->size = commit_size;
     unit->end_pc = unit->start_pc + commit_size;
     unit->reserved_end_pc = unit->start_pc + new_size;
+    pclookup_index_reset(unit);
+    memcpy(unit->pclookup_index, old_index, old_index_size);
+    nonpersistent_heap_free(GLOBAL_DCONTEXT, old_index, old_index_size
+                            HEAPACCT(ACCT_MEM_MGT));
     vmvector_add(fcache_unit_areas, unit->start_pc,
                  unit->reserved_end_pc, (void *) unit);
     unit->full = false; /* reset */
@@ -2493,8 +2646,11 @@ try_for_more_space(dcontext_t *dcontext, fcache_t *cache, fcache_unit_t *unit,
         LOG(THREAD, LOG_CACHE, 1, "max size = %d, cur size = %d\n",
             cache->max_size/1024, cache->size/1024);
         /* at larger sizes better to create separate units to avoid expensive
-         * re-linking when resize */
-        if (unit->size >= cache->max_unit_size) {
+         * re-linking when resize.  Huge page units are already as big as
+         * we'd want and would lose their alignment if moved.
+         */
+        if (unit->size >= cache->max_unit_size
+            IF_LINUX(IF_NOT_LINUX_KERNEL(|| DYNAMO_OPTION(cache_huge_pages)))) {
             fcache_unit_t *newunit;
             size_t newsize;
             ASSERT(!USE_FIFO_FOR_CACHE(cache) ||
@@ -2642,6 +2798,8 @@ place_fragment(dcontext_t *dcontext, fragment_t *f, fcache_unit_t *unit,
      */
     FRAG_START_ASSIGN(f, header_pc + HEADER_SIZE(f));
     ASSERT(ALIGNED(FRAG_HDR_START(f), SLOT_ALIGNMENT(cache)));
+    if (!cache->is_coarse)
+        pclookup_index_add(unit, header_pc);
     STATS_FCACHE_ADD(cache, headers, HEADER_SIZE(f));
     STATS_FCACHE_ADD(cache, align, f->fcache_extra - (stats_int_t)HEADER_SIZE(f));
 
@@ -2716,6 +2874,9 @@ force_fragment_from_cache(dcontext_t *dcontext, fcache_t *cache, fragment_t *vic
 {
     bool empty = FRAG_EMPTY(victim); /* fifo_remove will free empty slot */
     ASSERT(CACHE_PROTECTED(cache));
+    /* FRAGDEL_NO_FCACHE below skips fcache_remove_fragment() */
+    if (!empty && !cache->is_coarse)
+        pclookup_index_remove(FIFO_UNIT(victim), victim);
     if (USE_FIFO(victim))
         fifo_remove(dcontext, cache, victim);
     if (!empty) {
@@ -2854,6 +3015,21 @@ replace_fifo(dcontext_t *dcontext, fcache_t *cache, fragment_t *f, uint slot_siz
     ASSERT(USE_FIFO(f));
     ASSERT(CACHE_PROTECTED(cache));
     while (fifo != NULL) {
+        if (TEST(FRAG_RECENTLY_USED, fifo->flags)) {
+            /* second chance: clear the bit and move to the back of the FIFO.
+             * Each bit is cleared only once, so we come back to it at the
+             * latest after a full pass.  Its physical neighbors can still be
+             * taken along with an older victim by replace_fragments().
+             */
+            fragment_t *next = FIFO_NEXT(fifo);
+            ASSERT(DYNAMO_OPTION(cache_second_chance) && !FRAG_EMPTY(fifo));
+            fifo->flags &= ~FRAG_RECENTLY_USED;
+            fifo_remove(dcontext, cache, fifo);
+            fifo_append(cache, fifo);
+            STATS_INC(num_fragments_second_chance);
+            fifo = (next == NULL) ? fifo : next;
+            continue;
+        }
         unit = FIFO_UNIT(fifo);
         if ((ptr_uint_t)(unit->end_pc - FRAG_HDR_START(fifo)) >= slot_size) {
             /* try to replace fifo and possibly subsequent frags with f
@@ -3648,6 +3824,8 @@ fcache_remove_fragment(dcontext_t *dcontext, fragment_t *f)
      * the unit on free lists or the FIFO
      */
     if (!unit->pending_free) {
+        if (!cache->is_coarse)
+            pclookup_index_remove(unit, f);
         /* empty slots always go on front */
         fifo_prepend_empty(dcontext, cache, unit, f, FRAG_HDR_START(f), FRAG_SIZE(f));
         if (USE_FIFO(f)) {
@@ -118,6 +118,15 @@ bool schedule_reset(uint target);
 
 void fcache_low_on_memory(void);
 
+/* -cache_second_chance access bit, set when DR finds a fragment to enter or
+ * adds it to an ibl table.  Only private fragments are kept in FIFO caches,
+ * and only their owning thread sets or clears the bit.
+ */
+#define FCACHE_MARK_RECENTLY_USED(f) do {                               \
+    if (DYNAMO_OPTION(cache_second_chance) && !TEST(FRAG_SHARED, (f)->flags)) \
+        (f)->flags |= FRAG_RECENTLY_USED;                               \
+} while (0)
+
 /* macros to put mask check outside of function, for efficiency */
 /* when NULL is passed for f then the entire fcache will be affected */
 #define SELF_PROTECT_CACHE(dc, f, w) do {                    \
@@ -97,6 +97,13 @@
 DECLARE_FREQPROT_VAR(static dcontext_t *flusher, NULL);
 /* Current allsynch-flusher, protected by thread_initexit_lock. */
 DECLARE_FREQPROT_VAR(static dcontext_t *allsynch_flusher, NULL);
+/* Region being flushed by a -flush_nostall flush, or NULL when there is no
+ * such flush in progress.  Written by the flusher while holding
+ * thread_initexit_lock, read by other threads while holding their own
+ * linking_lock, which orders the reads wrt the flusher's per-thread walks.
+ */
+DECLARE_NEVERPROT_VAR(static app_pc flush_nostall_start, NULL);
+DECLARE_NEVERPROT_VAR(static app_pc flush_nostall_end, NULL);
 
 #if defined(NATIVE_RETURN) && !defined(DEBUG)
 /* for release build, we use this to identify early code that is
@@ -660,6 +667,69 @@ hashtable_ibl_free_entry(dcontext_t *dcontext, ibl_table_t *table,
     /* nothing to do, data is inlined */
 }
 
+/* Adds fe to a thread-shared IBT table while holding only the table's read
+ * lock, so IBL misses on different targets don't serialize on the write lock.
+ * A slot is claimed by swapping its tag from NULL_TAG to fe's tag; an in-cache
+ * lookup that sees the tag before the start_pc is written goes to
+ * hashlookup_null_handler and simply takes another miss.  Claims only turn
+ * empty slots into full ones, while everything that moves or clears slots
+ * (remove, unlink, resize, groom) holds the write lock, so collision chains
+ * are stable underneath us and two threads adding the same tag find each
+ * other's claim rather than creating a duplicate.
+ * Returns false, without adding, if the add would cross the resize or groom
+ * threshold: the caller must then fall back to hashtable_ibl_add() under the
+ * write lock.
+ */
+static bool
+hashtable_ibl_add_concurrent(dcontext_t *dcontext, fragment_entry_t fe,
+                             ibl_table_t *table)
+{
+    uint entries, hindex;
+
+    ASSERT_TABLE_SYNCHRONIZED(table, READ);
+    ASSERT(TESTALL(HASHTABLE_SHARED | HASHTABLE_LOCKLESS_ACCESS, table->table_flags));
+    ASSERT(fe.tag_fragment != NULL_TAG && fe.tag_fragment != FAKE_TAG);
+
+    /* reserve our entry first so concurrent adders can't overfill the table;
+     * unlinked_entries only changes under the write lock
+     */
+    do {
+        entries = table->entries;
+        if (entries + table->unlinked_entries + 1 > table->resize_threshold ||
+            (table->groom_threshold > 0 && entries + 1 > table->groom_threshold))
+            return false;
+    } while (!atomic_compare_exchange_int((volatile int *)&table->entries,
+                                          (int)entries, (int)entries + 1));
+
+    hindex = HASH_FUNC((ptr_uint_t)fe.tag_fragment, table);
+    for (;;) {
+        fragment_entry_t *slot = &table->table[hindex];
+        app_pc tag = slot->tag_fragment;
+        if (tag == fe.tag_fragment) {
+            /* another thread claimed this target first */
+            ATOMIC_DEC(int, table->entries);
+            STATS_INC(num_ibt_concurrent_add_races);
+            return true;
+        }
+        if (tag == NULL_TAG) {
+            /* the wraparound never reaches the sentinel */
+            ASSERT(!IBL_ENTRY_IS_SENTINEL(*slot));
+            if (atomic_compare_exchange_ptr(&slot->tag_fragment, NULL_TAG,
+                                            fe.tag_fragment)) {
+                ATOMIC_ADDR_WRITE(&slot->start_pc_fragment, fe.start_pc_fragment,
+                                  false);
+                LOG(THREAD, LOG_HTABLE, 4,
+                    "hashtable_ibl_add_concurrent: added "PFX" to %s at table[%u]\n",
+                    fe.tag_fragment, table->name, hindex);
+                return true;
+            }
+            /* lost the slot: re-examine it, it may now hold our tag */
+            continue;
+        }
+        hindex = HASH_INDEX_WRAPAROUND(hindex + 1, table);
+    }
+}
+
 /*******************************************************************************
  * FRAGMENT HASHTABLE INSTANTIATION
  */
@@ -2335,6 +2405,7 @@ fragment_create_heap(dcontext_t *dcontext,
     LOG(THREAD, LOG_FRAGMENT, 5,
         "fragment heap size for flags 0x%08x, exits %d %d, is %d => "PFX"\n",
         flags, direct_exits, indirect_exits, heapsz, f);
+    STATS_ADD_PEAK(fragment_heap_bytes, heapsz);
 
     return f;
 }
@@ -2624,6 +2695,7 @@ fragment_free(dcontext_t *dcontext, fragment_t *f)
     heapsz = fragment_heap_size(f->flags, direct_exits, indirect_exits);
 
     STATS_INC(num_fragments_deleted);
+    STATS_SUB(fragment_heap_bytes, heapsz);
 
     if (HAS_STORED_TRANSLATION_INFO(f)) {
         ASSERT(FRAGMENT_TRANSLATION_INFO(f) != NULL);
@@ -2999,6 +3071,27 @@ fragment_pclookup_with_linkstubs(dcontext_t *dcontext, cache_pc pc,
     return f;
 }
 
+#ifdef LINUX_KERNEL
+/* Calls func on the tag of every bb in dcontext's private bb table.
+ * The caller must be dcontext's thread or have it suspended.
+ */
+void
+fragment_private_bb_tags_iterate(dcontext_t *dcontext,
+                                 void (*func)(app_pc tag, void *data), void *data)
+{
+    per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
+    fragment_t *f;
+    uint i;
+    ASSERT(dcontext != GLOBAL_DCONTEXT && pt != NULL);
+    for (i = 0; i < pt->bb.capacity; i++) {
+        f = pt->bb.table[i];
+        if (!REAL_FRAGMENT(f))
+            continue;
+        (*func)(f->tag, data);
+    }
+}
+#endif
+
 /* add f to the ftable */
 void
 fragment_add(dcontext_t *dcontext, fragment_t *f)
@@ -4150,6 +4243,11 @@ is_fragment_index_wraparound(dcontext_t *dcontext, ibl_table_t *ftable, fragment
 }
 #endif /* DEBUG */
 
+/* forward decl */
+static void
+fragment_add_ibl_target_added(dcontext_t *dcontext, fragment_t *f,
+                              ibl_table_t *ibl_table);
+
 static void
 fragment_add_ibl_target_helper(dcontext_t *dcontext, fragment_t *f,
                                ibl_table_t *ibl_table)
@@ -4161,6 +4259,30 @@ fragment_add_ibl_target_helper(dcontext_t *dcontext, fragment_t *f,
     ASSERT(!(!TEST(FRAG_IS_TRACE, f->flags) &&
              TEST(FRAG_TABLE_TRACE, ibl_table->table_flags)));
 
+    /* For shared tables try to add without excluding other adders first.
+     * Trace head marking removes from IBT tables under the write lock, so
+     * the FRAG_IS_TRACE_HEAD check below is just as good under the read lock.
+     */
+    if (TEST(FRAG_TABLE_SHARED, ibl_table->table_flags) &&
+        INTERNAL_OPTION(concurrent_ibt_add)) {
+        bool added;
+        TABLE_RWLOCK(ibl_table, read, lock);
+        if (TEST(FRAG_IS_TRACE_HEAD, f->flags)) {
+            TABLE_RWLOCK(ibl_table, read, unlock);
+            STATS_INC(num_th_bb_ibt_add_race);
+            return;
+        }
+        added = hashtable_ibl_add_concurrent(dcontext, fe, ibl_table);
+        TABLE_RWLOCK(ibl_table, read, unlock);
+        if (added) {
+            STATS_INC(num_ibt_concurrent_adds);
+            fragment_add_ibl_target_added(dcontext, f, ibl_table);
+            return;
+        }
+        /* table needs a resize or groom: that takes the write lock */
+        STATS_INC(num_ibt_concurrent_add_fallbacks);
+    }
+
     /* adding is a write operation */
     TABLE_RWLOCK(ibl_table, write, lock);
     /* This is the last time the table lock is grabbed before adding the frag so
@@ -4198,6 +4320,14 @@ fragment_add_ibl_target_helper(dcontext_t *dcontext, fragment_t *f,
         hashtable_ibl_add(dcontext, fe, ibl_table);
     }
     TABLE_RWLOCK(ibl_table, write, unlock);
+    fragment_add_ibl_target_added(dcontext, f, ibl_table);
+}
+
+/* Stats and logging common to both ways of adding an IBL target */
+static void
+fragment_add_ibl_target_added(dcontext_t *dcontext, fragment_t *f,
+                              ibl_table_t *ibl_table)
+{
     DOSTATS({
         if (!TEST(FRAG_IS_TRACE, f->flags))
             STATS_INC(num_bbs_ibl_targets);
@@ -4308,12 +4438,22 @@ fragment_add_ibl_target(dcontext_t *dcontext, app_pc tag,
         tag, branch_type, f != NULL ? f->id : 0, 
         (f != NULL && TEST(FRAG_IS_TRACE, f->flags)) ? "existing trace" : "");
 
+    /* A -flush_nostall flusher may be invalidating f from the ibl tables
+     * without having stopped us; leave the add to a later miss.
+     */
+    if (f != NULL && flush_nostall_end != NULL) {
+        STATS_INC(num_ibt_adds_skipped_flush);
+        return f;
+    }
+
     /* a valid IBT fragment exists */
     if (f != NULL) {
         ibl_table_t *ibl_table = GET_IBT_TABLE(pt, f->flags, branch_type);
         DEBUG_DECLARE(fragment_entry_t *orig_lookuptable = NULL;)
         fragment_entry_t current;
 
+        FCACHE_MARK_RECENTLY_USED(f);
+
         /* Make sure this thread's local ptrs & state is current in case a
          * shared table resize occurred while it was in the cache. We update
          * only during an IBL miss, since that's the first time that
@@ -4432,6 +4572,10 @@ fragment_add_ibl_target(dcontext_t *dcontext, app_pc tag,
                        !DYNAMO_OPTION(bb_ibt_table_includes_traces)) {
                 reason = "BBs do not target traces";
                 STATS_INC(num_ibt_exit_src_trace_shared_syscall);
+            } else if (current.start_pc_fragment == HASHLOOKUP_NULL_START_PC) {
+                /* claimed by hashtable_ibl_add_concurrent() but the start_pc
+                 * isn't written yet */
+                reason = "concurrent IBT add in progress";
             } else if (!INTERNAL_OPTION(link_ibl)) {
                 reason = "-no_link_ibl prevents ibl";
                 STATS_INC(num_ibt_exit_nolink);
@@ -5703,6 +5847,32 @@ is_couldbelinking(dcontext_t *dcontext)
             pt->could_be_linking);
 }
 
+/* A -flush_nostall flusher does not stop threads that have nothing in its
+ * region, so such a thread must stop on its own before it builds, links, or
+ * extends a trace with code from the region.  A bb can run for up to
+ * max_bb_instrs past its tag, so we pad the region by that much below.
+ * Caller must hold pt->linking_lock.
+ */
+static bool
+flush_nostall_must_wait(dcontext_t *dcontext)
+{
+    app_pc start = flush_nostall_start;
+    app_pc end = flush_nostall_end;
+    app_pc tag = dcontext->next_tag;
+    size_t bb_span = DYNAMO_OPTION(max_bb_instrs) * MAX_INSTR_LENGTH;
+    if (end == NULL)
+        return false;
+    if (tag < end && (ptr_uint_t)tag + bb_span > (ptr_uint_t)start)
+        return true;
+    if (is_building_trace(dcontext)) {
+        void *trace_vmlist = cur_trace_vmlist(dcontext);
+        if (trace_vmlist != NULL &&
+            vm_list_overlaps(dcontext, trace_vmlist, start, end))
+            return true;
+    }
+    return false;
+}
+
 static void
 wait_for_flusher_nolinking(dcontext_t *dcontext)
 {
@@ -5711,6 +5881,13 @@ wait_for_flusher_nolinking(dcontext_t *dcontext)
      */
     per_thread_t *pt = (per_thread_t *) dcontext->fragment_field;
     ASSERT(!pt->could_be_linking);
+    if (!pt->wait_for_unlink && flush_nostall_must_wait(dcontext)) {
+        /* flush_fragments_end_synch() clears the region before it walks the
+         * threads, so it is guaranteed to see this and wake us up
+         */
+        pt->wait_for_unlink = true;
+        STATS_INC(num_flush_nostall_waits);
+    }
     while (pt->wait_for_unlink) {
         LOG(THREAD, LOG_DISPATCH|LOG_THREADS, 2,
             "Thread %d waiting for flush (flusher is %d @flushtime %d)\n",
@@ -5718,7 +5895,9 @@ wait_for_flusher_nolinking(dcontext_t *dcontext)
             dcontext->owning_thread, flusher->owning_thread, flushtime_global);
         mutex_unlock(&pt->linking_lock);
         STATS_INC(num_wait_flush);
+        KSTART(flush_stall);
         wait_for_event(pt->finished_all_unlink);
+        KSTOP(flush_stall);
         LOG(THREAD, LOG_DISPATCH|LOG_THREADS, 2,
             "Thread %d resuming after flush\n", dcontext->owning_thread);
         mutex_lock(&pt->linking_lock);
@@ -5741,7 +5920,9 @@ wait_for_flusher_linking(dcontext_t *dcontext)
         mutex_unlock(&pt->linking_lock);
         signal_event(pt->waiting_for_unlink);
         STATS_INC(num_wait_flush);
+        KSTART(flush_stall);
         wait_for_event(pt->finished_with_unlink);
+        KSTOP(flush_stall);
         LOG(THREAD, LOG_DISPATCH|LOG_THREADS, 2,
             "Thread %d resuming after flush\n", dcontext->owning_thread);
         mutex_lock(&pt->linking_lock);
@@ -6306,6 +6487,7 @@ flush_fragments_synch_unlink_priv(dcontext_t *dcontext, app_pc base, size_t size
 {
     dcontext_t *tgt_dcontext;
     per_thread_t *tgt_pt;
+    bool nostall;
     int i;
 
     LOG(THREAD, LOG_FRAGMENT, 2,
@@ -6404,6 +6586,25 @@ flush_fragments_synch_unlink_priv(dcontext_t *dcontext, app_pc base, size_t size
 
     DODEBUG({ num_flushed = 0; });
 
+    /* With -flush_nostall we only stop threads that are already in DR, that
+     * have private fragments in the region, or that we act for at a syscall.
+     * The rest keep running and stop themselves only if they reach the region
+     * (see flush_nostall_must_wait()): shared fragments are unlinked under
+     * change_linking_lock and freed through the shared deletion flushtimes,
+     * which need no barrier.  Private ibl tables are updated without locks
+     * by their owners, so they still require every thread to be stopped.
+     * A bb that elides a jmp or call can pull in code from the region
+     * under a tag far from it, which flush_nostall_must_wait() can't tell
+     * from the tag, so we stop everyone when elision is on.
+     */
+    nostall = DYNAMO_OPTION(flush_nostall) && DYNAMO_OPTION(shared_deletion) &&
+        DYNAMO_OPTION(max_elide_jmp) == 0 && DYNAMO_OPTION(max_elide_call) == 0 &&
+        size > 0 && (!SHARED_IB_TARGETS() || SHARED_IBT_TABLES_ENABLED());
+    if (nostall) {
+        flush_nostall_start = base;
+        flush_nostall_end = base + size;
+    }
+
 #ifdef WINDOWS
     /* Make sure exit fcache if currently inside syscall.  For thread-shared
      * shared_syscall, we re-link after the shared fragments have all been
@@ -6442,7 +6643,9 @@ flush_fragments_synch_unlink_priv(dcontext_t *dcontext, app_pc base, size_t size
                 "\twaiting for thread %d\n", tgt_dcontext->owning_thread);
             tgt_pt->wait_for_unlink = true;
             mutex_unlock(&tgt_pt->linking_lock);
+            KSTART(flush_synch);
             wait_for_event(tgt_pt->waiting_for_unlink);
+            KSTOP(flush_synch);
             mutex_lock(&tgt_pt->linking_lock);
             tgt_pt->wait_for_unlink = false;
             LOG(THREAD, LOG_FRAGMENT, 2,
@@ -6588,8 +6791,15 @@ flush_fragments_synch_unlink_priv(dcontext_t *dcontext, app_pc base, size_t size
          * synch to stop threads at cache exit, since we need them all
          * out of DR for duration of shared flush.
          */
-        if (tgt_dcontext != dcontext && !tgt_pt->could_be_linking)
-            tgt_pt->wait_for_unlink = true; /* stop at cache exit */
+        if (tgt_dcontext != dcontext && !tgt_pt->could_be_linking) {
+            if (nostall && !tgt_pt->flush_queue_nonempty &&
+                !tgt_pt->at_syscall_at_flush) {
+                LOG(THREAD, LOG_FRAGMENT, 2, "\tnot stopping thread %d\n",
+                    tgt_dcontext->owning_thread);
+                STATS_INC(num_flush_nostall_threads);
+            } else
+                tgt_pt->wait_for_unlink = true; /* stop at cache exit */
+        }
         mutex_unlock(&tgt_pt->linking_lock);
     }
 
@@ -6783,6 +6993,10 @@ flush_fragments_end_synch(dcontext_t *dcontext, bool keep_initexit_lock)
         return;
     }
 
+    /* Must precede the walk below: see wait_for_flusher_nolinking() */
+    flush_nostall_start = NULL;
+    flush_nostall_end = NULL;
+
     /* now can let all threads at DR synch point go 
      * FIXME: if implement thread-private optimization above, this would turn into
      * re-setting exec areas lock to treat all threads uniformly
@@ -8104,6 +8318,8 @@ fragment_coarse_lookup_in_unit(dcontext_t *dcontext, coarse_info_t *info, app_pc
     ASSERT(info != NULL);
     if (info->htable == NULL) /* not initialized yet, so no code there */
         goto coarse_lookup_return;
+    if (TEST(PERSCACHE_CODE_CORRUPT, info->flags)) /* failed a lazy page check */
+        goto coarse_lookup_return;
     htable = (coarse_table_t *) info->htable;
     TABLE_RWLOCK(htable, read, lock);
     a2c = hashtable_coarse_lookup(dcontext, (ptr_uint_t)tag, htable);
@@ -8111,6 +8327,11 @@ fragment_coarse_lookup_in_unit(dcontext_t *dcontext, coarse_info_t *info, app_pc
         ASSERT(BOOLS_MATCH(info->frozen, info->cache_start_pc != NULL));
         /* for frozen, htable only holds body pc */
         res = ((ptr_uint_t)a2c.cache) + info->cache_start_pc;
+        if (info->cache_page_crc != NULL &&
+            !coarse_unit_check_cache_page(dcontext, info, res)) {
+            TABLE_RWLOCK(htable, read, unlock);
+            goto coarse_lookup_return;
+        }
     }
     if (res != NULL)
         coarse_body_from_htable_entry(dcontext, info, tag, res, &stub_pc, &body_pc);
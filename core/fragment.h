@@ -139,6 +139,13 @@
 
 #ifdef SIDELINE
 # define FRAG_DO_NOT_SIDELINE     0x40000000
+/* no bit left for -cache_second_chance, which then behaves like FIFO */
+# define FRAG_RECENTLY_USED       0
+#else
+/* Private fragments only: DR reached this fragment since fcache's
+ * -cache_second_chance replacement last passed over it
+ */
+# define FRAG_RECENTLY_USED       0x40000000
 #endif
 
 /* This fragment immediately follows a free entry in the fcache */
@@ -680,6 +687,12 @@ fragment_t *
 fragment_pclookup_with_linkstubs(dcontext_t *dcontext, cache_pc pc,
                                  /*OUT*/bool *alloc);
 
+#ifdef LINUX_KERNEL
+void
+fragment_private_bb_tags_iterate(dcontext_t *dcontext,
+                                 void (*func)(app_pc tag, void *data), void *data);
+#endif
+
 #ifdef DEBUG
 fragment_t *
 fragment_pclookup_by_htable(dcontext_t *dcontext, cache_pc pc, fragment_t *wrapper);
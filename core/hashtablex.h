@@ -1681,14 +1681,24 @@ HTNAME(hashtable_,NAME_KEY,_study)(dcontext_t *dcontext,
     uint overwraps = 0;
     ENTRY_TYPE e;
     bool lockless_access = TEST(HASHTABLE_LOCKLESS_ACCESS, table->table_flags);
+    bool study_as_writer;
 
     /* studying needs the entire table to be in a consistent state.
      * we considered having read mean local read/write and write mean global
      * read/write, thus making study() a writer and add() a reader,
      * but we do want add() and remove() to be exclusive w/o relying on the
      * bb building lock, so we have them as writers and study() as a reader.
+     * -concurrent_ibt_add adds to shared lockless tables under the read lock
+     * though, so there we must be a writer to keep those adds out.
      */
-    TABLE_RWLOCK(table, read, lock);
+    study_as_writer = TESTALL(HASHTABLE_SHARED | HASHTABLE_LOCKLESS_ACCESS,
+                              table->table_flags) &&
+        INTERNAL_OPTION(concurrent_ibt_add) && TABLE_NEEDS_LOCK(table) &&
+        !self_owns_write_lock(&table->rwlock);
+    if (study_as_writer)
+        write_lock(&table->rwlock);
+    else
+        TABLE_RWLOCK(table, read, lock);
 
     for (i = 0; i < table->capacity; i++) {
         e = table->table[i];
@@ -1809,7 +1819,10 @@ HTNAME(hashtable_,NAME_KEY,_study)(dcontext_t *dcontext,
 
     HTNAME(hashtable_,NAME_KEY,_study_custom)(dcontext, table, entries_inc);
 
-    TABLE_RWLOCK(table, read, unlock);
+    if (study_as_writer)
+        write_unlock(&table->rwlock);
+    else
+        TABLE_RWLOCK(table, read, unlock);
 }
 
 void
@@ -92,6 +92,15 @@ extern bool vm_areas_exited;
  * what we pass to the user)
  */
 
+/* Basic blocks carry whichever struct -shared_bbs makes common: DRK's caches
+ * are CPU-private, so its bbs all use private_fragment_t.
+ */
+#ifdef LINUX_KERNEL
+# define BB_STRUCT_SIZE sizeof(private_fragment_t)
+#else
+# define BB_STRUCT_SIZE sizeof(fragment_t)
+#endif
+
 static const uint BLOCK_SIZES[] = {
     8, /* for instr bits */
 #ifndef X64
@@ -100,14 +109,14 @@ static const uint BLOCK_SIZES[] = {
 #endif
     /* we have a lot of size 16 requests for IR but they are transient */
     24, /* fcache empties and vm_area_t are now 20, vm area extras still 24 */
-    ALIGN_FORWARD(sizeof(fragment_t) + sizeof(indirect_linkstub_t), HEAP_ALIGNMENT), /* 40 dbg / 36 rel */
+    ALIGN_FORWARD(BB_STRUCT_SIZE + sizeof(indirect_linkstub_t), HEAP_ALIGNMENT), /* 40 dbg / 36 rel (88 dbg DRK) */
 #if defined(X64) || defined(PROFILE_LINKCOUNT) || defined(CUSTOM_EXIT_STUBS)
     sizeof(instr_t), /* 64 (104 x64) */
-    sizeof(fragment_t) + sizeof(direct_linkstub_t)
-        + sizeof(cbr_fallthrough_linkstub_t), /* 68 dbg / 64 rel, 112 x64 */
+    BB_STRUCT_SIZE + sizeof(direct_linkstub_t)
+        + sizeof(cbr_fallthrough_linkstub_t), /* 68 dbg / 64 rel, 112 x64 (128 DRK) */
     /* all other bb/trace buckets are 8 larger but in same order */
 #else
-    sizeof(fragment_t) + sizeof(direct_linkstub_t)
+    BB_STRUCT_SIZE + sizeof(direct_linkstub_t)
         + sizeof(cbr_fallthrough_linkstub_t), /* 60 dbg / 56 rel */
     sizeof(instr_t), /* 64 */
 #endif
@@ -115,8 +124,8 @@ static const uint BLOCK_SIZES[] = {
      * hit this.
      * FIXME: release == instr_t here so a small waste when walking buckets 
      */
-    ALIGN_FORWARD(sizeof(fragment_t) + 2*sizeof(direct_linkstub_t),
-                  HEAP_ALIGNMENT), /* 68 dbg / 64 rel (128 x64) */
+    ALIGN_FORWARD(BB_STRUCT_SIZE + 2*sizeof(direct_linkstub_t),
+                  HEAP_ALIGNMENT), /* 68 dbg / 64 rel (128 x64, 144 DRK) */
     ALIGN_FORWARD(sizeof(trace_t) + 2*sizeof(direct_linkstub_t) + sizeof(uint),
                   HEAP_ALIGNMENT), /* 80 dbg / 76 rel (148 x64 => 152) */
     /* FIXME: measure whether should put in indirect mixes as well */
@@ -257,10 +266,34 @@ typedef struct _thread_units_t {
 #endif
 } thread_units_t;
 
+/* A thread's cache of free blocks of each fixed size from global_units, so
+ * that most global_heap_alloc() and global_heap_free() calls don't need
+ * global_alloc_lock.  Blocks are taken and given back -heap_magazine_size/2
+ * at a time.  While in a magazine a block still counts as allocated, under
+ * ACCT_MAGAZINE, in global_units.  Any block from global_units can be freed
+ * into any thread's magazine.
+ */
+typedef struct _heap_magazine_t {
+    heap_pc free_list[BLOCK_TYPES-1];
+    uint count[BLOCK_TYPES-1];
+    /* Set while the owning thread is using the magazine, so that a signal
+     * handler (or, in DRK, an interrupt) that allocates on the same thread
+     * goes to the global heap instead.
+     */
+    bool busy;
+#ifdef HEAP_ACCOUNTING
+    /* Changes to global_units' accounting not yet folded in, which happens
+     * at every refill and drain.
+     */
+    heap_acct_t acct;
+#endif
+} heap_magazine_t;
+
 /* per-thread structure: */
 typedef struct _thread_heap_t {
     thread_units_t *local_heap;
     thread_units_t *nonpersistent_heap;
+    heap_magazine_t *magazine; /* NULL if -heap_magazine_size is 0 */
 } thread_heap_t;
 
 /* global, unique thread-shared structure: 
@@ -354,6 +387,7 @@ const char * whichheap_name[] = {
     "Client",
 # endif
     "Lib Dup",
+    "Magazines",
     /* NOTE: Add your heap name here */
     "Other",
 };
@@ -796,6 +830,15 @@ vmm_heap_unit_init(vm_heap_t *vmh, size_t size)
         report_low_on_memory(OOM_INIT, error_code);
     }
     vmh->end_addr = vmh->start_addr + size;
+#if defined(LINUX) && !defined(LINUX_KERNEL)
+    /* Heap units are carved out of this reservation, so advising it once
+     * covers all of them.
+     */
+    if (DYNAMO_OPTION(heap_huge_pages) &&
+        !os_heap_advise_huge(vmh->start_addr, size)) {
+        SYSLOG_INTERNAL_WARNING("-heap_huge_pages: no transparent huge page support");
+    }
+#endif
     ASSERT_TRUNCATE(vmh->num_blocks, uint, size / VMM_BLOCK_SIZE);
     vmh->num_blocks = (uint) (size / VMM_BLOCK_SIZE);
     vmh->num_free_blocks = vmh->num_blocks;
@@ -2196,6 +2239,65 @@ heap_mmap(size_t size)
     return heap_mmap_reserve(size, size);
 }
 
+#if defined(LINUX) && !defined(LINUX_KERNEL)
+/* Like heap_mmap() but p is HUGE_PAGE_SIZE-aligned and advised to be backed
+ * by huge pages, so a whole fcache unit takes one TLB entry.  Guard pages
+ * would break up the huge page, so there are none.  size must be a multiple
+ * of HUGE_PAGE_SIZE.  Returns NULL if we can't get the memory, leaving it to
+ * the caller to fall back to a regular allocation.
+ */
+void *
+heap_mmap_huge(size_t size)
+{
+    uint prot = MEMPROT_EXEC|MEMPROT_READ|MEMPROT_WRITE;
+    /* vmm blocks are VMM_BLOCK_SIZE-aligned, so this much extra always
+     * contains an aligned start
+     */
+    size_t reserve_size = size + HUGE_PAGE_SIZE - VMM_BLOCK_SIZE;
+    heap_error_code_t error_code;
+    vm_addr_t base, p;
+    ASSERT(ALIGNED(size, HUGE_PAGE_SIZE));
+
+    /* memory alloc/dealloc and updating DR list must be atomic */
+    dynamo_vm_areas_lock();
+    base = vmm_heap_reserve(reserve_size, &error_code, true/*+x*/);
+    if (base == NULL) {
+        dynamo_vm_areas_unlock();
+        LOG(GLOBAL, LOG_HEAP, 1, "heap_mmap_huge: can't reserve %d bytes\n",
+            reserve_size);
+        return NULL;
+    }
+    ASSERT(ALIGNED(base, VMM_BLOCK_SIZE));
+    p = (vm_addr_t) ALIGN_FORWARD(base, HUGE_PAGE_SIZE);
+    /* give back the unaligned ends */
+    if (p > base) {
+        vmm_heap_free(base, p - base, &error_code);
+        ASSERT(error_code == HEAP_ERROR_SUCCESS);
+    }
+    if (p + size < base + reserve_size) {
+        vmm_heap_free(p + size, base + reserve_size - (p + size), &error_code);
+        ASSERT(error_code == HEAP_ERROR_SUCCESS);
+    }
+    account_for_memory((void *)p, size, prot, true _IF_DEBUG("heap_mmap_huge"));
+    dynamo_vm_areas_unlock();
+
+    extend_commitment(p, size, prot, true /* initial commit */);
+    /* Advising after the commit keeps the mprotect from splitting off an
+     * unadvised mapping.  Without huge pages the unit still works, it just
+     * doesn't save any TLB entries.
+     */
+    if (!os_heap_advise_huge(p, size))
+        STATS_INC(mmap_huge_failed);
+    STATS_INC(mmap_huge);
+#ifdef DEBUG_MEMORY
+    memset(p, HEAP_ALLOCATED_BYTE, size);
+#endif
+    LOG(GLOBAL, LOG_HEAP, 2, "heap_mmap_huge: %d bytes @ "PFX"\n", size, p);
+    STATS_ADD_PEAK(mmap_capacity, size);
+    return p;
+}
+#endif
+
 /* free memory-mapped storage */
 void
 heap_munmap_ex(void *p, size_t size, bool guarded)
@@ -2525,11 +2627,198 @@ common_global_heap_free(thread_units_t *tu, void *p, size_t size HEAPACCT(which_
     ASSERT(ok);
 }
 
+/* Returns the calling thread's magazine, marked busy, or NULL if it has
+ * none or is already using it.
+ */
+static inline heap_magazine_t *
+magazine_acquire(void)
+{
+    dcontext_t *dcontext = get_thread_private_dcontext();
+    heap_magazine_t *mag;
+    if (dcontext == NULL || dcontext == GLOBAL_DCONTEXT || dcontext->heap_field == NULL)
+        return NULL;
+    mag = ((thread_heap_t *) dcontext->heap_field)->magazine;
+    if (mag == NULL || mag->busy)
+        return NULL;
+    mag->busy = true;
+    return mag;
+}
+
+static inline void
+magazine_release(heap_magazine_t *mag)
+{
+    ASSERT(mag->busy);
+    mag->busy = false;
+}
+
+#ifdef HEAP_ACCOUNTING
+/* Folds a magazine's accounting into global_units.  Caller must hold
+ * global_alloc_lock.  Since the changes arrive in batches, max_usage is only
+ * the max seen at folds.
+ */
+static void
+magazine_fold_acct(heap_magazine_t *mag)
+{
+    heap_acct_t *acct = &heapmgt->global_units.acct;
+    uint i;
+    ASSERT_OWN_RECURSIVE_LOCK(true, &global_alloc_lock);
+    for (i = 0; i < ACCT_LAST; i++) {
+        acct->alloc_reuse[i] += mag->acct.alloc_reuse[i];
+        acct->cur_usage[i] += mag->acct.cur_usage[i];
+        acct->num_alloc[i] += mag->acct.num_alloc[i];
+        /* another thread's unfolded allocs may make cur_usage briefly negative */
+        if ((ptr_int_t) acct->cur_usage[i] > (ptr_int_t) acct->max_usage[i])
+            acct->max_usage[i] = acct->cur_usage[i];
+        if (mag->acct.max_single[i] > acct->max_single[i])
+            acct->max_single[i] = mag->acct.max_single[i];
+    }
+    memset(&mag->acct, 0, sizeof(mag->acct));
+}
+
+/* Moves alloc_sz bytes between ACCT_MAGAZINE and which. */
+# define MAGAZINE_ACCOUNT_ALLOC(mag, which, alloc_sz, ask_sz) do {           \
+    (mag)->acct.cur_usage[ACCT_MAGAZINE] -= (alloc_sz);                        \
+    global_racy_units.acct.cur_usage[ACCT_MAGAZINE] -= (alloc_sz);             \
+    (mag)->acct.alloc_reuse[which] += (alloc_sz);                              \
+    (mag)->acct.num_alloc[which]++;                                            \
+    (mag)->acct.cur_usage[which] += (alloc_sz);                                \
+    if ((ask_sz) > (mag)->acct.max_single[which])                              \
+        (mag)->acct.max_single[which] = (ask_sz);                              \
+    ACCOUNT_FOR_ALLOC_HELPER(alloc_reuse, &global_racy_units, which,           \
+                             alloc_sz, ask_sz);                                \
+} while (0)
+
+# define MAGAZINE_ACCOUNT_FREE(mag, which, alloc_sz) do {                    \
+    (mag)->acct.cur_usage[which] -= (alloc_sz);                                \
+    global_racy_units.acct.cur_usage[which] -= (alloc_sz);                     \
+    (mag)->acct.cur_usage[ACCT_MAGAZINE] += (alloc_sz);                        \
+    global_racy_units.acct.cur_usage[ACCT_MAGAZINE] += (alloc_sz);             \
+} while (0)
+#else
+# define MAGAZINE_ACCOUNT_ALLOC(mag, which, alloc_sz, ask_sz)
+# define MAGAZINE_ACCOUNT_FREE(mag, which, alloc_sz)
+#endif
+
+/* Moves up to half a magazine of bucket's blocks from global_units into mag.
+ * Returns false if there was no room without units being added, in which
+ * case the caller should use common_global_heap_alloc().
+ */
+static bool
+magazine_refill(heap_magazine_t *mag, uint bucket)
+{
+    thread_units_t *tu = &heapmgt->global_units;
+    uint want = MAX(DYNAMO_OPTION(heap_magazine_size) / 2, 1);
+    ASSERT(mag->count[bucket] == 0);
+    acquire_recursive_lock(&global_alloc_lock);
+    while (mag->count[bucket] < want) {
+        heap_pc p = (heap_pc)
+            common_heap_alloc(tu, BLOCK_SIZES[bucket] HEAPACCT(ACCT_MAGAZINE));
+        if (p == NULL)
+            break;
+        *((heap_pc *)p) = mag->free_list[bucket];
+        mag->free_list[bucket] = p;
+        mag->count[bucket]++;
+    }
+#ifdef HEAP_ACCOUNTING
+    magazine_fold_acct(mag);
+#endif
+    release_recursive_lock(&global_alloc_lock);
+    STATS_INC(heap_magazine_refills);
+    return mag->count[bucket] > 0;
+}
+
+/* Gives all but keep of mag's blocks of bucket back to global_units. */
+static void
+magazine_drain(heap_magazine_t *mag, uint bucket, uint keep)
+{
+    thread_units_t *tu = &heapmgt->global_units;
+    acquire_recursive_lock(&global_alloc_lock);
+    while (mag->count[bucket] > keep) {
+        heap_pc p = mag->free_list[bucket];
+        DEBUG_DECLARE(bool ok;)
+        mag->free_list[bucket] = *((heap_pc *)p);
+        mag->count[bucket]--;
+#ifdef DEBUG_MEMORY
+        /* look like the full-size alloc that refill took */
+        *((heap_pc *)p) = (heap_pc) HEAP_ALLOCATED_PTR_UINT;
+#endif
+        /* fixed-size blocks never free units, so this can't fail */
+        DEBUG_DECLARE(ok = )
+            common_heap_free(tu, p, BLOCK_SIZES[bucket] HEAPACCT(ACCT_MAGAZINE));
+        ASSERT(ok);
+    }
+#ifdef HEAP_ACCOUNTING
+    magazine_fold_acct(mag);
+#endif
+    release_recursive_lock(&global_alloc_lock);
+    STATS_INC(heap_magazine_drains);
+}
+
+/* Returns NULL if size isn't a fixed-size bucket or no block can be had
+ * without adding units.
+ */
+static void *
+magazine_alloc(heap_magazine_t *mag, size_t size HEAPACCT(which_heap_t which))
+{
+    size_t aligned_size = ALIGN_FORWARD(size, HEAP_ALIGNMENT);
+    uint bucket = 0;
+    heap_pc p;
+    ASSERT(size > 0 && size < MAX_VALID_HEAP_ALLOCATION);
+    while (aligned_size > BLOCK_SIZES[bucket])
+        bucket++;
+    if (bucket == BLOCK_TYPES-1)
+        return NULL;
+    if (mag->count[bucket] == 0 && !magazine_refill(mag, bucket))
+        return NULL;
+    p = mag->free_list[bucket];
+    mag->free_list[bucket] = *((heap_pc *)p);
+    mag->count[bucket]--;
+    ASSERT(ALIGNED(p, HEAP_ALIGNMENT));
+    MAGAZINE_ACCOUNT_ALLOC(mag, which, BLOCK_SIZES[bucket], aligned_size);
+#ifdef DEBUG_MEMORY
+    memset(p, HEAP_ALLOCATED_BYTE, size);
+    memset(p+size, HEAP_PAD_BYTE, BLOCK_SIZES[bucket]-size);
+#endif
+    return p;
+}
+
+/* Returns false if size isn't a fixed-size bucket. */
+static bool
+magazine_free(heap_magazine_t *mag, void *p_void, size_t size
+              HEAPACCT(which_heap_t which))
+{
+    size_t aligned_size = ALIGN_FORWARD(size, HEAP_ALIGNMENT);
+    heap_pc p = (heap_pc) p_void;
+    uint bucket = 0;
+    while (aligned_size > BLOCK_SIZES[bucket])
+        bucket++;
+    if (bucket == BLOCK_TYPES-1)
+        return false;
+#ifdef DEBUG_MEMORY
+    ASSERT(is_region_memset_to_char(p+size, BLOCK_SIZES[bucket]-size, HEAP_PAD_BYTE));
+    memset(p, HEAP_ALLOCATED_BYTE, BLOCK_SIZES[bucket]);
+#endif
+    MAGAZINE_ACCOUNT_FREE(mag, which, BLOCK_SIZES[bucket]);
+    *((heap_pc *)p) = mag->free_list[bucket];
+    mag->free_list[bucket] = p;
+    mag->count[bucket]++;
+    if (mag->count[bucket] >= DYNAMO_OPTION(heap_magazine_size))
+        magazine_drain(mag, bucket, DYNAMO_OPTION(heap_magazine_size) / 2);
+    return true;
+}
+
 /* these functions use the global heap instead of a thread's heap: */
 void *
 global_heap_alloc(size_t size HEAPACCT(which_heap_t which))
 {
-    void *p = common_global_heap_alloc(&heapmgt->global_units, size HEAPACCT(which));
+    void *p = NULL;
+    heap_magazine_t *mag = magazine_acquire();
+    if (mag != NULL) {
+        p = magazine_alloc(mag, size HEAPACCT(which));
+        magazine_release(mag);
+    }
+    if (p == NULL)
+        p = common_global_heap_alloc(&heapmgt->global_units, size HEAPACCT(which));
     ASSERT(p != NULL);
     LOG(GLOBAL, LOG_HEAP, 6, "\nglobal alloc: "PFX" (%d bytes)\n", p, size);
     return p;
@@ -2538,7 +2827,14 @@ global_heap_alloc(size_t size HEAPACCT(which_heap_t which))
 void
 global_heap_free(void *p, size_t size HEAPACCT(which_heap_t which))
 {
-    common_global_heap_free(&heapmgt->global_units, p, size HEAPACCT(which));
+    bool freed = false;
+    heap_magazine_t *mag = (p == NULL) ? NULL : magazine_acquire();
+    if (mag != NULL) {
+        freed = magazine_free(mag, p, size HEAPACCT(which));
+        magazine_release(mag);
+    }
+    if (!freed)
+        common_global_heap_free(&heapmgt->global_units, p, size HEAPACCT(which));
     LOG(GLOBAL, LOG_HEAP, 6, "\nglobal free: "PFX" (%d bytes)\n", p, size);
 }
 
@@ -2984,6 +3280,7 @@ heap_thread_init(dcontext_t *dcontext)
 {
     thread_heap_t *th = (thread_heap_t *)
         global_heap_alloc(sizeof(thread_heap_t) HEAPACCT(ACCT_MEM_MGT));
+    th->magazine = NULL;
     dcontext->heap_field = (void *) th;
     th->local_heap = (thread_units_t *) global_heap_alloc(sizeof(thread_units_t)
                                                        HEAPACCT(ACCT_MEM_MGT));
@@ -2994,6 +3291,14 @@ heap_thread_init(dcontext_t *dcontext)
     } else
         th->nonpersistent_heap = NULL;
     heap_thread_reset_init(dcontext);
+    /* the magazine's free-list links would be writes to protected memory */
+    if (DYNAMO_OPTION(heap_magazine_size) > 0 &&
+        !TEST(SELFPROT_GLOBAL, DYNAMO_OPTION(protect_mask))) {
+        heap_magazine_t *mag = (heap_magazine_t *)
+            global_heap_alloc(sizeof(heap_magazine_t) HEAPACCT(ACCT_MEM_MGT));
+        memset(mag, 0, sizeof(*mag));
+        th->magazine = mag;
+    }
 }
 
 void
@@ -3015,6 +3320,17 @@ void
 heap_thread_exit(dcontext_t *dcontext)
 {
     thread_heap_t *th = (thread_heap_t *) dcontext->heap_field;
+    if (th->magazine != NULL) {
+        heap_magazine_t *mag = th->magazine;
+        uint i;
+        /* the thread may be some other one that's exiting, so we don't
+         * check busy, but it must not be using the magazine now
+         */
+        th->magazine = NULL;
+        for (i = 0; i < BLOCK_TYPES-1; i++)
+            magazine_drain(mag, i, 0);
+        global_heap_free(mag, sizeof(heap_magazine_t) HEAPACCT(ACCT_MEM_MGT));
+    }
     threadunits_exit(th->local_heap, dcontext);
     heap_thread_reset_free(dcontext);
     global_heap_free(th->local_heap, sizeof(thread_units_t) HEAPACCT(ACCT_MEM_MGT));
@@ -3024,6 +3340,8 @@ heap_thread_exit(dcontext_t *dcontext)
                          HEAPACCT(ACCT_MEM_MGT));
     }
     global_heap_free(th, sizeof(thread_heap_t) HEAPACCT(ACCT_MEM_MGT));
+    /* the rest of thread exit still uses the global heap */
+    dcontext->heap_field = NULL;
 }
 
 #if defined(DEBUG_MEMORY) && defined(DEBUG)
@@ -71,6 +71,7 @@ typedef enum {
     ACCT_CLIENT,
 # endif
     ACCT_LIBDUP, /* private copies of system libs => may leak */
+    ACCT_MAGAZINE, /* free global blocks held in threads' magazines */
     /* NOTE: Also update the whichheap_name in heap.c when adding here */
     ACCT_OTHER,
     ACCT_LAST
@@ -134,6 +135,15 @@ void *heap_mmap_reserve(size_t reserve_size, size_t commit_size);
 void *heap_mmap_ex(size_t reserve_size, size_t commit_size, uint prot, bool guarded);
 void heap_munmap_ex(void *p, size_t size, bool guarded);
 
+#if defined(LINUX) && !defined(LINUX_KERNEL)
+/* Transparent huge page size on x86. */
+# define HUGE_PAGE_SIZE (2*1024*1024)
+/* Allocates fully committed, unguarded executable memory on a huge page
+ * boundary.  Free with heap_munmap_ex(p, size, false).
+ */
+void *heap_mmap_huge(size_t size);
+#endif
+
 /* updates dynamo_areas and calls the os_ versions */
 byte *
 map_file(file_t f, size_t *size INOUT, uint64 offs, app_pc addr, uint prot,
@@ -0,0 +1,377 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include "dr_api.h"
+#include "coverage_interface.h"
+MODULE_LICENSE("Dual BSD/GPL");
+
+/* Kernel coverage for fuzzing and profiling. Each bb gets a dense id the
+ * first time any CPU builds it. Bbs bump their CPU's counter for that id, and,
+ * with the edges option, set a byte for the hash of the (previous bb, bb)
+ * edge. Nothing is shared between CPUs at run time; the controller merges the
+ * CPUs' data when it reads them.
+ *
+ * Options: "bits" sets each bb's counter to 1 instead of incrementing it, so
+ * it never needs the flags; "edges" turns on edge coverage.
+ */
+
+#define TESTALL(mask, var) (((mask) & (var)) == (mask))
+#define TESTANY(mask, var) (((mask) & (var)) != 0)
+
+static bool bits_only;
+static bool edges_on;
+
+typedef struct {
+    coverage_cpu_t data;
+    /* Edge map slot of the last bb, i.e., &data.edges[edge_src_key(id)]. */
+    unsigned char *prev;
+} coverage_tls_t;
+
+/* Linux's per_cpu variable, like instrcount, because DR only has TLS for a
+ * single client and the ioctls run in the kernel context. The data is in DR's
+ * heap, which the instrumentation can address with a 32-bit displacement.
+ */
+DEFINE_PER_CPU(coverage_tls_t*, coverage_tls);
+
+/* Held while publishing or clearing a CPU's coverage_tls and while an ioctl
+ * copies from it, so a CPU's data is never freed under the copy.
+ */
+static DEFINE_SPINLOCK(coverage_tls_lock);
+
+static coverage_tls_t*
+get_coverage_tls(void)
+{
+    return __get_cpu_var(coverage_tls);
+}
+
+/* Open addressing table from tags to ids, kept at most half full. Slots are
+ * claimed with a cmpxchg on the tag, and the claimer then publishes the id, so
+ * CPUs building bbs never take a lock.
+ */
+#define COVERAGE_HASH_BITS 17
+#define COVERAGE_HASH_SIZE (1 << COVERAGE_HASH_BITS)
+
+typedef struct {
+    unsigned long tag;
+    /* 0 until the claimer publishes id + 1. */
+    int id;
+} coverage_slot_t;
+
+static coverage_slot_t slots[COVERAGE_HASH_SIZE];
+static atomic_t num_bbs = ATOMIC_INIT(0);
+static atomic_t dropped = ATOMIC_INIT(0);
+
+#define HASH_MULT 0x9e3779b97f4a7c15UL
+
+static uint
+tag_hash(unsigned long tag)
+{
+    return (uint) ((tag * HASH_MULT) >> (64 - COVERAGE_HASH_BITS));
+}
+
+/* Returns tag's id, or -1 if the id space is full. */
+static int
+bb_id(unsigned long tag)
+{
+    uint i = tag_hash(tag);
+    for (;;) {
+        unsigned long cur = ACCESS_ONCE(slots[i].tag);
+        if (cur == 0) {
+            int id;
+            if (atomic_read(&num_bbs) >= COVERAGE_MAX_BBS) {
+                atomic_inc(&dropped);
+                return -1;
+            }
+            cur = cmpxchg(&slots[i].tag, 0, tag);
+            if (cur == 0) {
+                id = atomic_inc_return(&num_bbs) - 1;
+                smp_wmb();
+                if (id >= COVERAGE_MAX_BBS) {
+                    /* Racing claimers can overshoot the limit. Publish -1,
+                     * since 0 would look pending.
+                     */
+                    atomic_inc(&dropped);
+                    slots[i].id = -1;
+                    return -1;
+                }
+                slots[i].id = id + 1;
+                return id;
+            }
+        }
+        if (cur == tag) {
+            int id;
+            while ((id = ACCESS_ONCE(slots[i].id)) == 0) {
+                cpu_relax();
+            }
+            smp_rmb();
+            return id < 0 ? -1 : id - 1;
+        }
+        i = (i + 1) & (COVERAGE_HASH_SIZE - 1);
+    }
+}
+
+/* An edge's hash is edge_src_key(src) + edge_dst_key(dst). Each key is half
+ * the map's bits, from different multipliers so a->b and b->a differ.
+ */
+static uint
+edge_src_key(int id)
+{
+    return ((uint) id * 0x9e3779b1U) >> (32 - (COVERAGE_EDGE_BITS - 1));
+}
+
+static uint
+edge_dst_key(int id)
+{
+    return ((uint) id * 0x85ebca6bU) >> (32 - (COVERAGE_EDGE_BITS - 1));
+}
+
+static void
+thread_init_event(void *drcontext)
+{
+    coverage_tls_t *tls = dr_thread_alloc(drcontext, sizeof(coverage_tls_t));
+    unsigned long flags;
+    memset(tls, 0, sizeof(coverage_tls_t));
+    tls->prev = &tls->data.edges[0];
+    spin_lock_irqsave(&coverage_tls_lock, flags);
+    __get_cpu_var(coverage_tls) = tls;
+    spin_unlock_irqrestore(&coverage_tls_lock, flags);
+}
+
+static void
+thread_exit_event(void *drcontext)
+{
+    coverage_tls_t *tls;
+    unsigned long flags;
+    spin_lock_irqsave(&coverage_tls_lock, flags);
+    tls = get_coverage_tls();
+    __get_cpu_var(coverage_tls) = NULL;
+    spin_unlock_irqrestore(&coverage_tls_lock, flags);
+    dr_thread_free(drcontext, tls, sizeof(coverage_tls_t));
+}
+
+/* Sets this edge's byte and makes this bb the previous one. Uses only xax,
+ * and none of its instructions write the flags:
+ *   mov xax, [prev]
+ *   mov byte [xax + dst_key], 1
+ *   mov xax, &edges[src_key]
+ *   mov [prev], xax
+ */
+static void
+insert_edge(void *drcontext, instrlist_t *bb, instr_t *where,
+            coverage_tls_t *tls, int id)
+{
+    dr_save_reg(drcontext, bb, where, DR_REG_XAX, SPILL_SLOT_2);
+    instrlist_meta_preinsert(bb, where,
+        INSTR_CREATE_mov_ld(drcontext, opnd_create_reg(DR_REG_XAX),
+                            OPND_CREATE_ABSMEM((byte *) &tls->prev, OPSZ_8)));
+    instrlist_meta_preinsert(bb, where,
+        INSTR_CREATE_mov_st(drcontext,
+                            OPND_CREATE_MEM8(DR_REG_XAX, edge_dst_key(id)),
+                            OPND_CREATE_INT8(1)));
+    instrlist_meta_preinsert(bb, where,
+        INSTR_CREATE_mov_imm(drcontext, opnd_create_reg(DR_REG_XAX),
+            OPND_CREATE_INTPTR((ptr_int_t)
+                               &tls->data.edges[edge_src_key(id)])));
+    instrlist_meta_preinsert(bb, where,
+        INSTR_CREATE_mov_st(drcontext,
+                            OPND_CREATE_ABSMEM((byte *) &tls->prev, OPSZ_8),
+                            opnd_create_reg(DR_REG_XAX)));
+    dr_restore_reg(drcontext, bb, where, DR_REG_XAX, SPILL_SLOT_2);
+}
+
+static dr_emit_flags_t
+bb_event(void *drcontext, void *tag, instrlist_t *bb, bool for_trace,
+         bool translating) {
+    coverage_tls_t *tls = get_coverage_tls();
+    instr_t *first = instrlist_first(bb);
+    instr_t *where = first;
+    instr_t *instr;
+    opnd_t count;
+    bool eflags_saved = true;
+    int id;
+
+    if (first == NULL) {
+        return DR_EMIT_DEFAULT;
+    }
+    /* Translation must recreate the same code, which it does because the tag
+     * keeps its id.
+     */
+    id = bb_id((unsigned long) tag);
+    if (id < 0) {
+        return DR_EMIT_DEFAULT;
+    }
+
+    /* The edge has to be recorded before any of the bb's exits. */
+    if (edges_on) {
+        insert_edge(drcontext, bb, first, tls, id);
+    }
+
+    count = OPND_CREATE_ABSMEM((byte *) &tls->data.counts[id], OPSZ_4);
+    if (bits_only) {
+        instrlist_meta_preinsert(bb, first,
+            INSTR_CREATE_mov_st(drcontext, count, OPND_CREATE_INT32(1)));
+        return DR_EMIT_DEFAULT;
+    }
+
+    /* Any point in a bb counts it, so look for one where the eflags are dead.
+     */
+    for (instr = first; instr != NULL; instr = instr_get_next(instr)) {
+        uint flags = instr_get_arith_flags(instr);
+        if (TESTALL(EFLAGS_WRITE_6, flags) && !TESTANY(EFLAGS_READ_6, flags)) {
+            where = instr;
+            eflags_saved = false;
+            break;
+        }
+    }
+    if (!translating) {
+        if (eflags_saved) {
+            tls->data.eflags_saved++;
+        } else {
+            tls->data.eflags_dead++;
+        }
+    }
+    if (eflags_saved) {
+        dr_save_arith_flags(drcontext, bb, where, SPILL_SLOT_1);
+    }
+    instrlist_meta_preinsert(bb, where,
+        INSTR_CREATE_add(drcontext, count, OPND_CREATE_INT8(1)));
+    if (eflags_saved) {
+        dr_restore_arith_flags(drcontext, bb, where, SPILL_SLOT_1);
+    }
+    return DR_EMIT_DEFAULT;
+}
+
+void
+drinit(client_id_t id)
+{
+    const char *options = dr_get_options(id);
+    printk("drinit %d\n", id);
+    bits_only = strstr(options, "bits") != NULL;
+    edges_on = strstr(options, "edges") != NULL;
+    dr_register_thread_init_event(thread_init_event);
+    dr_register_thread_exit_event(thread_exit_event);
+    dr_register_bb_event(bb_event);
+}
+
+static int
+bbs_ioctl(unsigned long ioctl_param)
+{
+    coverage_bbs_t *bbs;
+    int i;
+    int res = 0;
+
+    bbs = vmalloc(sizeof(coverage_bbs_t));
+    if (bbs == NULL) {
+        printk("Could not allocate %luB for the bb ids.\n",
+               sizeof(coverage_bbs_t));
+        return -ENOMEM;
+    }
+    memset(bbs, 0, sizeof(coverage_bbs_t));
+    /* CPUs may be adding bbs as we go; ones we miss just read as tag 0. */
+    bbs->num_bbs = min(atomic_read(&num_bbs), COVERAGE_MAX_BBS);
+    bbs->dropped = atomic_read(&dropped);
+    for (i = 0; i < COVERAGE_HASH_SIZE; i++) {
+        int id = ACCESS_ONCE(slots[i].id);
+        if (id > 0) {
+            smp_rmb();
+            bbs->tags[id - 1] = slots[i].tag;
+        }
+    }
+    if (copy_to_user((void __user *) ioctl_param, bbs, sizeof(coverage_bbs_t)) != 0) {
+        printk("Could not copy the bb ids to userspace.\n");
+        res = -EINVAL;
+    }
+    vfree(bbs);
+    return res;
+}
+
+static int
+cpu_ioctl(unsigned long ioctl_param)
+{
+    coverage_cpu_cmd_t __user *cmd;
+    coverage_cpu_t *data;
+    coverage_tls_t *tls;
+    unsigned long flags;
+    int cpu;
+    int res = 0;
+
+    cmd = (coverage_cpu_cmd_t __user *) ioctl_param;
+    if (copy_from_user(&cpu, &cmd->cpu, sizeof(cpu)) != 0) {
+        printk("Could not copy cpu # from userspace.\n");
+        return -EINVAL;
+    }
+    if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_possible(cpu)) {
+        printk("Invalid CPU # (%d).\n", cpu);
+        return -EINVAL;
+    }
+    data = vmalloc(sizeof(coverage_cpu_t));
+    if (data == NULL) {
+        printk("Could not allocate %luB for cpu %d's coverage.\n",
+               sizeof(coverage_cpu_t), cpu);
+        return -ENOMEM;
+    }
+    /* copy_to_user can fault, so snapshot the data under the lock first. The
+     * CPU keeps counting while we copy, so the counters are only as
+     * consistent as a racy read of each.
+     */
+    spin_lock_irqsave(&coverage_tls_lock, flags);
+    tls = per_cpu(coverage_tls, cpu);
+    if (tls != NULL) {
+        memcpy(data, &tls->data, sizeof(coverage_cpu_t));
+    }
+    spin_unlock_irqrestore(&coverage_tls_lock, flags);
+    if (tls == NULL) {
+        printk("cpu %d not yet initialized\n", cpu);
+        res = -EPERM;
+    } else if (copy_to_user(&cmd->data, data, sizeof(coverage_cpu_t)) != 0) {
+        printk("Could not copy coverage to the user-supplied buffer %p.\n",
+               &cmd->data);
+        res = -EINVAL;
+    }
+    vfree(data);
+    return res;
+}
+
+static int
+device_ioctl(struct inode* inode, struct file* file, unsigned int ioctl_num,
+             unsigned long ioctl_param)
+{
+    switch (ioctl_num) {
+    case COVERAGE_IOCTL_BBS:
+        return bbs_ioctl(ioctl_param);
+    case COVERAGE_IOCTL_CPU:
+        return cpu_ioctl(ioctl_param);
+    default:
+        printk("Unknown ioctl number %u.\n", ioctl_num);
+    }
+    return -ENOTTY;
+}
+
+static struct file_operations fops = {
+    .ioctl = device_ioctl,
+};
+
+static int device_major;
+
+static int __init
+coverage_init(void)
+{
+    device_major = register_chrdev(0, COVERAGE_DEVICE_NAME, &fops);
+    if (device_major < 0) {
+        printk("Registering the character device failed with %d.\n",
+               device_major);
+        return device_major;
+    }
+    return 0;
+}
+
+static void __exit
+coverage_exit(void)
+{
+    unregister_chrdev(device_major, COVERAGE_DEVICE_NAME);
+}
+
+module_init(coverage_init);
+module_exit(coverage_exit);
@@ -443,6 +443,7 @@ typedef struct _umbra_info_t {
     reg_t     num_pages_for_page_table;
     reg_t     num_pages_for_shadow;
     reg_t     num_ro_pages_in_shadow;
+    reg_t     num_ro_large_pages_in_shadow;
     reg_t     num_dead_regs;
     reg_t     num_spill_regs;
     reg_t     num_dead_aflags;
@@ -490,6 +491,18 @@ typedef struct _umbra_client_t {
                                    mem_ref_t    *ref,
                                    instrlist_t  *ilist,
                                    instr_t      *where);
+    /* Optional. Called with ref's app address in reg, before the ref cache
+     * lookup, to insert a check that jumps to skip when the access needs
+     * neither the lookup nor instrument_update. Must preserve reg. Not
+     * called for a ref with followers in its group, which need its lookup.
+     */
+    void (*instrument_fast_path)(void         *drcontext,
+                                 umbra_info_t  *umbra_info,
+                                 mem_ref_t    *ref,
+                                 reg_id_t      reg,
+                                 instrlist_t  *ilist,
+                                 instr_t      *where,
+                                 instr_t      *skip);
     void (*shadow_page_alloc)(umbra_info_t *umbra_info,
                               void *addr, size_t size); 
     bool (*interrupt)(umbra_info_t *umbra_info, dr_interrupt_t *interrupt);
@@ -43,6 +43,8 @@
 #ifndef LINUX_KERNEL
 #  include <string.h>
 #  include <stddef.h>  /* offsetof */
+#else
+#  include "msr.h"
 #endif
 
 #define CODE_CACHE_SIZE (PAGE_SIZE << 2)
@@ -220,6 +222,24 @@ ref_get_base_disp(mem_ref_t *ref, reg_id_t *base, reg_id_t *index, int *disp)
     }
 }
 
+/* The address of a ref whose opnd_is_abs_addr or opnd_is_rel_addr. In the
+ * kernel, the former includes gs-relative refs with neither base nor index,
+ * i.e., per-CPU variables, whose address is fixed because fragments only run
+ * on the CPU that built them.
+ */
+static void *
+ref_get_static_addr(mem_ref_t *ref)
+{
+    void *addr = opnd_get_addr(ref->opnd);
+#ifdef LINUX_KERNEL
+    if (opnd_is_far_abs_addr(ref->opnd) &&
+        opnd_get_segment(ref->opnd) == DR_SEG_GS) {
+        addr += get_msr(MSR_GS_BASE);
+    }
+#endif
+    return addr;
+}
+
 static instr_t *
 instr_create_and_decode(void *drcontext, byte *pc)
 {
@@ -237,7 +257,7 @@ umbra_get_app_addr(umbra_info_t *umbra_info, dr_mcontext_t *mc, mem_ref_t *ref)
 
     if (IF_X64(opnd_is_rel_addr(ref->opnd) ||)
         opnd_is_abs_addr(ref->opnd)) {
-        return opnd_get_addr(ref->opnd);
+        return ref_get_static_addr(ref);
     } else {
         /* We need to re-decode the instruction b/c ref->instr points to a
          * potentially deleted instr from the bb's ilist. */
@@ -1134,7 +1154,7 @@ preinsert_calculate_shd_addr(void          *drcontext,
          */ 
         void *addr;
         void *shd_addr[MAX_NUM_SHADOWS];
-        addr = opnd_get_addr(mem->ref->opnd);
+        addr = ref_get_static_addr(mem->ref);
         if (client->app_unit_bits[0] > 0 && client->shd_unit_bits[0] != 0)
             addr = (void *)((reg_t)addr & (-1 << client->app_unit_bits[0]));
 #ifndef LINUX_KERNEL
@@ -1231,7 +1251,7 @@ instrument_update(void         *drcontext,
                 opnd_is_abs_addr(mem->ref->opnd)) { 
                 void *addr;
                 void *shd_addr[MAX_NUM_SHADOWS];
-                addr = opnd_get_addr(mem->ref->opnd);
+                addr = ref_get_static_addr(mem->ref);
                 if (client->app_unit_bits[0] > 0 && client->shd_unit_bits[0] != 0) {
                     addr = (void *)((reg_t)addr & (-1 << client->app_unit_bits[0]));
                 }
@@ -1449,6 +1469,7 @@ instrument_lean_call(void         *drcontext,
 
 /* 
  *   lea [ref]  => %r1
+ *   ...        # client's fast path, may jmp .skip; none if ref has followers
  *   %r1 & proc_info.unit_mask => %r1
  *   cmp %r1, cache->tag
  *   je .update
@@ -1461,6 +1482,7 @@ instrument_lean_call(void         *drcontext,
  *   jmp .restore_context
  * .update
  *   ...
+ * .skip
  * .restore_context
  */
 static void
@@ -1471,6 +1493,7 @@ instrument_inline_check(void         *drcontext,
                         instrlist_t  *ilist,
 #ifdef LINUX_KERNEL
                         instr_t      *update_user,
+                        instr_t      *skip,
 #endif
                         instr_t      *update,
                         bool          for_trace)
@@ -1497,6 +1520,17 @@ instrument_inline_check(void         *drcontext,
                                  ilist,
                                  where);
 
+#ifdef LINUX_KERNEL
+    if (proc_info.client.instrument_fast_path != NULL && skip != NULL)
+        proc_info.client.instrument_fast_path(drcontext,
+                                              umbra_info,
+                                              mem->ref,
+                                              ilist_info->reg_addr,
+                                              ilist,
+                                              where,
+                                              skip);
+#endif
+
     if (proc_info.options.opt_inline_check == false)
         return;
     if (proc_info.options.stat == true) {
@@ -1549,6 +1583,22 @@ instrument_inline_check(void         *drcontext,
     instrlist_meta_preinsert(ilist, where, instr);
 }
 
+#ifdef LINUX_KERNEL
+/* Followers take their shadow offset from the leader's ref cache, which only
+ * the leader's lookup keeps current.
+ */
+static bool
+mem_has_followers(ilist_info_t *ilist_info, int leader)
+{
+    int i;
+    for (i = 0; i < ilist_info->num_mems; i++) {
+        if (i != leader && ilist_info->mems[i].group.leader == leader)
+            return true;
+    }
+    return false;
+}
+#endif
+
 /*
  * # ref1's fast check code
  *   ...
@@ -1576,6 +1626,7 @@ instrument_inline_code(void         *drcontext,
     instr_t *update = NULL;
 #ifdef LINUX_KERNEL
     instr_t *update_user = NULL;
+    instr_t *skip;
 #endif
     bool no_check;
 
@@ -1607,6 +1658,17 @@ instrument_inline_code(void         *drcontext,
 #endif
         if (ilist_info->mems[i].group.leader == i) {
             if (no_check == false || ilist_info->mems[i].ref->count > 1) {
+#ifdef LINUX_KERNEL
+                /* .skip follows the update code, for the client's fast path,
+                 * which can't skip the lookup that followers depend on
+                 */
+                if (mem_has_followers(ilist_info, i)) {
+                    skip = NULL;
+                } else {
+                    skip = INSTR_CREATE_label(drcontext);
+                    instrlist_meta_preinsert(ilist, where, skip);
+                }
+#endif
                 /* instrument translation lookup at greoup leader */
                 /* fast check */
                 instrument_inline_check(drcontext,
@@ -1616,6 +1678,7 @@ instrument_inline_code(void         *drcontext,
                                         ilist,
 #ifdef LINUX_KERNEL
                                         update_user,
+                                        skip,
 #endif
                                         update,
                                         for_trace);
@@ -72,6 +72,14 @@ typedef struct {
     uint64 num_slowpath_slub_function;
     uint64 num_slowpath_false_negatives;
     uint64 num_eos_read;
+    /* Refs instrumented, by class. Stack refs are rsp- or rbp-based; the fast
+     * ones skip the shadow when they're in the current stack. Per-CPU refs are
+     * gs-relative, with a shadow address fixed at instrumentation time.
+     */
+    uint64 num_stack_refs;
+    uint64 num_stack_fast_refs;
+    uint64 num_per_cpu_refs;
+    uint64 num_other_refs;
 } memcheck_tls_t;
 
 #ifdef DEBUG
@@ -836,6 +844,24 @@ segment_base_always_zero(reg_id_t segment)
     return segment != DR_SEG_FS && segment != DR_SEG_GS;
 }
 
+static bool
+ref_is_per_cpu(mem_ref_t *ref)
+{
+    return opnd_is_far_abs_addr(ref->opnd) &&
+           opnd_get_segment(ref->opnd) == DR_SEG_GS;
+}
+
+static bool
+ref_is_stack(mem_ref_t *ref)
+{
+    reg_id_t base;
+    if (!opnd_is_near_base_disp(ref->opnd)) {
+        return false;
+    }
+    base = opnd_get_base(ref->opnd);
+    return base == DR_REG_XSP || base == DR_REG_XBP;
+}
+
 static bool
 ref_is_interested(umbra_info_t *info, mem_ref_t *ref)
 {
@@ -845,9 +871,14 @@ ref_is_interested(umbra_info_t *info, mem_ref_t *ref)
         return false;
     }
 
-    /* TODO(peter): handle gs-relative */
-    return !opnd_is_far_base_disp(ref->opnd) ||
-           segment_base_always_zero(opnd_get_segment(ref->opnd));
+    if (!opnd_is_far_base_disp(ref->opnd) ||
+        segment_base_always_zero(opnd_get_segment(ref->opnd))) {
+        return true;
+    }
+    /* Per-CPU variables, which Umbra shadows through this CPU's gs base.
+     * TODO(peter): handle gs-relative refs with a base or index.
+     */
+    return ref_is_per_cpu(ref);
 }
 
 static void
@@ -1578,13 +1609,18 @@ static void update_check_def(void) {}
  *
  *   load $PERMISSION_UNADDRESSABLE => %scratch_reg
  *   testb 0(%shadow_reg), %scratch_reg
+ * if dr_moving_cold_code()
+ *   jnz slowpath
+ *   jmp after_slowpath
+ *   # Cold: DR moves this past the fragment's exits and drops the jmp above.
+ * else
  *   jz after_slowpath
+ * fi
  *
  * slowpath:
  *   mov %shadow_reg, mem
  *   load done.pc => tls->cache_pc
  *   jmp slowpath[%shadow_reg]
- *   jmp done
  *
  * after_slowpath:
  *
@@ -1625,6 +1661,7 @@ instrument_update(void *drcontext, umbra_info_t  *umbra_info,
     reg_id_t shadow_reg = umbra_info->steal_regs[0];
     reg_id_t scratch_reg = umbra_info->steal_regs[1];
     opnd_size_t opsz = get_canonical_opsz(opnd_get_size(ref->opnd));
+    bool cold = dr_moving_cold_code();
 
     if (tls->check_def_enabled) {
         update_check_def();
@@ -1637,6 +1674,14 @@ instrument_update(void *drcontext, umbra_info_t  *umbra_info,
     DR_ASSERT(ref->type == MemRead || ref->type == MemWrite ||
               ref->type == MemModify);
 
+    if (ref_is_stack(ref)) {
+        tls->num_stack_refs++;
+    } else if (ref_is_per_cpu(ref)) {
+        tls->num_per_cpu_refs++;
+    } else {
+        tls->num_other_refs++;
+    }
+
     done = INSTR_CREATE_label(drcontext);
     slowpath = INSTR_CREATE_label(drcontext);
     after_slowpath = INSTR_CREATE_label(drcontext);
@@ -1672,12 +1717,25 @@ instrument_update(void *drcontext, umbra_info_t  *umbra_info,
     instr = INSTR_CREATE_test(drcontext, opnd1, opnd2);
     instrlist_meta_preinsert(ilist, where, instr);
 
-    /* jz after_slowpath */
-    opnd1 = opnd_create_instr(after_slowpath);
-    instr = INSTR_CREATE_jcc_short(drcontext, OP_jz_short, opnd1);
-    instrlist_meta_preinsert(ilist, where, instr);
+    if (cold) {
+        /* jnz slowpath: not short, as slowpath will be moved */
+        opnd1 = opnd_create_instr(slowpath);
+        instr = INSTR_CREATE_jcc(drcontext, OP_jnz, opnd1);
+        instrlist_meta_preinsert(ilist, where, instr);
+
+        /* jmp after_slowpath */
+        opnd1 = opnd_create_instr(after_slowpath);
+        instr = INSTR_CREATE_jmp_short(drcontext, opnd1);
+        instrlist_meta_preinsert(ilist, where, instr);
+    } else {
+        /* jz after_slowpath */
+        opnd1 = opnd_create_instr(after_slowpath);
+        instr = INSTR_CREATE_jcc_short(drcontext, OP_jz_short, opnd1);
+        instrlist_meta_preinsert(ilist, where, instr);
+    }
 
     /* slowpath: */
+    instr_set_cold(slowpath, cold);
     instrlist_meta_preinsert(ilist, where, slowpath);
 
     /* mov %shadow_reg, mem */
@@ -1688,12 +1746,14 @@ instrument_update(void *drcontext, umbra_info_t  *umbra_info,
         opnd2 = OPND_CREATE_INTPTR(ref);
     }
     instr = INSTR_CREATE_mov_imm(drcontext, opnd1, opnd2);
+    instr_set_cold(instr, cold);
     instrlist_meta_preinsert(ilist, where, instr);
 
     /* load done.pc => tls->cache_pc */
     opnd1 = OPND_CREATE_ABSMEM(&tls->cache_pc, OPSZ_PTR);
     opnd2 = opnd_create_instr(done);
     instr = INSTR_CREATE_mov_st(drcontext, opnd1, opnd2);
+    instr_set_cold(instr, cold);
     instrlist_meta_preinsert(ilist, where, instr);
 
     /* jmp tls->slowpath_code[%shadow_reg] */
@@ -1702,6 +1762,7 @@ instrument_update(void *drcontext, umbra_info_t  *umbra_info,
     DR_ASSERT(tls->slowpath_code[shadow_reg] >= tls->code_cache_start);
     opnd1 = opnd_create_pc(tls->slowpath_code[shadow_reg]);
     instr = INSTR_CREATE_jmp(drcontext, opnd1);
+    instr_set_cold(instr, cold);
     instrlist_meta_preinsert(ilist, where, instr);
 
     /* after_slowpath: */
@@ -1762,9 +1823,12 @@ instrument_update(void *drcontext, umbra_info_t  *umbra_info,
         instr = INSTR_CREATE_test(drcontext, opnd1, opnd2);
         instrlist_meta_preinsert(ilist, where, instr);
 
-        /* jz slowpath */
+        /* jz slowpath: not short if slowpath will be moved */
         opnd1 = opnd_create_instr(slowpath);
-        instr = INSTR_CREATE_jcc_short(drcontext, OP_jz_short, opnd1);
+        if (cold)
+            instr = INSTR_CREATE_jcc(drcontext, OP_jz, opnd1);
+        else
+            instr = INSTR_CREATE_jcc_short(drcontext, OP_jz_short, opnd1);
         instrlist_meta_preinsert(ilist, where, instr);
     } else {
         DR_ASSERT(false);
@@ -1783,6 +1847,77 @@ instrument_update(void *drcontext, umbra_info_t  *umbra_info,
 }
 
 
+/* Kernel stacks are THREAD_SIZE-aligned blocks with the thread_info and then
+ * the end-of-stack guard word at the bottom.
+ */
+#define STACK_GUARD_END (sizeof(struct thread_info) + sizeof(unsigned long))
+
+/* Every byte of the current stack above the guard is addressable, so a stack
+ * ref there needs no shadow unless definedness is being tracked. Other stacks
+ * (e.g., irq stacks) fail the check and take the ref cache path.
+ *
+ *   mov %rsp => %scratch_reg
+ *   and %scratch_reg, -THREAD_SIZE
+ *   neg %scratch_reg
+ *   lea -STACK_GUARD_END(%reg, %scratch_reg) => %scratch_reg
+ *   cmp %scratch_reg, THREAD_SIZE - STACK_GUARD_END
+ *   jb skip
+ */
+static void
+instrument_fast_path(void *drcontext, umbra_info_t *umbra_info, mem_ref_t *ref,
+                     reg_id_t reg, instrlist_t *ilist, instr_t *where,
+                     instr_t *skip)
+{
+    instr_t *instr;
+    opnd_t opnd1, opnd2;
+    memcheck_tls_t *tls = memcheck_tls(umbra_info);
+    reg_id_t scratch_reg = umbra_info->steal_regs[1];
+
+    if (!ref_is_stack(ref) || ref->opcode == OP_movs) {
+        return;
+    }
+    if (MEMCHECK_OPTION(check_defined) && tls->check_def_enabled) {
+        return;
+    }
+    DR_ASSERT(scratch_reg != reg);
+    tls->num_stack_fast_refs++;
+
+    /* mov %rsp => %scratch_reg */
+    opnd1 = opnd_create_reg(scratch_reg);
+    opnd2 = opnd_create_reg(DR_REG_XSP);
+    instr = INSTR_CREATE_mov_ld(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    /* and %scratch_reg, -THREAD_SIZE */
+    opnd1 = opnd_create_reg(scratch_reg);
+    opnd2 = OPND_CREATE_INT32(-THREAD_SIZE);
+    instr = INSTR_CREATE_and(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    /* neg %scratch_reg */
+    opnd1 = opnd_create_reg(scratch_reg);
+    instr = INSTR_CREATE_neg(drcontext, opnd1);
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    /* lea -STACK_GUARD_END(%reg, %scratch_reg) => %scratch_reg */
+    opnd1 = opnd_create_reg(scratch_reg);
+    opnd2 = opnd_create_base_disp(reg, scratch_reg, 1,
+                                  -(int) STACK_GUARD_END, OPSZ_lea);
+    instr = INSTR_CREATE_lea(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    /* cmp %scratch_reg, THREAD_SIZE - STACK_GUARD_END */
+    opnd1 = opnd_create_reg(scratch_reg);
+    opnd2 = OPND_CREATE_INT32(THREAD_SIZE - STACK_GUARD_END);
+    instr = INSTR_CREATE_cmp(drcontext, opnd1, opnd2);
+    instrlist_meta_preinsert(ilist, where, instr);
+
+    /* jb skip */
+    opnd1 = opnd_create_instr(skip);
+    instr = INSTR_CREATE_jcc(drcontext, OP_jb, opnd1);
+    instrlist_meta_preinsert(ilist, where, instr);
+}
+
 static void
 instrument_update_user(void *drcontext, umbra_info_t  *umbra_info,
                        mem_ref_t *ref, instrlist_t *ilist, instr_t *where)
@@ -2048,6 +2183,8 @@ init_options(client_id_t id)
                                                             : NULL;
     client->instrument_update_user = MEMCHECK_OPTION(check_addr) ? instrument_update_user
                                                                  : NULL;
+    client->instrument_fast_path = MEMCHECK_OPTION(check_addr) ? instrument_fast_path
+                                                               : NULL;
     client->app_to_app_transformation = app_to_app_transformation;
     client->app_unit_bits[0] = 0;
     client->shd_unit_bits[0] = 0;
@@ -2106,6 +2243,10 @@ show_memcheck_stats(int cpu, char *buf)
     PRINT_STAT(num_slowpath_slub_function);
     PRINT_STAT(num_slowpath_false_negatives);
     PRINT_STAT(num_eos_read);
+    PRINT_STAT(num_stack_refs);
+    PRINT_STAT(num_stack_fast_refs);
+    PRINT_STAT(num_per_cpu_refs);
+    PRINT_STAT(num_other_refs);
 #undef PRINT_STAT
     return buf - orig_buf;
 }
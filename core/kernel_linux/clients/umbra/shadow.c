@@ -89,6 +89,16 @@ possible_shadow_address(void *address)
 #define SHADOW_MEMORY_SIZE (512 * 1024 * 1024)
 pagepool_t *pagepool;
 pfn_t global_ro_pfn;
+
+/* A 2MB chunk of initialized shadow that read faults map with one read-only
+ * large page, so shadow that is only read costs neither an L1 table nor a
+ * fault and a TLB entry per 4KB. NULL if it could not be allocated, in which
+ * case every read fault maps global_ro_pfn.
+ */
+#define LARGE_PAGE_ORDER 9
+#define PAGES_PER_LARGE_PAGE (1 << LARGE_PAGE_ORDER)
+struct page *global_ro_large_page;
+pfn_t global_ro_large_pfn;
 #endif
 
 /* Data structure for memory map fast lookup via hashtable */
@@ -1584,15 +1594,68 @@ get_proc_mem_info(void)
 }
 
 
+#ifdef LINUX_KERNEL
+/* How many units the kernel regions found at takeover may reserve shadow for.
+ * They get at most half of the shadow hole, leaving the rest for units added
+ * lazily.
+ */
+static int
+kernel_region_unit_budget(void)
+{
+    reg_t size[MAX_NUM_SHADOWS];
+    reg_t unit_shd_size = 0;
+    int i;
+
+    compute_shd_memory_size(proc_info.unit_size, size);
+    for (i = 0; i < MAX_NUM_SHADOWS; i++) {
+        /* memory_map_shd_add pads each shadow by a page. */
+        unit_shd_size += size[i] + PAGE_SIZE;
+    }
+    return (KERNEL_HOLE_END - KERNEL_HOLE_START) / 2 / unit_shd_size;
+}
+
+/* traverse_page_table_contiguous callback that adds the units of a present
+ * kernel region, e.g., the direct map or part of vmalloc space. The unit with
+ * the kernel text is skipped because reserve_app_mem_space adds it last.
+ */
+static void
+add_kernel_region(const vm_region_t *region, void *arg)
+{
+    int *units_left = (int*) arg;
+    void *text_unit = (void *)((reg_t)KERNEL_TEXT_BASE & proc_info.unit_mask);
+    void *base;
+
+    if (!region->present || region->start <= VM_HOLE_END) {
+        return;
+    }
+    base = (void *)((reg_t)region->start & proc_info.unit_mask);
+    for (; base != NULL && base <= region->end; base += proc_info.unit_size) {
+        if (*units_left == 0) {
+            return;
+        }
+        if (base == text_unit || possible_shadow_address(base) ||
+            memory_map_app_lookup(proc_info.maps, base) != NULL) {
+            continue;
+        }
+        if (memory_map_app_add(base, base + proc_info.unit_size, false)) {
+            (*units_left)--;
+        }
+    }
+}
+#endif
+
 static void
 reserve_app_mem_space(void)
 {
 #ifdef LINUX_KERNEL
-    /* TODO(peter): Initally we could use traverse_page_table_contiguous to add
-     * all of the existing kernel regions. We still have to implement lazy
-     * shadow allocation, so I'm using that for everything now. We still need to
-     * allocate a single map for the instrument_thread_init code to work properly.
+    /* Add the existing kernel regions now, so their shadows are set up once
+     * at takeover instead of by lazy adds from instrumented code. Units mapped
+     * later are still added lazily. The kernel text goes last so it is the
+     * first map, which reserve_shd_mem_space takes as the binary map.
      */
+    int units_left = kernel_region_unit_budget();
+    traverse_page_table_contiguous(get_l4_page_table(), add_kernel_region,
+                                   &units_left);
      DR_ASSERT(memory_map_app_add(KERNEL_TEXT_BASE,
                                   KERNEL_TEXT_BASE + KERNEL_TEXT_SIZE,
                                   false));
@@ -1680,6 +1743,14 @@ shadow_init(void)
     global_ro_pfn = pagepool_alloc(pagepool);
     client_init_page(umbra_get_info(),
                      page_address(pfn_to_page(global_ro_pfn)));
+    if (global_ro_large_page != NULL) {
+        int i;
+        global_ro_large_pfn = page_to_pfn(global_ro_large_page);
+        for (i = 0; i < PAGES_PER_LARGE_PAGE; i++) {
+            client_init_page(umbra_get_info(),
+                             page_address(global_ro_large_page + i));
+        }
+    }
 #else
     /* For now, on linux, we don't use memory mods. We just allocate pages for
      * shadow memory on demand.
@@ -1712,6 +1783,11 @@ shadow_kernel_init(void)
     if (!pagepool) {
         goto stats_free;
     }
+    /* Physically contiguous, so it may fail on a fragmented system; read
+     * faults then fall back to 4KB pages.
+     */
+    global_ro_large_page = alloc_pages(GFP_KERNEL | __GFP_NOWARN,
+                                       LARGE_PAGE_ORDER);
     return 0;
 stats_free:
     dr_stats_free(&shadow_stats);
@@ -1722,6 +1798,9 @@ void
 shadow_kernel_exit(void)
 {
     dr_stats_free(&shadow_stats);
+    if (global_ro_large_page != NULL) {
+        __free_pages(global_ro_large_page, LARGE_PAGE_ORDER);
+    }
     pagepool_kernel_exit(pagepool);
 }
 
@@ -1744,9 +1823,14 @@ shadow_memory_modules_remove(memory_mod_t *mods)
 static void
 return_to_pagepool(unsigned long pfn, void *arg)
 {
-    if (pfn != global_ro_pfn) {
-        pagepool_free(pagepool, pfn);
+    if (pfn == global_ro_pfn) {
+        return;
+    }
+    if (global_ro_large_page != NULL && pfn >= global_ro_large_pfn &&
+        pfn < global_ro_large_pfn + PAGES_PER_LARGE_PAGE) {
+        return;
     }
+    pagepool_free(pagepool, pfn);
 }
 
 static void
@@ -2032,6 +2116,21 @@ create_pte(generic_page_table_entry_t *entry, vm_access_t *access,
     entry->present = 1;
 }
 
+/* Like create_pte, but for a level 2 entry that maps a 2MB page. */
+static void
+create_large_pte(generic_page_table_entry_t *entry, vm_access_t *access,
+                 pfn_t pfn)
+{
+    memset(entry, 0, sizeof(generic_page_table_entry_t));
+    entry->writable = access->writable;
+    entry->user = access->user;
+    entry->not_executable = access->executable;
+    entry->size = 1;
+    entry->next_pfn = pfn;
+    asm volatile("mfence");
+    entry->present = 1;
+}
+
 static void
 invlpg(void *address)
 {
@@ -2050,6 +2149,28 @@ static vm_access_t ro_access = {
     .user = false,
 };
 
+/* Replaces a read-only large page of global_ro_large_pfn with an L1 table of
+ * read-only mappings of global_ro_pfn, which has the same contents, so that
+ * single pages can be made writable.
+ */
+static void
+split_ro_large_page(umbra_info_t *umbra, generic_page_table_entry_t *entry,
+                    pagepool_t *pool)
+{
+    pfn_t table_pfn = pagepool_alloc(pool);
+    generic_page_table_entry_t *table = page_address(pfn_to_page(table_pfn));
+    int i;
+
+    DR_ASSERT(entry->size && entry->next_pfn == global_ro_large_pfn);
+    for (i = 0; i < PAGE_TABLE_ENTIRES_PER_LEVEL; i++) {
+        create_pte(&table[i], &ro_access, global_ro_pfn, false);
+    }
+    create_pte(entry, &rw_access, table_pfn, false);
+    umbra->num_pages_for_page_table++;
+    umbra->num_ro_large_pages_in_shadow--;
+    umbra->num_ro_pages_in_shadow += PAGE_TABLE_ENTIRES_PER_LEVEL;
+}
+
 static void
 insert_page_table_mapping(umbra_info_t *umbra,
                           generic_page_table_entry_t *l4,
@@ -2087,7 +2208,12 @@ insert_page_table_mapping(umbra_info_t *umbra,
         case 3: create_pte(parent, &rw_access, pagepool_alloc(pool), true);
                 parent = &follow_page_table_entry(parent)[va.l2_index];
                 umbra->num_pages_for_page_table++;
-        case 2: create_pte(parent, &rw_access, pagepool_alloc(pool), true);
+        case 2: if (!is_write && global_ro_large_page != NULL) {
+                    create_large_pte(parent, &ro_access, global_ro_large_pfn);
+                    umbra->num_ro_large_pages_in_shadow++;
+                    break;
+                }
+                create_pte(parent, &rw_access, pagepool_alloc(pool), true);
                 parent = &follow_page_table_entry(parent)[va.l1_index];
                 umbra->num_pages_for_page_table++;
         case 1:
@@ -2104,6 +2230,13 @@ insert_page_table_mapping(umbra_info_t *umbra,
          * non-present mappings.
          */
     } else if (is_write) {
+        if (parent_level == 2) {
+            /* invlpg(address) below flushes the large page's TLB entry. */
+            DR_ASSERT(!region.access.writable);
+            split_ro_large_page(umbra, parent, pool);
+            parent = &follow_page_table_entry(parent)[va.l1_index];
+            parent_level = 1;
+        }
         DR_ASSERT(parent_level == 1);     
         if (!region.access.writable) {
             create_pte(parent, &rw_access, pagepool_alloc(pool), false);
@@ -542,6 +542,7 @@ show_umbra_stats(int cpu, char *buf)
     PRINT_UMBRA_STAT(num_pages_for_page_table);
     PRINT_UMBRA_STAT(num_pages_for_shadow);
     PRINT_UMBRA_STAT(num_ro_pages_in_shadow);
+    PRINT_UMBRA_STAT(num_ro_large_pages_in_shadow);
     PRINT_UMBRA_STAT(num_spill_regs);
     PRINT_UMBRA_STAT(num_dead_regs);
     PRINT_UMBRA_STAT(num_spill_aflags);
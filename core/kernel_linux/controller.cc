@@ -1,13 +1,20 @@
 #include <stdlib.h>
 extern "C" {
 #include "dynamorio_controller_module.h"
+#include "coverage_interface.h"
 }
 
+#include <algorithm>
 #include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
 #include <sstream>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 #include <sched.h>
 #include <stdio.h>
 
@@ -21,8 +28,13 @@ class DynamoRIODevice {
     DynamoRIODevice() : device_(DYNAMORIO_DEVICE_NAME, DYNAMORIO_DEVICE_PATH) {
     }
 
-    void Init(const string& options) {
+    void Init(const string& options, vector<char>* persisted) {
         dynamorio_init_cmd_t cmd;
+        memset(&cmd, 0, sizeof(cmd));
+        if (persisted != NULL && !persisted->empty()) {
+            cmd.persist_data = &(*persisted)[0];
+            cmd.persist_size = persisted->size();
+        }
         /* Add 1 for the NULL terminator. */
         if (options.size() + 1 > KERNEL_ENV_VALUE_MAX) {
             stringstream ss;
@@ -38,12 +50,21 @@ class DynamoRIODevice {
         }
     }
 
-    void Exit() {
+    void Exit(vector<char>* persisted) {
         dynamorio_exit_cmd_t cmd;
+        memset(&cmd, 0, sizeof(cmd));
+        if (persisted != NULL) {
+            persisted->resize(DYNAMORIO_PERSIST_MAX_SIZE);
+            cmd.persist_data = &(*persisted)[0];
+            cmd.persist_max = persisted->size();
+        }
         if (device_.Ioctl(DYNAMORIO_IOCTL_EXIT, &cmd) != 0) {
             throw runtime_error("DYNAMORIO_IOCTL_EXIT failed. Have you run init"
                                 " yet? Have you already exited?");
         }
+        if (persisted != NULL) {
+            persisted->resize(cmd.persist_size);
+        }
     }
 
     void GetKStats(dynamorio_kstats_cmd_t *kstats) {
@@ -58,29 +79,68 @@ class DynamoRIODevice {
         }
     }
 
+    void GetPCProfile(dynamorio_pcprofile_cmd_t *pcprofile) {
+        if (device_.Ioctl(DYNAMORIO_IOCTL_PCPROFILE, pcprofile) != 0) {
+            throw runtime_error("DYNAMORIO_IOCTL_PCPROFILE failed. Check dmesg.");
+        }
+    }
+
   private:
     LinuxDevice device_;
 };
 
+static void read_persisted(const char* path, vector<char>* persisted) {
+    ifstream in(path, ios::in | ios::binary);
+    if (!in) {
+        /* No cache yet, e.g., on the first run. */
+        cout << "No persisted cache at " << path << endl;
+        return;
+    }
+    persisted->assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    cout << "Persisted cache: " << path << " (" << persisted->size() << "B)"
+         << endl;
+}
+
+static void write_persisted(const char* path, const vector<char>& persisted) {
+    ofstream out(path, ios::out | ios::binary | ios::trunc);
+    if (!out || !out.write(persisted.empty() ? NULL : &persisted[0],
+                           persisted.size())) {
+        throw runtime_error(string("Could not write persisted cache ") + path);
+    }
+    cout << "Persisted cache: " << path << " (" << persisted.size() << "B)"
+         << endl;
+}
+
 static void handle_init(int argc, char** argv) {
     const char* options = "";
-    if (argc < 2 || argc > 3 || string(argv[1]) != "init") {
-        throw runtime_error("Usage: controller init [\"options\"]");
+    vector<char> persisted;
+    if (argc < 2 || argc > 4 || string(argv[1]) != "init") {
+        throw runtime_error("Usage: controller init [\"options\" "
+                            "[persisted_cache]]");
     }
-    if (argc == 3) {
+    if (argc >= 3) {
         options = argv[2];
     }
+    if (argc == 4) {
+        read_persisted(argv[3], &persisted);
+    }
     cout << "Options: " << options << endl;
     DynamoRIODevice device;
-    device.Init(options);
+    device.Init(options, &persisted);
 }
 
 static void handle_exit(int argc, char** argv) {
-    if (argc != 2 || string(argv[1]) != "exit") {
-        throw runtime_error("Usage: controller exit");
+    if (argc < 2 || argc > 3 || string(argv[1]) != "exit") {
+        throw runtime_error("Usage: controller exit [persisted_cache]");
     }
     DynamoRIODevice device;
-    device.Exit();
+    if (argc == 3) {
+        vector<char> persisted;
+        device.Exit(&persisted);
+        write_persisted(argv[2], persisted);
+    } else {
+        device.Exit(NULL);
+    }
 }
 
 static int get_cpu_count() {
@@ -127,13 +187,166 @@ static void handle_stats(int argc, char** argv) {
     dump_stats(&stats.buffer.data, stats.buffer.size, cout);
 }
 
+/* Prints every CPU's -prof_pcs samples, merged, as folded stacks: one line
+ * per distinct stack with its frames separated by ';' and then the number of
+ * samples. The root frame says what was interrupted; for kernel code it's
+ * followed by the kernel pc the sample translated to.
+ */
+/* Kernel and module text symbols from /proc/kallsyms, sorted by address so
+ * a pc resolves with one binary search.
+ */
+class KernelSymbols {
+  public:
+    KernelSymbols() {
+        ifstream in("/proc/kallsyms");
+        string line;
+        while (getline(in, line)) {
+            istringstream ss(line);
+            unsigned long addr;
+            char type;
+            string name;
+            if (!(ss >> hex >> addr >> type >> name)) {
+                continue;
+            }
+            /* Without CAP_SYSLOG every address reads as 0. */
+            if (addr == 0 || (type != 't' && type != 'T')) {
+                continue;
+            }
+            symbols_.push_back(make_pair(addr, name));
+        }
+        sort(symbols_.begin(), symbols_.end());
+    }
+
+    /* Returns the name of the function containing pc, or its address in hex
+     * if there's no symbol at or below it.
+     */
+    string Lookup(unsigned long pc) const {
+        vector<pair<unsigned long, string> >::const_iterator it =
+            upper_bound(symbols_.begin(), symbols_.end(),
+                        make_pair(pc, string("\xff")));
+        stringstream ss;
+        if (it == symbols_.begin()) {
+            ss << "0x" << hex << pc;
+        } else {
+            ss << (it - 1)->second;
+        }
+        return ss.str();
+    }
+
+  private:
+    vector<pair<unsigned long, string> > symbols_;
+};
+
+static void handle_pcprofile(int argc, char** argv) {
+    static const char* where_names[] = PCPROFILE_WHERE_NAMES;
+    if (argc != 2 || string(argv[1]) != "pcprofile") {
+        throw runtime_error("Usage: controller pcprofile");
+    }
+    DynamoRIODevice device;
+    KernelSymbols symbols;
+    int cpu_count = get_cpu_count();
+    /* Fold by function, so pcs in the same function make one stack. */
+    map<string, unsigned long> folded;
+    vector<char> buffer(sizeof(dynamorio_pcprofile_cmd_t));
+    dynamorio_pcprofile_cmd_t* pcprofile =
+        reinterpret_cast<dynamorio_pcprofile_cmd_t*>(&buffer[0]);
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        pcprofile->cpu = cpu;
+        device.GetPCProfile(pcprofile);
+        for (int i = 0; i < PCPROFILE_NUM_ENTRIES; i++) {
+            const pcprofile_entry_t& e = pcprofile->table.entries[i];
+            if (e.count == 0 || e.where >= PCPROFILE_WHERE_LAST) {
+                continue;
+            }
+            string stack = where_names[e.where];
+            if (e.pc != 0) {
+                stack += ";" + symbols.Lookup(e.pc);
+            }
+            folded[stack] += e.count;
+        }
+        if (pcprofile->table.dropped != 0) {
+            cerr << "cpu " << cpu << ": dropped " << pcprofile->table.dropped
+                 << " of " << pcprofile->table.samples << " samples" << endl;
+        }
+    }
+    map<string, unsigned long>::const_iterator it;
+    for (it = folded.begin(); it != folded.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+}
+
+/* Prints the coverage client's bbs that ran on any CPU, one per line with
+ * their kernel pc, function and execution count summed over the CPUs, and
+ * then the totals, with the number of distinct edge hashes taken.
+ */
+static void handle_coverage(int argc, char** argv) {
+    if (argc != 2 || string(argv[1]) != "coverage") {
+        throw runtime_error("Usage: controller coverage");
+    }
+    LinuxDevice device(COVERAGE_DEVICE_NAME, COVERAGE_DEVICE_PATH);
+    KernelSymbols symbols;
+    int cpu_count = get_cpu_count();
+    vector<char> bbs_buffer(sizeof(coverage_bbs_t));
+    coverage_bbs_t* bbs = reinterpret_cast<coverage_bbs_t*>(&bbs_buffer[0]);
+    if (device.Ioctl(COVERAGE_IOCTL_BBS, bbs) != 0) {
+        throw runtime_error("COVERAGE_IOCTL_BBS failed. Check dmesg.");
+    }
+    vector<unsigned long> counts(COVERAGE_MAX_BBS);
+    vector<bool> edges(COVERAGE_NUM_EDGES);
+    unsigned long eflags_saved = 0;
+    unsigned long eflags_dead = 0;
+    vector<char> buffer(sizeof(coverage_cpu_cmd_t));
+    coverage_cpu_cmd_t* cmd = reinterpret_cast<coverage_cpu_cmd_t*>(&buffer[0]);
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        cmd->cpu = cpu;
+        if (device.Ioctl(COVERAGE_IOCTL_CPU, cmd) != 0) {
+            throw runtime_error("COVERAGE_IOCTL_CPU failed. Check dmesg.");
+        }
+        for (int i = 0; i < COVERAGE_MAX_BBS; i++) {
+            counts[i] += cmd->data.counts[i];
+        }
+        for (int i = 0; i < COVERAGE_NUM_EDGES; i++) {
+            if (cmd->data.edges[i] != 0) {
+                edges[i] = true;
+            }
+        }
+        eflags_saved += cmd->data.eflags_saved;
+        eflags_dead += cmd->data.eflags_dead;
+    }
+    unsigned long covered = 0;
+    for (unsigned long id = 0; id < bbs->num_bbs; id++) {
+        if (counts[id] == 0 || bbs->tags[id] == 0) {
+            continue;
+        }
+        covered++;
+        cout << "0x" << hex << bbs->tags[id] << dec << " "
+             << symbols.Lookup(bbs->tags[id]) << " " << counts[id] << endl;
+    }
+    cerr << covered << " of " << bbs->num_bbs << " bbs covered, "
+         << count(edges.begin(), edges.end(), true) << " edges";
+    if (bbs->dropped != 0) {
+        cerr << ", " << bbs->dropped << " bbs not instrumented";
+    }
+    cerr << endl;
+    /* Zero with the bits option, whose counters never touch the flags. */
+    if (eflags_saved + eflags_dead != 0) {
+        cerr << eflags_dead << " bb counters placed where the flags are dead, "
+             << eflags_saved << " saving them" << endl;
+    }
+}
+
 static void show_usage(int argc, char** argv) {
     cerr << "Usage: controller <subcommand>" << endl;
     cerr << endl;
     cerr << "Available subcommands:" << endl;
-    cerr << "   init [options] - initilizes the module and takes over" << endl;
-    cerr << "   exit - returns to native execution" << endl;
+    cerr << "   init [options [cache]] - initilizes the module and takes over,"
+            " prebuilding the persisted cache file if given" << endl;
+    cerr << "   exit [cache] - returns to native execution, persisting the"
+            " kernel's bbs to the cache file if given" << endl;
     cerr << "   kstats - dumps kstats to the screen" << endl;
+    cerr << "   pcprofile - dumps -prof_pcs samples as folded stacks" << endl;
+    cerr << "   coverage - dumps the coverage client's bb counts, merged over"
+            " CPUs" << endl;
 }
 
 int main(int argc, char** argv) {
@@ -152,6 +365,10 @@ int main(int argc, char** argv) {
             handle_kstats(argc, argv);
         } else if (cmd == "stats") {
             handle_stats(argc, argv);
+        } else if (cmd == "pcprofile") {
+            handle_pcprofile(argc, argv);
+        } else if (cmd == "coverage") {
+            handle_coverage(argc, argv);
         } else {
             show_usage(argc, argv);
             return EXIT_FAILURE;
@@ -13,6 +13,7 @@ typedef int file_t;
 extern "C" {
 #include "stats.h"
 #include "lib/dr_stats.h"
+#include "stats_interface.h"
 }
 using namespace std;
 
@@ -107,14 +108,53 @@ dump_kstats(char *buffer, unsigned long buffer_size, ostream& out)
 #endif
 }
 
+/* Names of the per-CPU stats, in the order of each CPU's counters. */
+static const char *cpu_stat_names[] = {
+#define CPU_STATS_DEF(name) #name,
+#include "cpustatsx.h"
+#undef CPU_STATS_DEF
+};
+
+#define NUM_CPU_STATS (sizeof(cpu_stat_names) / sizeof(cpu_stat_names[0]))
+
 void
 dump_stats(char *buffer, unsigned long buffer_size, ostream& out)
 {
-    dr_statistics_t *stats = (dr_statistics_t*) buffer;
+    dr_stats_header_t *header = (dr_stats_header_t *) buffer;
+    if (buffer_size < sizeof(*header) || header->magic != DR_STATS_MAGIC ||
+        header->version != DR_STATS_VERSION) {
+        throw runtime_error("dump_stats: the module's stats are not in a "
+                            "version this controller knows.");
+    }
+    if (header->num_cpu_stats != NUM_CPU_STATS && header->num_cpus != 0) {
+        stringstream ss;
+        ss << "dump_stats: the module has " << header->num_cpu_stats;
+        ss << " per-CPU stats, but cpustatsx.h has " << NUM_CPU_STATS << ".";
+        throw runtime_error(ss.str());
+    }
+    if (header->cpu_offset + header->num_cpus * header->num_cpu_stats *
+        sizeof(stats_int_t) > buffer_size) {
+        throw runtime_error("dump_stats: truncated stats buffer.");
+    }
+    dr_statistics_t *stats = (dr_statistics_t*) (buffer + header->global_offset);
+    stats_int_t *cpu_stats = (stats_int_t *) (buffer + header->cpu_offset);
     out << "{" << endl;
     for (uint i = 0; i < stats->num_stats; i++) {
         single_stat_t *stat = &stats->stats[i];
-        out << "  \"" << stat->name << "\": " << stat->value << "," << endl;
+        stats_int_t value = stat->value;
+        for (uint j = 0; j < NUM_CPU_STATS; j++) {
+            if (strcmp(stat->name, cpu_stat_names[j]) != 0) {
+                continue;
+            }
+            /* The global value holds a stale sum if DR dumped its stats
+             * (see cpu_stats_aggregate()), so replace it.
+             */
+            value = 0;
+            for (unsigned long cpu = 0; cpu < header->num_cpus; cpu++) {
+                value += cpu_stats[cpu * header->num_cpu_stats + j];
+            }
+        }
+        out << "  \"" << stat->name << "\": " << value << "," << endl;
     }
     out << "  \"__end\" : 0" << endl;
     out << "}" << endl;
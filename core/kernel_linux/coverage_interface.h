@@ -0,0 +1,57 @@
+#ifndef __COVERAGE_INTERFACE_H_
+#define __COVERAGE_INTERFACE_H_
+
+#include <linux/ioctl.h>
+
+/* Layout of the coverage client's data, shared by the client module and the
+ * controller. The controller reads the bb ids with COVERAGE_IOCTL_BBS and
+ * each CPU's counters with COVERAGE_IOCTL_CPU, and merges them.
+ */
+
+#define COVERAGE_DEVICE_PATH "/dev/dynamorio_coverage"
+
+#define COVERAGE_DEVICE_NAME "dynamorio_coverage"
+
+/* Bbs beyond this many distinct tags are not instrumented; they're counted in
+ * coverage_bbs_t.dropped.
+ */
+#define COVERAGE_MAX_BBS (1 << 16)
+
+/* Edges are hashed into a byte map, AFL-style, so distinct edges can collide.
+ */
+#define COVERAGE_EDGE_BITS 16
+#define COVERAGE_NUM_EDGES (1 << COVERAGE_EDGE_BITS)
+
+typedef struct {
+    /* Bb ids are dense, in [0, num_bbs). */
+    unsigned long num_bbs;
+    /* Tags that found the id space full. */
+    unsigned long dropped;
+    /* The kernel pc of each bb id. */
+    unsigned long tags[COVERAGE_MAX_BBS];
+} coverage_bbs_t;
+
+#define COVERAGE_IOCTL_BBS _IOR(0xfe, 0, coverage_bbs_t *)
+
+typedef struct {
+    /* Executions of each bb id, or just 1 once it has run with the bits
+     * option. The counters wrap.
+     */
+    unsigned int counts[COVERAGE_MAX_BBS];
+    /* Non-zero for each edge hash that was taken. */
+    unsigned char edges[COVERAGE_NUM_EDGES];
+    /* Counter increments that had to save the flags, and those that didn't. */
+    unsigned long eflags_saved;
+    unsigned long eflags_dead;
+} coverage_cpu_t;
+
+typedef struct {
+    /* Input. */
+    int cpu;
+    /* Output. */
+    coverage_cpu_t data;
+} coverage_cpu_cmd_t;
+
+#define COVERAGE_IOCTL_CPU _IOWR(0xfe, 1, coverage_cpu_cmd_t *)
+
+#endif
@@ -0,0 +1,128 @@
+/* Contention microbenchmark for cpustatsx.h's per-CPU stats. Runs one thread
+ * per CPU, each incrementing a counter, three ways:
+ *   shared - a locked add to one counter, like the global STATS_INC
+ *   packed - a plain add to the thread's own counter, with the counters
+ *            next to each other so they share cache lines
+ *   percpu - the same, with the counters CPU_STATS_LINE apart, like
+ *            STATS_INC_CPU
+ * and prints the ns per increment for each.
+ *
+ * Usage: cpu_stats_benchmark [threads [increments per thread]]
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CPU_STATS_LINE 64
+#define MAX_THREADS 256
+
+typedef enum {
+    MODE_SHARED,
+    MODE_PACKED,
+    MODE_PERCPU,
+    MODE_LAST
+} bench_mode_t;
+
+static const char *mode_names[] = { "shared", "packed", "percpu" };
+
+typedef struct {
+    volatile unsigned long value;
+    char pad[CPU_STATS_LINE - sizeof(unsigned long)];
+} padded_counter_t;
+
+static volatile unsigned long shared_counter;
+static volatile unsigned long packed_counters[MAX_THREADS];
+static padded_counter_t percpu_counters[MAX_THREADS]
+    __attribute__((aligned(CPU_STATS_LINE)));
+
+static bench_mode_t mode;
+static unsigned long increments;
+static pthread_barrier_t start_barrier;
+
+static void
+pin_to_cpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % sysconf(_SC_NPROCESSORS_ONLN), &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void *
+thread_main(void *arg)
+{
+    int id = (int) (long) arg;
+    unsigned long i;
+    pin_to_cpu(id);
+    pthread_barrier_wait(&start_barrier);
+    switch (mode) {
+    case MODE_SHARED:
+        for (i = 0; i < increments; i++) {
+            __sync_fetch_and_add(&shared_counter, 1);
+        }
+        break;
+    case MODE_PACKED:
+        for (i = 0; i < increments; i++) {
+            packed_counters[id]++;
+        }
+        break;
+    case MODE_PERCPU:
+        for (i = 0; i < increments; i++) {
+            percpu_counters[id].value++;
+        }
+        break;
+    default:
+        break;
+    }
+    return NULL;
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char **argv)
+{
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t threads[MAX_THREADS];
+    int i;
+    increments = 10 * 1000 * 1000;
+    if (argc > 1) {
+        num_threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        increments = strtoul(argv[2], NULL, 10);
+    }
+    if (num_threads < 1 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "threads must be in [1, %d]\n", MAX_THREADS);
+        return EXIT_FAILURE;
+    }
+    printf("%d threads, %lu increments each\n", num_threads, increments);
+    for (mode = 0; mode < MODE_LAST; mode++) {
+        double start, end;
+        pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+        for (i = 0; i < num_threads; i++) {
+            pthread_create(&threads[i], NULL, thread_main, (void *) (long) i);
+        }
+        pthread_barrier_wait(&start_barrier);
+        start = now_ns();
+        for (i = 0; i < num_threads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        end = now_ns();
+        pthread_barrier_destroy(&start_barrier);
+        printf("%-8s %8.2f ns/inc\n", mode_names[mode],
+               (end - start) / increments);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,28 @@
+/* cpustatsx.h
+ *
+ * Hot-path statistics that DRK counts per CPU, in cache-line-separated blocks
+ * without atomics. Each must also have a STATS_DEF in statsx.h, whose global
+ * value is only filled in, with the sum over the CPUs, when the stats are
+ * read.
+ */
+
+/* This file is included multiple times
+   - in utils.h for the cpu_stats_t definition,
+   - in dynamo.c to sum the CPUs' counts into the global stats,
+   - in controller_stats_interface.cc to do the same for the stats ioctl.
+*/
+
+/* Client files that include this header should define the following macro
+#define CPU_STATS_DEF(name)
+*/
+
+CPU_STATS_DEF(num_syscalls)
+CPU_STATS_DEF(num_exits_interrupts)
+CPU_STATS_DEF(num_fragment_interrupt_patches)
+CPU_STATS_DEF(num_interrupts)
+CPU_STATS_DEF(num_user_interrupts)
+CPU_STATS_DEF(num_ibl_interrupts)
+CPU_STATS_DEF(num_fcache_enter_interrupts)
+CPU_STATS_DEF(num_fcache_return_interrupts)
+CPU_STATS_DEF(num_delayed_frag_intr)
+CPU_STATS_DEF(num_ndelayed_frag_intr)
@@ -5,6 +5,7 @@
 #include <linux/percpu.h>
 #include <linux/smp.h>
 #include <linux/sched.h>
+#include <linux/vmalloc.h>
 #include "dynamorio_controller_module.h"
 #include "dynamorio_module_interface.h"
 #include "simple_tests.h"
@@ -14,6 +15,10 @@ static int device_major;
 static bool initialized = false;
 static bool exited = false;
 static dr_exports_t dr_exports;
+/* Kept until the module is unloaded because DR reads it while the CPUs take
+ * over, which can still be going on when init_ioctl returns.
+ */
+static void *persist_in = NULL;
 DEFINE_PER_CPU(dr_cpu_exports_t, dr_cpu_exports);
 
 static void
@@ -57,6 +62,27 @@ init_ioctl(struct inode* inode, struct file* file,
         return -EPERM;
     }
     #endif
+    if (cmd.persist_data != NULL) {
+        if (cmd.persist_size > DYNAMORIO_PERSIST_MAX_SIZE) {
+            printk("Persisted cache image (%luB) is larger than %luB.\n",
+                   cmd.persist_size, DYNAMORIO_PERSIST_MAX_SIZE);
+            return -EINVAL;
+        }
+        persist_in = vmalloc(cmd.persist_size);
+        if (persist_in == NULL) {
+            printk("Could not allocate %luB for the persisted cache image.\n",
+                   cmd.persist_size);
+            return -ENOMEM;
+        }
+        if (copy_from_user(persist_in, cmd.persist_data, cmd.persist_size) != 0) {
+            printk("Could not copy the persisted cache image from userspace.\n");
+            vfree(persist_in);
+            persist_in = NULL;
+            return -EINVAL;
+        }
+        dr_exports.persist_in = persist_in;
+        dr_exports.persist_in_size = cmd.persist_size;
+    }
     initialized = true;
     dr_pre_smp_init(&dr_exports, cmd.options);
     on_each_cpu(smp_init_and_takeover, NULL, false /* wait */);
@@ -70,6 +96,9 @@ exit_ioctl(struct inode* inode, struct file* file,
            unsigned int ioctl_num, unsigned long ioctl_param)
 {
     dynamorio_exit_cmd_t cmd;
+    dynamorio_exit_cmd_t __user *user_cmd;
+    void *persist_out = NULL;
+    int res = 0;
     if (!initialized) {
         printk("Module is not yet initialized.\n");
         return -EPERM;
@@ -82,10 +111,37 @@ exit_ioctl(struct inode* inode, struct file* file,
         printk("Could not copy options from userspace.\n");
         return -EINVAL;
     }
+    user_cmd = (dynamorio_exit_cmd_t __user *) ioctl_param;
+    if (cmd.persist_data != NULL) {
+        unsigned long max = min(cmd.persist_max, DYNAMORIO_PERSIST_MAX_SIZE);
+        persist_out = vmalloc(max);
+        if (persist_out == NULL) {
+            printk("Could not allocate %luB for the persisted cache image.\n",
+                   max);
+            return -ENOMEM;
+        }
+        dr_exports.persist_out = persist_out;
+        dr_exports.persist_out_max = max;
+        dr_exports.persist_out_size = 0;
+    }
     exited = true;
     on_each_cpu(smp_exit, NULL, false /* wait */);
-    /* We will return here on the calling CPU under native control. */
-    return 0;
+    /* We will return here on the calling CPU under native control. smp_exit
+     * on this CPU waits for the main thread's cleanup, which is where the
+     * persisted image is written.
+     */
+    if (persist_out != NULL) {
+        if (copy_to_user(cmd.persist_data, persist_out,
+                         dr_exports.persist_out_size) != 0 ||
+            copy_to_user(&user_cmd->persist_size, &dr_exports.persist_out_size,
+                         sizeof(user_cmd->persist_size)) != 0) {
+            printk("Could not copy the persisted cache image to userspace.\n");
+            res = -EINVAL;
+        }
+        dr_exports.persist_out = NULL;
+        vfree(persist_out);
+    }
+    return res;
 }
 
 static int
@@ -125,12 +181,18 @@ kstats_ioctl(struct inode* inode, struct file* file,
         return -EPERM;
     }
 
+    /* DR frees the exported data when it exits */
+    if (exited) {
+        printk("Module already exited.\n");
+        return -EPERM;
+    }
+
     if (copy_from_user(&cpu, &kstats->cpu, sizeof(cpu)) != 0) {
         printk("Could not copy cpu # from userspace.\n");
         return -EINVAL;
     }
 
-    if (cpu >= num_possible_cpus()) {
+    if (cpu < 0 || cpu >= num_possible_cpus()) {
         printk("Invalid CPU # (%d).\n", cpu);
         return -EINVAL;
     }
@@ -153,6 +215,11 @@ stats_ioctl(struct inode* inode, struct file* file,
             unsigned int ioctl_num, unsigned long ioctl_param)
 {
     dynamorio_stats_cmd_t __user *stats;
+    dr_stats_header_t header;
+    char __user *data;
+    unsigned long cpu_size;
+    unsigned long size;
+    unsigned long cpu;
     stats = (dynamorio_stats_cmd_t __user *) ioctl_param;
 
     if (!initialized) {
@@ -160,8 +227,106 @@ stats_ioctl(struct inode* inode, struct file* file,
         return -EPERM;
     }
 
-    return copy_export_to_user(dr_exports.stats_data, dr_exports.stats_size,
-                               DYNAMORIO_STATS_MAX_SIZE, &stats->buffer);
+    if (exited) {
+        printk("Module already exited.\n");
+        return -EPERM;
+    }
+
+    /* We only copy the buffers. Summing the CPUs' counters is left to the
+     * controller, so reading stats costs DR nothing.
+     */
+    cpu_size = dr_exports.num_cpu_stats * sizeof(unsigned long);
+    header.magic = DR_STATS_MAGIC;
+    header.version = DR_STATS_VERSION;
+    header.global_offset = sizeof(header);
+    header.global_size = dr_exports.stats_size;
+    header.cpu_offset = header.global_offset + header.global_size;
+    header.num_cpu_stats = dr_exports.num_cpu_stats;
+    header.num_cpus = dr_exports.num_cpus;
+    size = header.cpu_offset + header.num_cpus * cpu_size;
+    if (size > DYNAMORIO_STATS_MAX_SIZE) {
+        printk("User buffer is too small (%luB) to hold stats (%luB).\n",
+               DYNAMORIO_STATS_MAX_SIZE, size);
+        return -EINVAL;
+    }
+    data = &stats->buffer.data;
+    if (copy_to_user(data, &header, sizeof(header)) != 0 ||
+        copy_to_user(data + header.global_offset, dr_exports.stats_data,
+                     header.global_size) != 0) {
+        printk("Could not copy stats to the user-supplied buffer %p.\n", data);
+        return -EINVAL;
+    }
+    for (cpu = 0; cpu < header.num_cpus; cpu++) {
+        char *block = (char *) dr_exports.cpu_stats_data +
+            cpu * dr_exports.cpu_stats_stride;
+        if (copy_to_user(data + header.cpu_offset + cpu * cpu_size, block,
+                         cpu_size) != 0) {
+            printk("Could not copy cpu %lu's stats to the user-supplied "
+                   "buffer %p.\n", cpu, data);
+            return -EINVAL;
+        }
+    }
+    if (copy_to_user(&stats->buffer.size, &size, sizeof(size))) {
+        printk("Could not copy stats size to user-supplied field %p.\n",
+               &stats->buffer.size);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static int
+pcprofile_ioctl(struct inode* inode, struct file* file,
+                unsigned int ioctl_num, unsigned long ioctl_param)
+{
+    dynamorio_pcprofile_cmd_t __user *pcprofile;
+    dr_cpu_exports_t *exports;
+    int cpu;
+
+    pcprofile = (dynamorio_pcprofile_cmd_t __user *) ioctl_param;
+
+    if (!initialized) {
+        printk("Module not yet initlized. You can't retrieve samples now.");
+        return -EPERM;
+    }
+
+    if (exited) {
+        printk("Module already exited.\n");
+        return -EPERM;
+    }
+
+    if (copy_from_user(&cpu, &pcprofile->cpu, sizeof(cpu)) != 0) {
+        printk("Could not copy cpu # from userspace.\n");
+        return -EINVAL;
+    }
+
+    if (cpu < 0 || cpu >= num_possible_cpus()) {
+        printk("Invalid CPU # (%d).\n", cpu);
+        return -EINVAL;
+    }
+
+    exports = &per_cpu(dr_cpu_exports, cpu);
+
+    if (exports->pcprofile_data == NULL) {
+        printk("exports->pcprofile_data is NULL. Make sure to specify the"
+               " -prof_pcs option.\n");
+        return -EPERM;
+    }
+    if (exports->pcprofile_size != sizeof(pcprofile_table_t)) {
+        printk("Sample table is %luB, expected %luB.\n",
+               exports->pcprofile_size, sizeof(pcprofile_table_t));
+        return -EINVAL;
+    }
+
+    /* The CPU keeps sampling while we copy. Entries are only published once
+     * they're filled in, so at worst we miss the latest samples.
+     */
+    if (copy_to_user(&pcprofile->table, exports->pcprofile_data,
+                     sizeof(pcprofile_table_t)) != 0) {
+        printk("Could not copy samples to the user-supplied buffer %p.\n",
+               &pcprofile->table);
+        return -EINVAL;
+    }
+    return 0;
 }
 
 static int device_ioctl(struct inode* inode,
@@ -177,6 +342,8 @@ static int device_ioctl(struct inode* inode,
         return kstats_ioctl(inode, file, ioctl_num, ioctl_param);
     case DYNAMORIO_IOCTL_STATS:
         return stats_ioctl(inode, file, ioctl_num, ioctl_param);
+    case DYNAMORIO_IOCTL_PCPROFILE:
+        return pcprofile_ioctl(inode, file, ioctl_num, ioctl_param);
     default:
         printk("Uknwown ioctl number %d.\n", ioctl_num);
     }
@@ -205,6 +372,9 @@ static int mod_init(void) {
 
 static void mod_exit(void) {
     unregister_chrdev(device_major, DYNAMORIO_DEVICE_NAME);
+    if (persist_in != NULL) {
+        vfree(persist_in);
+    }
 }
 
 module_init(mod_init);
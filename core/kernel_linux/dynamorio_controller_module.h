@@ -3,18 +3,31 @@
 
 #include <linux/ioctl.h>
 #include "kernel_interface.h"
+#include "pcprofile_interface.h"
+#include "stats_interface.h"
 
 #define DYNAMORIO_DEVICE_PATH "/dev/dynamorio_controller"
 
 #define DYNAMORIO_DEVICE_NAME "dynamorio_controller"
 
+/* Largest persisted kernel cache image we pass in or out. */
+#define DYNAMORIO_PERSIST_MAX_SIZE (32*1024*1024LU)
+
 typedef struct {
     char options[KERNEL_ENV_VALUE_MAX];
+    /* Optional persisted kernel cache image to prebuild at takeover. */
+    void *persist_data;
+    unsigned long persist_size;
 } dynamorio_init_cmd_t;
 
 #define DYNAMORIO_IOCTL_INIT _IOW(0xFF, 0, dynamorio_init_cmd_t *)
 
 typedef struct {
+    /* Input. Optional buffer for the persisted kernel cache image. */
+    void *persist_data;
+    unsigned long persist_max;
+    /* Output. Size of the image written to persist_data. */
+    unsigned long persist_size;
 } dynamorio_exit_cmd_t;
 
 #define DYNAMORIO_IOCTL_EXIT _IOW(0xFF, 1, dynamorio_exit_cmd_t *)
@@ -40,12 +53,21 @@ typedef struct {
 #define DYNAMORIO_STATS_MAX_SIZE 100*1024LU
 
 typedef struct {
-    /* Output. */
+    /* Output. The data is laid out as described in stats_interface.h. */
     stats_buffer_t buffer;
     char more_data[DYNAMORIO_STATS_MAX_SIZE];
 } dynamorio_stats_cmd_t;
 
 #define DYNAMORIO_IOCTL_STATS _IOWR(0xff, 3, dynamorio_stats_cmd_t *)
 
+typedef struct {
+    /* Input. */
+    int cpu;
+    /* Output. */
+    pcprofile_table_t table;
+} dynamorio_pcprofile_cmd_t;
+
+#define DYNAMORIO_IOCTL_PCPROFILE _IOWR(0xff, 4, dynamorio_pcprofile_cmd_t *)
+
 
 #endif
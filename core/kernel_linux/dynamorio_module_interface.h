@@ -9,11 +9,33 @@ typedef struct {
      */
     void *kstats_data;
     unsigned long kstats_size;
+    /* The CPU's -prof_pcs samples, a pcprofile_table_t. */
+    void *pcprofile_data;
+    unsigned long pcprofile_size;
 } dr_cpu_exports_t;
 
 typedef struct {
     void *stats_data;
     unsigned long stats_size;
+    /* The per-CPU blocks of the stats in cpustatsx.h: num_cpus blocks,
+     * cpu_stats_stride bytes apart, each starting with num_cpu_stats counters.
+     * They're not in stats_data's values until summed at read time.
+     */
+    void *cpu_stats_data;
+    unsigned long cpu_stats_stride;
+    unsigned long num_cpu_stats;
+    unsigned long num_cpus;
+    /* Input: a persisted kernel cache image from an earlier run to prebuild
+     * at takeover, or NULL.
+     */
+    void *persist_in;
+    unsigned long persist_in_size;
+    /* Input: a buffer for the persisted image recorded at exit, or NULL.
+     * Output: the size of the image written to it.
+     */
+    void *persist_out;
+    unsigned long persist_out_max;
+    unsigned long persist_out_size;
 } dr_exports_t;
 
 extern void dr_pre_smp_init(dr_exports_t *exports, const char* options);
@@ -7,6 +7,8 @@
 #include <linux/kallsyms.h>
 #include <linux/sched.h>
 #include <linux/mm.h>
+#include <asm/apic.h>
+#include <asm/irq_vectors.h>
 
 #include "dynamorio_module_interface.h"
 #include "dynamorio_module_assert_interface.h"
@@ -140,6 +142,9 @@ kernel_symbol_t native_load_gs_index_symbol;
 kernel_symbol_t gs_change_symbol;
 static void* (*module_alloc_address)(unsigned long) = NULL;
 static unsigned long (*module_kallsyms_lookup_name_address)(const char *name) = NULL;
+/* Bounds of the core kernel's text, for kernel_get_text_unit. */
+static byte *core_text_start = NULL;
+static byte *core_text_end = NULL;
 
 bool
 kernel_module_init(size_t dr_heap_size)
@@ -169,6 +174,11 @@ kernel_module_init(size_t dr_heap_size)
     if (!module_kallsyms_lookup_name_address) {
         return false;
     }
+    core_text_start = find_kernel_symbol_address("_stext");
+    core_text_end = find_kernel_symbol_address("_etext");
+    if (!core_text_start || !core_text_end) {
+        return false;
+    }
 
     /* Use module_alloc so the heap is located close (i.e., 32-bit reachable) to
      * the module's text and data. The Linux kernel allocates only 1.5 GB of
@@ -279,6 +289,48 @@ kernel_get_module_base(byte *pc)
     return start;
 }
 
+bool
+kernel_get_text_unit(byte *pc, byte **start, byte **end, const char **name)
+{
+    struct module *module;
+    if (pc >= core_text_start && pc < core_text_end) {
+        *start = core_text_start;
+        *end = core_text_end;
+        *name = KERNEL_CORE_TEXT_NAME;
+        return true;
+    }
+    module = __module_address((unsigned long)pc);
+    if (module == NULL) {
+        return false;
+    }
+    *start = (byte*) module->module_core;
+    *end = (byte*) module->module_core + module->core_text_size;
+    *name = module->name;
+    return pc >= *start && pc < *end;
+}
+
+bool
+kernel_find_text_unit(const char *name, byte **start, byte **end)
+{
+    struct module *module;
+    if (strcmp(name, KERNEL_CORE_TEXT_NAME) == 0) {
+        *start = core_text_start;
+        *end = core_text_end;
+        return true;
+    }
+    /* See the comment about module_mutex in kernel_load_shared_library. */
+    if (mutex_is_locked(&module_mutex)) {
+        return false;
+    }
+    module = find_module(name);
+    if (module == NULL) {
+        return false;
+    }
+    *start = (byte*) module->module_core;
+    *end = (byte*) module->module_core + module->core_text_size;
+    return true;
+}
+
 bool
 kernel_find_dynamorio_module_bounds(byte **start, byte **end)
 {
@@ -367,6 +419,16 @@ kernel_run_on_all_cpus(void (*func) (void *info), void *info)
     on_each_cpu(func, info, false/* wait */);
 }
 
+void
+kernel_interrupt_other_cpus(void)
+{
+    /* Unlike on_each_cpu, this is safe with interrupts disabled. The
+     * reschedule vector's handler only acks the APIC and sets need_resched,
+     * so running it natively afterwards is harmless.
+     */
+    apic->send_IPI_allbutself(RESCHEDULE_VECTOR);
+}
+
 void
 kernel_printk(const char* fmt, ...)
 {
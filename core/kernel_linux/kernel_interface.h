@@ -36,6 +36,9 @@ int kernel_get_cpu_id(void);
 
 void kernel_run_on_all_cpus(void (*func) (void *info), void *info);
 
+/* Sends a single broadcast IPI to all other online CPUs. */
+void kernel_interrupt_other_cpus(void);
+
 void kernel_printk(const char* fmt, ...);
 
 #define KERNEL_ENV_NAME_MAX  50
@@ -55,4 +58,15 @@ bool kernel_shared_library_bounds(void* lib, byte* addr, byte** start,
                                   byte** end);
 byte* kernel_get_module_base(byte* pc);
 
+/* Name of the core kernel's text unit, as opposed to a module's. */
+#define KERNEL_CORE_TEXT_NAME "vmlinux"
+
+/* Returns the bounds and name of the text unit (the core kernel's text or a
+ * module's core text) containing pc, or false if pc is in neither.
+ */
+bool kernel_get_text_unit(byte* pc, byte** start, byte** end,
+                          const char** name);
+/* Returns the current bounds of the text unit with the given name. */
+bool kernel_find_text_unit(const char* name, byte** start, byte** end);
+
 #endif
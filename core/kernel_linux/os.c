@@ -17,6 +17,7 @@
 #include "fcache.h"
 #include "cr.h"
 #include "monitor.h"
+#include "perscache.h"
 
 #ifdef CLIENT_INTERFACE
 # include "instrument.h"
@@ -152,6 +153,15 @@ typedef struct {
 
     /* The fragment we created for syscall entry. */
     fragment_t *syscall_entry_frag;
+
+    /* Warmup measurement for os_note_dispatch_exit(), in query_time_millis()
+     * units.  The CPU reaches steady state at the last on-demand bb build
+     * that is followed by -kernel_warmup_ms without another.
+     */
+    uint64 takeover_ms;
+    uint64 last_bb_ms;
+    bool steady_state;
+    bool warmup_done;
 } os_thread_data_t;
 
 
@@ -585,7 +595,7 @@ static void
 handle_user_interrupt(dcontext_t *dcontext, interrupt_context_t *interrupt)
 {
     os_thread_data_t *ostd = (os_thread_data_t *) dcontext->os_field;
-    STATS_INC(num_user_interrupts);
+    STATS_INC_CPU(num_user_interrupts);
     if (!DYNAMO_OPTION(optimize_sys_call_ret)) {
         ASSERT(dcontext->whereami == WHERE_USERMODE);
     }
@@ -796,7 +806,7 @@ patch_fragment(dcontext_t *dcontext, os_thread_data_t *ostd, byte *patch_pc,
                interrupt_vector_t vector)
 {
     int patch_index = ostd->num_patches++;
-    STATS_INC(num_fragment_interrupt_patches);
+    STATS_INC_CPU(num_fragment_interrupt_patches);
     ASSERT(ostd->num_patches <= MAX_NUM_PATCHES);
     ostd->patch_pc[patch_index] = patch_pc;
     patch_interrupt(dcontext, patch_pc, vector,
@@ -926,7 +936,7 @@ handle_fragment_interrupt(dcontext_t *dcontext, interrupt_context_t *interrupt)
         dcontext->next_tag = mcontext.xip;
         set_last_exit(dcontext,
                       (linkstub_t *) get_kernel_interrupt_entry_linkstub());
-        STATS_INC(num_ndelayed_frag_intr);
+        STATS_INC_CPU(num_ndelayed_frag_intr);
         transfer_to_dispatch(dcontext, 0, &mcontext);
     } else if (res == RECREATE_DELAY_UNTIL_DISPATCH) {
         /* Switch from kernel_interrupt_handling */
@@ -942,7 +952,7 @@ handle_fragment_interrupt(dcontext_t *dcontext, interrupt_context_t *interrupt)
         ostd->need_to_link_interrupted_fragment =
             unlink_interrupted_fragment(dcontext, ostd->interrupted_fragment);
         record_pending_interrupt(dcontext, interrupt, NULL, true);
-        STATS_INC(num_delayed_frag_intr);
+        STATS_INC_CPU(num_delayed_frag_intr);
     } else if (res == RECREATE_DELAY_UNTIL_PC) {
         KSWITCH(kernel_interrupt_frag_delay_pc);
         ASSERT(!vector_is_synchronous(interrupt->vector));
@@ -993,7 +1003,7 @@ handle_ibl_interrupt(dcontext_t *dcontext, interrupt_context_t *interrupt)
     ostd->interrupted_ibl_pc = interrupt->frame.xip;
     unlink_ibl_routine(dcontext, ostd->interrupted_ibl_pc);
     record_pending_interrupt(dcontext, interrupt, NULL, true);
-    STATS_INC(num_ibl_interrupts);
+    STATS_INC_CPU(num_ibl_interrupts);
 }
 
 
@@ -1014,7 +1024,7 @@ handle_fcache_enter_interrupt(dcontext_t *dcontext,
     dcontext->next_tag = dcontext->next_app_tag;
     ASSERT(!is_dynamo_address(dcontext->next_tag));
     ASSERT(is_kernel_code(dcontext->next_tag));
-    STATS_INC(num_fcache_enter_interrupts);
+    STATS_INC_CPU(num_fcache_enter_interrupts);
     transfer_to_dispatch(dcontext, 0, get_mcontext(dcontext));
 }
 
@@ -1022,7 +1032,7 @@ static void
 handle_fcache_return_interrupt(dcontext_t *dcontext,
                                interrupt_context_t *interrupt)
 {
-    STATS_INC(num_fcache_return_interrupts);
+    STATS_INC_CPU(num_fcache_return_interrupts);
     KSWITCH(kernel_interrupt_fcache_return);
     record_pending_interrupt(dcontext, interrupt, NULL, true);
     /* Before fcache_return disables interrupts, xax always holds the linkstub
@@ -1106,6 +1116,39 @@ static void
 nmi_handler(void) {
 }
 
+/* Records a -prof_pcs sample of where the interrupt arrived. */
+static void
+sample_interrupted_pc(dcontext_t *dcontext, interrupt_context_t *interrupt)
+{
+    cache_pc pc = interrupt->frame.xip;
+    switch (interrupt->location) {
+    case INTERRUPTED_USER:
+        pcprofile_sample(dcontext, PCPROFILE_USER, NULL);
+        break;
+    case INTERRUPTED_FRAGMENT:
+        pcprofile_sample(dcontext, PCPROFILE_BB, pc);
+        break;
+    case INTERRUPTED_GENCODE:
+        pcprofile_sample(dcontext,
+                         in_indirect_branch_lookup_code(dcontext, pc) ?
+                         PCPROFILE_IBL : PCPROFILE_CONTEXT_SWITCH, NULL);
+        break;
+    case INTERRUPTED_DYNAMORIO:
+        pcprofile_sample(dcontext, PCPROFILE_DYNAMORIO, pc);
+        break;
+#ifdef CLIENT_INTERFACE
+    case INTERRUPTED_CLIENT_LIB:
+        pcprofile_sample(dcontext, PCPROFILE_CLIENT_LIB, pc);
+        break;
+    case INTERRUPTED_CLIENT_GENCODE:
+        pcprofile_sample(dcontext, PCPROFILE_CLIENT_GENCODE, NULL);
+        break;
+#endif
+    default:
+        ASSERT_NOT_REACHED();
+    }
+}
+
 #ifdef CLIENT_INTERFACE
 static bool
 send_interrupt_to_client(dcontext_t *dcontext, interrupt_context_t *interrupt)
@@ -1129,7 +1172,7 @@ handle_interrupt(interrupt_stack_frame_t* frame, dr_mcontext_t* mcontext,
     os_thread_data_t *ostd;
     bool local;
     interrupt_context_t interrupt;
-    STATS_INC(num_interrupts);
+    STATS_INC_CPU(num_interrupts);
 
     if (vector == VECTOR_NMI) {
         nmi_handler();
@@ -1216,6 +1259,9 @@ handle_interrupt(interrupt_stack_frame_t* frame, dr_mcontext_t* mcontext,
         ASSERT(!has_pending_interrupt(dcontext));
         interrupt.location = get_interrupted_location(dcontext,
                                                       &interrupt.frame);
+        if (INTERNAL_OPTION(profile_pcs) &&
+            interrupt.vector == INTERNAL_OPTION(prof_pcs_vector))
+            sample_interrupted_pc(dcontext, &interrupt);
     
 #if 0
         ASSERT(ostd->num_patches == 0 ||
@@ -1280,15 +1326,47 @@ os_fragment_thread_reset_free(dcontext_t *dcontext) {
 
 void
 os_warm_fcache(dcontext_t *dcontext) {
+    os_thread_data_t *ostd = (os_thread_data_t *) dcontext->os_field;
+    /* Prebuilding is part of the time to steady state. */
+    ostd->takeover_ms = query_time_millis();
+    ostd->last_bb_ms = ostd->takeover_ms;
     /* TODO(peter): We want to warm this with the syscall and vector entry
      * points and patch those routines to jump directly into the cache where
      * possible.
      */
-    if (DYNAMO_OPTION(optimize_sys_call_ret)) {
+    if (DYNAMO_OPTION(optimize_sys_call_ret))
         optimize_syscall_entry(dcontext);
+    kernel_persist_warm(dcontext);
+}
+
+static void
+reach_steady_state(os_thread_data_t *ostd)
+{
+    ostd->steady_state = true;
+    STATS_TRACK_MAX(kernel_ms_to_steady_state, ostd->last_bb_ms - ostd->takeover_ms);
+}
+
+void
+os_note_dispatch_exit(dcontext_t *dcontext, bool built_bb)
+{
+    os_thread_data_t *ostd = (os_thread_data_t *) dcontext->os_field;
+    uint64 now;
+    if (ostd->warmup_done)
         return;
+    now = query_time_millis();
+    if (now - ostd->takeover_ms < DYNAMO_OPTION(kernel_warmup_ms)) {
+        STATS_INC(num_warmup_exits);
+        if (built_bb)
+            STATS_INC(num_warmup_bbs);
+    } else if (ostd->steady_state) {
+        ostd->warmup_done = true;
+    }
+    if (built_bb && !ostd->steady_state) {
+        if (now - ostd->last_bb_ms >= DYNAMO_OPTION(kernel_warmup_ms))
+            reach_steady_state(ostd);
+        else
+            ostd->last_bb_ms = now;
     }
-    
 }
 
 static bool
@@ -1487,6 +1565,9 @@ os_thread_init(dcontext_t *dcontext)
     memset(ostd, 0, sizeof(*ostd));
 
     ostd->native_state.msr_lstar = get_msr(MSR_LSTAR);
+
+    if (INTERNAL_OPTION(profile_pcs))
+        pcprofile_thread_init(dcontext);
 }
 
 void
@@ -1500,6 +1581,16 @@ os_thread_exit(dcontext_t *dcontext)
 {
     os_thread_data_t *ostd = (os_thread_data_t *) dcontext->os_field;
 
+    if (INTERNAL_OPTION(profile_pcs))
+        pcprofile_thread_exit(dcontext);
+
+    /* A CPU whose last bb build is far enough behind it got there, even if
+     * it never built another one to notice.
+     */
+    if (!ostd->steady_state &&
+        query_time_millis() - ostd->last_bb_ms >= DYNAMO_OPTION(kernel_warmup_ms))
+        reach_steady_state(ostd);
+
     /* Restore interrupt handlers. */
     heap_free(dcontext, ostd->idt, UNALIGNED_IDT_SIZE HEAPACCT(ACCT_OTHER));
     set_idtr(&ostd->native_state.idtr);
@@ -1528,6 +1619,15 @@ os_run_on_all_threads(void (*func) (void *info), void *info) {
     kernel_run_on_all_cpus(func, info);
 }
 
+void
+os_interrupt_other_threads(void)
+{
+    /* The interrupt is delayed until each CPU's next fragment exit, so it
+     * reaches dispatch before the kernel's handler runs.
+     */
+    kernel_interrupt_other_cpus();
+}
+
 process_id_t
 get_process_id()
 {
@@ -2610,17 +2710,6 @@ check_for_unsupported_modules()
     return true;
 }
 
-void
-pcprofile_fragment_deleted(dcontext_t *dcontext, fragment_t *f)
-{
-    ASSERT_NOT_PORTED(false);
-}
-
-void
-pcprofile_thread_exit(dcontext_t *dcontext) {
-    ASSERT_NOT_PORTED(false);
-}
-
 void *
 get_clone_record(reg_t xsp)
 {
@@ -54,6 +54,11 @@
 #define OS_ALLOC_GRANULARITY     (4*1024)
 #define MAP_FILE_VIEW_ALIGNMENT  (4*1024)
 
+/* Bound on CPU numbers, i.e., thread ids, for statically sized per-CPU
+ * tables.
+ */
+#define KERNEL_MAX_CPUS 256
+
 /* We steal a segment register, and so use fs for x86 (where pthreads
  * uses gs) and gs for x64 (where pthreads uses fs) (presumably to
  * avoid conflicts w/ wine).
@@ -192,6 +197,8 @@ typedef struct _kernel_sigset_t {
 
 bool has_pending_interrupt(dcontext_t *dcontext);
 void receive_pending_interrupt(dcontext_t *dcontext);
+/* Sends one IPI to every other CPU, bringing each to dispatch. */
+void os_interrupt_other_threads(void);
 bool is_signal_restorer_code(byte *pc, size_t *len);
 
 #define CONTEXT_HEAP_SIZE(sc) (sizeof(sc))
@@ -258,8 +265,14 @@ get_itimer_frequency(dcontext_t *dcontext, int which);
 /***************************************************************************/
 
 /* in pcprofile.c */
+#include "pcprofile_interface.h"
+void pcprofile_thread_init(dcontext_t *dcontext);
 void pcprofile_fragment_deleted(dcontext_t *dcontext, fragment_t *f);
 void pcprofile_thread_exit(dcontext_t *dcontext);
+void pcprofile_sample(dcontext_t *dcontext, pcprofile_where_t where, cache_pc pc);
+void pcprofile_translate_pending(dcontext_t *dcontext);
+/* Returns the CPU's sample table, in the pcprofile_table_t layout, or NULL. */
+void *pcprofile_get_data(dcontext_t *dcontext, size_t *size);
 
 /* in stackdump.c */
 /* fork, dump core, and use gdb for complete stack trace */
@@ -0,0 +1,163 @@
+/*
+ * pcprofile.c - pc sampling profiler for the kernel
+ *
+ * With -prof_pcs, every arrival of the -prof_pcs_vector interrupt (the local
+ * APIC timer by default) on a CPU records where that CPU was. Samples land
+ * in a fixed per-CPU table that only that CPU writes, with interrupts off, so
+ * recording a sample takes no locks and allocates nothing. Translating an
+ * fcache pc does both, so the interrupt handler only queues the raw pc and
+ * the next dispatch on that CPU attributes it to the kernel pc it translates
+ * to. The controller reads the tables with DYNAMORIO_IOCTL_PCPROFILE.
+ *
+ * DR runs with interrupts disabled, so time in the dispatcher is charged to
+ * wherever the timer interrupt is finally delivered rather than to DR.
+ */
+
+#include "../globals.h"
+#include "../fragment.h"
+#include "../fcache.h"
+#include "arch.h"
+#include "string_wrapper.h"
+#include "pcprofile_interface.h"
+
+/* Give up on an entry after this many probes and count the sample as
+ * dropped.
+ */
+#define MAX_PROBES 16
+
+/* Fcache samples queued between two dispatches. The timer fires far less
+ * often than we exit the cache, so this rarely holds more than one.
+ */
+#define MAX_PENDING 32
+
+typedef struct {
+    /* What the controller reads: must come first. */
+    pcprofile_table_t table;
+    /* Untranslated fcache pcs, in the order they were sampled. */
+    cache_pc pending[MAX_PENDING];
+    uint num_pending;
+} pcprofile_info_t;
+
+void
+pcprofile_thread_init(dcontext_t *dcontext)
+{
+    pcprofile_info_t *info =
+        heap_alloc(dcontext, sizeof(pcprofile_info_t) HEAPACCT(ACCT_OTHER));
+    memset(info, 0, sizeof(*info));
+    dcontext->pcprofile_field = info;
+}
+
+/* Called both from the process exit walk over all threads and from
+ * os_thread_exit(), whichever comes first.
+ */
+void
+pcprofile_thread_exit(dcontext_t *dcontext)
+{
+    pcprofile_info_t *info = (pcprofile_info_t *) dcontext->pcprofile_field;
+    if (info == NULL)
+        return;
+    dcontext->pcprofile_field = NULL;
+    heap_free(dcontext, info, sizeof(pcprofile_info_t) HEAPACCT(ACCT_OTHER));
+}
+
+void *
+pcprofile_get_data(dcontext_t *dcontext, size_t *size)
+{
+    pcprofile_info_t *info = (pcprofile_info_t *) dcontext->pcprofile_field;
+    *size = sizeof(pcprofile_table_t);
+    return info == NULL ? NULL : &info->table;
+}
+
+/* Pending samples are translated at the cache exit that follows them (see
+ * pcprofile_translate_pending()), so there's nothing to retire.
+ */
+void
+pcprofile_fragment_deleted(dcontext_t *dcontext, fragment_t *f)
+{
+}
+
+static void
+pcprofile_add(pcprofile_table_t *table, pcprofile_where_t where, ptr_uint_t pc)
+{
+    uint hindex = HASH_FUNC_BITS(pc, PCPROFILE_HASH_BITS);
+    uint i;
+    table->samples++;
+    for (i = 0; i < MAX_PROBES; i++) {
+        pcprofile_entry_t *e = &table->entries[hindex];
+        if (e->count == 0) {
+            e->pc = pc;
+            e->where = where;
+            /* The controller can read the table at any time, so don't
+             * publish the entry until it's filled in.
+             */
+            asm volatile("" : : : "memory");
+            e->count = 1;
+            return;
+        }
+        if (e->pc == pc && e->where == where) {
+            e->count++;
+            return;
+        }
+        hindex = (hindex + 1) & (PCPROFILE_NUM_ENTRIES - 1);
+    }
+    table->dropped++;
+}
+
+/* Records a sample taken by the interrupt handler. For PCPROFILE_BB, pc is
+ * the interrupted fcache pc, which is queued for
+ * pcprofile_translate_pending(); otherwise it's kept as is. Must be called
+ * with interrupts disabled.
+ */
+void
+pcprofile_sample(dcontext_t *dcontext, pcprofile_where_t where, cache_pc pc)
+{
+    pcprofile_info_t *info = (pcprofile_info_t *) dcontext->pcprofile_field;
+    if (info == NULL)
+        return;
+    if (where == PCPROFILE_BB) {
+        if (info->num_pending < MAX_PENDING)
+            info->pending[info->num_pending++] = pc;
+        else {
+            info->table.samples++;
+            info->table.dropped++;
+        }
+        return;
+    }
+    pcprofile_add(&info->table, where, (ptr_uint_t) pc);
+}
+
+/* Attributes the fcache samples taken since the last cache exit to the
+ * kernel pcs they translate to. Called by dispatch() once it's
+ * couldbelinking, with interrupts disabled, so the interrupt handler can't
+ * queue more meanwhile. A fragment flushed at this very cache exit can
+ * already be gone: its samples count as stubs.
+ */
+void
+pcprofile_translate_pending(dcontext_t *dcontext)
+{
+    pcprofile_info_t *info = (pcprofile_info_t *) dcontext->pcprofile_field;
+    uint i;
+    if (info == NULL)
+        return;
+    ASSERT(is_couldbelinking(dcontext));
+    for (i = 0; i < info->num_pending; i++) {
+        cache_pc pc = info->pending[i];
+        pcprofile_where_t where = PCPROFILE_BB;
+        fragment_t wrapper;
+        fragment_t *f = fragment_pclookup(dcontext, pc, &wrapper);
+        if (f == NULL) {
+            where = PCPROFILE_STUB;
+            pc = NULL;
+        } else {
+            app_pc app = recreate_app_pc(dcontext, pc, f);
+            if (TEST(FRAG_IS_TRACE, f->flags))
+                where = PCPROFILE_TRACE;
+            /* A fragment pending deletion can't be translated: charge its
+             * entry point.
+             */
+            pc = (app == NULL) ? f->tag : app;
+        }
+        pcprofile_add(&info->table, where, (ptr_uint_t) pc);
+    }
+    info->num_pending = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef __PCPROFILE_INTERFACE_H_
+#define __PCPROFILE_INTERFACE_H_
+
+/* Layout of a CPU's -prof_pcs samples, shared by DR and the controller, which
+ * reads them with the DYNAMORIO_IOCTL_PCPROFILE ioctl and prints them as
+ * folded stacks for flamegraph tools.
+ */
+
+/* What a sample interrupted. The controller prints the name of each as the
+ * root frame of the sample's stack.
+ */
+typedef enum {
+    PCPROFILE_USER,             /* user mode: pc is always 0 */
+    PCPROFILE_BB,               /* a bb: pc is the translated kernel pc */
+    PCPROFILE_TRACE,            /* a trace: pc is the translated kernel pc */
+    PCPROFILE_STUB,             /* fcache pc in no fragment, i.e., a stub */
+    PCPROFILE_IBL,              /* indirect branch lookup: pc is 0 */
+    PCPROFILE_CONTEXT_SWITCH,   /* fcache enter or return: pc is 0 */
+    PCPROFILE_DYNAMORIO,        /* DR itself: pc is the DR pc */
+    PCPROFILE_CLIENT_LIB,       /* a clean callee: pc is the client pc */
+    PCPROFILE_CLIENT_GENCODE,   /* client code outside of fragments: pc is 0 */
+    PCPROFILE_WHERE_LAST
+} pcprofile_where_t;
+
+#define PCPROFILE_WHERE_NAMES { \
+    "user", "bb", "trace", "stub", "ibl", "context_switch", "dynamorio", \
+    "client_lib", "client_gencode" }
+
+typedef struct {
+    unsigned long pc;
+    /* Set last, so an entry with a count of 0 is unused. */
+    unsigned int count;
+    unsigned int where; /* pcprofile_where_t */
+} pcprofile_entry_t;
+
+#define PCPROFILE_HASH_BITS 12
+#define PCPROFILE_NUM_ENTRIES (1 << PCPROFILE_HASH_BITS)
+
+typedef struct {
+    unsigned long samples;
+    /* Samples that found the table full. */
+    unsigned long dropped;
+    pcprofile_entry_t entries[PCPROFILE_NUM_ENTRIES];
+} pcprofile_table_t;
+
+#endif
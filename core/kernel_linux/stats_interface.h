@@ -0,0 +1,30 @@
+#ifndef __STATS_INTERFACE_H_
+#define __STATS_INTERFACE_H_
+
+/* Layout of the DYNAMORIO_IOCTL_STATS buffer, shared by the controller module
+ * and the controller. It starts with a dr_stats_header_t. Then come the global
+ * dr_statistics_t and, for each CPU, the num_cpu_stats counters of
+ * cpustatsx.h, in that order. The counters are not yet in the global values;
+ * the controller adds them to the global stats of the same name.
+ */
+
+#define DR_STATS_MAGIC 0x534b5244 /* "DRKS" */
+
+/* Bump when the layout below changes. */
+#define DR_STATS_VERSION 1
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    /* Offset from the header and size of the dr_statistics_t. */
+    unsigned long global_offset;
+    unsigned long global_size;
+    /* Offset from the header of CPU 0's counters. Each CPU's counters follow
+     * the previous CPU's, num_cpu_stats 8-byte values each.
+     */
+    unsigned long cpu_offset;
+    unsigned long num_cpu_stats;
+    unsigned long num_cpus;
+} dr_stats_header_t;
+
+#endif
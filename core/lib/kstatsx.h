@@ -57,6 +57,7 @@ KSTAT_DEF("total measured and propagated in thread", thread_measured)
 KSTAT_DEF("in bb building", bb_building)
 KSTAT_DEF("in bb decoding", bb_decoding) /* sub-node of bb_building */
 KSTAT_DEF("in emitting BB", bb_emit) /* sub-node of bb_building */
+KSTAT_DEF("waiting for another bb builder", bb_building_wait)
 KSTAT_DEF("in mangling", mangling)
 KSTAT_DEF("in emit", emit)
 KSTAT_DEF("in hotpatch lookup", hotp_lookup)
@@ -66,7 +67,10 @@ KSTAT_DEF("in trace monitor ", monitor_enter)
 KSTAT_DEF("in trace monitor, thci ", monitor_enter_thci)
 KSTAT_DEF("cache flush unit walk ", cache_flush_unit_walk)
 KSTAT_DEF("flush_region", flush_region)
+KSTAT_DEF("flush waiting for threads to synch", flush_synch)
+KSTAT_DEF("stalled waiting for a flusher", flush_stall)
 KSTAT_DEF("synchall flush ", synchall_flush)
+KSTAT_DEF("synch with all cpus via IPI", synch_with_all_cpus)
 KSTAT_DEF("coarse pclookup", coarse_pclookup)
 KSTAT_DEF("coarse freeze all", coarse_freeze_all)
 KSTAT_DEF("persisted cache generation", persisted_generation)
@@ -275,6 +275,9 @@
     STATS_DEF("Flush queue marked nonempty: relink shared_sys",
               num_flushq_relink_syscall)
     STATS_DEF("Flush queue marked nonempty, yet empty", num_flushq_actually_empty)
+    STATS_DEF("Flush -flush_nostall threads not stopped", num_flush_nostall_threads)
+    STATS_DEF("Flush -flush_nostall threads stopped at region", num_flush_nostall_waits)
+    STATS_DEF("IBT adds skipped during -flush_nostall flush", num_ibt_adds_skipped_flush)
     STATS_DEF("Fragments added to lazy deletion list", num_lazy_deletion_appends)
     STATS_DEF("Fragments freed from lazy deletion list at exit",
               num_lazy_deletion_frees_atexit)
@@ -283,6 +286,8 @@
     STATS_DEF("Lazy list fragments moved to pending list", num_lazy_del_frags_to_pending)
     STATS_DEF("Translation info computed", translations_computed)
     STATS_DEF("Fragments with translation info stored", num_fragment_translation_stored)
+    STATS_DEF("Translation info bytes", translation_info_bytes)
+    STATS_DEF("Peak translation info bytes", peak_translation_info_bytes)
     STATS_DEF("Resets of entire fcache, proactively", fcache_reset_proactively)
     STATS_DEF("Resets due to too many pending deletions", fcache_reset_pending_del)
     STATS_DEF("Resets aborted due to thread synch problems", fcache_reset_abort)
@@ -384,6 +389,8 @@
     STATS_DEF("Fragments tails generated b/c of iret", num_fragment_tails_iret)
 #endif
     RSTATS_DEF("Basic block fragments generated", num_bbs)
+    STATS_DEF("BB builds that waited for another builder", num_bb_build_waits)
+    STATS_DEF("BB builds avoided: built by another thread", num_bb_builds_deduped)
     RSTATS_DEF("Trace fragments generated", num_traces)
     STATS_DEF("Trace fragments aborted for any reason", num_aborted_traces)
     STATS_DEF("Trace fragments aborted: shared race", num_aborted_traces_race)
@@ -402,6 +409,12 @@
     STATS_DEF("Maximum number of bbs in a trace", max_bbs_in_a_trace)
     STATS_DEF("Traces truncated due to cache size limits", num_max_trace_size_enforced)
     STATS_DEF("Number of times max_trace_bbs was enforced", num_max_trace_bbs_enforced)
+#ifdef INTERNAL
+    STATS_DEF("Traces optimized", opt_traces)
+    STATS_DEF("Basic blocks optimized", opt_bbs)
+    STATS_DEF("Optimized instrs given the next instr's translation",
+              opt_translations_inherited)
+#endif
     STATS_DEF("Trace wannabes prevented from being traces", num_wannabe_traces)
     STATS_DEF("Trace head too large to be a trace", num_huge_fragments)
     STATS_DEF("Shared trace links shifted back to trace head", links_shared_trace_to_head)
@@ -458,7 +471,10 @@
     STATS_DEF("BBs that write no arithmetic flags", bbs_eflags_writes_none)
     STATS_DEF("BBs that write no arithmetic flags, end in ib", bbs_eflags_writes_none_ind)
     STATS_DEF("Cbrs sharing a single exit stub", num_cbr_single_stub)
+    STATS_DEF("Cold code runs moved past final exit", num_cold_runs_moved)
     STATS_DEF("Fragments requiring post_linkstub offs", num_fragment_post_linkstub)
+    STATS_DEF("Fragment and linkstub heap bytes", fragment_heap_bytes)
+    STATS_DEF("Peak fragment and linkstub heap bytes", peak_fragment_heap_bytes)
     STATS_DEF("Fragments smaller than minimum fcache slot size", num_fragment_too_small)
     STATS_DEF("Fragments final size < minimum fcache slot size", num_final_fragment_too_small)
     STATS_DEF("Fragments unlinked for flushing", num_flushed_fragments)
@@ -469,6 +485,8 @@
     STATS_DEF("Shared fragments deleted no-flush, race", shared_delete_noflush_race)
     STATS_DEF("Trace component fragments deleted", trace_components_deleted)
     STATS_DEF("Fragments deleted due to capacity conflicts", num_fragments_replaced)
+    STATS_DEF("Fragments spared a replacement by second chance",
+              num_fragments_second_chance)
     STATS_DEF("Fragments deleted on thread/process death", num_fragments_deleted_exit)
     STATS_DEF("Fragments deleted on thread/process reset", num_fragments_deleted_reset)
     STATS_DEF("Trace heads marked", num_trace_heads_marked)
@@ -508,6 +526,10 @@
               num_shared_tables_updated_atsyscall)
     STATS_DEF("IBT unlinked entries NOT moved on resize",
               num_ibt_unlinked_entries_not_moved)
+    STATS_DEF("Shared IBT adds under the read lock", num_ibt_concurrent_adds)
+    STATS_DEF("Shared IBT adds lost to a racing add", num_ibt_concurrent_add_races)
+    STATS_DEF("Shared IBT adds deferred to write lock",
+              num_ibt_concurrent_add_fallbacks)
     STATS_DEF("BB fragments in 3 IBL tables", num_bbs_in_3_ibl_tables)
     STATS_DEF("BB fragments in 2 IBL tables", num_bbs_in_2_ibl_tables)
     STATS_DEF("BB fragments in 1 IBL tables", num_bbs_in_1_ibl_tables)
@@ -664,6 +686,22 @@
     STATS_DEF("Persisted cache hotp nudge flush avoided", perscache_hotp_flush_avoided)
 #endif
     STATS_DEF("Persisted cache ibl entries prefilled", perscache_ibl_prefill)
+    STATS_DEF("Persisted cache pages crc-checked lazily", perscache_pages_checked)
+    STATS_DEF("Persisted cache page crc mismatches", perscache_page_crc_mismatch)
+#ifdef LINUX_KERNEL
+    STATS_DEF("Persisted kernel cache units written", perscache_kernel_units_written)
+    STATS_DEF("Persisted kernel cache bb tags written", perscache_kernel_tags_written)
+    STATS_DEF("Persisted kernel cache bb tags dropped: no space",
+              perscache_kernel_tags_dropped)
+    STATS_DEF("Persisted kernel cache bb tags rejected", perscache_kernel_tags_rejected)
+    STATS_DEF("Persisted kernel cache bb tags built by too few CPUs",
+              perscache_kernel_tags_cold)
+    STATS_DEF("Persisted kernel cache bbs prebuilt", perscache_kernel_bbs_prebuilt)
+    STATS_DEF("Dispatcher exits in each CPU's warmup window", num_warmup_exits)
+    STATS_DEF("BBs built on demand in each CPU's warmup window", num_warmup_bbs)
+    STATS_DEF("Max ms from takeover to a CPU's last bb build before steady state",
+              kernel_ms_to_steady_state)
+#endif
     STATS_DEF("Persisted cache stub unprot for link", pcache_unprot_link)
     STATS_DEF("Persisted cache stub unprot for unlink", pcache_unprot_unlink)
     STATS_DEF("Persisted cache stub writes over limit", pcache_unprot_over_limit)
@@ -752,6 +790,8 @@
     STATS_DEF("Fcache exits, self-replacement", num_exits_dir_self_replacement)
 #ifdef LINUX
     STATS_DEF("Fcache exits, signal delivery", num_exits_dir_signal)
+    STATS_DEF("Inline signal checks inserted", num_signal_checks_inserted)
+    STATS_DEF("Delayable signals left to inline checks", num_signals_inline_checked)
 #endif
     STATS_DEF("Fcache exits needing cbr disambiguation", cbr_disambiguations)
 
@@ -765,6 +805,8 @@
     STATS_DEF("Fcache trace peak used (bytes)", fcache_trace_peak)
     STATS_DEF("Fcache trace headers (bytes)", fcache_trace_headers)
     STATS_DEF("Fcache trace fragment bodies (bytes)", fcache_trace_bodies)
+    STATS_DEF("Fcache trace cold code after exits (bytes)", fcache_trace_cold)
+    STATS_DEF("Fcache trace hot path i-cache lines", fcache_trace_hot_lines)
     STATS_DEF("Fcache trace direct exit stubs (bytes)", fcache_trace_direct_stubs)
     STATS_DEF("Fcache trace indirect exit stubs (bytes)", fcache_trace_indirect_stubs)
     STATS_DEF("Fcache trace fragment prefixes (bytes)", fcache_trace_prefixes)
@@ -785,6 +827,8 @@
     STATS_DEF("Fcache bb peak used (bytes)", fcache_bb_peak)
     STATS_DEF("Fcache bb headers (bytes)", fcache_bb_headers)
     STATS_DEF("Fcache bb fragment bodies (bytes)", fcache_bb_bodies)
+    STATS_DEF("Fcache bb cold code after exits (bytes)", fcache_bb_cold)
+    STATS_DEF("Fcache bb hot path i-cache lines", fcache_bb_hot_lines)
     STATS_DEF("Fcache bb direct exit stubs (bytes)", fcache_bb_direct_stubs)
     STATS_DEF("Fcache bb indirect exit stubs (bytes)", fcache_bb_indirect_stubs)
     STATS_DEF("Fcache bb fragment prefixes (bytes)", fcache_bb_prefixes)
@@ -805,6 +849,8 @@
     STATS_DEF("Fcache shared bb peak used (bytes)", fcache_shared_bb_peak)
     STATS_DEF("Fcache shared bb headers (bytes)", fcache_shared_bb_headers)
     STATS_DEF("Fcache shared bb fragment bodies (bytes)", fcache_shared_bb_bodies)
+    STATS_DEF("Fcache shared bb cold code after exits (bytes)", fcache_shared_bb_cold)
+    STATS_DEF("Fcache shared bb hot path i-cache lines", fcache_shared_bb_hot_lines)
     STATS_DEF("Fcache shared bb direct exit stubs (bytes)", fcache_shared_bb_direct_stubs)
     STATS_DEF("Fcache shared bb indirect exit stubs (bytes)", fcache_shared_bb_indirect_stubs)
     STATS_DEF("Fcache shared bb fragment prefixes (bytes)", fcache_shared_bb_prefixes)
@@ -825,6 +871,8 @@
     STATS_DEF("Fcache shared trace peak used (bytes)", fcache_shared_trace_peak)
     STATS_DEF("Fcache shared trace headers (bytes)", fcache_shared_trace_headers)
     STATS_DEF("Fcache shared trace fragment bodies (bytes)", fcache_shared_trace_bodies)
+    STATS_DEF("Fcache shared trace cold code after exits (bytes)", fcache_shared_trace_cold)
+    STATS_DEF("Fcache shared trace hot path i-cache lines", fcache_shared_trace_hot_lines)
     STATS_DEF("Fcache shared trace direct exit stubs (bytes)", fcache_shared_trace_direct_stubs)
     STATS_DEF("Fcache shared trace indirect exit stubs (bytes)", fcache_shared_trace_indirect_stubs)
     STATS_DEF("Fcache shared trace fragment prefixes (bytes)", fcache_shared_trace_prefixes)
@@ -892,6 +940,8 @@
     STATS_DEF("Peak heap bucket pad space (bytes)", peak_heap_bucket_pad)
     STATS_DEF("Heap allocs in buckets", heap_allocs_buckets)
     STATS_DEF("Heap allocs variable-sized", heap_allocs_variable)
+    STATS_DEF("Heap magazine refills", heap_magazine_refills)
+    STATS_DEF("Heap magazine drains", heap_magazine_drains)
     STATS_DEF("Total reserved memory", reserved_memory_capacity)
     STATS_DEF("Peak total reserved memory", peak_reserved_memory_capacity)
     STATS_DEF("Guard pages, reserved virtual pages", guard_pages)
@@ -905,6 +955,8 @@
     STATS_DEF("Peak mmap capacity (bytes)", peak_mmap_capacity)
     STATS_DEF("Mmap reserved but not committed (bytes)", mmap_reserved_only)
     STATS_DEF("Peak mmap reserved but not committed (bytes)", peak_mmap_reserved_only)
+    STATS_DEF("Huge page mmaps", mmap_huge)
+    STATS_DEF("Huge page mmaps not backed by huge pages", mmap_huge_failed)
     STATS_DEF("Heap claimed (bytes)", heap_claimed)
     STATS_DEF("Peak heap claimed (bytes)", peak_heap_claimed)
     STATS_DEF("Heap capacity (bytes)", heap_capacity)
@@ -1091,6 +1143,8 @@
     STATS_DEF("Num synch yields for exiting threads", synch_yields_for_exiting_thread)
     STATS_DEF("Num synch yields", synch_yields)
     STATS_DEF("Num synch loops in wait_at_safe_spot", synch_loops_wait_safe)
+    STATS_DEF("Num synch-alls via IPI", synch_all_cpus)
+    STATS_DEF("Num CPUs acking synch-all IPIs", synch_all_cpus_acks)
     STATS_DEF("Multiple setcontexts while in wait_at_safe_spot", wait_multiple_setcxt)
 
 #ifdef WINDOWS
@@ -1117,6 +1171,10 @@
     STATS_DEF("Trace fragment ending with an IBL, syscall", num_traces_end_at_ibl_syscall)
     STATS_DEF("Trace fragment ending at MUST_END_TRACE", num_traces_at_must_end_trace)
     STATS_DEF("Trace fragment ending with an IBL, speculative", num_traces_end_at_ibl_speculative_link)
+    STATS_DEF("Trace last IB exit targets compared inline", num_speculated_ibl_targets)
+    STATS_DEF("Trace last IB exit targets not imm32, skipped",
+              num_speculated_ibl_targets_too_far)
+    STATS_DEF("IB targets recorded in speculation profile", num_ibl_profile_records)
     STATS_DEF("Yields in intercept_apc wait dynamo_initialized", apc_yields_while_initializing)
     STATS_DEF("IBL Tables groomed", num_ibt_groomed)
     STATS_DEF("IBL Tables reached maximum capacity", num_ibt_max_capacity)
@@ -395,6 +395,13 @@ linkstub_propagatable_flags(uint flags)
     return flags;
 }
 
+/* Only bbs of the dominant sharing type may omit the post_linkstub_t, as
+ * linkstub_fragment() has to assume their struct size.
+ */
+#define BB_NO_OFFS_SHARED() (DYNAMO_OPTION(shared_bbs))
+#define BB_NO_OFFS_STRUCT_SIZE() \
+    (BB_NO_OFFS_SHARED() ? sizeof(fragment_t) : sizeof(private_fragment_t))
+
 /* is a post_linkstub_t structure required to store the fragment_t offset? */
 bool
 linkstub_frag_offs_at_end(uint flags, int direct_exits, int indirect_exits)
@@ -405,14 +412,12 @@ linkstub_frag_offs_at_end(uint flags, int direct_exits, int indirect_exits)
      * 2) two direct exits
      * 3) coarse-grain, which of course have no fragment_t
      * see linkstub_fragment() for how we find their owning fragment_t's.
-     * Since we have to assume sizeof(fragment_t) we can only allow
-     * shared fragments to not have an offset, unless we add a LINK_SHARED
-     * flag, which we can do if we end up having a product config w/ private bbs.
-     * FIXME: make the sizeof calculation dynamic such that the dominant
-     * type of bb fragment is the one w/o the post_linkstub_t.
+     * Since we have to assume the struct size, only the dominant type of bb
+     * (shared w/ -shared_bbs, private otherwise, as in DRK's CPU-private
+     * caches) can go without an offset.
      */
     return !(!TEST(FRAG_IS_TRACE, flags) &&
-             TEST(FRAG_SHARED, flags) &&
+             TEST(FRAG_SHARED, flags) == BB_NO_OFFS_SHARED() &&
              /* We can't tell from the linkstub_t whether there is a
               * translation field.  FIXME: we could avoid this problem
               * by storing the translation field after the linkstubs.
@@ -520,7 +525,7 @@ linkstub_fragment(dcontext_t *dcontext, linkstub_t *l)
         if (LINKSTUB_INDIRECT(l->flags)) {
             /* Option 1: a single indirect exit */
             ASSERT(TEST(LINK_END_OF_LIST, l->flags));
-            return (fragment_t *) ( ((byte *)l) - sizeof(fragment_t) );
+            return (fragment_t *) ( ((byte *)l) - BB_NO_OFFS_STRUCT_SIZE() );
         } else {
             ASSERT(LINKSTUB_DIRECT(l->flags));
             /* Option 2: two direct exits (doesn't matter if 2nd uses
@@ -530,9 +535,9 @@ linkstub_fragment(dcontext_t *dcontext, linkstub_t *l)
              */
             if (TEST(LINK_END_OF_LIST, l->flags)) {
                 return (fragment_t *) ( ((byte *)l) - sizeof(direct_linkstub_t) -
-                                      sizeof(fragment_t) );
+                                      BB_NO_OFFS_STRUCT_SIZE() );
             } else {
-                return (fragment_t *) ( ((byte *)l) - sizeof(fragment_t) );
+                return (fragment_t *) ( ((byte *)l) - BB_NO_OFFS_STRUCT_SIZE() );
             }
         }
     }
@@ -1099,6 +1104,14 @@ bool
 is_linkable(dcontext_t *dcontext, fragment_t *from_f, linkstub_t *from_l, fragment_t *to_f,
             bool have_link_lock, bool mark_new_trace_head)
 {
+#ifdef INLINE_SIGNAL_CHECKS
+    /* A pending-signal check must always reach dispatch.  Its exit targets
+     * its own fragment's tag, which monitor_is_linkable() would take for a
+     * backward branch and mark as a trace head, so test it first.
+     */
+    if (TEST(LINK_SIGNAL_CHECK, from_l->flags))
+        return false;
+#endif
     /* monitor_is_linkable is what marks trace heads, so must
      * call it no matter the result
      */
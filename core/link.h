@@ -83,6 +83,11 @@ enum {
     LINK_SELFMOD_EXIT    = 0x0040,
 #ifdef UNSUPPORTED_API
     LINK_TARGET_PREFIX   = 0x0080,
+#elif defined(LINUX) && !defined(LINUX_KERNEL)
+    /* exit from an inline pending-signal check (-signal_checks_inline):
+     * never linked, so it always reaches dispatch
+     */
+    LINK_SIGNAL_CHECK    = 0x0080,
 #endif
 #ifdef X64
     /* PR 257963: since we don't store targets of ind branches, we need a flag
@@ -123,6 +128,11 @@ enum {
     /* WARNING: flags field is a ushort, so max flag is 0x8000! */
 };
 
+/* LINK_SIGNAL_CHECK borrows the bit of the UNSUPPORTED_API LINK_TARGET_PREFIX */
+#if defined(LINUX) && !defined(LINUX_KERNEL) && !defined(UNSUPPORTED_API)
+# define INLINE_SIGNAL_CHECKS
+#endif
+
 #ifdef LINUX
 # define LINK_NI_SYSCALL_ALL (LINK_NI_SYSCALL | LINK_NI_SYSCALL_INT)
 #else
@@ -149,7 +159,8 @@ enum {
  *   post_linkstub_t
  *   
  * There are three types of specially-supported basic blocks that
- * have no post_linkstub_t:
+ * have no post_linkstub_t, where fragment_t is private_fragment_t instead
+ * under -no_shared_bbs (see linkstub_frag_offs_at_end()):
  *   
  *   fragment_t
  *   indirect_linkstub_t
@@ -2064,6 +2064,23 @@ os_heap_get_commit_limit(size_t *commit_used, size_t *commit_limit)
     return false;
 }
 
+#ifndef MADV_HUGEPAGE
+# define MADV_HUGEPAGE 14 /* not in older headers */
+#endif
+
+/* Returns false if the kernel has no transparent huge page support.  The
+ * advice sticks to the mapping across later mprotects, so it can be given
+ * for reserved-only memory.
+ */
+bool
+os_heap_advise_huge(void *p, size_t size)
+{
+    long res = dynamorio_syscall(SYS_madvise, 3, p, size, MADV_HUGEPAGE);
+    LOG(GLOBAL, LOG_HEAP, 2, "os_heap_advise_huge: %d bytes @ "PFX" => %d\n",
+        size, p, res);
+    return res == 0;
+}
+
 /* yield the current thread */
 void
 thread_yield()
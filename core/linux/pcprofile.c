@@ -102,6 +102,7 @@ static pc_profile_entry_t *pcprofile_add_entry(thread_pc_info_t *info, void *pc,
 static pc_profile_entry_t *pcprofile_lookup(thread_pc_info_t *info, void *pc);
 static void pcprofile_reset(thread_pc_info_t *info);
 static void pcprofile_results(thread_pc_info_t *info);
+static void pcprofile_folded_results(thread_pc_info_t *info);
 static void pcprofile_alarm(dcontext_t *dcontext, dr_mcontext_t *mcontext);
 
 /* initialization */
@@ -161,6 +162,7 @@ pcprofile_thread_exit(dcontext_t *dcontext)
     set_itimer_callback(dcontext, ITIMER_VIRTUAL, 0, NULL);
 
     pcprofile_results(info);
+    pcprofile_folded_results(info);
     size = HASHTABLE_SIZE(HASH_BITS) * sizeof(pc_profile_entry_t*);
     pcprofile_reset(info); /* special heap so no fast path */
 #ifdef DEBUG
@@ -578,3 +580,59 @@ pcprofile_results(thread_pc_info_t *info)
         }
     }    
 }
+
+/* Prints the samples as folded stacks for flamegraph tools: one line per
+ * distinct stack, frames separated by ';', then the count. The root frame
+ * names the component that was running, matching the names the kernel
+ * controller's "pcprofile" command uses; fragment samples are charged to
+ * the fragment's tag and DR samples to the DR routine type.
+ */
+static void
+pcprofile_folded_results(thread_pc_info_t *info)
+{
+    int i;
+    pc_profile_entry_t *e;
+    file_t file = open_log_file("pcsamples.folded", NULL, 0);
+    if (file == INVALID_FILE)
+        return;
+    for (i = 0; i < HASHTABLE_SIZE(HASH_BITS); i++) {
+        for (e = info->htable[i]; e != NULL; e = e->next) {
+            switch (e->whereami) {
+            case WHERE_APP:
+                print_file(file, "user;"PFX" %d\n", e->pc, e->counter);
+                break;
+            case WHERE_FCACHE:
+                print_file(file, "%s;"PFX" %d\n", e->trace ? "trace" : "bb",
+                           e->tag, e->counter);
+                break;
+            case WHERE_IBL:
+                print_file(file, "ibl %d\n", e->counter);
+                break;
+            case WHERE_CONTEXT_SWITCH:
+                print_file(file, "context_switch %d\n", e->counter);
+                break;
+            case WHERE_INTERP:
+                print_file(file, "dynamorio;interp %d\n", e->counter);
+                break;
+            case WHERE_DISPATCH:
+                print_file(file, "dynamorio;dispatch %d\n", e->counter);
+                break;
+            case WHERE_MONITOR:
+                print_file(file, "dynamorio;monitor %d\n", e->counter);
+                break;
+            case WHERE_SYSCALL_HANDLER:
+                print_file(file, "dynamorio;syscall_handler %d\n", e->counter);
+                break;
+            case WHERE_SIGNAL_HANDLER:
+                print_file(file, "dynamorio;signal_handler %d\n", e->counter);
+                break;
+            default:
+                print_file(file, "%s;"PFX" %d\n",
+                           is_dynamo_address(e->pc) ? "dynamorio" : "unknown",
+                           e->pc, e->counter);
+                break;
+            }
+        }
+    }
+    os_close(file);
+}
@@ -3037,7 +3037,19 @@ record_pending_signal(dcontext_t *dcontext, int sig, kernel_ucontext_t *ucxt,
                 receive_now = true;
                 LOG(THREAD, LOG_ASYNCH, 2,
                     "signal interrupted pre or post syscall itself so delivering now\n");
-            } else {
+            }
+#ifdef INLINE_SIGNAL_CHECKS
+            else if (DYNAMO_OPTION(signal_checks_inline) &&
+                     !TESTANY(FRAG_COARSE_GRAIN|FRAG_HAS_SYSCALL, f->flags)) {
+                /* Every entry into f's successors checks signals_pending,
+                 * which is set below, so there's nothing to unlink.  A
+                 * syscall in f could block, though, so those still unlink.
+                 */
+                LOG(THREAD, LOG_ASYNCH, 2, "\tleaving it to the inline checks\n");
+                STATS_INC(num_signals_inline_checked);
+            }
+#endif
+            else {
                 /* could get another signal but should be in same fragment */
                 ASSERT(info->interrupted == NULL || info->interrupted == f);
                 if (unlink_fragment_for_signal(dcontext, f, pc)) {
@@ -392,10 +392,115 @@ monitor_thread_exit(dcontext_t *dcontext)
                      md->thead_table.capacity*sizeof(trace_head_counter_t*)
                      HEAPACCT(ACCT_THCOUNTER));
     }
+    if (md->ibl_profile != NULL) {
+        heap_free(dcontext, md->ibl_profile,
+                  HASHTABLE_SIZE(IBL_PROFILE_BITS)*sizeof(ibl_profile_entry_t)
+                  HEAPACCT(ACCT_TRACE));
+    }
     heap_free(dcontext, md, sizeof(monitor_data_t) HEAPACCT(ACCT_TRACE));
 #endif
 }
 
+static inline ibl_profile_entry_t *
+ibl_profile_entry(monitor_data_t *md, app_pc src_tag)
+{
+    /* bb tags are spread enough that the low bits make a fine index */
+    return &md->ibl_profile[(ptr_uint_t)src_tag & HASH_MASK(IBL_PROFILE_BITS)];
+}
+
+/* We only sample while building a trace, when every indirect branch taken
+ * leaves the cache.  An IBL miss otherwise happens about once per target,
+ * before the target lands in the IBT table, so counting misses would rank
+ * targets by first touch rather than by how often they are taken.  Trace
+ * building instead follows the hot paths, so the samples it sees are spread
+ * like the hits.
+ */
+void
+monitor_profile_ibl_target(dcontext_t *dcontext, fragment_t *last_f,
+                           linkstub_t *last_l, app_pc target)
+{
+    monitor_data_t *md = (monitor_data_t *) dcontext->monitor_field;
+    ibl_profile_entry_t *e;
+    uint i;
+
+    ASSERT(DYNAMO_OPTION(speculate_last_exit));
+    if (md->trace_tag == NULL)
+        return;
+    /* Trace exits would need the component bb tag; a trace's blocks were
+     * profiled as bbs before the trace was built.
+     */
+    if (LINKSTUB_FAKE(last_l) || TEST(FRAG_IS_TRACE, last_f->flags))
+        return;
+    if (md->ibl_profile == NULL) {
+        md->ibl_profile = (ibl_profile_entry_t *)
+            heap_alloc(dcontext, HASHTABLE_SIZE(IBL_PROFILE_BITS)*
+                       sizeof(ibl_profile_entry_t) HEAPACCT(ACCT_TRACE));
+        memset(md->ibl_profile, 0,
+               HASHTABLE_SIZE(IBL_PROFILE_BITS)*sizeof(ibl_profile_entry_t));
+    }
+    e = ibl_profile_entry(md, last_f->tag);
+    if (e->src_tag != last_f->tag) {
+        memset(e, 0, sizeof(*e));
+        e->src_tag = last_f->tag;
+    }
+    STATS_INC(num_ibl_profile_records);
+    for (i = 0; i < IBL_PROFILE_TARGETS; i++) {
+        if (e->targets[i] == target || e->targets[i] == NULL) {
+            e->targets[i] = target;
+            e->counts[i]++;
+            return;
+        }
+    }
+    e->other++;
+}
+
+/* Fills targets with up to max_targets of the most frequent profiled targets
+ * of the indirect branch ending block src_tag, always starting with
+ * next_tag, the target seen while building the trace.
+ */
+static uint
+ibl_profile_speculate_targets(dcontext_t *dcontext, app_pc src_tag, app_pc next_tag,
+                              app_pc *targets, uint max_targets)
+{
+    monitor_data_t *md = (monitor_data_t *) dcontext->monitor_field;
+    ibl_profile_entry_t *e;
+    uint num = 0, total, i, j;
+
+    ASSERT(max_targets > 0);
+    targets[num++] = next_tag;
+    if (md->ibl_profile == NULL)
+        return num;
+    e = ibl_profile_entry(md, src_tag);
+    if (e->src_tag != src_tag)
+        return num;
+    total = e->other;
+    for (i = 0; i < IBL_PROFILE_TARGETS; i++)
+        total += e->counts[i];
+    while (num < max_targets) {
+        uint best = IBL_PROFILE_TARGETS;
+        for (i = 0; i < IBL_PROFILE_TARGETS; i++) {
+            bool taken = false;
+            if (e->targets[i] == NULL)
+                continue;
+            for (j = 0; j < num; j++) {
+                if (targets[j] == e->targets[i])
+                    taken = true;
+            }
+            if (!taken && (best == IBL_PROFILE_TARGETS ||
+                           e->counts[i] > e->counts[best]))
+                best = i;
+        }
+        if (best == IBL_PROFILE_TARGETS ||
+            e->counts[best] * 100 < total * INTERNAL_OPTION(speculate_ibl_min_share))
+            break;
+        targets[num++] = e->targets[best];
+    }
+    LOG(THREAD, LOG_MONITOR, 3,
+        "ibl profile for "PFX": %u targets inlined, %u profiled exits\n",
+        src_tag, num, total);
+    return num;
+}
+
 static trace_head_counter_t *
 thcounter_lookup(dcontext_t *dcontext, app_pc tag)
 {
@@ -1330,15 +1435,29 @@ end_and_emit_trace(dcontext_t *dcontext, fragment_t *cur_f)
                 ASSERT_CURIOSITY(dcontext->next_tag != NULL);
                 if (DYNAMO_OPTION(speculate_last_exit)) {
                     app_pc speculate_next_tag = dcontext->next_tag;
+#ifdef X64
+                    app_pc targets[IBL_PROFILE_TARGETS];
+                    uint num_targets;
+#endif
 #ifdef SPECULATE_LAST_EXIT_STUDY 
                     /* for a performance study: add overhead on
                      * all IBLs that never hit by comparing to a 0xbad tag */
                     speculate_next_tag = 0xbad;
 #endif
+#ifdef X64
+                    num_targets = ibl_profile_speculate_targets
+                        (dcontext, cur_f->tag, speculate_next_tag, targets,
+                         MIN(IBL_PROFILE_TARGETS,
+                             MAX(1, DYNAMO_OPTION(speculate_ibl_targets))));
+                    md->emitted_size +=
+                        append_trace_speculate_ibl_targets(dcontext, trace, targets,
+                                                           num_targets, false);
+#else
                     md->emitted_size += 
                         append_trace_speculate_last_ibl(dcontext, trace, 
                                                         speculate_next_tag, 
                                                         false);
+#endif
                 } else {
 #ifdef HASHTABLE_STATISTICS
                     ASSERT(INTERNAL_OPTION(stay_on_trace_stats) || 
@@ -97,6 +97,15 @@ void trace_abort(dcontext_t *dcontext);
 void
 thcounter_range_remove(dcontext_t *dcontext, app_pc start, app_pc end);
 
+/* Records that the indirect branch ending last_f went to target, for
+ * choosing the targets inlined at a trace's last indirect exit with
+ * -speculate_last_exit.  Only exits taken while building a trace are
+ * recorded.
+ */
+void
+monitor_profile_ibl_target(dcontext_t *dcontext, fragment_t *last_f,
+                           linkstub_t *last_l, app_pc target);
+
 /* trace head counters are thread-private and must be kept in a
  * separate table and not in the fragment_t structure.
  * FIXME: may want to do this for non-shared-cache, since persistent counters
@@ -125,6 +134,19 @@ typedef struct _trace_head_table_t {
     uint  resize_threshold;    /*  = capacity * load_factor */
 } trace_head_table_t;
 
+/* Per-thread profile of the targets seen by one indirect branch, kept in a
+ * small direct-mapped table indexed by the tag of the block the branch ends.
+ * A colliding block simply takes over the slot: the profile is only a hint.
+ */
+#define IBL_PROFILE_TARGETS 4
+#define IBL_PROFILE_BITS    8
+typedef struct _ibl_profile_entry_t {
+    app_pc src_tag;
+    app_pc targets[IBL_PROFILE_TARGETS];
+    uint   counts[IBL_PROFILE_TARGETS];
+    uint   other;  /* targets that didn't fit */
+} ibl_profile_entry_t;
+
 typedef struct _trace_bb_build_t {
     trace_bb_info_t info;
     /* PR 299808: we need to check bb bounds at emit time.  Also used
@@ -164,6 +186,9 @@ typedef struct _monitor_data_t {
     /* FIXME: use new generic_table_t and generic_hash_* routines */
     trace_head_table_t thead_table;
 
+    /* -speculate_last_exit target profile, allocated on first use */
+    ibl_profile_entry_t *ibl_profile;
+
 #ifdef CLIENT_INTERFACE
     /* PR 299808: we re-build each bb and pass to the client */
     instrlist_t    unmangled_ilist;
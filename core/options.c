@@ -1782,7 +1782,7 @@ check_option_compatibility_helper(int recurse_count)
             dynamo_options.indirect_stubs = true;
             changed_options = true;
         }
-        if (INTERNAL_OPTION(store_translations)) {
+        if (DYNAMO_OPTION(store_translations)) {
             /* FIXME case 9707: NYI */
             USAGE_ERROR("case 9707: -coarse_units does not support -store_translations, "
                         "disabling");
@@ -300,6 +300,11 @@
 
 #if defined(LINUX)
     OPTION_NAME_INTERNAL(bool, profile_pcs, "prof_pcs", "pc-sampling profiling")
+# ifdef LINUX_KERNEL
+    /* 0xef is LOCAL_TIMER_VECTOR */
+    OPTION_DEFAULT_INTERNAL(uint, prof_pcs_vector, 0xef,
+        "interrupt vector whose arrivals -prof_pcs samples")
+# endif
 #else
 # ifdef WINDOWS_PC_SAMPLE
      OPTION_NAME(bool, profile_pcs, "prof_pcs", "pc-sampling profiling")
@@ -538,6 +543,18 @@
 
     /* PR 304708: we intercept all signals for a better client interface */
     OPTION_DEFAULT(bool, intercept_all_signals, true, "intercept all signals")
+
+# ifndef LINUX_KERNEL
+    /* Rather than unlinking the interrupted fragment to get a delayable signal
+     * to dispatch, every bb (and every block of a trace) starts with a check
+     * of dcontext->signals_pending that exits to dispatch.  Saves the
+     * unlink/relink on every signal for apps with high-rate timers.
+     * Traces built by decode_fragment() from bbs' cache code keep each
+     * block's check; mangle_trace() adds them for client-modified traces.
+     */
+    OPTION_DEFAULT(bool, signal_checks_inline, false,
+                   "check for pending signals inline at bb entry instead of unlinking")
+# endif
 #endif /* LINUX */
 
     /* Disable diagnostics by default. -security turns it on */
@@ -678,6 +695,8 @@
 
     OPTION_DEFAULT(bool, shared_deletion, true, "enable shared fragment deletion")
     OPTION_DEFAULT(bool, syscalls_synch_flush, true, "syscalls are flush synch points (currently for shared_deletion only)")
+    OPTION_DEFAULT(bool, flush_nostall, false,
+        "region flushes stop only threads that reach the region (needs shared_deletion and no bb elision)")
     OPTION_DEFAULT(uint, lazy_deletion_max_pending, 128,
         "maximum size of lazy shared deletion list before moving to normal list")
 
@@ -715,6 +734,14 @@
     OPTION_DEFAULT_INTERNAL(bool, cbr_single_stub, true,
         "both sides of a cbr share a single stub")
 
+#ifdef CLIENT_INTERFACE
+    /* Client code marked with instr_set_cold() goes after a fragment's final
+     * exit, next to its inline stubs, so the hot path stays dense.
+     */
+    OPTION_DEFAULT(bool, move_cold_code, false,
+        "lay out client code marked cold after a fragment's exits")
+#endif
+
     /* PR 210990: Improvement is in the noise for spec2k on P4, but is noticeable on
      * Core2, and on IIS on P4.  Note that this gets disabled if
      * coarse_units is on (PR 213262 covers supporting it there).
@@ -753,6 +780,12 @@
     OPTION_DEFAULT(bool, ref_count_shared_ibt_tables, true,
         "use ref-counting to free thread-shared IBT tables prior to process exit")
 
+    /* Lets IBL misses on different targets fill a thread-shared IBT table in
+     * parallel; only a resize or groom still takes the table's write lock.
+     */
+    OPTION_DEFAULT_INTERNAL(bool, concurrent_ibt_add, true,
+        "add targets to thread-shared IBT tables while holding only the read lock")
+
     /* PR 361894: if no TLS available, we fall back to thread-private */
     OPTION_DEFAULT(bool, ibl_table_in_tls, IF_HAVE_TLS_ELSE(true, false),
         "use TLS to hold IBL table addresses & masks")
@@ -812,6 +845,11 @@
                    "share ibl routine for traces")
     OPTION_DEFAULT(bool, speculate_last_exit, false, 
         "enable speculative linking of trace last IB exit")
+    /* x64 only: 32-bit still inlines just the target seen at trace creation */
+    OPTION_DEFAULT(uint, speculate_ibl_targets, 2,
+        "max profiled targets compared inline at a trace's last IB exit")
+    OPTION_DEFAULT_INTERNAL(uint, speculate_ibl_min_share, 10,
+        "min percent of a branch's profiled exits for a target to be inlined")
 
     OPTION_DEFAULT(uint, max_trace_bbs, 128, "maximum number of basic blocks in a trace")
 
@@ -953,7 +991,23 @@
     OPTION_DEFAULT_INTERNAL(uint_size, initial_global_heap_unit_size, 32*1024, "initial global heap unit size")
     OPTION_DEFAULT_INTERNAL(uint_size, max_heap_unit_size, 64*1024, "maximum heap unit size")
     OPTION_DEFAULT(uint_size, heap_commit_increment, 4*1024, "heap commit increment")
+    /* Each thread caches up to this many free blocks of each fixed size from
+     * the global heap, refilling and draining half of them at a time under
+     * the global heap lock.
+     */
+    OPTION_DEFAULT(uint, heap_magazine_size, 32,
+                   "free global heap blocks per size cached by each thread (0 = off)")
     OPTION_DEFAULT(uint, cache_commit_increment, 4*1024, "cache commit increment")
+#if defined(LINUX) && !defined(LINUX_KERNEL)
+    /* Each new fcache unit is a whole 2MB transparent huge page, committed up
+     * front, so hot code takes a handful of iTLB entries.  Traces and bbs
+     * live in separate caches, so hot traces don't share pages with cold bbs.
+     */
+    OPTION_DEFAULT(bool, cache_huge_pages, false,
+                   "allocate fcache units as 2MB huge pages")
+    OPTION_DEFAULT(bool, heap_huge_pages, false,
+                   "back the vmm heap reservation with transparent huge pages")
+#endif
 
     /* cache capacity control
      * FIXME: these are external for now while we study the right way to
@@ -1121,6 +1175,9 @@
         }
     }, "always sandbox non-text writable regions", STATIC, OP_PCACHE_GLOBAL)
 
+    OPTION_DEFAULT(bool, cache_second_chance, false,
+        "spare recently used fragments one FIFO pass before replacing them (private caches)")
+
     /* FIXME: separate for bb and trace shared caches? */
     OPTION_DEFAULT(bool, cache_shared_free_list, true,
         "use size-separated free lists to manage empty shared cache slots")
@@ -1731,7 +1788,12 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
     /* FIXME: off by default until dll load perf issues are solved: case 3559 */
     OPTION_DEFAULT_INTERNAL(bool, safe_translate_flushed, false,
         "store info at flush time for safe post-flush translation")
-    PC_OPTION_INTERNAL(bool, store_translations,
+    /* Translating a cache pc then needs no re-decode of app or cache code:
+     * worth it when faults, signals or (for DRK) interrupts land in the cache
+     * often.  Costs an entry (16 bytes on x64) per change in translation
+     * stride or in our spill state.
+     */
+    PC_OPTION(bool, store_translations,
         "store info at emit time for fragment translation")
 
      /* case 8812 - owner validation possible only on Win32 */
@@ -1833,12 +1895,17 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
                    "keep persisted file handle open to prevent writes/deletes")
     /* FIXME: could make PC_ to coexist for separate values */
     /* PR 215036: linux does not support PERSCACHE_MODULE_MD5_AT_LOAD */
-    OPTION_DEFAULT(uint, persist_gen_validation, IF_WINDOWS_ELSE(0x1d,0xd),
+    OPTION_DEFAULT(uint, persist_gen_validation, IF_WINDOWS_ELSE(0x3d,0x2d),
                    /* PERSCACHE_MODULE_MD5_SHORT | PERSCACHE_MODULE_MD5_AT_LOAD |
-                      PERSCACHE_GENFILE_MD5_{SHORT,COMPLETE} */
+                      PERSCACHE_GENFILE_MD5_{SHORT,COMPLETE} |
+                      PERSCACHE_CACHE_PAGE_CRC */
         "controls md5 values that we store when we persist")
-    OPTION_DEFAULT(uint, persist_load_validation, 0x5,
-                   /* PERSCACHE_MODULE_MD5_SHORT | PERSCACHE_GENFILE_MD5_SHORT */
+    /* PERSCACHE_CACHE_PAGE_CRC checks each cache page on first lookup instead
+     * of at load time, so it is a cheap alternative to PERSCACHE_GENFILE_MD5_COMPLETE
+     */
+    OPTION_DEFAULT(uint, persist_load_validation, 0x25,
+                   /* PERSCACHE_MODULE_MD5_SHORT | PERSCACHE_GENFILE_MD5_SHORT |
+                      PERSCACHE_CACHE_PAGE_CRC */
         "controls which md5 values we check when we load a persisted file; must "
         "be a subset of -persist_gen_validation, else we won't load anything")
     /* Size of short checksum of file header and footer for PERSCACHE_MODULE_MD5_SHORT.
@@ -2497,6 +2564,9 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
     OPTIMIZE_OPTION(bool, call_return_matching)
     OPTIMIZE_OPTION(bool, remove_unnecessary_zeroing) // FIXME: unnecessarily long option
     OPTIMIZE_OPTION(bool, peephole)
+    /* not itself an optimization: selects where the ones above run */
+    OPTION_DEFAULT(bool, optimize_bbs, false,
+        "also run the bb-safe optimizations on basic blocks")
 # undef OPTIMIZE_OPTION
 #endif /* EXPOSE_INTERNAL_OPTIONS */
 #ifdef HOT_PATCHING_INTERFACE
@@ -2643,6 +2713,17 @@ IF_RCT_IND_BRANCH(options->rct_ind_jump = OPTION_DISABLED;)
 #ifdef LINUX_KERNEL
     OPTION_DEFAULT(bool, optimize_sys_call_ret, true,
                    "optimize syscall and sysret to avoid dispatch")
+    OPTION_DEFAULT(bool, kernel_use_persisted, true,
+                   "prebuild the bbs of a persisted kernel cache, if one is supplied")
+    OPTION_DEFAULT(bool, kernel_persist_trust_reloc, false,
+                   "use persisted bbs of a module loaded at a new base, whose text "
+                   "digest cannot match, if its name and text size match and each "
+                   "bb still decodes")
+    OPTION_DEFAULT(uint, kernel_persist_min_cpus, 1,
+                   "only prebuild persisted bbs that at least this many CPUs built")
+    OPTION_DEFAULT(uint, kernel_warmup_ms, 1000,
+                   "window after each CPU's takeover in which dispatcher exits are "
+                   "counted, and the bb-build-free time that marks its steady state")
 #endif
 
 #undef OPTION
@@ -73,6 +73,13 @@ void os_heap_exit(void);
  */
 void os_warm_fcache(dcontext_t* dcontext);
 
+#ifdef LINUX_KERNEL
+/* Called on each dispatcher exit to measure how long a CPU takes to warm up.
+ * built_bb says whether the exit built a bb on demand.
+ */
+void os_note_dispatch_exit(dcontext_t *dcontext, bool built_bb);
+#endif
+
 void os_fragment_thread_reset_free(dcontext_t *dcontext);
 
 /* os provided heap routines */
@@ -126,6 +133,11 @@ bool os_heap_systemwide_overcommit(heap_error_code_t last_error_code);
 
 bool os_heap_get_commit_limit(size_t *commit_used, size_t *commit_limit);
 
+#if defined(LINUX) && !defined(LINUX_KERNEL)
+/* asks the kernel to back [p, p+size) with transparent huge pages */
+bool os_heap_advise_huge(void *p, size_t size);
+#endif
+
 thread_id_t get_thread_id(void);
 process_id_t get_process_id(void);
 void thread_yield(void);
@@ -49,6 +49,9 @@
 #include "module_shared.h"
 #include "string_wrapper.h"  /* for memset */
 #include <stddef.h> /* for offsetof */
+#ifdef LINUX_KERNEL
+# include "kernel_interface.h"
+#endif
 
 #ifdef DEBUG
 # include "disassemble.h"
@@ -82,12 +85,27 @@ static void
 coarse_unit_merge_persist_info(dcontext_t *dcontext, coarse_info_t *dst,
                                coarse_info_t *info1, coarse_info_t *info2);
 
+static bool
+coarse_unit_check_all_cache_pages(dcontext_t *dcontext, coarse_info_t *info);
+
 #ifdef DEBUG
 /* used below for pcache_dir_check_permissions() */
 DECLARE_CXTSWPROT_VAR(static mutex_t pcache_dir_check_lock,
                       INIT_LOCK_FREE(pcache_dir_check_lock));
 #endif
 
+#ifdef LINUX_KERNEL
+/* protects the tags gathered by kernel_persist_thread_exit() */
+DECLARE_CXTSWPROT_VAR(static mutex_t kernel_persist_lock,
+                      INIT_LOCK_FREE(kernel_persist_lock));
+
+static void
+kernel_persist_load(void);
+
+static void
+kernel_persist_write(void);
+#endif
+
 /***************************************************************************
  * COARSE-GRAIN UNITS
  */
@@ -290,6 +308,12 @@ coarse_unit_reset_free_internal(dcontext_t *dcontext, coarse_info_t *info,
             if (info->rac_table != NULL)
                 rct_table_free(GLOBAL_DCONTEXT, info->rac_table, false/*data mmapped*/);
 #endif
+            if (info->cache_page_checked != NULL) {
+                HEAP_ARRAY_FREE(GLOBAL_DCONTEXT, info->cache_page_checked,
+                                bitmap_element_t,
+                                BITMAP_INDEX(info->cache_page_crc_num) + 1,
+                                ACCT_VMAREAS, PROTECTED);
+            }
             ASSERT(info->mmap_pc != NULL);
             if (info->mmap_ro_size > 0) {
                 /* two views */
@@ -370,6 +394,9 @@ static file_t perscache_user_directory = INVALID_FILE;
 void
 perscache_init(void)
 {
+#ifdef LINUX_KERNEL
+    kernel_persist_load();
+#endif
     if (DYNAMO_OPTION(use_persisted) && 
         DYNAMO_OPTION(persist_per_user) &&
         DYNAMO_OPTION(validate_owner_dir)) {
@@ -422,6 +449,9 @@ perscache_fast_exit(void)
     if (DYNAMO_OPTION(coarse_freeze_at_exit)) {
         coarse_units_freeze_all(false/*!in place*/);
     }
+#ifdef LINUX_KERNEL
+    kernel_persist_write();
+#endif
 
     if (perscache_user_directory != INVALID_FILE) {
         ASSERT_CURIOSITY(DYNAMO_OPTION(validate_owner_dir));
@@ -435,6 +465,9 @@ void
 perscache_slow_exit(void)
 {
     DODEBUG(DELETE_LOCK(pcache_dir_check_lock););
+#ifdef LINUX_KERNEL
+    DELETE_LOCK(kernel_persist_lock);
+#endif
 }
 
 /***************************************************************************
@@ -1796,6 +1829,10 @@ coarse_unit_merge(dcontext_t *dcontext, coarse_info_t *info1, coarse_info_t *inf
         return NULL;
     /* Currently we only do online merging where one unit is live */
     ASSERT(!info1->persisted || !info2->persisted);
+    /* We copy every fragment, so a lazily-validated unit must be checked in full */
+    if (!coarse_unit_check_all_cache_pages(dcontext, info1) ||
+        !coarse_unit_check_all_cache_pages(dcontext, info2))
+        return NULL;
 
     /* Much more efficient to merge smaller cache into larger */
     if (fragment_coarse_num_entries(info1) > fragment_coarse_num_entries(info2)) {
@@ -2340,8 +2377,11 @@ persist_calculate_module_digest(module_digest_t *digest, app_pc modbase, size_t
     size_t view_size = modsize;
     if (TESTANY(PERSCACHE_MODULE_MD5_COMPLETE|PERSCACHE_MODULE_MD5_SHORT,
                 validation_option)) {
-        /* case 9717: need view size, not image size */
-        view_size = os_module_get_view_size(modbase);
+        /* case 9717: need view size, not image size.
+         * Kernel text units are not on the module list, and the caller
+         * passes the unit's text as the whole module.
+         */
+        view_size = IF_LINUX_KERNEL_ELSE(modsize, os_module_get_view_size(modbase));
     }
     if (TEST(PERSCACHE_MODULE_MD5_COMPLETE, validation_option)) {
         /* We can't use a full md5 from module_calculate_digest() since .data
@@ -2816,6 +2856,33 @@ pad_persist_file(dcontext_t *dcontext, file_t fd, size_t bytes, coarse_info_t *i
     return true;
 }
 
+/* Writes the PERSCACHE_CACHE_PAGE_CRC section: the crc32 of each page of
+ * the cache, counted from cache_start_pc so that the pages line up with the
+ * page-aligned cache in the file.
+ */
+static bool
+write_persist_cache_page_crcs(dcontext_t *dcontext, file_t fd, coarse_info_t *info,
+                              size_t crc_len)
+{
+    uint crc[64];
+    uint num = 0;
+    size_t written = 0;
+    cache_pc pc;
+    for (pc = info->cache_start_pc; pc < info->fcache_return_prefix; pc += PAGE_SIZE) {
+        size_t len = MIN(PAGE_SIZE, info->fcache_return_prefix - pc);
+        crc[num++] = crc32((const char *) pc, (uint) len);
+        if (num == BUFFER_SIZE_ELEMENTS(crc) ||
+            pc + PAGE_SIZE >= info->fcache_return_prefix) {
+            if (!write_persist_file(dcontext, fd, crc, num * sizeof(uint)))
+                return false; /* logs, stats are in write_persist_file */
+            written += num * sizeof(uint);
+            num = 0;
+        }
+    }
+    ASSERT(written == crc_len);
+    return true;
+}
+
 /* Fills in pers with data from info */
 static void
 coarse_unit_set_persist_data(dcontext_t *dcontext, coarse_info_t *info,
@@ -2938,6 +3005,13 @@ coarse_unit_set_persist_data(dcontext_t *dcontext, coarse_info_t *info,
 
     /* Add new data section here */
 
+    if (TEST(PERSCACHE_CACHE_PAGE_CRC, DYNAMO_OPTION(persist_gen_validation))) {
+        pers->cache_page_crc_len = sizeof(uint) *
+            (ALIGN_FORWARD(pers->cache_len, PAGE_SIZE) / PAGE_SIZE);
+    } else
+        pers->cache_page_crc_len = 0;
+    x_offs += pers->cache_page_crc_len;
+
     pers->option_string_len = option_string == NULL ? 0 :
         (ALIGN_FORWARD((strlen(option_string)+1/*include NULL*/)*sizeof(char),
                        OPTION_STRING_ALIGNMENT));
@@ -3185,6 +3259,11 @@ coarse_unit_persist(dcontext_t *dcontext, coarse_info_t *info)
 
     /* New data section goes here */
 
+    if (pers.cache_page_crc_len > 0) {
+        if (!write_persist_cache_page_crcs(dcontext, fd, info, pers.cache_page_crc_len))
+            goto coarse_unit_persist_exit;
+    }
+
 #ifdef HOT_PATCHING_INTERFACE
     if (pers.hotp_patch_list_len > 0) {
         if (!write_persist_file(dcontext, fd, info->hotp_ppoint_vec,
@@ -3651,6 +3730,18 @@ coarse_unit_load(dcontext_t *dcontext, app_pc start, app_pc end,
         }
     }
 
+    /* The cache itself is checked lazily, a page at a time, by
+     * coarse_unit_check_cache_page(); here we only require the crcs to be there.
+     */
+    if (TEST(PERSCACHE_CACHE_PAGE_CRC, DYNAMO_OPTION(persist_load_validation)) &&
+        (offsetof(coarse_persisted_info_t, cache_page_crc_len) >= pers->header_len ||
+         pers->cache_page_crc_len != sizeof(uint) *
+         (ALIGN_FORWARD(pers->cache_len, PAGE_SIZE) / PAGE_SIZE))) {
+        LOG(THREAD, LOG_CACHE, 1, "  no cache page crcs in %s\n", filename);
+        STATS_INC(perscache_md5_mismatch);
+        goto coarse_unit_load_exit;
+    }
+
     /* Consistency with original module */
     persist_calculate_module_digest(&modinfo.module_md5, modbase,
                                     (size_t) modinfo.image_size,
@@ -3991,6 +4082,21 @@ coarse_unit_load(dcontext_t *dcontext, app_pc start, app_pc end,
     }
 #endif
 
+    if (offsetof(coarse_persisted_info_t, cache_page_crc_len) < pers->header_len) {
+        pc -= pers->cache_page_crc_len;
+        if (TEST(PERSCACHE_CACHE_PAGE_CRC, DYNAMO_OPTION(persist_load_validation))) {
+            /* checked to be present and sized to the cache up above */
+            info->cache_page_crc = (uint *) pc;
+            info->cache_page_crc_num = (uint) (pers->cache_page_crc_len / sizeof(uint));
+            info->cache_page_checked =
+                HEAP_ARRAY_ALLOC(GLOBAL_DCONTEXT, bitmap_element_t,
+                                 BITMAP_INDEX(info->cache_page_crc_num) + 1,
+                                 ACCT_VMAREAS, PROTECTED);
+            memset(info->cache_page_checked, 0, sizeof(bitmap_element_t) *
+                   (BITMAP_INDEX(info->cache_page_crc_num) + 1));
+        }
+    }
+
     ASSERT(pc - map >= (int)pers->header_len);
 
     DEBUG_DECLARE(ok =)
@@ -4020,6 +4126,76 @@ coarse_unit_load(dcontext_t *dcontext, app_pc start, app_pc end,
     return info;
 }
 
+/* Checks the crc of the cache page holding pc, the first time a lookup lands
+ * there, for a unit loaded with PERSCACHE_CACHE_PAGE_CRC (so that we only
+ * read in and verify the pages that are actually used).  A body may run off
+ * the end of its page, so we check the following page as well.  Returns
+ * false if the unit's code does not match what was persisted: the caller
+ * should treat that as a miss, and further lookups in the unit will miss too.
+ * Pages reached only through direct links from other pages of the unit are
+ * not checked until a lookup lands in them.
+ */
+bool
+coarse_unit_check_cache_page(dcontext_t *dcontext, coarse_info_t *info, cache_pc pc)
+{
+    uint page, last, flags;
+    ASSERT(info != NULL && info->cache_page_crc != NULL);
+    ASSERT(info->frozen && info->persisted);
+    if (TEST(PERSCACHE_CODE_CORRUPT, info->flags))
+        return false;
+    ASSERT(pc >= info->cache_start_pc && pc < info->fcache_return_prefix);
+    page = (uint) ((pc - info->cache_start_pc) / PAGE_SIZE);
+    last = MIN(page + 1, info->cache_page_crc_num - 1);
+    for (; page <= last; page++) {
+        cache_pc start = info->cache_start_pc + page * PAGE_SIZE;
+        size_t len;
+        if (bitmap_test(info->cache_page_checked, page))
+            continue;
+        len = MIN(PAGE_SIZE, info->fcache_return_prefix - start);
+        if (crc32((const char *) start, (uint) len) != info->cache_page_crc[page]) {
+            LOG(THREAD, LOG_CACHE, 1,
+                "coarse_unit_check_cache_page %s: crc mismatch on page "PFX"\n",
+                info->module, start);
+            SYSLOG_INTERNAL_WARNING_ONCE("persistent cache page crc mismatch");
+            STATS_INC(perscache_page_crc_mismatch);
+            /* We can't take info->lock under the htable lock, and other flags
+             * are updated under info->lock, so set ours atomically to not
+             * lose theirs.  If one of theirs loses ours, the unchecked page
+             * just fails again on the next lookup.
+             */
+            do {
+                flags = info->flags;
+            } while (!atomic_compare_exchange_int((volatile int *)&info->flags,
+                                                  (int)flags,
+                                                  (int)(flags | PERSCACHE_CODE_CORRUPT)));
+            return false;
+        }
+        STATS_INC(perscache_pages_checked);
+        /* Racing lookups may set bits in the same word and lose one: that
+         * only costs a second check of that page.
+         */
+        bitmap_set(info->cache_page_checked, page);
+    }
+    return true;
+}
+
+/* Checks every not-yet-checked page of a lazily-validated unit, for callers
+ * like merging that read the whole cache.  Returns true for other units.
+ */
+static bool
+coarse_unit_check_all_cache_pages(dcontext_t *dcontext, coarse_info_t *info)
+{
+    uint page;
+    if (info->cache_page_crc == NULL)
+        return true;
+    for (page = 0; page < info->cache_page_crc_num; page += 2) {
+        if (!coarse_unit_check_cache_page(dcontext, info,
+                                          info->cache_start_pc + page * PAGE_SIZE))
+            return false;
+    }
+    return true;
+}
+
 bool
 exists_coarse_ibl_pending_table(dcontext_t *dcontext, /* in case per-thread someday */
                                 coarse_info_t *info, ibl_branch_type_t branch_type)
@@ -4058,3 +4234,478 @@ mark_module_exempted(app_pc pc)
     }
 }
 
+
+#ifdef LINUX_KERNEL
+/***************************************************************************
+ * KERNEL PERSISTED CACHES
+ */
+
+static dr_exports_t *kernel_persist_exports;
+
+/* Rebased tags from the image supplied at init, hottest first, built by every
+ * thread in kernel_persist_warm().  Read-only once perscache_init() returns.
+ */
+static app_pc *kernel_persist_load_tags;
+static uint kernel_persist_load_num;
+static uint kernel_persist_load_capacity;
+/* Weight of each of kernel_persist_load_tags, only while loading */
+static uint *kernel_persist_load_weights;
+
+/* Tags of every thread's bbs, gathered at exit for kernel_persist_write() */
+static app_pc *kernel_persist_exit_tags;
+static uint kernel_persist_exit_num;
+static uint kernel_persist_exit_capacity;
+
+#define KERNEL_PERSIST_INIT_TAGS 4096
+
+#define KERNEL_PERSIST_BITMAP_SIZE(start, end) \
+    (BITMAP_INDEX((end) - (start) + BITMAP_DENSITY - 1) * sizeof(bitmap_element_t))
+
+/* A text unit seen while writing the image */
+typedef struct _kernel_persist_unit_t {
+    const char *name;
+    app_pc start;
+    app_pc end;
+    bitmap_element_t *tags; /* one bit per text byte */
+    uint num_tags;
+    /* The unit's sorted offsets and their weights in the image, or NULL if
+     * it did not fit
+     */
+    uint *offs;
+    uint *weights;
+} kernel_persist_unit_t;
+
+void
+kernel_persist_set_exports(dr_exports_t *exports)
+{
+    kernel_persist_exports = exports;
+}
+
+/* Relocated module text differs from the persisted text wherever the module
+ * loader patched in addresses, so there is no digest to check.  We at least
+ * make sure the bb at tag still decodes, up to its ending cti, without
+ * leaving the unit.
+ */
+static bool
+kernel_persist_bb_decodes(app_pc tag, app_pc end)
+{
+    instr_t instr;
+    app_pc pc = tag;
+    uint num_instrs = 0;
+    bool ok = false;
+    instr_init(GLOBAL_DCONTEXT, &instr);
+    do {
+        instr_reset(GLOBAL_DCONTEXT, &instr);
+        pc = decode_cti(GLOBAL_DCONTEXT, pc, &instr);
+        if (pc == NULL || pc > end)
+            break;
+        /* the bb builder stops at max_bb_instrs too */
+        ok = (instr_opcode_valid(&instr) && instr_is_cti(&instr)) ||
+            ++num_instrs >= DYNAMO_OPTION(max_bb_instrs);
+    } while (!ok);
+    instr_free(GLOBAL_DCONTEXT, &instr);
+    return ok;
+}
+
+static void
+kernel_persist_load_unit(kernel_persisted_unit_t *unit)
+{
+    uint *offs = (uint *) (unit + 1);
+    uint *weights = offs + unit->num_tags;
+    module_digest_t digest;
+    app_pc start, end;
+    bool rebased;
+    uint i;
+
+    if (unit->name[KERNEL_PERSIST_NAME_MAX - 1] != '\0' ||
+        !kernel_find_text_unit(unit->name, &start, &end)) {
+        LOG(GLOBAL, LOG_CACHE, 1, "  unit not loaded\n");
+        STATS_INC(perscache_load_noname);
+        return;
+    }
+    LOG(GLOBAL, LOG_CACHE, 1, "  unit %s "PFX"-"PFX", persisted at "PFX"\n",
+        unit->name, start, end, unit->base);
+    if ((size_t)(end - start) != unit->text_size) {
+        LOG(GLOBAL, LOG_CACHE, 1, "  text size mismatch "SZFMT" vs persisted "SZFMT"\n",
+            (size_t)(end - start), unit->text_size);
+        STATS_INC(perscache_modinfo_mismatch);
+        return;
+    }
+    rebased = (start != unit->base);
+    if (!rebased) {
+        persist_calculate_module_digest(&digest, start, unit->text_size, start, end,
+                                        PERSCACHE_MODULE_MD5_COMPLETE);
+        if (!md5_digests_equal(digest.full_MD5, unit->digest.full_MD5)) {
+            LOG(GLOBAL, LOG_CACHE, 1, "  text md5 mismatch\n");
+            STATS_INC(perscache_md5_mismatch);
+            return;
+        }
+    } else if (!DYNAMO_OPTION(kernel_persist_trust_reloc)) {
+        LOG(GLOBAL, LOG_CACHE, 1, "  unit base mismatch\n");
+        STATS_INC(perscache_base_mismatch);
+        return;
+    }
+    for (i = 0; i < unit->num_tags; i++) {
+        app_pc tag = start + offs[i];
+        if (offs[i] >= unit->text_size ||
+            (rebased && !kernel_persist_bb_decodes(tag, end))) {
+            STATS_INC(perscache_kernel_tags_rejected);
+            continue;
+        }
+        if (weights[i] < DYNAMO_OPTION(kernel_persist_min_cpus)) {
+            STATS_INC(perscache_kernel_tags_cold);
+            continue;
+        }
+        ASSERT(kernel_persist_load_num < kernel_persist_load_capacity);
+        kernel_persist_load_weights[kernel_persist_load_num] = weights[i];
+        kernel_persist_load_tags[kernel_persist_load_num++] = tag;
+    }
+    STATS_INC(perscache_loaded);
+}
+
+/* Reorders kernel_persist_load_tags by descending weight, keeping the
+ * persisted order among equal weights.  Weights are at most the number of
+ * CPUs, so this is a counting sort.
+ */
+static void
+kernel_persist_order_hot(void)
+{
+    uint max_weight = (uint) get_num_processors();
+    uint *starts;
+    app_pc *sorted;
+    uint i, w, pos;
+    starts = (uint *)
+        global_heap_alloc((max_weight + 1) * sizeof(uint) HEAPACCT(ACCT_OTHER));
+    memset(starts, 0, (max_weight + 1) * sizeof(uint));
+    /* a bad image may claim more CPUs than we have */
+    for (i = 0; i < kernel_persist_load_num; i++) {
+        if (kernel_persist_load_weights[i] > max_weight)
+            kernel_persist_load_weights[i] = max_weight;
+        starts[kernel_persist_load_weights[i]]++;
+    }
+    for (w = max_weight + 1, pos = 0; w-- > 0; ) {
+        uint count = starts[w];
+        starts[w] = pos;
+        pos += count;
+    }
+    sorted = (app_pc *)
+        global_heap_alloc(kernel_persist_load_capacity * sizeof(app_pc)
+                          HEAPACCT(ACCT_OTHER));
+    for (i = 0; i < kernel_persist_load_num; i++)
+        sorted[starts[kernel_persist_load_weights[i]]++] = kernel_persist_load_tags[i];
+    global_heap_free(kernel_persist_load_tags,
+                     kernel_persist_load_capacity * sizeof(app_pc) HEAPACCT(ACCT_OTHER));
+    kernel_persist_load_tags = sorted;
+    global_heap_free(starts, (max_weight + 1) * sizeof(uint) HEAPACCT(ACCT_OTHER));
+}
+
+/* Validates the image supplied at init and gathers the tags of every unit
+ * whose text still matches.  Called on the main thread before any thread has
+ * taken over, so the units cannot change underneath us.
+ */
+static void
+kernel_persist_load(void)
+{
+    kernel_persisted_header_t *header;
+    byte *pc, *image_end;
+    size_t image_size;
+    uint num_tags = 0;
+    uint u;
+
+    if (kernel_persist_exports == NULL || kernel_persist_exports->persist_in == NULL ||
+        !DYNAMO_OPTION(kernel_use_persisted))
+        return;
+    header = (kernel_persisted_header_t *) kernel_persist_exports->persist_in;
+    image_size = kernel_persist_exports->persist_in_size;
+    image_end = (byte *) header + image_size;
+    LOG(GLOBAL, LOG_CACHE, 1, "kernel_persist_load: image of "SZFMT" bytes\n",
+        image_size);
+    STATS_INC(perscache_load_attempt);
+    if (image_size < sizeof(*header) || header->magic != PERSISTENT_CACHE_MAGIC ||
+        header->size != image_size) {
+        LOG(GLOBAL, LOG_CACHE, 1, "  invalid persisted image\n");
+        STATS_INC(perscache_bad_file);
+        return;
+    }
+    if (header->version != KERNEL_PERSIST_VERSION) {
+        LOG(GLOBAL, LOG_CACHE, 1, "  invalid persisted image version %d\n",
+            header->version);
+        STATS_INC(perscache_version_mismatch);
+        return;
+    }
+    /* Check every unit fits before trusting any of them */
+    pc = (byte *) (header + 1);
+    for (u = 0; u < header->num_units; u++) {
+        kernel_persisted_unit_t *unit = (kernel_persisted_unit_t *) pc;
+        if ((size_t)(image_end - pc) < sizeof(*unit) ||
+            (size_t)(image_end - pc) < KERNEL_PERSIST_UNIT_SIZE(unit->num_tags)) {
+            LOG(GLOBAL, LOG_CACHE, 1, "  truncated persisted image\n");
+            STATS_INC(perscache_bad_file);
+            return;
+        }
+        if (unit->num_tags > UINT_MAX - num_tags) {
+            LOG(GLOBAL, LOG_CACHE, 1, "  too many persisted tags\n");
+            STATS_INC(perscache_bad_file);
+            return;
+        }
+        num_tags += unit->num_tags;
+        pc += KERNEL_PERSIST_UNIT_SIZE(unit->num_tags);
+    }
+    if (num_tags == 0)
+        return;
+    kernel_persist_load_capacity = num_tags;
+    kernel_persist_load_tags = (app_pc *)
+        global_heap_alloc(num_tags * sizeof(app_pc) HEAPACCT(ACCT_OTHER));
+    kernel_persist_load_weights = (uint *)
+        global_heap_alloc(num_tags * sizeof(uint) HEAPACCT(ACCT_OTHER));
+    pc = (byte *) (header + 1);
+    for (u = 0; u < header->num_units; u++) {
+        kernel_persisted_unit_t *unit = (kernel_persisted_unit_t *) pc;
+        kernel_persist_load_unit(unit);
+        pc += KERNEL_PERSIST_UNIT_SIZE(unit->num_tags);
+    }
+    kernel_persist_order_hot();
+    global_heap_free(kernel_persist_load_weights, num_tags * sizeof(uint)
+                     HEAPACCT(ACCT_OTHER));
+    kernel_persist_load_weights = NULL;
+    LOG(GLOBAL, LOG_CACHE, 1, "  %d of %d persisted tags usable\n",
+        kernel_persist_load_num, num_tags);
+}
+
+void
+kernel_persist_warm(dcontext_t *dcontext)
+{
+    uint i;
+    if (kernel_persist_load_num == 0)
+        return;
+    KSTART(persisted_load);
+    for (i = 0; i < kernel_persist_load_num; i++) {
+        app_pc tag = kernel_persist_load_tags[i];
+        /* an earlier tag's bb build may have already built this one as a
+         * link target
+         */
+        if (fragment_lookup(dcontext, tag) != NULL)
+            continue;
+        build_basic_block_fragment(dcontext, tag, 0, true/*link*/, true/*visible*/
+                                   _IF_CLIENT(false/*!for_trace*/) _IF_CLIENT(NULL));
+        STATS_INC(perscache_kernel_bbs_prebuilt);
+    }
+    KSTOP(persisted_load);
+}
+
+static void
+kernel_persist_add_tag(app_pc tag, void *data)
+{
+    ASSERT_OWN_MUTEX(true, &kernel_persist_lock);
+    if (kernel_persist_exit_num == kernel_persist_exit_capacity) {
+        uint new_capacity = (kernel_persist_exit_capacity == 0) ?
+            KERNEL_PERSIST_INIT_TAGS : kernel_persist_exit_capacity * 2;
+        kernel_persist_exit_tags = (app_pc *)
+            global_heap_realloc(kernel_persist_exit_tags, kernel_persist_exit_capacity,
+                                new_capacity, sizeof(app_pc) HEAPACCT(ACCT_OTHER));
+        kernel_persist_exit_capacity = new_capacity;
+    }
+    kernel_persist_exit_tags[kernel_persist_exit_num++] = tag;
+}
+
+void
+kernel_persist_thread_exit(dcontext_t *dcontext)
+{
+    if (kernel_persist_exports == NULL || kernel_persist_exports->persist_out == NULL)
+        return;
+    KSTART(persisted_generation);
+    mutex_lock(&kernel_persist_lock);
+    fragment_private_bb_tags_iterate(dcontext, kernel_persist_add_tag, NULL);
+    mutex_unlock(&kernel_persist_lock);
+    KSTOP(persisted_generation);
+}
+
+/* Returns the unit containing tag, adding it to units if it's new, or NULL
+ * if tag is not in persistable text.
+ */
+static kernel_persist_unit_t *
+kernel_persist_find_unit(kernel_persist_unit_t **units, uint *num_units,
+                         uint *capacity, app_pc tag)
+{
+    kernel_persist_unit_t *unit;
+    const char *name;
+    app_pc start, end;
+    uint i;
+    for (i = 0; i < *num_units; i++) {
+        unit = &(*units)[i];
+        if (tag >= unit->start && tag < unit->end)
+            return unit;
+    }
+    if (is_in_dynamo_dll(tag) || !kernel_get_text_unit(tag, &start, &end, &name))
+        return NULL;
+    if (*num_units == *capacity) {
+        uint new_capacity = (*capacity == 0) ? 32 : *capacity * 2;
+        *units = (kernel_persist_unit_t *)
+            global_heap_realloc(*units, *capacity, new_capacity,
+                                sizeof(kernel_persist_unit_t) HEAPACCT(ACCT_OTHER));
+        *capacity = new_capacity;
+    }
+    unit = &(*units)[(*num_units)++];
+    unit->name = name;
+    unit->start = start;
+    unit->end = end;
+    unit->tags = (bitmap_element_t *)
+        global_heap_alloc(KERNEL_PERSIST_BITMAP_SIZE(start, end) HEAPACCT(ACCT_OTHER));
+    memset(unit->tags, 0, KERNEL_PERSIST_BITMAP_SIZE(start, end));
+    unit->num_tags = 0;
+    unit->offs = NULL;
+    unit->weights = NULL;
+    return unit;
+}
+
+/* Serializes one unit into out, returning the bytes used, or 0 if it
+ * does not fit in max bytes.  The weights are left 0 for
+ * kernel_persist_weigh_tag() to fill in.
+ */
+static size_t
+kernel_persist_write_unit(kernel_persist_unit_t *unit, byte *out, size_t max)
+{
+    kernel_persisted_unit_t *pers = (kernel_persisted_unit_t *) out;
+    uint *offs = (uint *) (pers + 1);
+    size_t size = KERNEL_PERSIST_UNIT_SIZE(unit->num_tags);
+    uint i, n = 0;
+    if (size > max)
+        return 0;
+    memset(pers, 0, sizeof(*pers));
+    strncpy(pers->name, unit->name, BUFFER_SIZE_ELEMENTS(pers->name));
+    NULL_TERMINATE_BUFFER(pers->name);
+    pers->base = unit->start;
+    pers->text_size = unit->end - unit->start;
+    persist_calculate_module_digest(&pers->digest, unit->start, pers->text_size,
+                                    unit->start, unit->end,
+                                    PERSCACHE_MODULE_MD5_COMPLETE);
+    pers->num_tags = unit->num_tags;
+    /* walking the bitmap yields the offsets sorted and without the duplicates
+     * from different threads building the same bb
+     */
+    for (i = 0; i < pers->text_size; i++) {
+        if (unit->tags[BITMAP_INDEX(i)] == 0) {
+            i += BITMAP_DENSITY - 1 - (i % BITMAP_DENSITY);
+            continue;
+        }
+        if (bitmap_test(unit->tags, i))
+            offs[n++] = i;
+    }
+    ASSERT(n == unit->num_tags);
+    unit->offs = offs;
+    unit->weights = offs + n;
+    memset(unit->weights, 0, n * sizeof(uint));
+    LOG(GLOBAL, LOG_CACHE, 1, "  unit %s "PFX"-"PFX": %d tags\n",
+        unit->name, unit->start, unit->end, n);
+    return size;
+}
+
+/* Counts one thread's copy of the bb at offs toward its weight */
+static void
+kernel_persist_weigh_tag(kernel_persist_unit_t *unit, uint offs)
+{
+    uint lo = 0, hi = unit->num_tags;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (unit->offs[mid] < offs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    ASSERT(lo < unit->num_tags && unit->offs[lo] == offs);
+    unit->weights[lo]++;
+}
+
+/* Writes the tags gathered by kernel_persist_thread_exit() to the
+ * controller's persist_out buffer, grouped by text unit and weighted by the
+ * number of threads that gathered each.  Units that do not
+ * fit are dropped.
+ */
+static void
+kernel_persist_write(void)
+{
+    kernel_persisted_header_t *header;
+    kernel_persist_unit_t *units = NULL;
+    uint num_units = 0, units_capacity = 0;
+    byte *out;
+    size_t max, used;
+    uint i;
+
+    if (kernel_persist_load_tags != NULL) {
+        global_heap_free(kernel_persist_load_tags,
+                         kernel_persist_load_capacity * sizeof(app_pc)
+                         HEAPACCT(ACCT_OTHER));
+        kernel_persist_load_tags = NULL;
+        kernel_persist_load_num = 0;
+    }
+    if (kernel_persist_exports == NULL || kernel_persist_exports->persist_out == NULL)
+        return;
+    out = (byte *) kernel_persist_exports->persist_out;
+    max = kernel_persist_exports->persist_out_max;
+    kernel_persist_exports->persist_out_size = 0;
+    if (max < sizeof(*header))
+        return;
+    LOG(GLOBAL, LOG_CACHE, 1, "kernel_persist_write: %d tags into "SZFMT" bytes\n",
+        kernel_persist_exit_num, max);
+
+    mutex_lock(&kernel_persist_lock);
+    for (i = 0; i < kernel_persist_exit_num; i++) {
+        app_pc tag = kernel_persist_exit_tags[i];
+        kernel_persist_unit_t *unit =
+            kernel_persist_find_unit(&units, &num_units, &units_capacity, tag);
+        uint offs;
+        if (unit == NULL)
+            continue;
+        offs = (uint) (tag - unit->start);
+        if (!bitmap_test(unit->tags, offs)) {
+            bitmap_set(unit->tags, offs);
+            unit->num_tags++;
+        }
+    }
+
+    header = (kernel_persisted_header_t *) out;
+    header->magic = PERSISTENT_CACHE_MAGIC;
+    header->version = KERNEL_PERSIST_VERSION;
+    header->num_units = 0;
+    used = sizeof(*header);
+    for (i = 0; i < num_units; i++) {
+        size_t size = kernel_persist_write_unit(&units[i], out + used, max - used);
+        if (size == 0) {
+            STATS_ADD(perscache_kernel_tags_dropped, units[i].num_tags);
+        } else {
+            used += size;
+            header->num_units++;
+            STATS_INC(perscache_kernel_units_written);
+            STATS_ADD(perscache_kernel_tags_written, units[i].num_tags);
+        }
+    }
+    /* every thread that still had a bb at exit counts toward its weight */
+    for (i = 0; i < kernel_persist_exit_num; i++) {
+        app_pc tag = kernel_persist_exit_tags[i];
+        kernel_persist_unit_t *unit =
+            kernel_persist_find_unit(&units, &num_units, &units_capacity, tag);
+        if (unit != NULL && unit->weights != NULL)
+            kernel_persist_weigh_tag(unit, (uint) (tag - unit->start));
+    }
+    if (kernel_persist_exit_tags != NULL) {
+        global_heap_free(kernel_persist_exit_tags,
+                         kernel_persist_exit_capacity * sizeof(app_pc)
+                         HEAPACCT(ACCT_OTHER));
+        kernel_persist_exit_tags = NULL;
+        kernel_persist_exit_num = 0;
+        kernel_persist_exit_capacity = 0;
+    }
+    mutex_unlock(&kernel_persist_lock);
+    for (i = 0; i < num_units; i++) {
+        global_heap_free(units[i].tags,
+                         KERNEL_PERSIST_BITMAP_SIZE(units[i].start, units[i].end)
+                         HEAPACCT(ACCT_OTHER));
+    }
+    if (units != NULL) {
+        global_heap_free(units, units_capacity * sizeof(kernel_persist_unit_t)
+                         HEAPACCT(ACCT_OTHER));
+    }
+    header->size = used;
+    kernel_persist_exports->persist_out_size = used;
+}
+#endif /* LINUX_KERNEL */
@@ -40,6 +40,9 @@
 #define _PERSCACHE_H_ 1
 
 #include "module_shared.h" /* for module_digest_t */
+#ifdef LINUX_KERNEL
+# include "dynamorio_module_interface.h" /* for dr_exports_t */
+#endif
 
 /***************************************************************************
  * COARSE-GRAIN UNITS
@@ -163,6 +166,14 @@ struct _coarse_info_t {
     /* case 10525: leave stubs as writable if written too many times */
     uint stubs_write_count;
 
+    /* For persisted units loaded with PERSCACHE_CACHE_PAGE_CRC: the crc of
+     * each cache page, pointing into the mmapped file, and a bitmap of the
+     * pages we have already checked.
+     */
+    uint *cache_page_crc;
+    uint cache_page_crc_num;
+    bitmap_element_t *cache_page_checked;
+
     /* case 9521: we can have a second unit in the same region for new,
      * non-frozen coarse code if the primary unit is frozen.
      * Presumably frozen unit is larger so we put it first.
@@ -226,6 +237,9 @@ coarse_unit_free(dcontext_t *dcontext, coarse_info_t *info);
 void
 coarse_unit_mark_in_use(coarse_info_t *info);
 
+bool
+coarse_unit_check_cache_page(dcontext_t *dcontext, coarse_info_t *info, cache_pc pc);
+
 /***************************************************************************
  * FROZEN UNITS
  */
@@ -349,6 +363,12 @@ enum {
      * Xref case 10601.
      */
     PERSCACHE_CODE_INVALID       = 0x00000400,
+
+    /* Used only in coarse_info_t.  Set when a page of a lazily-validated
+     * cache fails its PERSCACHE_CACHE_PAGE_CRC check; from then on every
+     * lookup in the unit misses.
+     */
+    PERSCACHE_CODE_CORRUPT       = 0x00000800,
 };
 
 /* Consistency and security checking options */
@@ -363,6 +383,10 @@ enum {
      * In 4.4 this will be stored at 1st execution, not load time (case 10601)
      */
     PERSCACHE_MODULE_MD5_AT_LOAD     = 0x00000010, /* else, at persist time */
+    /* Per-page crc of the code cache: checked lazily, the first time a
+     * lookup lands in each page, rather than at load time
+     */
+    PERSCACHE_CACHE_PAGE_CRC         = 0x00000020,
 };
 
 /* FIXME: share with hotp_module_sig_t in hotpatch.c
@@ -486,6 +510,9 @@ typedef struct _coarse_persisted_info_t {
     /* Case 9799: pcache-affecting options that differ from default values */
     size_t option_string_len;
 
+    /* PERSCACHE_CACHE_PAGE_CRC: one uint crc32 per page of the cache section */
+    size_t cache_page_crc_len;
+
     /* Add length of new +r data section here (header grows downward)
      * header_len indicates the start of the data section
      */
@@ -495,6 +522,8 @@ typedef struct _coarse_persisted_info_t {
 
     /* Add new data section here (data grows upward across versions) */
 
+    /* Per-page crcs of the cache, for PERSCACHE_CACHE_PAGE_CRC */
+
 #ifdef HOT_PATCHING_INTERFACE
     /* Hotp patch points matched at persist time to avoid flushing if
      * the same vulns are active in the current run (case 9969).
@@ -582,4 +611,61 @@ coarse_unit_check_persist_space(file_t fd_in/*OPTIONAL*/, size_t size_needed);
 void
 mark_module_exempted(app_pc pc);
 
+#ifdef LINUX_KERNEL
+/***************************************************************************
+ * KERNEL PERSISTED CACHES
+ *
+ * DRK only builds thread-private bbs (see os_check_option_compatibility()),
+ * so it has no coarse units to freeze.  Instead, at exit we record, per text
+ * unit (the core kernel's text or a module's), the offsets of the bbs built
+ * during the run, each weighted by how many CPUs built it.  At the next
+ * takeover we rebuild those bbs up front, hottest first, for every unit
+ * whose text still matches, rebasing modules that were loaded at a new
+ * address.  The image is handed to and from the controller through
+ * dr_exports_t since we have no file access.
+ */
+
+enum {
+    KERNEL_PERSIST_VERSION = 2,
+    KERNEL_PERSIST_NAME_MAX = 64,
+};
+
+typedef struct _kernel_persisted_header_t {
+    uint magic; /* PERSISTENT_CACHE_MAGIC */
+    uint version; /* KERNEL_PERSIST_VERSION */
+    size_t size; /* of the whole image, including this header */
+    uint num_units;
+    /* kernel_persisted_unit_t num_units times follows */
+} kernel_persisted_header_t;
+
+typedef struct _kernel_persisted_unit_t {
+    char name[KERNEL_PERSIST_NAME_MAX];
+    app_pc base; /* text start at persist time */
+    size_t text_size;
+    module_digest_t digest; /* PERSCACHE_MODULE_MD5_COMPLETE of the text */
+    uint num_tags;
+    /* uint offsets from base, num_tags times, sorted, follow, and then the
+     * uint weight of each offset: the number of CPUs that built its bb
+     */
+} kernel_persisted_unit_t;
+
+#define KERNEL_PERSIST_UNIT_SIZE(num_tags) \
+    (sizeof(kernel_persisted_unit_t) + \
+     ALIGN_FORWARD(2 * sizeof(uint) * (num_tags), sizeof(app_pc)))
+
+/* Called before dynamorio_app_init() with the controller's exports, whose
+ * persist_in and persist_out fields are read at init and exit.
+ */
+void
+kernel_persist_set_exports(dr_exports_t *exports);
+
+/* Records the calling thread's bbs for the image written at exit */
+void
+kernel_persist_thread_exit(dcontext_t *dcontext);
+
+/* Builds the calling thread's bbs from the image supplied at init */
+void
+kernel_persist_warm(dcontext_t *dcontext);
+#endif /* LINUX_KERNEL */
+
 #endif /* _PERSCACHE_H_ */
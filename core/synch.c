@@ -86,6 +86,30 @@ typedef struct _thread_synch_data_t {
 DECLARE_CXTSWPROT_VAR(mutex_t all_threads_synch_lock,
                       INIT_LOCK_FREE(all_threads_synch_lock));
 
+#ifdef LINUX_KERNEL
+/* DRK's threads are CPUs, and thread ids are CPU numbers.  Rather than
+ * suspending and polling each thread, synch_with_all_cpus() sends a single
+ * broadcast IPI, which brings every CPU to dispatch at its next fragment exit,
+ * and waits for each CPU to set its bit here from check_wait_at_safe_spot().
+ */
+# define SYNCH_ACK_WORD_BITS (sizeof(uint) * 8)
+# define SYNCH_ACK_WORDS (KERNEL_MAX_CPUS / SYNCH_ACK_WORD_BITS)
+DECLARE_NEVERPROT_VAR(static volatile uint synch_cpu_acks[SYNCH_ACK_WORDS], {0});
+
+static void
+synch_cpu_ack(thread_id_t cpu)
+{
+    volatile uint *word = &synch_cpu_acks[cpu / SYNCH_ACK_WORD_BITS];
+    uint bit = 1U << (cpu % SYNCH_ACK_WORD_BITS);
+    uint old;
+    ASSERT(cpu >= 0 && cpu < KERNEL_MAX_CPUS);
+    do {
+        old = *word;
+    } while (!atomic_compare_exchange_int((volatile int *)word, (int)old,
+                                          (int)(old | bit)));
+}
+#endif
+
 /* pass either mc or both cxt and cxt_size */
 static void
 free_setcontext(dr_mcontext_t *mc, void *cxt, size_t cxt_size _IF_X64(byte *cxt_alloc))
@@ -567,6 +591,9 @@ check_wait_at_safe_spot(dcontext_t *dcontext, thread_synch_permission_t cur_stat
      * once we have detach handling system calls here.
      */
     spinmutex_unlock(tsd->synch_lock);
+#ifdef LINUX_KERNEL
+    synch_cpu_ack(get_thread_id());
+#endif
     while (tsd->pending_synch_count > 0 && 
            tsd->synch_perm != THREAD_SYNCH_NONE) {
         STATS_INC_DC(dcontext, synch_loops_wait_safe);
@@ -737,6 +764,10 @@ synch_thread_yield()
      * since the target thread might be doing some long latency dr operation (like
      * dumping 500kb of registry into a forensics file) so we have the option to sleep
      * instead. */
+#ifdef LINUX_KERNEL
+    /* DRK runs with interrupts off, so there is nothing to sleep on */
+    SPINLOCK_PAUSE();
+#else
     uint num_procs = get_num_processors();
     ASSERT(num_procs != 0);
     if ((num_procs == 1 && DYNAMO_OPTION(synch_thread_sleep_UP)) ||
@@ -745,6 +776,7 @@ synch_thread_yield()
     } else {
         thread_yield();
     }
+#endif
 }
 
 /* returns a thread_synch_result_t value
@@ -986,6 +1018,109 @@ synch_with_thread(thread_id_t id, bool block, bool hold_initexit_lock,
     return res;
 }
 
+#ifdef LINUX_KERNEL
+/* The wait for acks is a tight spin, so we count this many pauses as one of
+ * synch_with_all_threads' loops when applying -synch_all_threads_max_loops.
+ */
+# define SYNCH_CPU_SPINS_PER_LOOP 1024
+
+/* DRK's synch_with_all_threads(): CPUs wait in dispatch before looking up
+ * their next fragment, holding no locks and no fragment, at
+ * THREAD_SYNCH_NO_LOCKS_NO_XFER so that flushes and resets can free anything
+ * without translating them.  Called holding all_threads_synch_lock and
+ * thread_initexit_lock; has the same return contract as
+ * synch_with_all_threads().
+ */
+static bool
+synch_with_all_cpus(thread_synch_state_t desired_synch_state,
+                    /*OUT*/ thread_record_t ***threads_out,
+                    /*OUT*/ int *num_threads_out,
+                    uint flags, uint max_loops)
+{
+    thread_record_t **threads = NULL;
+    int num_threads = 0, i;
+    uint expected[SYNCH_ACK_WORDS];
+    uint loop_count = 0, spins = 0, w;
+    thread_id_t my_id = get_thread_id();
+    bool all_synched = false;
+
+    /* process exit goes through dr_smp_exit()'s barriers instead */
+    ASSERT_NOT_IMPLEMENTED(!THREAD_SYNCH_IS_CLEANED(desired_synch_state));
+    ASSERT(THREAD_SYNCH_SAFE(THREAD_SYNCH_NO_LOCKS_NO_XFER, desired_synch_state));
+    KSTART(synch_with_all_cpus);
+    STATS_INC(synch_all_cpus);
+
+    get_list_of_threads(&threads, &num_threads);
+    memset(expected, 0, sizeof(expected));
+    for (w = 0; w < SYNCH_ACK_WORDS; w++)
+        synch_cpu_acks[w] = 0;
+    for (i = 0; i < num_threads; i++) {
+        thread_id_t cpu = threads[i]->id;
+        if (cpu == my_id)
+            continue;
+        ASSERT(cpu >= 0 && cpu < KERNEL_MAX_CPUS);
+        expected[cpu / SYNCH_ACK_WORD_BITS] |= 1U << (cpu % SYNCH_ACK_WORD_BITS);
+        /* the locked add also orders the ack reset above before the IPI */
+        adjust_wait_at_safe_spot(threads[i]->dcontext, 1);
+    }
+    LOG(THREAD_GET, LOG_SYNCH, 2, "synch with all cpus: interrupting %d cpus\n",
+        num_threads - 1);
+    os_interrupt_other_threads();
+
+    while (!all_synched && loop_count < max_loops) {
+        all_synched = true;
+        for (w = 0; w < SYNCH_ACK_WORDS; w++) {
+            if ((synch_cpu_acks[w] & expected[w]) != expected[w]) {
+                all_synched = false;
+                break;
+            }
+        }
+        if (!all_synched) {
+            SPINLOCK_PAUSE();
+            if (++spins % SYNCH_CPU_SPINS_PER_LOOP == 0)
+                loop_count++;
+        }
+    }
+    ASSERT_CURIOSITY(loop_count < max_loops);
+
+    for (i = 0; i < num_threads; i++) {
+        thread_id_t cpu = threads[i]->id;
+        thread_synch_data_t *tsd =
+            (thread_synch_data_t *) threads[i]->dcontext->synch_field;
+        if (cpu == my_id)
+            continue;
+        tsd->synch_with_success =
+            TEST(1U << (cpu % SYNCH_ACK_WORD_BITS),
+                 synch_cpu_acks[cpu / SYNCH_ACK_WORD_BITS]);
+        DOSTATS({
+            if (tsd->synch_with_success)
+                STATS_INC(synch_all_cpus_acks);
+        });
+    }
+    if (!all_synched && TEST(THREAD_SYNCH_SUSPEND_FAILURE_ABORT, flags)) {
+        /* release whoever did arrive */
+        for (i = 0; i < num_threads; i++) {
+            if (threads[i]->id != my_id)
+                adjust_wait_at_safe_spot(threads[i]->dcontext, -1);
+        }
+        global_heap_free(threads, num_threads * sizeof(thread_record_t *)
+                         HEAPACCT(ACCT_THREAD_MGT));
+        threads = NULL;
+        num_threads = 0;
+        mutex_unlock(&thread_initexit_lock);
+        mutex_unlock(&all_threads_synch_lock);
+    }
+    LOG(THREAD_GET, LOG_SYNCH, 1,
+        "Finished synch with all cpus: result=%d after %d spins\n",
+        all_synched, spins);
+    *threads_out = threads;
+    *num_threads_out = num_threads;
+    dynamo_all_threads_synched = all_synched;
+    KSTOP(synch_with_all_cpus);
+    return all_synched;
+}
+#endif
+
 /* desired_synch_state - a requested state define from above that describes
  *                        the synchronization required
  * threads, num_threads - must not be NULL, if !THREAD_SYNCH_IS_CLEANED(desired
@@ -1136,6 +1271,10 @@ synch_with_all_threads(thread_synch_state_t desired_synch_state,
     }
 
     mutex_lock(&thread_initexit_lock);
+#ifdef LINUX_KERNEL
+    return synch_with_all_cpus(desired_synch_state, threads_out, num_threads_out,
+                               flags, max_loops);
+#endif
     /* synch with all threads */
     /* FIXME: this should be a do/while loop - then we wouldn't have
      * to initialize all the variables above 
@@ -1433,6 +1572,11 @@ resume_all_threads(thread_record_t **threads, const uint num_threads)
         }
 #endif
 
+#ifdef LINUX_KERNEL
+        /* CPUs were not suspended but are waiting at their safe spot */
+        adjust_wait_at_safe_spot(threads[i]->dcontext, -1);
+        continue;
+#endif
         /* This routine assumes that each thread in the array was suspended, so
          * each one has to successfully resume.
          */
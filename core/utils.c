@@ -2836,6 +2836,9 @@ dump_global_stats(bool raw)
     });
     if (!dynamo_exited_and_cleaned)
         print_vmm_heap_data(GLOBAL);
+#if defined(LINUX_KERNEL) && defined(DEBUG)
+    cpu_stats_aggregate();
+#endif
     if (GLOBAL_STATS_ON()) {
         LOG(GLOBAL, LOG_STATS, 1, "(Begin) All statistics @%d ", GLOBAL_STAT(num_fragments));
         DOLOG(1, LOG_STATS, { print_timestamp(GLOBAL); });
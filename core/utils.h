@@ -427,6 +427,9 @@ enum {
     LOCK_RANK(coarse_stub_areas), /* < global_alloc_lock */
     LOCK_RANK(moduledb_lock), /* < global heap allocation */
     LOCK_RANK(pcache_dir_check_lock),
+#ifdef LINUX_KERNEL
+    LOCK_RANK(kernel_persist_lock), /* < global_alloc_lock */
+#endif
 #ifdef LINUX
     LOCK_RANK(suspend_lock),
     LOCK_RANK(shared_lock),
@@ -1506,6 +1509,39 @@ enum {LONGJMP_EXCEPTION = 1};
 #   define STATS_RESET(stat) /* nothing */
 #endif /* DEBUG */
 
+#if defined(LINUX_KERNEL) && defined(DEBUG)
+/* DRK's hot-path stats, listed in cpustatsx.h, are counted in a block per CPU
+ * rather than with atomic adds to the global stats, which bounce the stats'
+ * cache lines between CPUs.  A CPU only updates its own block and blocks don't
+ * share lines, so no atomics are needed.  Reading the stats sums the blocks:
+ * cpu_stats_aggregate() for DR's own dumps, the controller for the stats ioctl.
+ * The controller ignores the global values of these stats, which only hold
+ * the sum as of DR's last dump.
+ */
+typedef struct {
+# define CPU_STATS_DEF(name) stats_int_t name;
+# include "cpustatsx.h"
+# undef CPU_STATS_DEF
+} cpu_stats_t;
+
+# define CPU_STATS_LINE 64
+# define CPU_STATS_STRIDE ALIGN_FORWARD(sizeof(cpu_stats_t), CPU_STATS_LINE)
+extern byte *cpu_stats_base;
+# define CPU_STATS(cpu) \
+    ((cpu_stats_t *) (cpu_stats_base + (cpu) * CPU_STATS_STRIDE))
+/* An interrupt between the load and the store can lose the nested increment,
+ * which is fine for stats.
+ */
+# define STATS_ADD_CPU(stat, value) do {                        \
+        CPU_STATS(get_thread_id())->stat += (stats_int_t) (value); \
+    } while (0)
+# define STATS_INC_CPU(stat) STATS_ADD_CPU(stat, 1)
+void cpu_stats_aggregate(void);
+#else
+# define STATS_INC_CPU STATS_INC
+# define STATS_ADD_CPU STATS_ADD
+#endif
+
 #ifdef KSTATS
 # define DOKSTATS(statement) do { statement } while (0)
 
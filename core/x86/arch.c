@@ -2483,6 +2483,8 @@ instr_is_trace_cmp(dcontext_t *dcontext, instr_t *inst)
         instr_get_opcode(inst) == OP_seto ||
         instr_get_opcode(inst) == OP_cmp ||
         instr_get_opcode(inst) == OP_jnz ||
+        /* jz into the match blocks of a speculated ibl target chain */
+        instr_get_opcode(inst) == OP_jz ||
         instr_get_opcode(inst) == OP_add ||
         instr_get_opcode(inst) == OP_sahf
 #else
@@ -2553,7 +2555,8 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
          * return failure today for selfmod thread relocation since won't
          * match push/pop checks below).  Our trace cmp is the only
          * instance (besides selfmod) where we have a cti in our mangling,
-         * but it doesn't affect our linearity assumption.  We assume we
+         * but it doesn't affect our linearity assumption, except for the
+         * speculated ibl target chain, which we refuse to relocate in.  We assume we
          * have no entry points in between a spill and a restore.  Our
          * mangling goes in last (for regular bbs and traces; see
          * comment above for post-mangling traces), and so for local
@@ -2561,13 +2564,15 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
          */
         if (instr_is_cti(inst) &&
             /* Do not reset for a trace-cmp jecxz or jmp (32-bit) or
-             * jne (64-bit), since ecx needs to be restored (won't
-             * fault, but for thread relocation)
+             * jne (64-bit), or for the jz of a speculated ibl target chain
+             * (64-bit), since ecx needs to be restored (won't fault, but for
+             * thread relocation)
              */
             ((instr_get_opcode(inst) != OP_jecxz &&
               instr_get_opcode(inst) != OP_jmp &&
               /* x64 trace cmp uses jne for exit */
-              instr_get_opcode(inst) != OP_jne) ||
+              instr_get_opcode(inst) != OP_jne &&
+              instr_get_opcode(inst) != OP_jz) ||
              /* Rather than check for trace, just ignore exit jumps, which
               * won't mess up linearity here. For stored translation info we
               * don't have meta-flags so we can't use instr_is_exit_cti(). */
@@ -2685,16 +2690,30 @@ translate_walk_track(dcontext_t *tdcontext, instr_t *inst, translate_walk_t *wal
                 break;
 # endif
             case OP_cmp:
-                ASSERT(walk->lahf && walk->seto && !walk->restore_eflags);
+                /* a speculated ibl target chain repeats the cmp */
+                ASSERT(walk->lahf && walk->seto &&
+                       (!walk->restore_eflags || walk->unsupported_mangle));
                 walk->restore_eflags = true;
                 break;
+            case OP_jz:
+                /* append_trace_speculate_ibl_targets() chain: each match
+                 * block after the first runs with xax, xcx and the flags
+                 * still saved, while this linear walk has restored them in
+                 * the earlier blocks.  Rather than model the branches we
+                 * refuse to relocate anywhere past the first jz; nothing in
+                 * the chain can fault.
+                 */
+                walk->unsupported_mangle = true;
+                break;
 # ifdef DEBUG
             case OP_add:
-                ASSERT(walk->lahf && walk->seto && walk->restore_eflags);
+                ASSERT(walk->unsupported_mangle ||
+                       (walk->lahf && walk->seto && walk->restore_eflags));
                 break;
 # endif
             case OP_sahf:
-                ASSERT(walk->lahf && walk->seto && walk->restore_eflags);
+                ASSERT(walk->unsupported_mangle ||
+                       (walk->lahf && walk->seto && walk->restore_eflags));
                 walk->restore_eflags = false;
 # ifdef DEBUG
                 walk->lahf = false;
@@ -2849,6 +2868,69 @@ translate_restore_clean_call(dcontext_t *tdcontext, translate_walk_t *walk)
      */
 }
 
+/* Records in e the walk state that recreating at an instr translating to app
+ * would see, normalized so that runs of instrs with the same effective state
+ * compare equal.
+ */
+static void
+translation_entry_set_walk(translation_entry_t *e, translate_walk_t *walk, app_pc app)
+{
+    reg_id_t r;
+    e->xsp_adjust = 0;
+    e->spilled = 0;
+    e->spilled_tls = 0;
+    if (!translate_walk_good_state(NULL, walk, app))
+        e->flags |= TRANSLATE_BAD_STATE;
+    /* translate_walk_restore() only restores when still in app's region */
+    if (app == NULL || app != walk->translation)
+        return;
+    e->flags |= TRANSLATE_IN_REGION;
+    if (walk->in_ret)
+        e->flags |= TRANSLATE_IN_RET;
+    if (walk->ret_addr_in_xcx)
+        e->flags |= TRANSLATE_RET_IN_XCX;
+#ifdef X64
+    if (walk->restore_eflags)
+        e->flags |= TRANSLATE_RESTORE_EFLAGS;
+#endif
+    if (walk->xsp_adjust < SCHAR_MIN || walk->xsp_adjust > SCHAR_MAX)
+        e->flags |= TRANSLATE_BAD_STATE;
+    else
+        e->xsp_adjust = (sbyte) walk->xsp_adjust;
+    for (r = 0; r < REG_SPILL_NUM; r++) {
+        if (walk->reg_spilled[r]) {
+            e->spilled |= (byte) (1 << r);
+            if (walk->reg_tls[r])
+                e->spilled_tls |= (byte) (1 << r);
+        }
+    }
+}
+
+/* The inverse of translation_entry_set_walk(): sets up walk for
+ * translate_walk_good_state() and translate_walk_restore() at app.
+ */
+static void
+translation_entry_get_walk(const translation_entry_t *e, translate_walk_t *walk,
+                           app_pc app)
+{
+    reg_id_t r;
+    walk->unsupported_mangle = TEST(TRANSLATE_BAD_STATE, e->flags);
+    if (!TEST(TRANSLATE_IN_REGION, e->flags))
+        return;
+    walk->in_mangle_region = true;
+    walk->translation = app;
+    walk->in_ret = TEST(TRANSLATE_IN_RET, e->flags);
+    walk->ret_addr_in_xcx = TEST(TRANSLATE_RET_IN_XCX, e->flags);
+#ifdef X64
+    walk->restore_eflags = TEST(TRANSLATE_RESTORE_EFLAGS, e->flags);
+#endif
+    walk->xsp_adjust = e->xsp_adjust;
+    for (r = 0; r < REG_SPILL_NUM; r++) {
+        walk->reg_spilled[r] = TEST(1 << r, e->spilled);
+        walk->reg_tls[r] = TEST(1 << r, e->spilled_tls);
+    }
+}
+
 /* Returns a success code, but makes a best effort regardless.
  * If just_pc is true, only recreates pc.
  * Modifies mc with the recreated state.
@@ -2862,18 +2944,17 @@ recreate_app_state_from_info(dcontext_t *tdcontext, const translation_info_t *in
                              bool restore_memory _IF_DEBUG(uint flags))
 {
     byte *answer = NULL;
-    byte *cpc, *prev_cpc;
     cache_pc target_cache = mc->pc;
-    uint i;
-    bool contig = true, ours = false;
+    uint target_offs, lo, hi, i;
+    const translation_entry_t *e;
+    bool ours;
     recreate_success_t res = (just_pc ? RECREATE_SUCCESS_PC : RECREATE_SUCCESS_STATE);
-    instr_t instr;
     translate_walk_t walk;
     translate_walk_init(&walk, start_cache, end_cache, mc);
-    instr_init(tdcontext, &instr);
 
     ASSERT(info != NULL);
     ASSERT(end_cache >= start_cache);
+    ASSERT(target_cache >= start_cache && target_cache < end_cache);
 
     LOG(THREAD_GET, LOG_INTERP, 3,
         "recreate_app : looking for "PFX" in frag @ "PFX" (tag "PFX")\n",
@@ -2882,64 +2963,41 @@ recreate_app_state_from_info(dcontext_t *tdcontext, const translation_info_t *in
         translation_info_print(info, start_cache, THREAD_GET);
     });
 
-    /* Strategy: walk through cache instrs, updating current app translation
-     * as we go along from the info table.  The table records only
-     * translations at change points and must interpolate between them, using
-     * either a stride of 0 if the previous translation entry is marked
-     * "identical" or a stride equal to the instruction length as we decode
-     * from the cache if the previous entry is !identical=="contiguous".
+    /* The table records only translations at change points, along with the
+     * state we'd otherwise have to decode the cache to track: binary search
+     * for the last change point at or before the target and interpolate,
+     * using either a stride of 0 if it is marked "identical" or the distance
+     * into its run if it's "contiguous".
      */
-
-    cpc = start_cache;
-    ASSERT(cpc - start_cache == info->translation[0].cache_offs);
-    i = 0;
-    while (cpc < end_cache) {
-        /* we can go beyond the end of the table: then use the last point */
-        if (i < info->num_entries &&
-            cpc - start_cache >= info->translation[i].cache_offs) {
-        	if (TEST(TRANSLATE_CTI_TRANSLATION, info->translation[i].flags)) {
-                /* TODO(peter): This does not work with traces! */
-                ASSERT(!DYNAMO_OPTION(enable_traces));
-        		return RECREATE_DELAY_UNTIL_DISPATCH;
-        	}
-            /* We hit a change point: new app translation target */
-            answer = info->translation[i].app;
-            contig = !TEST(TRANSLATE_IDENTICAL, info->translation[i].flags);
-            ours = TEST(TRANSLATE_OUR_MANGLING, info->translation[i].flags);
-            i++;
-        }
-
-        if (cpc >= target_cache) {
-            /* we found the target to translate */
-            ASSERT(cpc == target_cache);
-            if (cpc > target_cache) { /* in debug will hit assert 1st */
-                LOG(THREAD_GET, LOG_INTERP, 2,
-                    "recreate_app -- WARNING: cache pc "PFX" != "PFX"\n",
-                    cpc, target_cache);
-                res = RECREATE_FAILURE; /* try to restore, but return false */
-            }
-            break;
-        }
-
-        /* PR 263407/PR 268372: we need to decode to instr level to track register
-         * values that we've spilled, and watch for ctis.  So far we don't need
-         * enough to justify a full decode_fragment().
-         */
-        instr_reset(tdcontext, &instr);
-        prev_cpc = cpc;
-        cpc = decode(tdcontext, cpc, &instr);
-        instr_set_our_mangling(&instr, ours);
-        instr_set_translation(&instr, ours ? answer : NULL);
-        translate_walk_track(tdcontext, &instr, &walk);
-
-        /* advance translation by the stride: either instr length or 0 */
-        if (contig)
-            answer += (cpc - prev_cpc);
-        /* else, answer stays put */
+    ASSERT(info->translation[0].cache_offs == 0);
+    target_offs = (uint) (target_cache - start_cache);
+    lo = 0;
+    hi = info->num_entries;
+    while (hi - lo > 1) {
+        uint mid = lo + (hi - lo) / 2;
+        if (info->translation[mid].cache_offs <= target_offs)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    e = &info->translation[lo];
+    /* index of the next change point, for the searches below */
+    i = lo + 1;
+    if (TEST(TRANSLATE_CTI_TRANSLATION, e->flags)) {
+#ifdef LINUX_KERNEL
+        /* TODO(peter): This does not work with traces! */
+        ASSERT(!DYNAMO_OPTION(enable_traces));
+        return RECREATE_DELAY_UNTIL_DISPATCH;
+#else
+        /* only cold code is marked in user mode: see record_translation_info() */
+        return RECREATE_FAILURE;
+#endif
     }
-    /* should always find xlation */
-    ASSERT(cpc < end_cache);
-    instr_free(tdcontext, &instr);
+    answer = e->app;
+    if (answer != NULL && !TEST(TRANSLATE_IDENTICAL, e->flags))
+        answer += target_offs - e->cache_offs;
+    ours = TEST(TRANSLATE_OUR_MANGLING, e->flags);
+    translation_entry_get_walk(e, &walk, answer);
 
     if (answer == NULL || !translate_walk_good_state(tdcontext, &walk, answer)) {
         /* PR 214962: we're either in client meta-code (NULL translation) or
@@ -3141,6 +3199,24 @@ recreate_app_state_from_ilist(dcontext_t *tdcontext, instrlist_t *ilist,
                  */
                 ASSERT(!instr_ok_to_mangle(inst));
 #ifdef LINUX_KERNEL                     
+                /* Cold code sits past the final exit (see move_cold_code()),
+                 * so there's no app instr after it to delay to.  It rarely
+                 * runs, so wait for dispatch as we do for cti translations.
+                 */
+                if (instr_is_cold(inst))
+                    return RECREATE_DELAY_UNTIL_DISPATCH;
+#else
+                /* Cold code sits past the final exit (see move_cold_code()),
+                 * so the app instr after it is not the one it logically
+                 * precedes: prev_bytes would name the wrong pc.
+                 */
+                if (instr_is_cold(inst)) {
+                    LOG(THREAD_GET, LOG_INTERP, 2,
+                        "recreate_app -- cannot translate cold code\n");
+                    return RECREATE_FAILURE;
+                }
+#endif
+#ifdef LINUX_KERNEL
                 /* We delay interrupts until the next non-meta instruction. */
                 if (!instr_ok_to_mangle(inst)) {
                     instr_t *next_non_meta = inst;
@@ -3697,21 +3773,22 @@ translation_info_alloc(dcontext_t *dcontext, uint num_entries)
     translation_info_t *info =
         global_heap_alloc(translation_info_alloc_size(num_entries) HEAPACCT(ACCT_OTHER));
     info->num_entries = num_entries;
+    STATS_ADD_PEAK(translation_info_bytes, translation_info_alloc_size(num_entries));
     return info;
 }
 
 void
 translation_info_free(dcontext_t *dcontext, translation_info_t *info)
 {
+    STATS_SUB(translation_info_bytes, translation_info_alloc_size(info->num_entries));
     global_heap_free(info, translation_info_alloc_size(info->num_entries)
                      HEAPACCT(ACCT_OTHER));
 }
 
+/* Appends e to the entries array, growing it as needed. */
 static inline void
-set_translation(dcontext_t *dcontext, translation_entry_t **entries,
-                uint *num_entries, uint entry,
-                ushort cache_offs, app_pc app, bool identical, bool our_mangling,
-                bool cti_translation)
+add_translation(dcontext_t *dcontext, translation_entry_t **entries,
+                uint *num_entries, uint entry, const translation_entry_t *e)
 {
     if (entry >= *num_entries) {
         /* alloc new arrays 2x as big */
@@ -3721,18 +3798,40 @@ set_translation(dcontext_t *dcontext, translation_entry_t **entries,
         *num_entries *= 2;
     }
     ASSERT(entry < *num_entries);
-    (*entries)[entry].cache_offs = cache_offs;
-    (*entries)[entry].app = app;
-    (*entries)[entry].flags = 0;
-    if (identical)
-        (*entries)[entry].flags |= TRANSLATE_IDENTICAL;
-    if (our_mangling)
-        (*entries)[entry].flags |= TRANSLATE_OUR_MANGLING;
-    if (cti_translation)
-        (*entries)[entry].flags |= TRANSLATE_CTI_TRANSLATION;
+    (*entries)[entry] = *e;
     LOG(THREAD, LOG_FRAGMENT, 4, "\tset_translation: %d +%5d => "PFX" %s%s\n",
-        entry, cache_offs, app, identical ? "identical" : "contiguous",
-        our_mangling ? " ours" : "");
+        entry, e->cache_offs, e->app,
+        TEST(TRANSLATE_IDENTICAL, e->flags) ? "identical" : "contiguous",
+        TEST(TRANSLATE_OUR_MANGLING, e->flags) ? " ours" : "");
+}
+
+/* Whether instrs recorded as cur can share prev's entry, given the
+ * translation and length of the last instr that prev covers.
+ */
+static inline bool
+translation_extends(translation_entry_t *prev, const translation_entry_t *cur,
+                    app_pc last_app, uint last_len)
+{
+    /* only the stride may differ */
+    if ((prev->flags & ~TRANSLATE_IDENTICAL) != (cur->flags & ~TRANSLATE_IDENTICAL) ||
+        prev->xsp_adjust != cur->xsp_adjust || prev->spilled != cur->spilled ||
+        prev->spilled_tls != cur->spilled_tls)
+        return false;
+    if (prev->cache_offs + last_len == cur->cache_offs) {
+        /* prev covers a single instr so far, so it can take either stride */
+        if (cur->app == last_app) {
+            prev->flags |= TRANSLATE_IDENTICAL;
+            return true;
+        }
+        if (last_app != NULL && cur->app == last_app + last_len) {
+            prev->flags &= ~TRANSLATE_IDENTICAL;
+            return true;
+        }
+        return false;
+    }
+    if (TEST(TRANSLATE_IDENTICAL, prev->flags))
+        return cur->app == last_app;
+    return last_app != NULL && cur->app == last_app + last_len;
 }
 
 void
@@ -3743,14 +3842,20 @@ translation_info_print(const translation_info_t *info, cache_pc start, file_t fi
     ASSERT(file != INVALID_FILE);
     print_file(file, "translation info "PFX"\n", info);
     for (i=0; i<info->num_entries; i++) {
-        print_file(file, "\t%d +%5d == "PFX" => "PFX" %s%s\n",
-                   i, info->translation[i].cache_offs,
-                   start + info->translation[i].cache_offs,
-                   info->translation[i].app,
-                   TEST(TRANSLATE_IDENTICAL, info->translation[i].flags) ?
-                   "identical" : "contiguous",
-                   TEST(TRANSLATE_OUR_MANGLING, info->translation[i].flags) ?
-                   " ours" : "");
+        const translation_entry_t *e = &info->translation[i];
+        print_file(file, "\t%d +%5d == "PFX" => "PFX" %s%s%s",
+                   i, e->cache_offs, start + e->cache_offs, e->app,
+                   TEST(TRANSLATE_IDENTICAL, e->flags) ? "identical" : "contiguous",
+                   TEST(TRANSLATE_OUR_MANGLING, e->flags) ? " ours" : "",
+                   TEST(TRANSLATE_BAD_STATE, e->flags) ? " bad-state" : "");
+        if (TEST(TRANSLATE_IN_REGION, e->flags)) {
+            print_file(file, " xsp%+d spills 0x%02x tls 0x%02x%s%s%s",
+                       e->xsp_adjust, e->spilled, e->spilled_tls,
+                       TEST(TRANSLATE_IN_RET, e->flags) ? " ret" : "",
+                       TEST(TRANSLATE_RET_IN_XCX, e->flags) ? " ret-in-xcx" : "",
+                       TEST(TRANSLATE_RESTORE_EFLAGS, e->flags) ? " eflags" : "");
+        }
+        print_file(file, "\n");
     }
 }
 
@@ -3772,9 +3877,10 @@ record_translation_info(dcontext_t *dcontext, fragment_t *f, instrlist_t *existi
     instr_t *inst;
     uint i;
     uint last_len = 0;
-    bool last_contig;
     app_pc last_translation = NULL;
     cache_pc cpc;
+    translation_entry_t cur;
+    translate_walk_t walk;
     
     LOG(THREAD, LOG_FRAGMENT, 3, "record_translation_info: F%d("PFX")."PFX"\n",
         f->id, f->tag, f->start_pc);
@@ -3832,31 +3938,56 @@ record_translation_info(dcontext_t *dcontext, fragment_t *f, instrlist_t *existi
     entries = HEAP_ARRAY_ALLOC(GLOBAL_DCONTEXT, translation_entry_t,
                                NUM_INITIAL_TRANSLATIONS, ACCT_OTHER, PROTECTED);
 
+    /* We run the same walk over the ilist that recreation would run over the
+     * cache, recording its state alongside each translation.
+     */
+    translate_walk_init(&walk, f->start_pc, f->start_pc + f->size, NULL);
     i = 0;
     cpc = (byte *) FCACHE_ENTRY_PC(f);
     if (fragment_prefix_size(f->flags) > 0) {
         ASSERT(f->start_pc < cpc);
-        set_translation(dcontext, &entries, &num_entries, i, 0,
-                        f->tag, true/*identical*/, true/*our mangling*/, false);
+        memset(&cur, 0, sizeof(cur));
+        cur.app = f->tag;
+        cur.flags = TRANSLATE_IDENTICAL | TRANSLATE_OUR_MANGLING;
+        add_translation(dcontext, &entries, &num_entries, i, &cur);
         last_translation = f->tag;
-        last_contig = false;
+        last_len = (uint) (cpc - f->start_pc);
         i++;
     } else {
         ASSERT(f->start_pc == cpc);
-        last_contig = true; /* we create 1st entry on 1st loop iter */
     }
     for (inst = instrlist_first(ilist); inst; inst = instr_get_next(inst)) {
         app_pc app = instr_get_translation(inst);
-        uint prev_i = i;
+        uint len;
+        memset(&cur, 0, sizeof(cur));
+        cur.cache_offs = (ushort) (cpc - f->start_pc);
         if (instr_is_cti_translation(inst)) {
             /* TODO(peter): This does not work with traces! */
             ASSERT(!DYNAMO_OPTION(enable_traces));
-        	set_translation(dcontext, &entries, &num_entries, i, (ushort) (cpc - f->start_pc),
-        	                        NULL, false, false, true);
-        	i++;
-        	break;
+            cur.flags = TRANSLATE_CTI_TRANSLATION;
+            add_translation(dcontext, &entries, &num_entries, i, &cur);
+            i++;
+            break;
         }
-        if (instr_is_label(inst)) {
+        /* Like recreate_app_state_from_ilist(), skip labels and other
+         * zero-length instrs.
+         */
+        len = instr_length(dcontext, inst);
+        if (len == 0)
+            continue;
+        if (instr_is_cold(inst)) {
+            /* As in recreate_app_state_from_ilist(), there's no app instr
+             * after cold code to delay to, so wait for dispatch; user mode
+             * has no delays and fails instead.
+             */
+            cur.flags = TRANSLATE_CTI_TRANSLATION;
+            if (i == 0 || !TEST(TRANSLATE_CTI_TRANSLATION, entries[i-1].flags)) {
+                add_translation(dcontext, &entries, &num_entries, i, &cur);
+                i++;
+            }
+            last_translation = NULL;
+            last_len = len;
+            cpc += len;
             continue;
         }
 #ifndef CLIENT_INTERFACE
@@ -3872,88 +4003,22 @@ record_translation_info(dcontext_t *dcontext, fragment_t *f, instrlist_t *existi
          */
         /* PR 302951: clean call args are instr_is_our_mangling so no assert for that */
         ASSERT(app != NULL || !instr_ok_to_mangle(inst));
+        cur.app = app;
+        if (instr_is_our_mangling(inst))
+            cur.flags |= TRANSLATE_OUR_MANGLING;
+        translation_entry_set_walk(&cur, &walk, app);
         /* see whether we need a new entry, or the current stride (contig
          * or identical) holds
          */
-        if (last_contig) {
-            if ((i == 0 && (app == NULL || instr_is_our_mangling(inst)))
-                || app == last_translation) {
-                /* we are now in an identical region */
-                /* Our incremental discovery can cause us to add a new
-                 * entry of one type that on the next instr we discover
-                 * can optimally be recorded as the other type.  Here we
-                 * hit an app pc shift whose target needs an identical
-                 * entry: so rather than a contig followed by identical,
-                 * we can get away with a single identical.
-                 * Example: "x x+1 y y", where we use an identical for the
-                 * first y instead of the contig that we initially guessed
-                 * at b/c we assumed it was an elision.
-                 */
-                if (i > 0 && entries[i-1].cache_offs == cpc - last_len - f->start_pc) {
-                    /* convert prev contig into identical */
-                    ASSERT(!TEST(TRANSLATE_IDENTICAL, entries[i-1].flags));
-                    entries[i-1].flags |= TRANSLATE_IDENTICAL;
-                    LOG(THREAD, LOG_FRAGMENT, 3,
-                        "\tchanging %d to identical\n", i-1);
-                } else {
-                    set_translation(dcontext, &entries, &num_entries, i,
-                                    (ushort) (cpc - f->start_pc),
-                                    app, true/*identical*/, instr_is_our_mangling(inst), false);
-                    i++;
-                }
-                last_contig = false;
-            } else if ((i == 0 && app != NULL && !instr_is_our_mangling(inst))
-                       || app != last_translation + last_len) {
-                /* either 1st loop iter w/ app instr & no prefix, or else probably
-                 * a follow-ubr, so create a new contig entry
-                 */
-                set_translation(dcontext, &entries, &num_entries, i,
-                                (ushort) (cpc - f->start_pc),
-                                app, false/*contig*/, instr_is_our_mangling(inst), false);
-                last_contig = true;
-                i++;
-            } /* else, contig continues */
-        } else {
-            if (app != last_translation) {
-                /* no longer in an identical region */
-                ASSERT(i > 0);
-                /* If we have translations "x x+1 x+1 x+2 x+3" we can more
-                 * efficiently encode with a new contig entry at the 2nd
-                 * x+1 rather than an identical entry there followed by a
-                 * contig entry for x+2.
-                 */
-                if (app == last_translation + last_len &&
-                    entries[i-1].cache_offs == cpc - last_len - f->start_pc) {
-                    /* convert prev identical into contig */
-                    ASSERT(TEST(TRANSLATE_IDENTICAL, entries[i-1].flags));
-                    entries[i-1].flags &= ~TRANSLATE_IDENTICAL;
-                    LOG(THREAD, LOG_FRAGMENT, 3,
-                        "\tchanging %d to contig\n", i-1);
-                } else {
-                    /* probably a follow-ubr, so create a new contig entry */
-                    set_translation(dcontext, &entries, &num_entries, i,
-                                    (ushort) (cpc - f->start_pc), app, false/*contig*/,
-                                    instr_is_our_mangling(inst), false);
-                    last_contig = true;
-                    i++;
-                }
-            }
-        }
-        last_translation = app;
-
-        /* We need to make a new entry if the our-mangling flag changed */
-        if (i > 0 && i == prev_i && instr_is_our_mangling(inst) !=
-            TEST(TRANSLATE_OUR_MANGLING, entries[i-1].flags)) {
-            /* our manglings are usually identical */
-            bool identical = instr_is_our_mangling(inst);
-            set_translation(dcontext, &entries, &num_entries, i,
-                            (ushort) (cpc - f->start_pc),
-                            app, identical, instr_is_our_mangling(inst), false);
-            last_contig = !identical;
+        if (i == 0 ||
+            !translation_extends(&entries[i-1], &cur, last_translation, last_len)) {
+            add_translation(dcontext, &entries, &num_entries, i, &cur);
             i++;
         }
-        last_len = instr_length(dcontext, inst);
-        cpc += last_len;
+        translate_walk_track(dcontext, inst, &walk);
+        last_translation = app;
+        last_len = len;
+        cpc += len;
         ASSERT(CHECK_TRUNCATE_TYPE_ushort(cpc - f->start_pc));
     }
     /* exit stubs can be examined after app code is gone, so we don't need
@@ -347,6 +347,10 @@ enum {
 
 void mangle(dcontext_t *dcontext, instrlist_t *ilist, uint flags,
             bool mangle_calls, bool record_translation);
+#ifdef INLINE_SIGNAL_CHECKS
+void mangle_insert_signal_check(dcontext_t *dcontext, instrlist_t *ilist,
+                                instr_t *where, app_pc tag, bool record_translation);
+#endif
 
 /* in interp.c but not exported to non-x86 files */
 bool must_not_be_inlined(app_pc pc);
@@ -617,18 +617,36 @@ enum {
      */
     TRANSLATE_IDENTICAL      = 0x0001, /* otherwise contiguous */
     TRANSLATE_OUR_MANGLING   = 0x0002, /* added by our own mangling (PR 267260) */
-    TRANSLATE_CTI_TRANSLATION= 0x0004,
-}; /* no typedef b/c we need ushort not int */
+    TRANSLATE_CTI_TRANSLATION= 0x0004, /* or cold code: delay until dispatch,
+                                        * or fail in user mode */
+    /* The rest capture the state-recreation walk (arch.c's translate_walk_t)
+     * as it stands at each instr of the sequence, so recreation need not
+     * decode the cache to rebuild it.
+     */
+    TRANSLATE_BAD_STATE      = 0x0008, /* full state can't be recreated */
+    TRANSLATE_IN_REGION      = 0x0010, /* still inside the mangle region for app */
+    TRANSLATE_IN_RET         = 0x0020,
+    TRANSLATE_RET_IN_XCX     = 0x0040,
+    TRANSLATE_RESTORE_EFLAGS = 0x0080,
+}; /* no typedef b/c we need a byte not int */
 
 /* Translation table entry (case 3559).
  * PR 299783: for now we only support pc translation, not full arbitrary reg
  * state mappings, which aren't needed for DR but may be nice for clients.
+ * Besides the pc we do record our own spills and stack adjustments.
  */
 typedef struct _translation_entry_t {
     /* offset from fragment start_pc */
     ushort cache_offs;
     /* TRANSLATE_ flags */
-    ushort flags;
+    byte flags;
+    /* The fields below only matter with TRANSLATE_IN_REGION. */
+    /* PR 267260: xsp adjustment made by our mangling so far */
+    sbyte xsp_adjust;
+    /* PR 263407: bit r set if REG_START_SPILL+r is in a spill slot */
+    byte spilled;
+    /* bit r set if that slot is a tls slot rather than the mcontext */
+    byte spilled_tls;
     app_pc app;
 } translation_entry_t;
 
@@ -637,8 +655,9 @@ typedef struct _translation_entry_t {
  * The table records only translations at change points, so the
  * recreater must interpolate between them, using either a stride of 0
  * if the previous translation entry is marked "identical" or a stride
- * equal to the instruction length as we decode from the cache if the
- * previous entry is !identical=="contiguous".
+ * equal to the distance from the entry's cache offset if the entry is
+ * !identical=="contiguous": a new entry starts wherever an instr's cache
+ * length doesn't match its app length, so no decoding is needed.
  */
 typedef struct _translation_info_t {
     uint num_entries;
@@ -1230,6 +1249,11 @@ void interp(dcontext_t *dcontext);
 uint extend_trace(dcontext_t *dcontext, fragment_t *f, linkstub_t *prev_l);
 int append_trace_speculate_last_ibl(dcontext_t *dcontext, instrlist_t *trace,
                                     app_pc speculate_next_tag, bool record_translation);
+#ifdef X64
+int append_trace_speculate_ibl_targets(dcontext_t *dcontext, instrlist_t *trace,
+                                       app_pc *targets, uint num_targets,
+                                       bool record_translation);
+#endif
 
 uint
 forward_eflags_analysis(dcontext_t *dcontext, instrlist_t *ilist, instr_t *instr);
@@ -1618,6 +1642,7 @@ int
 instr_length(dcontext_t *dcontext, instr_t *instr);
 
 /* also in instr.c, but not exported */
+int instr_length_for_emit(dcontext_t *dcontext, instr_t *instr);
 void instr_shift_raw_bits(instr_t *instr, ssize_t offs);
 uint instr_branch_type(instr_t *cti_instr);
 int instr_exit_branch_type(instr_t *instr);
@@ -1653,7 +1678,9 @@ DR_API
  * \p has_instr_jmp_targets must be true.  If \p has_instr_jmp_targets is true,
  * the note field of each instr_t in ilist will be overwritten, and if any
  * instr_t targets are not in \p ilist, they must have their note fields set with
- * their offsets relative to pc.
+ * their offsets relative to pc.  The offset pass then also caches the raw
+ * bits of each instr whose encoding does not depend on its placement, as
+ * instr_length() does for instrs that are instr_ok_to_mangle().
  */
 byte *
 instrlist_encode(dcontext_t *dcontext, instrlist_t *ilist, byte *pc,
@@ -1684,6 +1711,7 @@ bool is_observed_call_site(dcontext_t *dcontext, app_pc retaddr);
 
 /* in optimize.c */
 void optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace);
+void optimize_bb(dcontext_t *dcontext, app_pc tag, instrlist_t *bb);
 #ifdef DEBUG
 void print_optimization_stats(void); 
 #endif
@@ -70,6 +70,13 @@
    starting with 0 at the top.  The lower opcode nibble defines the
    columns, starting with 0 at left. */
 
+#ifdef DEBUG
+/* The tables and routines below, through sizeof_fp_op(), are the original
+ * branch-driven length decoder.  decode_sizeof() now uses the packed tables
+ * further down; we keep this version in debug builds to cross-check it
+ * (see decode_sizeof_legacy()).
+ */
+
 /* Data table for fixed part of an x86 instruction.  The table is
    indexed by the 1st (primary) opcode byte.  Zero entries are
    reserved opcodes. */
@@ -381,16 +388,12 @@ static const byte threebyte_3a_fixed_length[256] = {
 };
 #endif
 
-/* Returns the length of the instruction at pc.
- * If num_prefixes is non-NULL, returns the number of prefix bytes.
- * If rip_rel_pos is non-NULL, returns the offset into the instruction
- * of a rip-relative addressing displacement (for data only: ignores
- * control-transfer relative addressing), or 0 if none.
- * May return 0 size for certain invalid instructions
+/* Branch-driven equivalent of decode_sizeof(), used only to validate
+ * the table-driven decoder.
  */
-int
-decode_sizeof(dcontext_t *dcontext, byte *start_pc, int *num_prefixes
-              _IF_X64(uint *rip_rel_pos))
+static int
+decode_sizeof_legacy(dcontext_t *dcontext, byte *start_pc, int *num_prefixes
+                     _IF_X64(uint *rip_rel_pos))
 {
     byte *pc = start_pc;
     uint opc = (uint)*pc;
@@ -662,6 +665,389 @@ sizeof_fp_op(dcontext_t *dcontext, byte *pc, bool addr16 _IF_X64(byte **rip_rel_
     /* fp opcode in reg/opcode field */
     return sizeof_modrm(dcontext, pc, addr16 _IF_X64(rip_rel_pc));
 }
+#endif /* DEBUG */
+
+
+/* Table-driven length decoding.
+ *
+ * Every opcode's contribution to the instruction length is folded into a
+ * single packed entry so that decode_sizeof() does one table load per
+ * opcode byte instead of a chain of compares.  Legacy and rex prefixes are
+ * classified by prefix_info[], which lets us consume a prefix run with one
+ * load and a test per byte rather than a switch.  We do not use SSE to
+ * scan for prefixes: DRK runs this code in the kernel where the xmm
+ * registers belong to the interrupted task, and a wide load could also
+ * fault on the page following a short instruction.
+ */
+
+/* Flags for prefix_info[] */
+enum {
+    PFX_LEGACY  = 0x01, /* lock, rep*, segment overrides */
+    PFX_DATA16  = 0x02,
+    PFX_ADDR16  = 0x04, /* really "addr32" for x64 mode */
+    PFX_REP     = 0x08,
+    PFX_REX     = 0x10, /* only a prefix in x64 mode */
+    PFX_REX_W   = 0x20,
+};
+
+#define P  PFX_LEGACY
+#define D  PFX_DATA16
+#define A  PFX_ADDR16
+#define R  (PFX_LEGACY|PFX_REP)
+#define X  PFX_REX
+#define W  (PFX_REX|PFX_REX_W)
+
+/* Data table classifying each byte as a prefix, indexed by the byte. */
+static const byte prefix_info[256] = {
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 0 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 1 */
+    0,0,0,0, 0,0,P,0, 0,0,0,0, 0,0,P,0,  /* 2 */
+    0,0,0,0, 0,0,P,0, 0,0,0,0, 0,0,P,0,  /* 3 */
+
+    X,X,X,X, X,X,X,X, W,W,W,W, W,W,W,W,  /* 4 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 5 */
+    0,0,0,0, P,P,D,A, 0,0,0,0, 0,0,0,0,  /* 6 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 7 */
+
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 8 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* 9 */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* A */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* B */
+
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* C */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* D */
+    0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0,  /* E */
+    P,0,R,R, 0,0,0,0, 0,0,0,0, 0,0,0,0   /* F */
+};
+
+#undef P
+#undef D
+#undef A
+#undef R
+#undef X
+#undef W
+
+/* Layout of a packed length entry:
+ *   bits 0-2  fixed length following the opcode byte(s), including the
+ *             opcode byte itself for the one-byte map
+ *   bits 3-4  how to size the variable part (LEN_VAR_*)
+ *   bits 5-   adjustments that depend on prefixes or mode (LEN_*)
+ */
+#define LEN_FIXED_MASK  0x0007
+#define LEN_VAR_SHIFT   3
+#define LEN_VAR_MASK    0x0018
+enum {
+    LEN_VAR_NONE  = 0x0000,
+    LEN_VAR_MODRM = 0x0008, /* modrm (+sib+disp) follows; fp ops size the same */
+    LEN_VAR_0F    = 0x0010, /* two-byte opcode: consult twobyte_length[] */
+    LEN_VAR_0F3X  = 0x0018, /* three-byte opcode: consult threebyte_length[] */
+
+    LEN_IMMZ      = 0x0020, /* Iz/Jz immed: shrinks by 2 with data16 */
+    LEN_REL_F64   = 0x0040, /* ...except on Intel x64 (Jz is "f64") */
+    LEN_MOFFS     = 0x0080, /* moffs: sized by address size, 8 bytes on x64 */
+    LEN_IMM64     = 0x0100, /* mov imm: grows by 4 with rex.w */
+    LEN_TEST_IMM  = 0x0200, /* f6/f7 /0 (OP_test) carries an immed */
+    LEN_0F78_IMM  = 0x0400, /* 0f 78: 2 1-byte immeds with data16 or rep */
+};
+
+#define LEN_FIXED(info) ((info) & LEN_FIXED_MASK)
+#define LEN_VAR(info)   ((info) & LEN_VAR_MASK)
+
+/* Some macros to make the following tables look better.
+ * _N: fixed size N, mN: modrm + fixed N, zN: fixed N with Iz/Jz immed,
+ * mz: modrm with Iz immed, jz: Jz rel32, mo: moffs, iq: mov r,imm
+ * mt: f6/f7, es: 0f escape, e3: 0f 38 and 0f 3a escapes,
+ * mx: 0f 78.
+ */
+#define _0 0
+#define _1 1
+#define _2 2
+#define _3 3
+#define _4 4
+#define _5 5
+#define m1 (1|LEN_VAR_MODRM)
+#define m2 (2|LEN_VAR_MODRM)
+#define mz (5|LEN_VAR_MODRM|LEN_IMMZ)
+#define z2 (2|LEN_IMMZ)
+#define z5 (5|LEN_IMMZ)
+#define z7 (7|LEN_IMMZ)
+#define jz (5|LEN_IMMZ|LEN_REL_F64)
+#define mo (5|LEN_MOFFS)
+#define iq (5|LEN_IMMZ|LEN_IMM64)
+#define mt (1|LEN_VAR_MODRM|LEN_TEST_IMM)
+#define es (1|LEN_VAR_0F)
+#define e3 (1|LEN_VAR_0F3X)
+#define mx (1|LEN_VAR_MODRM|LEN_0F78_IMM)
+
+/* One-byte opcode map, indexed by the primary opcode byte.  Combines
+ * fixed_length[], variable_length[], immed_adjustment*[], disp_adjustment[]
+ * and x64_adjustment[].
+ */
+static const ushort onebyte_length[256] = {
+    m1,m1,m1,m1, _2,z5,_1,_1, m1,m1,m1,m1, _2,z5,_1,es,  /* 0 */
+    m1,m1,m1,m1, _2,z5,_1,_1, m1,m1,m1,m1, _2,z5,_1,_1,  /* 1 */
+    m1,m1,m1,m1, _2,z5,_1,_1, m1,m1,m1,m1, _2,z5,_1,_1,  /* 2 */
+    m1,m1,m1,m1, _2,z5,_1,_1, m1,m1,m1,m1, _2,z5,_1,_1,  /* 3 */
+
+    _1,_1,_1,_1, _1,_1,_1,_1, _1,_1,_1,_1, _1,_1,_1,_1,  /* 4 */
+    _1,_1,_1,_1, _1,_1,_1,_1, _1,_1,_1,_1, _1,_1,_1,_1,  /* 5 */
+    _1,_1,m1,m1, _1,_1,_1,_1, z5,mz,_2,m2, _1,_1,_1,_1,  /* 6 */
+    _2,_2,_2,_2, _2,_2,_2,_2, _2,_2,_2,_2, _2,_2,_2,_2,  /* 7 */
+
+    m2,mz,m2,m2, m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1,  /* 8 */
+    _1,_1,_1,_1, _1,_1,_1,_1, _1,_1,z7,_1, _1,_1,_1,_1,  /* 9 */
+    mo,mo,mo,mo, _1,_1,_1,_1, _2,z5,_1,_1, _1,_1,_1,_1,  /* A */
+    _2,_2,_2,_2, _2,_2,_2,_2, iq,iq,iq,iq, iq,iq,iq,iq,  /* B */
+
+    m2,m2,_3,_1, m1,m1,m2,mz, _4,_1,_3,_1, _1,_2,_1,_1,  /* C */
+    m1,m1,m1,m1, _2,_2,_1,_1, m1,m1,m1,m1, m1,m1,m1,m1,  /* D */
+    _2,_2,_2,_2, _2,_2,_2,_2, jz,jz,z7,z2, _1,_1,_1,_1,  /* E */
+    _1,_1,_1,_1, _1,_1,mt,mt, _1,_1,_1,_1, _1,_1,m1,m1   /* F */
+};
+
+/* Two-byte opcode map, indexed by the byte following 0x0f.  The fixed
+ * part counts that byte.  Zero entries are reserved/bad opcodes.
+ */
+static const ushort twobyte_length[256] = {
+    m1,m1,m1,m1, _0,_1,_1,_1, _1,_1,_0,_1, _0,m1,_1,m2,  /* 0 */
+    m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1,  /* 1 */
+    m1,m1,m1,m1, _0,_0,_0,_0, m1,m1,m1,m1, m1,m1,m1,m1,  /* 2 */
+    _1,_1,_1,_1, _1,_1,_0,_0, e3,_0,e3,_0, _0,_0,_0,_0,  /* 3 */
+
+    m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1,  /* 4 */
+    m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1,  /* 5 */
+    m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1,  /* 6 */
+    m2,m2,m2,m2, m1,m1,m1,_1, mx,m1,_0,_0, m1,m1,m1,m1,  /* 7 */
+
+    _5,_5,_5,_5, _5,_5,_5,_5, _5,_5,_5,_5, _5,_5,_5,_5,  /* 8 */
+    m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1,  /* 9 */
+    _1,_1,_1,m1, m2,m1,_0,_0, _1,_1,_1,m1, m2,m1,m1,m1,  /* A */
+    m1,m1,m1,m1, m1,m1,m1,m1, m1,_1,m2,m1, m1,m1,m1,m1,  /* B */
+
+    m1,m1,m2,m1, m2,m2,m2,m1, _1,_1,_1,_1, _1,_1,_1,_1,  /* C */
+    m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1,  /* D */
+    m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1,  /* E */
+    m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,m1, m1,m1,m1,_0   /* F */
+};
+
+/* Three-byte opcode maps 0f 38 and 0f 3a, indexed by the second
+ * opcode byte's bit 1 (0x38 or 0x3a).  So far every instruction in
+ * these maps has a modrm byte and every 0f 3a instruction has a 1-byte
+ * immed, so one entry describes a whole map.  The fixed part counts the
+ * third opcode byte.
+ */
+static const ushort threebyte_length[2] = {
+    m1, /* 0f 38 */
+    m2, /* 0f 3a */
+};
+
+/* eliminate the macros */
+#undef _0
+#undef _1
+#undef _2
+#undef _3
+#undef _4
+#undef _5
+#undef m1
+#undef m2
+#undef mz
+#undef z2
+#undef z5
+#undef z7
+#undef jz
+#undef mo
+#undef iq
+#undef mt
+#undef es
+#undef e3
+#undef mx
+
+/* Size of the modrm byte plus any sib and displacement, indexed by
+ * MODRM_INDEX(modrm), i.e., by mod and r/m.  A MODRM_SIB_DISP entry
+ * grows by 4 when the sib base is 5 (disp32(,index,s));
+ * MODRM_RIP_REL marks rip-relative addressing in x64 mode.
+ */
+enum {
+    MODRM_LEN_MASK = 0x07,
+    MODRM_SIB_DISP = 0x08,
+    MODRM_RIP_REL  = 0x10,
+};
+#define MODRM_INDEX(modrm) ((((modrm) >> 3) & 0x18) | ((modrm) & 0x7))
+
+static const byte modrm_length[32] = {
+    1,1,1,1, 2|MODRM_SIB_DISP,5|MODRM_RIP_REL,1,1,  /* mod 0 */
+    2,2,2,2, 3,2,2,2,                               /* mod 1 */
+    5,5,5,5, 6,5,5,5,                               /* mod 2 */
+    1,1,1,1, 1,1,1,1,                               /* mod 3 */
+};
+
+/* 16-bit addressing forms, for an addr16 prefix in 32-bit mode */
+static const byte modrm16_length[32] = {
+    1,1,1,1, 1,1,3,1,  /* mod 0 */
+    2,2,2,2, 2,2,2,2,  /* mod 1 */
+    3,3,3,3, 3,3,3,3,  /* mod 2 */
+    1,1,1,1, 1,1,1,1,  /* mod 3 */
+};
+
+static inline int
+sizeof_modrm_fast(byte *pc, bool x64_mode, bool addr16 _IF_X64(byte **rip_rel_pc))
+{
+    uint index = MODRM_INDEX(*pc);
+    uint info;
+    if (addr16 && !x64_mode)
+        return modrm16_length[index];
+    /* for x64, addr16 simply truncates the computed address: there is
+     * no change in disp sizes */
+    info = modrm_length[index];
+#ifdef X64
+    if (TEST(MODRM_RIP_REL, info) && x64_mode)
+        *rip_rel_pc = pc + 1; /* no sib: next 4 bytes are disp */
+#endif
+    if (TEST(MODRM_SIB_DISP, info) && (*(pc+1) & 0x7) == 5)
+        return (info & MODRM_LEN_MASK) + 4;
+    return (info & MODRM_LEN_MASK);
+}
+
+/* Returns the length of the instruction at pc.
+ * If num_prefixes is non-NULL, returns the number of prefix bytes.
+ * If rip_rel_pos is non-NULL, returns the offset into the instruction
+ * of a rip-relative addressing displacement (for data only: ignores
+ * control-transfer relative addressing), or 0 if none.
+ * May return 0 size for certain invalid instructions
+ */
+int
+decode_sizeof(dcontext_t *dcontext, byte *start_pc, int *num_prefixes
+              _IF_X64(uint *rip_rel_pos))
+{
+    byte *pc = start_pc;
+    uint opc = (uint)*pc;
+    uint pfx;
+    uint info;
+    int sz, prefix_bytes;
+    bool x64_mode = X64_MODE_DC(dcontext);
+    /* rex bytes are inc/dec in 32-bit mode */
+    uint pfx_mask = x64_mode ? ~0U : ~((uint)(PFX_REX|PFX_REX_W));
+    bool word_operands = false; /* data16 */
+    bool qword_operands = false; /* rex.w */
+    bool addr16 = false; /* really "addr32" for x64 mode */
+    bool rep_prefix = false;
+#ifdef X64
+    byte *rip_rel_pc = NULL;
+#endif
+
+    /* NOTE - as in decode_sizeof_legacy() and read_instruction() we consider
+     * pre-prefix rex bytes part of the following instr: a rex.w only
+     * survives if nothing but other prefixes follow it, and data16 after
+     * rex.w cancels it (xref PR 241563, PR 271878).
+     */
+    while ((pfx = (prefix_info[opc] & pfx_mask)) != 0) {
+        if (TEST(PFX_REX_W, pfx)) {
+            qword_operands = true;
+            word_operands = false; /* rex.w trumps data16 */
+        } else if (TEST(PFX_DATA16, pfx)) {
+            qword_operands = false; /* rex.w before other prefixes is a nop */
+            word_operands = true;
+        } else if (TEST(PFX_ADDR16, pfx)) {
+            addr16 = true; /* up to caller to check for addr prefix! */
+        } else if (TEST(PFX_REP, pfx))
+            rep_prefix = true;
+        opc = (uint)*(++pc);
+    }
+    prefix_bytes = (int)(pc - start_pc);
+    if (num_prefixes != NULL)
+        *num_prefixes = prefix_bytes;
+    sz = prefix_bytes;
+
+    /* opc now really points to opcode */
+    info = onebyte_length[opc];
+    sz += LEN_FIXED(info);
+    if (TESTANY(LEN_IMMZ|LEN_MOFFS|LEN_TEST_IMM, info)) {
+        if (word_operands && TEST(LEN_IMMZ, info)) {
+            /* for x64 Intel, always 64-bit addr ("f64" in Intel table)
+             * FIXME: what about 2-byte jcc?
+             */
+            if (!(TEST(LEN_REL_F64, info) && x64_mode &&
+                  proc_get_vendor() == VENDOR_INTEL))
+                sz -= 2;
+        }
+        if (TEST(LEN_MOFFS, info)) {
+            if (addr16) /* from 64 down to 32 bits, or 32 down to 16 */
+                sz -= x64_mode ? 4 : 2;
+            if (x64_mode)
+                sz += 4;
+        }
+        if (x64_mode && qword_operands && TEST(LEN_IMM64, info))
+            sz += 4;
+        if (TEST(LEN_TEST_IMM, info) && (*(pc+1) & 0x38) == 0) {
+            /* TEST Eb,ib / TEST Ew,iw / TEST El,il -- add size of immediate */
+            if (opc == 0xf6)
+                sz += 1;
+            else
+                sz += word_operands ? 2 : 4;
+        }
+    }
+
+    /* for a valid instr, sz must be > 0 here, but we don't want to assert
+     * since we need graceful failure
+     */
+    switch (LEN_VAR(info)) {
+    case LEN_VAR_NONE:
+        break;
+    case LEN_VAR_MODRM:
+        sz += sizeof_modrm_fast(pc+1, x64_mode, addr16 _IF_X64(&rip_rel_pc));
+        break;
+    case LEN_VAR_0F:
+        /* no prefix adjustments for 2-byte escapes, other than 0f 78 */
+        opc = (uint)*(++pc);
+        info = twobyte_length[opc];
+        sz += LEN_FIXED(info);
+        if (LEN_VAR(info) == LEN_VAR_MODRM) {
+            sz += sizeof_modrm_fast(pc+1, x64_mode, addr16 _IF_X64(&rip_rel_pc));
+            /* special case: Intel and AMD added size-differing
+             * prefix-dependent instrs!
+             */
+            if (TEST(LEN_0F78_IMM, info) && (word_operands || rep_prefix))
+                sz += 2; /* extrq, insertq: 2 1-byte immeds */
+            /* else, vmread, w/ no immeds */
+        } else if (LEN_VAR(info) == LEN_VAR_0F3X) {
+            info = threebyte_length[(opc >> 1) & 1];
+            sz += LEN_FIXED(info);
+            pc++; /* skip the third opcode byte */
+            sz += sizeof_modrm_fast(pc+1, x64_mode, addr16 _IF_X64(&rip_rel_pc));
+        }
+        break;
+    default:
+        CLIENT_ASSERT(false, "internal decoding error");
+    }
+
+#ifdef X64
+    if (rip_rel_pos != NULL) {
+        if (rip_rel_pc != NULL) {
+            CLIENT_ASSERT(x64_mode, "decode_sizeof: invalid non-x64 rip_rel instr");
+            CLIENT_ASSERT(CHECK_TRUNCATE_TYPE_uint(rip_rel_pc - start_pc),
+                          "decode_sizeof: unknown rip_rel instr type");
+            *rip_rel_pos = (uint) (rip_rel_pc - start_pc);
+        } else
+            *rip_rel_pos = 0;
+    }
+#endif
+
+#ifdef DEBUG
+    /* DOCHECK's DYNAMO_OPTION uses ASSERT, which we can't use in this file */
+    if (DYNAMO_OPTION_NOT_STRING(checklevel) >= 1) {
+        int legacy_prefixes;
+        IF_X64(uint legacy_rip_rel_pos;)
+        CLIENT_ASSERT(decode_sizeof_legacy(dcontext, start_pc, &legacy_prefixes
+                                           _IF_X64(&legacy_rip_rel_pos)) == sz &&
+                      legacy_prefixes == prefix_bytes &&
+                      IF_X64_ELSE((rip_rel_pos == NULL ||
+                                   legacy_rip_rel_pos == *rip_rel_pos), true),
+                      "decode_sizeof: table decoder disagrees with legacy decoder");
+    }
+#endif
+
+    return sz;
+}
 
 
 /* Table indicating "interesting" instructions, i.e., ones we
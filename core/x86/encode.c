@@ -44,6 +44,7 @@
 #include "decode_fast.h"
 
 #include "string_wrapper.h" /* memcpy, memset */
+#include "limits_wrapper.h" /* SCHAR_MIN, etc. */
 
 #ifdef DEBUG
 /* case 10450: give messages to clients */
@@ -1032,6 +1033,199 @@ encoding_possible(decode_info_t *di, instr_t *in, const instr_info_t * ii)
     return true;
 }
 
+/* Template memo.  The first template in an opcode's instr_info_t chain that
+ * encoding_possible() accepts depends only on what the operand type checks
+ * look at: operand kinds, sizes and registers, which sizes an immediate,
+ * displacement or address fits in, and the mode and prefixes.  We pack
+ * exactly that into a key and remember how far down the chain the first
+ * match was, so the common case makes one encoding_possible() call instead
+ * of one per rejected template.  A hit must match the whole stored key, not
+ * just its hash: encoding_possible() on the memoized template can't tell us
+ * it is the first one that fits.
+ * Entries span several words, so each has a sequence number that is odd
+ * while a writer owns it; readers that see it odd or changed just miss.
+ */
+#define ENCODE_MEMO_BITS 10
+#define ENCODE_MEMO_SIZE (1 << ENCODE_MEMO_BITS)
+#define ENCODE_MEMO_MAX_OPNDS 6
+#define ENCODE_MEMO_KEY_WORDS (2 + ENCODE_MEMO_MAX_OPNDS)
+
+typedef struct _encode_memo_entry_t {
+    volatile uint seq; /* odd while being written */
+    volatile uint pos; /* 1-based position in the template chain, 0 if empty */
+    volatile uint64 key[ENCODE_MEMO_KEY_WORDS];
+} encode_memo_entry_t;
+
+DECLARE_NEVERPROT_VAR(static encode_memo_entry_t encode_memo[ENCODE_MEMO_SIZE],
+                      {{0}});
+
+/* Which immediate sizes val can be encoded in: see immed_size_ok() */
+static inline uint64
+encode_value_class(ptr_int_t val)
+{
+    return ((val == 0 ? 0x01 : 0) |
+            (val == 1 ? 0x02 : 0) |
+            (val >= SCHAR_MIN && val <= SCHAR_MAX ? 0x04 : 0) |
+            (val >= 0 && val <= UCHAR_MAX ? 0x08 : 0) |
+            (val >= SHRT_MIN && val <= SHRT_MAX ? 0x10 : 0) |
+            (val >= 0 && val <= USHRT_MAX ? 0x20 : 0) |
+            (val >= INT_MIN && val <= INT_MAX ? 0x40 : 0) |
+            (val >= 0 && (ptr_uint_t)val <= UINT_MAX ? 0x80 : 0));
+}
+
+static uint64
+encode_opnd_key(opnd_t opnd)
+{
+    uint64 key = opnd.kind;
+    if (opnd_is_reg(opnd))
+        key |= (uint64)opnd_get_reg(opnd) << 8;
+    else if (opnd_is_immed_int(opnd)) {
+        key |= ((uint64)opnd_get_size(opnd) << 8) |
+            (encode_value_class(opnd_get_immed_int(opnd)) << 16);
+    }
+    else if (opnd_is_pc(opnd)) /* includes far pc */
+        key |= encode_value_class((ptr_int_t)opnd_get_pc(opnd)) << 16;
+    else if (opnd_is_base_disp(opnd)) {
+        key |= ((uint64)opnd_get_size(opnd) << 8) |
+            (encode_value_class(opnd_get_disp(opnd)) << 16) |
+            ((uint64)opnd_get_segment(opnd) << 24) |
+            ((uint64)opnd_get_base(opnd) << 32) |
+            ((uint64)opnd_get_index(opnd) << 40) |
+            ((uint64)opnd_get_scale(opnd) << 48) |
+            ((uint64)((opnd_is_disp_encode_zero(opnd) ? 0x4 : 0) |
+                      (opnd_is_disp_force_full(opnd) ? 0x2 : 0) |
+                      (opnd_is_disp_short_addr(opnd) ? 0x1 : 0)) << 56);
+    }
+#ifdef X64
+    else if (opnd_is_rel_addr(opnd) || opnd_is_abs_addr(opnd)) {
+        key |= ((uint64)opnd_get_size(opnd) << 8) |
+            (encode_value_class((ptr_int_t)opnd_get_addr(opnd)) << 16) |
+            ((uint64)opnd_get_segment(opnd) << 24);
+    }
+#endif
+    return key;
+}
+
+/* Fills key for in and returns its hash, or returns false if in has too many
+ * operands to memoize.
+ */
+static bool
+encode_template_key(decode_info_t *di, instr_t *in, uint64 *key, uint *hash)
+{
+    uint64 h = 0xcbf29ce484222325ULL;
+    int i, n = 0;
+    if (in->num_dsts + in->num_srcs > ENCODE_MEMO_MAX_OPNDS)
+        return false;
+    key[n++] = di->prefixes IF_X64(| ((uint64)di->x86_mode << 32));
+    key[n++] = ((uint64)in->opcode << 16) | (in->num_dsts << 8) | in->num_srcs;
+    for (i = 0; i < in->num_dsts; i++)
+        key[n++] = encode_opnd_key(instr_get_dst(in, i));
+    for (i = 0; i < in->num_srcs; i++)
+        key[n++] = encode_opnd_key(instr_get_src(in, i));
+    while (n < ENCODE_MEMO_KEY_WORDS)
+        key[n++] = 0;
+    for (i = 0; i < ENCODE_MEMO_KEY_WORDS; i++) {
+        /* FNV-1a on whole words */
+        h = (h ^ key[i]) * 0x100000001b3ULL;
+    }
+    *hash = (uint)(h ^ (h >> 32));
+    return true;
+}
+
+/* Returns the memoized chain position for key, or 0 on a miss */
+static uint
+encode_memo_lookup(encode_memo_entry_t *entry, uint64 *key)
+{
+    uint seq = entry->seq;
+    uint pos;
+    int i;
+    if (TEST(1, seq))
+        return 0;
+    pos = entry->pos;
+    for (i = 0; i < ENCODE_MEMO_KEY_WORDS; i++) {
+        if (entry->key[i] != key[i])
+            return 0;
+    }
+    /* x86 keeps our loads in order, so an unchanged seq means no writer
+     * touched the entry while we read it
+     */
+    if (entry->seq != seq)
+        return 0;
+    return pos;
+}
+
+static void
+encode_memo_store(encode_memo_entry_t *entry, uint64 *key, uint pos)
+{
+    uint seq = entry->seq;
+    int i;
+    /* another writer owns it: just skip memoizing */
+    if (TEST(1, seq) ||
+        !atomic_compare_exchange_int((volatile int *)&entry->seq, (int)seq,
+                                     (int)seq + 1))
+        return;
+    entry->pos = pos;
+    for (i = 0; i < ENCODE_MEMO_KEY_WORDS; i++)
+        entry->key[i] = key[i];
+    entry->seq = seq + 2;
+}
+
+/* Walks info's chain for the first template that can encode in, as the
+ * decode tables order them.  Returns NULL if none can.
+ */
+static const instr_info_t *
+find_encoding_template(dcontext_t *dcontext, decode_info_t *di, instr_t *in,
+                       const instr_info_t *info)
+{
+    const instr_info_t *head = info;
+    uint orig_prefixes = di->prefixes;
+    uint64 key[ENCODE_MEMO_KEY_WORDS];
+    encode_memo_entry_t *entry = NULL;
+    uint hash, pos;
+
+    if (encode_template_key(di, in, key, &hash)) {
+        entry = &encode_memo[hash & (ENCODE_MEMO_SIZE - 1)];
+        pos = encode_memo_lookup(entry, key);
+        if (pos > 0) {
+            for (pos--; pos > 0 && info != NULL; pos--)
+                info = get_next_instr_info(info);
+            /* also sets di's size prefixes, so this is required even on a hit */
+            if (info != NULL && info->opcode != OP_CONTD &&
+                encoding_possible(di, in, info)) {
+                DOCHECK(1, {
+                    /* the chain walk must agree, or the key is missing
+                     * something that encoding_possible() depends on
+                     */
+                    decode_info_t check_di = *di;
+                    const instr_info_t *check = head;
+                    check_di.prefixes = orig_prefixes;
+                    while (check != NULL && check->opcode != OP_CONTD &&
+                           !encoding_possible(&check_di, in, check))
+                        check = get_next_instr_info(check);
+                    CLIENT_ASSERT(check == info, "encode template memo mismatch");
+                });
+                return info;
+            }
+            info = head;
+            di->prefixes = orig_prefixes;
+        }
+    }
+
+    pos = 1;
+    while (!encoding_possible(di, in, info)) {
+        LOG(THREAD, LOG_EMIT, ENC_LEVEL, "\tencoding for 0x%x no good...\n",
+            info->opcode);
+        info = get_next_instr_info(info);
+        /* stop when hit end of list or when hit extra operand tables (OP_CONTD) */
+        if (info == NULL || info->opcode == OP_CONTD)
+            return NULL;
+        pos++;
+    }
+    if (entry != NULL)
+        encode_memo_store(entry, key, pos);
+    return info;
+}
+
 /* exported, looks at all possible instr_info_t templates
  */
 bool
@@ -1050,15 +1244,7 @@ get_encoding_info(instr_t *instr)
     const instr_info_t * info = instr_get_instr_info(instr);
     decode_info_t di = {0};
     IF_X64(di.x86_mode = instr_get_x86_mode(instr));
-
-    while (!encoding_possible(&di, instr, info)) {
-        info = get_next_instr_info(info);
-        /* stop when hit end of list or when hit extra operand tables (OP_CONTD) */
-        if (info == NULL || info->opcode == OP_CONTD) {
-            return NULL;
-        }
-    }
-    return info;
+    return find_encoding_template(get_thread_private_dcontext(), &di, instr, info);
 }
 
 /* num is 0-based */
@@ -1931,22 +2117,18 @@ instr_encode_common(dcontext_t *dcontext, instr_t *instr, byte *pc,
      */
     di.prefixes = instr->prefixes;
 
-    while (!encoding_possible(&di, instr, info)) {
-        LOG(THREAD, LOG_EMIT, ENC_LEVEL, "\tencoding for 0x%x no good...\n", info->opcode);
-        info = get_next_instr_info(info);
-        /* stop when hit end of list or when hit extra operand tables (OP_CONTD) */
-        if (info == NULL || info->opcode == OP_CONTD) {
+    info = find_encoding_template(dcontext, &di, instr, info);
+    if (info == NULL) {
 #ifdef DEBUG
-            LOG(THREAD, LOG_EMIT, 1, "ERROR: Could not find encoding for: ");
-            instr_disassemble(dcontext, instr, THREAD);
-            LOG(THREAD, LOG_EMIT, 1, "\n");
+        LOG(THREAD, LOG_EMIT, 1, "ERROR: Could not find encoding for: ");
+        instr_disassemble(dcontext, instr, THREAD);
+        LOG(THREAD, LOG_EMIT, 1, "\n");
 #endif
-            CLIENT_ASSERT(false, "instr_encode error: no encoding found");
-            /* FIXME: since labels (case 4468) have a legal length 0
-             * we may want to return a separate status code for failure.
-             */
-            return NULL;
-        }
+        CLIENT_ASSERT(false, "instr_encode error: no encoding found");
+        /* FIXME: since labels (case 4468) have a legal length 0
+         * we may want to return a separate status code for failure.
+         */
+        return NULL;
     }
 
     /* fill out the other fields of di */
@@ -2270,7 +2452,7 @@ instrlist_encode(dcontext_t *dcontext, instrlist_t *ilist, byte *pc,
         /* must set note fields first with offset */
         for (inst = instrlist_first(ilist); inst; inst = instr_get_next(inst)) {
             instr_set_note(inst, (void *)(ptr_int_t)len);
-            len += instr_length(dcontext, inst);
+            len += instr_length_for_emit(dcontext, inst);
         }
     }
     for (inst = instrlist_first(ilist); inst; inst = instr_get_next(inst)) {
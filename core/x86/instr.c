@@ -1799,22 +1799,82 @@ instr_build_bits(dcontext_t *dcontext, int opcode, uint num_bytes)
 }
 
 
+/* Returns whether instr's encoding is the same wherever it is placed, so
+ * that its raw bits can be cached even for a meta instr.  Excludes ctis and
+ * any operand whose encoding depends on the instr's own address.
+ */
+static bool
+instr_encoding_is_position_independent(instr_t *instr)
+{
+    int i;
+    if (instr_is_cti(instr))
+        return false;
+    for (i = 0; i < instr_num_dsts(instr); i++) {
+        opnd_t op = instr_get_dst(instr, i);
+        if (opnd_is_pc(op) || opnd_is_instr(op) IF_X64(|| opnd_is_rel_addr(op)))
+            return false;
+    }
+    for (i = 0; i < instr_num_srcs(instr); i++) {
+        opnd_t op = instr_get_src(instr, i);
+        if (opnd_is_pc(op) || opnd_is_instr(op) IF_X64(|| opnd_is_rel_addr(op)))
+            return false;
+    }
+    return true;
+}
+
+/* Caches the encoding of a meta instr that encodes identically anywhere,
+ * for an emit that will then just copy it.  With no pc-relative operands
+ * reachability doesn't matter, so we can encode on the stack and copy
+ * straight into the instr's raw-bits buffer, which instr_allocate_raw_bits()
+ * keeps if the instr already has one of this length.
+ */
+static int
+private_instr_encode_position_independent(dcontext_t *dcontext, instr_t *instr)
+{
+    byte buf[32]; /* max instr length is 17 bytes */
+    byte *nxt = instr_encode_ignore_reachability(dcontext, instr, buf);
+    uint len;
+    if (nxt == NULL) {
+        SYSLOG_INTERNAL_WARNING("cannot encode %s\n", op_instr[instr->opcode]->name);
+        return 0;
+    }
+    len = (int) (nxt - buf);
+    CLIENT_ASSERT(len < 32, "encode instr for length/eflags error: instr too long");
+    ASSERT_CURIOSITY(len >= 0 && len < 18);
+    if (len > 0) {
+        bool valid = instr_operands_valid(instr);
+        CLIENT_ASSERT(!instr_raw_bits_valid(instr),
+                      "encode instr: bit validity error"); /* else shouldn't get here */
+        instr_allocate_raw_bits(dcontext, instr, len);
+        memcpy(instr->bytes, buf, len);
+        instr_set_operands_valid(instr, valid);
+    }
+    return len;
+}
+
 /* encodes to buffer, then returns length.
  * needed for things we must have encoding for: length and eflags.
- * if !always_cache, only caches the encoding if instr_ok_to_mangle();
+ * if !always_cache, only caches the encoding if instr_ok_to_mangle(), or
+ * if cache_meta and the encoding is position independent;
  * if always_cache, the caller should invalidate the cache when done.
  */
 static int
-private_instr_encode(dcontext_t *dcontext, instr_t *instr, bool always_cache)
+private_instr_encode(dcontext_t *dcontext, instr_t *instr, bool always_cache,
+                     bool cache_meta)
 {
+    byte *buf;
+    uint len;
+    byte *nxt;
+    bool valid_to_cache = true;
+    if (cache_meta && !always_cache && !instr_ok_to_mangle(instr) &&
+        instr_encoding_is_position_independent(instr))
+        return private_instr_encode_position_independent(dcontext, instr);
     /* we cannot use a stack buffer for encoding since our stack on x64 linux
      * can be too far to reach from our heap
      */
-    byte *buf = heap_alloc(dcontext, 32 /* max instr length is 17 bytes */
-                           HEAPACCT(ACCT_IR));
-    uint len;
-    byte *nxt = instr_encode_check_reachability(dcontext, instr, buf);
-    bool valid_to_cache = true;
+    buf = heap_alloc(dcontext, 32 /* max instr length is 17 bytes */
+                     HEAPACCT(ACCT_IR));
+    nxt = instr_encode_check_reachability(dcontext, instr, buf);
     if (nxt == NULL) {
         nxt = instr_encode_ignore_reachability(dcontext, instr, buf);
         if (nxt == NULL) {
@@ -1832,7 +1892,8 @@ private_instr_encode(dcontext_t *dcontext, instr_t *instr, bool always_cache)
     ASSERT_CURIOSITY(len >= 0 && len < 18);
 
     /* do not cache encoding if mangle is false, that way we can have
-     * non-cti-instructions that are pc-relative.
+     * non-cti-instructions that are pc-relative (position-independent ones
+     * were handled above).
      * we also cannot cache if a rip-relative operand is unreachable.
      * we can cache if a rip-relative operand is present b/c instr_encode()
      * sets instr_set_rip_rel_pos() for us.
@@ -2240,6 +2301,23 @@ instr_set_meta_may_fault(instr_t *instr, bool val)
         instr->flags &= ~INSTR_META_MAY_FAULT;
 }
 
+bool
+instr_is_cold(instr_t *instr)
+{
+    return !instr_ok_to_mangle(instr) && TEST(INSTR_COLD, instr->flags);
+}
+
+void
+instr_set_cold(instr_t *instr, bool val)
+{
+    CLIENT_ASSERT(!val || !instr_ok_to_mangle(instr),
+                  "instr_set_cold: only meta instrs can be cold");
+    if (val)
+        instr->flags |= INSTR_COLD;
+    else
+        instr->flags &= ~INSTR_COLD;
+}
+
 /* convenience routine */
 void
 instr_set_meta_no_translation(instr_t *instr)
@@ -2327,7 +2405,8 @@ instr_get_eflags(instr_t *instr)
         if (instr_needs_encoding(instr)) {
             int len;
             encoded = true;
-            len = private_instr_encode(dcontext, instr, true/*cache*/);
+            len = private_instr_encode(dcontext, instr, true/*cache*/,
+                                       false/*no meta*/);
             if (len == 0) {
                 if (!instr_is_label(instr))
                     CLIENT_ASSERT(false, "instr_get_eflags: invalid instr");
@@ -2712,8 +2791,8 @@ instr_set_prev(instr_t *instr, instr_t *prev)
     instr->prev = prev;
 }
 
-int
-instr_length(dcontext_t *dcontext, instr_t *instr)
+static int
+instr_length_common(dcontext_t *dcontext, instr_t *instr, bool for_emit)
 {
     if (!instr_needs_encoding(instr))
         return instr->length;
@@ -2752,7 +2831,25 @@ instr_length(dcontext_t *dcontext, instr_t *instr)
     }
 
     /* else, encode to find length */
-    return private_instr_encode(dcontext, instr, false/*don't need to cache*/);
+    return private_instr_encode(dcontext, instr, false/*don't need to cache*/,
+                                for_emit);
+}
+
+int
+instr_length(dcontext_t *dcontext, instr_t *instr)
+{
+    return instr_length_common(dcontext, instr, false/*!for_emit*/);
+}
+
+/* Like instr_length(), but for an instr that is about to be encoded, as in
+ * the offset pass ahead of an emit: this also caches the raw bits of meta
+ * instrs whose encoding doesn't depend on their placement, so the encode
+ * that follows is a copy.
+ */
+int
+instr_length_for_emit(dcontext_t *dcontext, instr_t *instr)
+{
+    return instr_length_common(dcontext, instr, true/*for_emit*/);
 }
 
 /***********************************************************************/
@@ -1438,6 +1438,8 @@ enum {
     INSTR_BRANCH_SELFMOD_EXIT   = LINK_SELFMOD_EXIT,
 #ifdef UNSUPPORTED_API
     INSTR_BRANCH_TARGETS_PREFIX = LINK_TARGET_PREFIX,
+#elif defined(LINUX) && !defined(LINUX_KERNEL)
+    INSTR_BRANCH_SIGNAL_CHECK   = LINK_SIGNAL_CHECK,
 #endif
 #ifdef X64
     /* PR 257963: since we don't store targets of ind branches, we need a flag
@@ -1464,6 +1466,8 @@ enum {
                                    INSTR_BRANCH_SELFMOD_EXIT |
 #ifdef UNSUPPORTED_API
                                    INSTR_BRANCH_TARGETS_PREFIX |
+#elif defined(LINUX) && !defined(LINUX_KERNEL)
+                                   INSTR_BRANCH_SIGNAL_CHECK |
 #endif
 #ifdef X64
                                    INSTR_TRACE_CMP_EXIT |
@@ -1493,6 +1497,11 @@ enum {
     INSTR_HAS_CUSTOM_STUB       = 0x00400000,
     /* used to indicate that an indirect call can be treated as a direct call */
     INSTR_IND_CALL_DIRECT       = 0x00800000,
+    /* Client meta code that rarely runs: laid out after the fragment's exits.
+     * Only app calls are INSTR_IND_CALL_DIRECT and only meta instrs can be
+     * cold, so the two share a bit; instr_is_cold() checks for meta.
+     */
+    INSTR_COLD                  = 0x00800000,
 #ifdef WINDOWS
     /* used to indicate that a syscall should be executed via shared syscall */
     INSTR_SHARED_SYSCALL        = 0x01000000,
@@ -1857,6 +1866,29 @@ DR_API
 void
 instr_set_meta_may_fault(instr_t *instr, bool val);
 
+DR_API
+/**
+ * Return true iff \p instr is marked as cold (see instr_set_cold()).
+ */
+bool
+instr_is_cold(instr_t *instr);
+
+DR_API
+/**
+ * Sets whether \p instr, a meta-instruction, is rarely executed.  With the
+ * -move_cold_code option, each run of consecutive cold instructions is moved
+ * past the fragment's final exit,
+ * next to its exit stubs, so that the commonly executed code stays dense
+ * in the instruction cache.  A cold run must only be entered by branches
+ * and must end in an unconditional jump, so that it is correct wherever it
+ * is placed.  The hot path should jump over it: if the cold run is moved,
+ * that jump is removed.  A slow path that calls out to a shared routine and
+ * jumps back is the typical use.  dr_moving_cold_code() says whether runs
+ * will be moved.
+ */
+void
+instr_set_cold(instr_t *instr, bool val);
+
 DR_API
 /**
  * Allocates \p num_bytes of memory for \p instr's raw bits.
@@ -2018,6 +2018,14 @@ dr_using_all_private_caches(void)
     return !SHARED_FRAGMENTS_ENABLED();
 }
 
+DR_API
+/* Returns true if runs of instr_set_cold() instrs are moved past the final exit. */
+bool
+dr_moving_cold_code(void)
+{
+    return DYNAMO_OPTION(move_cold_code);
+}
+
 DR_API
 void
 dr_request_synchronized_exit(void)
@@ -1430,6 +1430,16 @@ DR_API
 bool
 dr_using_all_private_caches(void);
 
+DR_API
+/**
+ * Returns true if runs of meta-instructions marked with instr_set_cold() are
+ * moved past the final exit of the fragments that contain them (the
+ * -move_cold_code option).  Otherwise they execute in place, and the hot
+ * path is better off branching over them with a short jump.
+ */
+bool
+dr_moving_cold_code(void);
+
 DR_API
 /**
  * Enables the -synch_at_exit runtime option, which guarantees that no
@@ -3220,6 +3220,14 @@ build_bb_ilist(dcontext_t *dcontext, build_bb_t *bb)
     }
 #endif
 
+#ifdef INTERNAL
+    /* before the client sees it, so clients and traces both see the result.
+     * this is redone on every rebuild of the bb, keeping translation exact.
+     */
+    if (DYNAMO_OPTION(optimize_bbs))
+        optimize_bb(dcontext, bb->start_pc, bb->ilist);
+#endif
+
 #ifdef CLIENT_INTERFACE
     client_process_bb(dcontext, bb, &ibl_branch_type);
     if (bb->unmangled_ilist != NULL)
@@ -3489,6 +3497,81 @@ bb_build_abort(dcontext_t *dcontext, bool clean_vmarea)
 /* returns false if need to rebuild bb: in that case this routine will
  * set the bb flags needed to ensure successful mangling 2nd time around
  */
+#ifdef CLIENT_INTERFACE
+/* Returns whether any instr in ilist has an instr operand that is target */
+static bool
+instrlist_refers_to(instrlist_t *ilist, instr_t *target)
+{
+    instr_t *inst;
+    int i;
+    for (inst = instrlist_first(ilist); inst != NULL; inst = instr_get_next(inst)) {
+        for (i = 0; i < instr_num_srcs(inst); i++) {
+            if (opnd_is_instr(instr_get_src(inst, i)) &&
+                opnd_get_instr(instr_get_src(inst, i)) == target)
+                return true;
+        }
+        for (i = 0; i < instr_num_dsts(inst); i++) {
+            if (opnd_is_instr(instr_get_dst(inst, i)) &&
+                opnd_get_instr(instr_get_dst(inst, i)) == target)
+                return true;
+        }
+    }
+    return false;
+}
+
+/* Moves each run of client code marked with instr_set_cold() to the end of
+ * ilist, past the final exit, so the hot path is contiguous.  If the hot
+ * path jumped over a run, the jump goes away with it.  Since decode_fragment()
+ * can't handle code past the final exit, callers leave bbs for traces alone:
+ * mangle_trace() moves the cold code for the whole trace instead.
+ */
+static void
+move_cold_code(dcontext_t *dcontext, instrlist_t *ilist)
+{
+    instr_t *inst, *next, *last, *before, *after;
+    instr_t *end = instrlist_last(ilist);
+    instrlist_t cold;
+    instrlist_init(&cold);
+    for (inst = instrlist_first(ilist); inst != NULL; inst = next) {
+        if (!instr_is_cold(inst)) {
+            next = (inst == end) ? NULL : instr_get_next(inst);
+            continue;
+        }
+        /* find the end of this run */
+        for (last = inst; last != end && instr_is_cold(instr_get_next(last));
+             last = instr_get_next(last))
+            ; /* nothing */
+        if (last == end) /* already at the end */
+            break;
+        CLIENT_ASSERT(instr_is_ubr(last) || instr_get_opcode(last) == OP_jmp_ind,
+                      "cold code must end in an unconditional jump");
+        before = instr_get_prev(inst);
+        after = instr_get_next(last);
+        next = after;
+        do {
+            instr_t *move = inst;
+            CLIENT_ASSERT(!instr_ok_to_mangle(move), "only meta instrs can be cold");
+            inst = (move == last) ? NULL : instr_get_next(move);
+            instrlist_remove(ilist, move);
+            instrlist_append(&cold, move);
+        } while (inst != NULL);
+        if (before != NULL && !instr_ok_to_mangle(before) && !instr_is_cold(before) &&
+            instr_is_ubr(before) && opnd_is_instr(instr_get_target(before)) &&
+            opnd_get_instr(instr_get_target(before)) == after &&
+            /* the jmp may itself be a branch target */
+            !instrlist_refers_to(ilist, before) && !instrlist_refers_to(&cold, before)) {
+            instrlist_remove(ilist, before);
+            instr_destroy(dcontext, before);
+        }
+        STATS_INC(num_cold_runs_moved);
+    }
+    while ((inst = instrlist_first(&cold)) != NULL) {
+        instrlist_remove(&cold, inst);
+        instrlist_append(ilist, inst);
+    }
+}
+#endif
+
 static bool
 mangle_bb_ilist(dcontext_t *dcontext, build_bb_t *bb)
 {
@@ -3533,6 +3616,22 @@ mangle_bb_ilist(dcontext_t *dcontext, build_bb_t *bb)
         instrlist_disassemble(dcontext, bb->start_pc, bb->ilist, THREAD);
     });
     mangle(dcontext, bb->ilist, bb->flags, true, bb->record_translation);
+#ifdef INLINE_SIGNAL_CHECKS
+    /* Coarse-grain exits can't carry LINK_SIGNAL_CHECK, so coarse units keep
+     * unlink-based delivery.
+     */
+    if (DYNAMO_OPTION(signal_checks_inline) && !TEST(FRAG_COARSE_GRAIN, bb->flags) &&
+        instrlist_first(bb->ilist) != NULL) {
+        mangle_insert_signal_check(dcontext, bb->ilist, instrlist_first(bb->ilist),
+                                   bb->start_pc, bb->record_translation);
+    }
+#endif
+#ifdef CLIENT_INTERFACE
+    /* coarse units can't have code past the final exit (PR 213005) */
+    if (DYNAMO_OPTION(move_cold_code) && !bb->for_trace &&
+        !TEST(FRAG_COARSE_GRAIN, bb->flags))
+        move_cold_code(dcontext, bb->ilist);
+#endif
     DOLOG(4, LOG_INTERP, {
         LOG(THREAD, LOG_INTERP, 4, "bb ilist after mangling:\n");
         instrlist_disassemble(dcontext, bb->start_pc, bb->ilist, THREAD);
@@ -4048,7 +4147,7 @@ init_interp_build_bb(dcontext_t *dcontext, build_bb_t *bb, app_pc start,
     init_build_bb(bb, start, true/*real interp*/, true/*for cache*/, true/*mangle*/, 
                   false /* translation: set below for clients */,
                   INVALID_FILE, initial_flags |
-                  (INTERNAL_OPTION(store_translations) ?
+                  (DYNAMO_OPTION(store_translations) ?
                    FRAG_HAS_TRANSLATION_INFO : 0), NULL/*no overlap*/);
     if (!TEST(FRAG_TEMP_PRIVATE, initial_flags))
         bb->has_bb_building_lock = true;
@@ -4272,6 +4371,52 @@ recreate_bb_ilist(dcontext_t *dcontext, byte *pc, uint flags, uint *res_flags,
     return bb.ilist;
 }
 
+/* Re-appends the last-exit speculation that end_and_emit_trace() added to
+ * trace f (case 4718), so that cache offsets past the final ibl exit line up
+ * with the recreated ilist.  The speculated targets are not stored anywhere
+ * else: they are the extra direct exits of f beyond those of ilist, in the
+ * order they were added.
+ */
+static void
+recreate_trace_speculation(dcontext_t *dcontext, fragment_t *f, instrlist_t *ilist)
+{
+    app_pc targets[IF_X64_ELSE(IBL_PROFILE_TARGETS, 1)];
+    uint num_targets = 0;
+    uint num_exits = 0;
+    instr_t *inst;
+    linkstub_t *l;
+
+    if (TEST(FRAG_FAKE, f->flags))
+        return;
+    for (inst = instrlist_first(ilist); inst != NULL; inst = instr_get_next(inst)) {
+        if (instr_is_exit_cti(inst))
+            num_exits++;
+    }
+    for (l = FRAGMENT_EXIT_STUBS(f); l != NULL; l = LINKSTUB_NEXT_EXIT(l)) {
+        if (num_exits > 0) {
+            num_exits--;
+            continue;
+        }
+        ASSERT(LINKSTUB_DIRECT(l->flags));
+        if (num_targets >= BUFFER_SIZE_ELEMENTS(targets)) {
+            ASSERT_NOT_REACHED();
+            break;
+        }
+        targets[num_targets++] = EXIT_TARGET_TAG(dcontext, f, l);
+    }
+    if (num_targets == 0)
+        return;
+    LOG(THREAD, LOG_INTERP, 3, "	re-adding %d speculated ibl target(s) to F%d\n",
+        num_targets, f->id);
+#ifdef X64
+    append_trace_speculate_ibl_targets(dcontext, ilist, targets, num_targets,
+                                       true/*record translation*/);
+#else
+    append_trace_speculate_last_ibl(dcontext, ilist, targets[0],
+                                    true/*record translation*/);
+#endif
+}
+
 /* Re-creates an ilist of the fragment that currently contains the
  * passed-in code cache pc, also returns the fragment.
  *
@@ -4469,6 +4614,9 @@ recreate_fragment_ilist(dcontext_t *dcontext, byte *pc,
                 }
             } /* else we mangled one bb at a time up above */
 
+            /* end_and_emit_trace() speculates before optimizing */
+            recreate_trace_speculation(dcontext, f, ilist);
+
 #ifdef INTERNAL
             /* we only optimize traces */
             if (dynamo_options.optimize) {
@@ -4489,9 +4637,6 @@ recreate_fragment_ilist(dcontext_t *dcontext, byte *pc,
             }
 #endif
 
-            /* FIXME: case 4718 append_trace_speculate_last_ibl(true)
-             * should be called as well 
-             */
             if (PAD_FRAGMENT_JMPS(f->flags))
                 nop_pad_ilist(dcontext, f, ilist, false /* set translation */);
         }
@@ -5462,6 +5607,170 @@ append_trace_speculate_last_ibl(dcontext_t *dcontext, instrlist_t *trace,
     return added_size;
 }
 
+#ifdef X64
+/* x64 version of append_trace_speculate_last_ibl() that compares against a
+ * chain of targets, the first being the one seen when the trace was built and
+ * the rest coming from the per-branch profile kept by the monitor.
+ * Returns additional size to add to trace estimate.
+ */
+int
+append_trace_speculate_ibl_targets(dcontext_t *dcontext, instrlist_t *trace,
+                                   app_pc *targets, uint num_targets,
+                                   bool record_translation)
+{
+    int added_size = 0;
+    uint i;
+    instr_t *targeter = instrlist_last(trace); /* the IBL exit */
+    instr_t *next = instr_get_next(targeter);
+    instr_t *match[IBL_PROFILE_TARGETS];
+    bool save_flags = !DYNAMO_OPTION(unsafe_ignore_eflags_trace);
+    bool save_of = save_flags && !INTERNAL_OPTION(unsafe_ignore_overflow);
+#ifdef HASHTABLE_STATISTICS
+    ibl_type_t ibl_type;
+    DEBUG_DECLARE(bool ok;)
+#endif
+
+    ASSERT(num_targets > 0 && num_targets <= IBL_PROFILE_TARGETS);
+    ASSERT(targeter != NULL && instr_is_exit_cti(targeter));
+#ifdef HASHTABLE_STATISTICS
+    DEBUG_DECLARE(ok = )
+        get_ibl_routine_type(dcontext, opnd_get_pc(instr_get_target(targeter)),
+                             &ibl_type);
+    ASSERT(ok);
+#endif
+
+    if (record_translation)
+        instrlist_set_translation_target(trace, instr_get_translation(targeter));
+    instrlist_set_our_mangling(trace, true); /* PR 267260 */
+
+    STATS_INC(num_traces_end_at_ibl_speculative_link);
+
+#ifdef HASHTABLE_STATISTICS
+    DOSTATS({
+        if (INTERNAL_OPTION(speculate_last_exit_stats)) {
+            int tls_stat_scratch_slot = os_tls_offset(HTABLE_STATS_SPILL_SLOT);
+            added_size += tracelist_add
+                (dcontext, trace, targeter, INSTR_CREATE_mov_st
+                 (dcontext, opnd_create_tls_slot(tls_stat_scratch_slot),
+                  opnd_create_reg(REG_XCX)));
+            added_size += insert_increment_stat_counter
+                (dcontext, trace, targeter,
+                 &get_ibl_per_type_statistics(dcontext, ibl_type.branch_type)->
+                 ib_trace_last_ibl_exit);
+            added_size += tracelist_add
+                (dcontext, trace, targeter, INSTR_CREATE_mov_ld
+                 (dcontext, opnd_create_reg(REG_XCX),
+                  opnd_create_tls_slot(tls_stat_scratch_slot)));
+        }
+    });
+#endif
+
+    /* The bb has already spilled xcx and put the app target in it.  We set
+     * up the same state that mangle_indirect_branch_in_trace() hands to the
+     * trace cmp entry of the ibl routine, so a miss anywhere in the chain
+     * continues into the hashtable lookup:
+     *       mov xax, xax-tls-spill-slot
+     *       if !INTERNAL_OPTION(unsafe_ignore_eflags_trace)
+     *         lahf
+     *         seto al
+     *       cmp xcx, $target1
+     *       je match1
+     *       ...
+     *       cmp xcx, $targetN
+     *       je matchN
+     *       jmp ibl-trace-cmp-entry
+     *     match<i>:
+     *       <restore flags, xax and xcx>
+     *       jmp target<i>    # new direct exit
+     * cmp only takes a sign-extended imm32 so farther targets are skipped:
+     * kernel text lives in the top 2GB, where every target qualifies.
+     */
+    added_size += tracelist_add
+        (dcontext, trace, targeter, INSTR_CREATE_mov_st
+         (dcontext, opnd_create_tls_slot(os_tls_offset(PREFIX_XAX_SPILL_SLOT)),
+          opnd_create_reg(REG_XAX)));
+    if (save_flags) {
+        added_size += tracelist_add(dcontext, trace, targeter, INSTR_CREATE_lahf(dcontext));
+        if (save_of) {
+            added_size += tracelist_add
+                (dcontext, trace, targeter,
+                 INSTR_CREATE_setcc(dcontext, OP_seto, opnd_create_reg(REG_AL)));
+        }
+    }
+    for (i = 0; i < num_targets; i++) {
+        instr_t *jcc;
+        match[i] = NULL;
+        if ((ptr_int_t)targets[i] != (ptr_int_t)(int)(ptr_int_t)targets[i]) {
+            STATS_INC(num_speculated_ibl_targets_too_far);
+            continue;
+        }
+        match[i] = INSTR_CREATE_label(dcontext);
+        added_size += tracelist_add
+            (dcontext, trace, targeter,
+             INSTR_CREATE_cmp(dcontext, opnd_create_reg(REG_XCX),
+                              OPND_CREATE_INT32((int)(ptr_int_t)targets[i])));
+        jcc = INSTR_CREATE_jcc(dcontext, OP_jz, opnd_create_instr(match[i]));
+        /* intra-fragment: do not treat as an exit cti */
+        instr_set_ok_to_mangle(jcc, false);
+        added_size += tracelist_add(dcontext, trace, targeter, jcc);
+        STATS_INC(num_speculated_ibl_targets);
+    }
+
+    /* a miss goes to the ibl entry that expects the flags already saved */
+    ASSERT(opnd_is_pc(instr_get_target(targeter)));
+    instr_set_target(targeter, opnd_create_pc
+                     (get_trace_cmp_entry(dcontext, opnd_get_pc
+                                          (instr_get_target(targeter)))));
+    instr_exit_branch_set_type(targeter, instr_exit_branch_type(targeter) |
+                               INSTR_TRACE_CMP_EXIT);
+    /* PR 214962: our spill restoration needs this whole sequence marked mangle */
+    instr_set_our_mangling(targeter, true);
+
+    for (i = 0; i < num_targets; i++) {
+        if (match[i] == NULL)
+            continue;
+        added_size += tracelist_add(dcontext, trace, next, match[i]);
+#ifdef HASHTABLE_STATISTICS
+        DOSTATS({
+            /* xcx is dead until restored below */
+            if (INTERNAL_OPTION(speculate_last_exit_stats)) {
+                added_size += insert_increment_stat_counter
+                    (dcontext, trace, next,
+                     &get_ibl_per_type_statistics(dcontext, ibl_type.branch_type)->
+                     ib_trace_last_ibl_speculate_success);
+            }
+        });
+#endif
+        if (save_flags) {
+            if (save_of) {
+                /* restore OF using add that overflows if OF was on when we did seto */
+                added_size += tracelist_add
+                    (dcontext, trace, next, INSTR_CREATE_add
+                     (dcontext, opnd_create_reg(REG_AL), OPND_CREATE_INT8(0x7f)));
+            }
+            added_size += tracelist_add(dcontext, trace, next, INSTR_CREATE_sahf(dcontext));
+        }
+        added_size += tracelist_add
+            (dcontext, trace, next, INSTR_CREATE_mov_ld
+             (dcontext, opnd_create_reg(REG_XAX),
+              opnd_create_tls_slot(os_tls_offset(PREFIX_XAX_SPILL_SLOT))));
+        added_size += insert_restore_spilled_xcx(dcontext, trace, next);
+        /* a pseudo direct exit, as in append_trace_speculate_last_ibl() */
+        added_size += tracelist_add(dcontext, trace, next,
+                                    INSTR_CREATE_jmp(dcontext, opnd_create_pc(targets[i])));
+        LOG(THREAD, LOG_INTERP, 3,
+            "append_trace_speculate_ibl_targets: added cmp vs. "PFX" for ind br\n",
+            targets[i]);
+    }
+
+    if (record_translation)
+        instrlist_set_translation_target(trace, NULL);
+    instrlist_set_our_mangling(trace, false); /* PR 267260 */
+
+    return added_size;
+}
+#endif /* X64 */
+
 #ifdef HASHTABLE_STATISTICS
 /* Add a counter on last IBL exit
  * if speculate_next_tag is not NULL then check case 4817's possible success
@@ -5700,6 +6009,9 @@ mangle_trace(dcontext_t *dcontext, instrlist_t *ilist, monitor_data_t *md)
     app_pc fallthrough = NULL;
     bool found_syscall = false, found_int = false;
     int i;
+#ifdef INLINE_SIGNAL_CHECKS
+    instr_t **check_at = NULL;
+#endif
 
     ASSERT(can_use_mangle_trace());
 
@@ -5913,6 +6225,27 @@ mangle_trace(dcontext_t *dcontext, instrlist_t *ilist, monitor_data_t *md)
     else
         md->trace_flags &= ~FRAG_HAS_SYSCALL;
 
+#ifdef INLINE_SIGNAL_CHECKS
+    /* Each block gets the pending-signal check that mangle_bb_ilist() gives
+     * bbs.  This is deliberately the same layout as traces without a client,
+     * which decode_fragment() builds from bbs' cache code, checks included:
+     * every block entry stays a point where a pending signal is seen.  We only
+     * mark the block starts here: the checks go in after the 3rd walk, as
+     * their jecxz would cut short fixup_last_cti()'s eflags analysis.
+     */
+    if (DYNAMO_OPTION(signal_checks_inline)) {
+        check_at = HEAP_ARRAY_ALLOC(dcontext, instr_t *, md->num_blks, ACCT_TRACE,
+                                    true);
+        for (blk = 0; blk < md->num_blks; blk++) {
+            instr_t *start = (blk == 0) ? instrlist_first(ilist) :
+                instr_get_next(md->blk_info[blk-1].bounds.end_instr);
+            ASSERT(start != NULL);
+            check_at[blk] = INSTR_CREATE_label(dcontext);
+            instrlist_meta_preinsert(ilist, start, check_at[blk]);
+        }
+    }
+#endif
+
     /* 2nd walk: mangle */
     DOLOG(4, LOG_INTERP, {
         LOG(THREAD, LOG_INTERP, 4, "trace ilist before mangling:\n");
@@ -5958,6 +6291,12 @@ mangle_trace(dcontext_t *dcontext, instrlist_t *ilist, monitor_data_t *md)
             blk++;
             if (blk >= md->num_blks && next_inst != NULL) {
                 CLIENT_ASSERT(false, "unsupported trace modification: exits modified");
+#ifdef INLINE_SIGNAL_CHECKS
+                if (check_at != NULL) {
+                    HEAP_ARRAY_FREE(dcontext, check_at, instr_t *, md->num_blks,
+                                    ACCT_TRACE, true);
+                }
+#endif
                 return false;
             }
             start_instr = next_inst;
@@ -5965,8 +6304,29 @@ mangle_trace(dcontext_t *dcontext, instrlist_t *ilist, monitor_data_t *md)
     }
     if (blk < md->num_blks) {
         CLIENT_ASSERT(false, "unsupported trace modification: cannot find all exits");
+#ifdef INLINE_SIGNAL_CHECKS
+        if (check_at != NULL)
+            HEAP_ARRAY_FREE(dcontext, check_at, instr_t *, md->num_blks, ACCT_TRACE, true);
+#endif
         return false;
     }
+#ifdef INLINE_SIGNAL_CHECKS
+    if (check_at != NULL) {
+        for (blk = 0; blk < md->num_blks; blk++) {
+            mangle_insert_signal_check(dcontext, ilist, check_at[blk],
+                                       md->blk_info[blk].info.tag,
+                                       TEST(FRAG_HAS_TRANSLATION_INFO, md->trace_flags));
+            instrlist_remove(ilist, check_at[blk]);
+            instr_destroy(dcontext, check_at[blk]);
+        }
+        HEAP_ARRAY_FREE(dcontext, check_at, instr_t *, md->num_blks, ACCT_TRACE, true);
+    }
+#endif
+#ifdef CLIENT_INTERFACE
+    /* speculation looks for the final exit at the end of the trace */
+    if (DYNAMO_OPTION(move_cold_code) && !DYNAMO_OPTION(speculate_last_exit))
+        move_cold_code(dcontext, ilist);
+#endif
     return true;
 }
 
@@ -2749,6 +2749,54 @@ mangle_syscall_code(dcontext_t *dcontext, fragment_t *f, byte *pc, bool skip)
 }
 #endif /* LINUX */
 
+#ifdef INLINE_SIGNAL_CHECKS
+/* For -signal_checks_inline: inserts before where a check that exits to
+ * dispatch, with tag as the next app pc, when dcontext->signals_pending is set:
+ *
+ *     mov  %xcx -> tls_xcx
+ *     mov  tls_dcontext -> %xcx
+ *     movzx signals_pending(%xcx) -> %ecx
+ *     jecxz no_signal
+ *     jmp  <tag>                   # exit marked LINK_SIGNAL_CHECK
+ *   no_signal:
+ *     mov  tls_xcx -> %xcx
+ *
+ * The eflags are untouched, so where must be a point at which exiting to tag
+ * is the same as falling through, i.e., the top of tag's code.  The exit
+ * leaves the app's xcx in its spill slot for dispatch to restore, so the one
+ * restore follows the join and the linear translation walk sees xcx spilled
+ * everywhere in between.
+ */
+void
+mangle_insert_signal_check(dcontext_t *dcontext, instrlist_t *ilist, instr_t *where,
+                           app_pc tag, bool record_translation)
+{
+    instr_t *no_signal = INSTR_CREATE_label(dcontext);
+    instr_t *exit = INSTR_CREATE_jmp(dcontext, opnd_create_pc(tag));
+    instr_exit_branch_set_type(exit, instr_branch_type(exit) | INSTR_BRANCH_SIGNAL_CHECK);
+
+    instrlist_set_our_mangling(ilist, true);
+    if (record_translation)
+        instrlist_set_translation_target(ilist, tag);
+    PRE(ilist, where, instr_create_save_to_tls(dcontext, REG_XCX, TLS_XCX_SLOT));
+    PRE(ilist, where,
+        instr_create_restore_from_tls(dcontext, REG_XCX, TLS_DCONTEXT_SLOT));
+    PRE(ilist, where,
+        INSTR_CREATE_movzx(dcontext, opnd_create_reg(REG_ECX),
+                           OPND_CREATE_MEM8(REG_XCX, offsetof(dcontext_t,
+                                                              signals_pending))));
+    PRE(ilist, where, INSTR_CREATE_jecxz(dcontext, opnd_create_instr(no_signal)));
+    /* an exit cti, not a meta instr */
+    instrlist_preinsert(ilist, where, exit);
+    PRE(ilist, where, no_signal);
+    PRE(ilist, where, instr_create_restore_from_tls(dcontext, REG_XCX, TLS_XCX_SLOT));
+    if (record_translation)
+        instrlist_set_translation_target(ilist, NULL);
+    instrlist_set_our_mangling(ilist, false);
+    STATS_INC(num_signal_checks_inserted);
+}
+#endif /* INLINE_SIGNAL_CHECKS */
+
 /***************************************************************************
  * NON-SYSCALL INTERRUPT
  */
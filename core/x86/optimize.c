@@ -125,94 +125,199 @@ void logtrace(dcontext_t *dcontext, uint level, instrlist_t *trace, char *string
 
 
 /****************************************************************************/
-/* master routine */
+/* pass pipeline */
+
+/* Properties of an optimization pass */
+enum {
+    /* Safe to run on a single basic block: the pass needs nothing that only a
+     * trace provides, and a fault or interrupt anywhere in the result
+     * translates back through the instrs' translations to an app pc from
+     * which re-executing gives the native result.  The state there is not
+     * always native: a pass may change state that is dead at that point
+     * (a removed xor or an inc->add leaves different arithmetic flags until
+     * their next writer) or that the restarted app instr recomputes (a split
+     * leave has already moved xsp when its pop faults).
+     */
+    OPT_PASS_BB  = 0x1,
+    /* Handles 64-bit registers, operands, and immediates */
+    OPT_PASS_X64 = 0x2,
+};
+
+typedef struct _opt_pass_t {
+    const char *name;
+    void (*func)(dcontext_t *dcontext, app_pc tag, instrlist_t *ilist);
+    uint flags; /* OPT_PASS_ flags */
+    /* the option that turns the pass on: a bool or a uint aggressiveness level */
+    size_t option_offs;
+    size_t option_size;
+} opt_pass_t;
+
+#define OPT_PASS(option, func, flags) \
+    { #option, func, flags, offsetof(options_t, option), \
+      sizeof(((options_t *)0)->option) }
+
+/* The passes run in this order, each if its option is on */
+static const opt_pass_t opt_passes[] = {
+    OPT_PASS(call_return_matching, call_return_matching, 0),
+    OPT_PASS(unroll_loops, unroll_loops, 0),
+    OPT_PASS(vectorize, identify_for_loop, 0),
+    OPT_PASS(prefetch, prefetch_optimize_trace, 0),
+    OPT_PASS(rlr, remove_redundant_loads, 0),
+    OPT_PASS(remove_unnecessary_zeroing, remove_unnecessary_zeroing,
+             OPT_PASS_BB|OPT_PASS_X64),
+    OPT_PASS(constant_prop, constant_propagation, 0),
+    OPT_PASS(remove_dead_code, remove_dead_code, 0),
+    OPT_PASS(stack_adjust, stack_adjust_combiner, 0),
+    OPT_PASS(peephole, peephole_optimize, OPT_PASS_BB|OPT_PASS_X64),
+#ifdef IA32_ON_IA64
+    OPT_PASS(test_ia64, test_i64, 0),
+#endif
+};
+#define NUM_OPT_PASSES (sizeof(opt_passes)/sizeof(opt_passes[0]))
 
-void 
-optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+#ifdef DEBUG
+/* per-pass stats, printed by print_optimization_stats() */
+static struct {
+    uint trace_runs;
+    uint bb_runs;
+    uint instrs_in;
+    int instrs_removed; /* net: a pass may add instrs */
+} opt_pass_stats[NUM_OPT_PASSES];
+#endif
+
+static bool
+opt_pass_enabled(const opt_pass_t *pass)
 {
-    /* we have un-truncation-check 32-bit casts for opnd_get_immed_int(), for
-     * one thing, here and in loadtoconst.c */
-    IF_X64(ASSERT_NOT_IMPLEMENTED(false));
+    byte *val = ((byte *) &dynamo_options) + pass->option_offs;
+    if (pass->option_size == sizeof(bool))
+        return *(bool *) val;
+    ASSERT(pass->option_size == sizeof(uint));
+    return *(uint *) val != 0;
+}
 
-    /* FIXME: this routine is of course not in its final form
-     * we are still playing with different optimizations
-     */
+#ifdef DEBUG
+static int
+opt_count_instrs(instrlist_t *ilist)
+{
+    instr_t *inst;
+    int count = 0;
+    for (inst = instrlist_first(ilist); inst != NULL; inst = instr_get_next(inst))
+        count++;
+    return count;
+}
+#endif
+
+/* An app instr that a pass created may have no translation.  Like our own
+ * mangling, it gets that of the next app instr that has one, so a fault in
+ * it restarts that instr.  A pass that rewrites an instr in place should use
+ * replace_inst(), which keeps the old instr's translation instead.
+ */
+static void
+opt_fix_translations(dcontext_t *dcontext, instrlist_t *ilist)
+{
+    instr_t *inst;
+    app_pc next_translation = NULL;
+    for (inst = instrlist_last(ilist); inst != NULL; inst = instr_get_prev(inst)) {
+        if (!instr_ok_to_mangle(inst) || instr_is_label(inst))
+            continue;
+        if (instr_get_translation(inst) != NULL)
+            next_translation = instr_get_translation(inst);
+        else if (next_translation != NULL) {
+            instr_set_translation(inst, next_translation);
+            STATS_INC(opt_translations_inherited);
+        }
+    }
+}
+
+static void
+optimize_ilist(dcontext_t *dcontext, app_pc tag, instrlist_t *ilist, bool is_trace)
+{
+    uint i;
 
     /* all opts want to expand all bundles and many want cti info including instr_t
      * targets, so we go ahead and do that up front
      */
-    instrlist_decode_cti(dcontext, trace);
+    instrlist_decode_cti(dcontext, ilist);
 
 #ifdef DEBUG
-    LOG(THREAD, LOG_OPTS, 3, "\noptimize_trace ******************\n");
+    LOG(THREAD, LOG_OPTS, 3, "\noptimize_%s ******************\n",
+        is_trace ? "trace" : "bb");
     LOG(THREAD, LOG_OPTS, 3, "\nbefore optimization:\n");
 
     if (stats->loglevel >= 3 && (stats->logmask & LOG_OPTS) != 0)
-        instrlist_disassemble(dcontext, tag, trace, THREAD);
+        instrlist_disassemble(dcontext, tag, ilist, THREAD);
 
 #endif
 
     if (dynamo_options.instr_counts) {
-        instr_counts(dcontext, tag, trace, true);
-    }
-
-    if (dynamo_options.call_return_matching) {
-        call_return_matching(dcontext, tag, trace);
+        instr_counts(dcontext, tag, ilist, true);
     }
 
-    if (dynamo_options.unroll_loops) {
-        unroll_loops(dcontext, tag, trace);
-    }
-
-    if (dynamo_options.vectorize) {
-        identify_for_loop(dcontext, tag, trace);
-    }
-
-    if (dynamo_options.prefetch) {
-        prefetch_optimize_trace(dcontext, tag, trace);
-    }
-
-    if (dynamo_options.rlr) {
-        remove_redundant_loads(dcontext, tag, trace);
-    }
-
-    if (dynamo_options.remove_unnecessary_zeroing) {
-        remove_unnecessary_zeroing(dcontext, tag, trace);
-    }
-
-    if (dynamo_options.constant_prop) {
-        constant_propagation(dcontext, tag, trace);
-    }
-
-    if (dynamo_options.remove_dead_code) {
-        remove_dead_code(dcontext, tag, trace);
-    }
-
-    if (dynamo_options.stack_adjust) {
-        stack_adjust_combiner(dcontext, tag, trace);
-    }
-
-    if (dynamo_options.peephole) {
-        peephole_optimize(dcontext, tag, trace);
-    }
-
-#ifdef IA32_ON_IA64
-    if (dynamo_options.test_i64) {
-        test_i64(dcontext, tag, trace);
-    }
+    for (i = 0; i < NUM_OPT_PASSES; i++) {
+        const opt_pass_t *pass = &opt_passes[i];
+        DEBUG_DECLARE(int instrs_in;)
+        if (!opt_pass_enabled(pass))
+            continue;
+        if (!is_trace && !TEST(OPT_PASS_BB, pass->flags))
+            continue;
+#ifdef X64
+        if (!TEST(OPT_PASS_X64, pass->flags)) {
+            /* these still assume 32-bit registers and immeds throughout */
+            SYSLOG_INTERNAL_WARNING_ONCE("skipping 32-bit-only optimization passes");
+            continue;
+        }
 #endif
+        LOG(THREAD, LOG_OPTS, 3, "running pass %s\n", pass->name);
+        DODEBUG({
+            instrs_in = opt_count_instrs(ilist);
+            if (is_trace)
+                opt_pass_stats[i].trace_runs++;
+            else
+                opt_pass_stats[i].bb_runs++;
+            opt_pass_stats[i].instrs_in += instrs_in;
+        });
+        (*pass->func)(dcontext, tag, ilist);
+        opt_fix_translations(dcontext, ilist);
+        DODEBUG({
+            opt_pass_stats[i].instrs_removed += instrs_in - opt_count_instrs(ilist);
+        });
+    }
 
     if (dynamo_options.instr_counts) {
-        instr_counts(dcontext, tag, trace, false);
+        instr_counts(dcontext, tag, ilist, false);
     }
     
 #ifdef DEBUG
     LOG(THREAD, LOG_OPTS, 3, "\nafter optimization:\n");
     if (stats->loglevel >= 3 && (stats->logmask & LOG_OPTS) != 0)
-        instrlist_disassemble(dcontext, tag, trace, THREAD);
+        instrlist_disassemble(dcontext, tag, ilist, THREAD);
 #endif
 }
 
+/****************************************************************************/
+/* master routines */
+
+/* Runs every enabled pass over trace.  On x64, passes not yet ported to
+ * 64-bit are skipped.
+ */
+void 
+optimize_trace(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
+{
+    STATS_INC(opt_traces);
+    optimize_ilist(dcontext, tag, trace, true/*trace*/);
+}
+
+/* Runs the enabled passes marked OPT_PASS_BB over a bb's app instrs, for
+ * -optimize_bbs.  Like optimize_trace(), this must be deterministic: a bb
+ * is rebuilt, and thus re-optimized, to translate a fault in it.
+ */
+void
+optimize_bb(dcontext_t *dcontext, app_pc tag, instrlist_t *bb)
+{
+    STATS_INC(opt_bbs);
+    optimize_ilist(dcontext, tag, bb, false/*bb*/);
+}
+
 #ifdef DEBUG
 static struct {
     /* rlr */
@@ -353,6 +458,19 @@ print_optimization_stats()
     }
 #endif
 
+    {
+        uint i;
+        LOG(GLOBAL, LOG_OPTS, 1, "Per-pass stats\n");
+        for (i = 0; i < NUM_OPT_PASSES; i++) {
+            if (opt_pass_stats[i].trace_runs == 0 && opt_pass_stats[i].bb_runs == 0)
+                continue;
+            LOG(GLOBAL, LOG_OPTS, 1,
+                "   %-26s %8u traces %8u bbs %10u instrs in %10d removed\n",
+                opt_passes[i].name, opt_pass_stats[i].trace_runs,
+                opt_pass_stats[i].bb_runs, opt_pass_stats[i].instrs_in,
+                opt_pass_stats[i].instrs_removed);
+        }
+    }
 }
 #endif
 
@@ -2850,62 +2968,106 @@ constant_propagation(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
  * the pentium 4 hardware (and maby earlier versions too) recognizes
  * xor zeroring specially and uses it to break the false dependences
  *
- * ignores effects on flags, should perhaps consider them for correctness
- * but one would not expect a program to use the flags set zeroing a register
- * for a conditional jmp
+ * A zeroing instr is only removed if the arithmetic flags it writes are
+ * dead, so the app state at every remaining instr is unchanged and the
+ * pass is safe on bbs as well as traces.  What is known to be zero is
+ * forgotten at every cti, label, meta instr, syscall, or interrupt.
  *
  * should also catch the adobe case where we for ex. 
  * xor zero eax, load into ah, use eax, xor zero eax, load into ah ...
- * 
- * relies to some degree on the enum in instr.h 
  */
+
+/* Returns the register whose full contents inst sets to zero, or REG_NULL.
+ * On x64 a 32-bit gpr write zeroes the top half as well, so a 32-bit or
+ * pointer-sized xor zeroes the whole pointer-sized register; narrower ones
+ * leave the rest of it alone and aren't tracked.
+ */
+static reg_id_t
+zeroed_reg(instr_t *inst)
+{
+    reg_id_t reg;
+    if (!is_zeroing_instr(inst) || !opnd_is_reg(instr_get_dst(inst, 0)))
+        return REG_NULL;
+    reg = opnd_get_reg(instr_get_dst(inst, 0));
+    if (reg_is_gpr(reg)) {
+        if (reg_get_size(reg) != OPSZ_4 IF_X64(&& reg_get_size(reg) != OPSZ_8))
+            return REG_NULL;
+        return reg_to_pointer_sized(reg);
+    }
+    if (reg_is_xmm(reg) || reg_is_mmx(reg))
+        return reg;
+    return REG_NULL;
+}
+
+/* Returns true if all 6 arithmetic flags are written before being read
+ * after inst, without leaving the straight-line code following it.
+ */
+static bool
+arith_flags_dead_after(instr_t *inst)
+{
+    instr_t *in;
+    uint written = 0;
+    for (in = instr_get_next(inst); in != NULL; in = instr_get_next(in)) {
+        uint eflags;
+        if (!instr_ok_to_mangle(in) || instr_is_label(in) || instr_is_cti(in) ||
+            instr_is_syscall(in) || instr_is_interrupt(in))
+            return false;
+        eflags = instr_get_arith_flags(in);
+        if ((eflags & EFLAGS_READ_6 & ~EFLAGS_WRITE_TO_READ(written)) != 0)
+            return false;
+        written |= (eflags & EFLAGS_WRITE_6);
+        if (written == EFLAGS_WRITE_6)
+            return true;
+    }
+    return false;
+}
+
 static void
 remove_unnecessary_zeroing(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
 {
     instr_t *inst, *next_inst;
-    int i, cur_reg, num_dsts;
+    int i, num_dsts;
     /* keeps track if actually necessary to mark off dst of non zeroing instructions */
-    bool check_dsts; 
-    bool zeroed[24];
-    opnd_t dst;
-    check_dsts = false;
-    for (i = 0; i < 24; i++) {
-        zeroed[i] = false;
-    }
+    bool check_dsts = false;
+    /* indexed by pointer-sized gpr, or by xmm/mmx reg */
+    bool zeroed[REG_LAST_VALID_ENUM + 1];
+    reg_id_t reg;
+    memset(zeroed, 0, sizeof(zeroed));
     for (inst = instrlist_first(trace); inst != NULL; inst = next_inst) {
         next_inst = instr_get_next(inst);
-        if (is_zeroing_instr(inst)) {
-            cur_reg = opnd_get_reg(instr_get_dst(inst,0)) - REG_START_32;
-            /* if zeroed (and also of all sub registers) then kill the inst 
-             * otherwise mark reg and sub regs as zeroed  */
-            if (check_down(zeroed, cur_reg)) {
-                /* is ok to remove instruction reg and subregs already zero */
+        if (!instr_ok_to_mangle(inst) || instr_is_label(inst) || instr_is_cti(inst) ||
+            instr_is_syscall(inst) || instr_is_interrupt(inst)) {
+            if (check_dsts) {
+                memset(zeroed, 0, sizeof(zeroed));
+                check_dsts = false;
+            }
+            continue;
+        }
+        reg = zeroed_reg(inst);
+        if (reg != REG_NULL) {
+            /* if already zeroed then kill the inst, otherwise mark reg as zeroed */
+            if (zeroed[reg] && arith_flags_dead_after(inst)) {
 #ifdef DEBUG
                 loginst(dcontext, 3, inst, "unnecsary xor removed ");
                 opt_stats_t.xors_removed++;
 #endif
                 remove_inst(dcontext, trace, inst);
-            }
-            else {
-                propagate_down(zeroed, cur_reg, true); 
+            } else {
+                zeroed[reg] = true;
                 check_dsts = true;
             }
-        }
-        else {
+        } else if (check_dsts) {
             /* non-zeroing instruction, check for registers being written 
              * and mark them non-zero if necessary */
-            if (check_dsts) {
-                num_dsts = instr_num_dsts(inst);
-                for (i = 0; i < num_dsts; i++) {
-                    dst = instr_get_dst(inst, i);
-                    if (opnd_is_reg(dst)) {
-                        cur_reg = opnd_get_reg(dst) - REG_START_32;
-                        propagate_down(zeroed, cur_reg, false);
-                    }   
+            num_dsts = instr_num_dsts(inst);
+            for (i = 0; i < num_dsts; i++) {
+                opnd_t dst = instr_get_dst(inst, i);
+                if (opnd_is_reg(dst)) {
+                    reg = opnd_get_reg(dst);
+                    if (reg_is_gpr(reg))
+                        reg = reg_to_pointer_sized(reg);
+                    zeroed[reg] = false;
                 }
-                check_dsts = false;
-                for (i = 0; i < 24; i++)
-                    check_dsts |= zeroed[i];
             }
         }
     }
@@ -3841,7 +4003,7 @@ call_return_matching(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
  * so we only walk instrlist once
  * current opts:
  *   p4 only: inc/dec -> add 1/sub 1
- *   leave -> mov ebp,esp; pop ebp
+ *   leave -> mov xbp,xsp; pop xbp
  */
 static void
 peephole_optimize(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
@@ -3867,20 +4029,26 @@ peephole_optimize(dcontext_t *dcontext, app_pc tag, instrlist_t *trace)
              * their simpler components.
              *     leave
              *     =>
-             *     movl %ebp,%esp
-             *     popl %ebp
+             *     mov %xbp,%xsp
+             *     pop %xbp
              * this makes a difference on microbenchmarks, doesn't
              * seem to show up on spec though
              */
+            app_pc xl8 = instr_get_translation(inst);
+            /* a data16 leave pops only bp */
+            if (instr_get_prefix_flag(inst, PREFIX_DATA))
+                continue;
+            /* the mov can't fault, and a fault in the pop restarts the leave */
             instrlist_preinsert(trace, inst,
-                                INSTR_CREATE_mov_ld(dcontext,
-                                                    opnd_create_reg(REG_ESP),
-                                                    opnd_create_reg(REG_EBP)));
+                                INSTR_XL8(INSTR_CREATE_mov_ld(dcontext,
+                                                              opnd_create_reg(REG_XSP),
+                                                              opnd_create_reg(REG_XBP)),
+                                          xl8));
             instrlist_preinsert(trace, inst,
-                                INSTR_CREATE_pop(dcontext,
-                                                 opnd_create_reg(REG_EBP)));
-            instrlist_remove(trace, inst);
-            instr_destroy(dcontext, inst);
+                                INSTR_XL8(INSTR_CREATE_pop(dcontext,
+                                                           opnd_create_reg(REG_XBP)),
+                                          xl8));
+            remove_inst(dcontext, trace, inst);
         }
     }
 }
@@ -3912,52 +4080,14 @@ replace_inc_with_add(dcontext_t *dcontext, instr_t *inst, instrlist_t *trace)
             ok_to_replace = true;
             break;
         }
-        /* test is down here b/c we want to look at 1st exit 
-         * if direct branch, look at top of target
+        /* Stop at the 1st exit: we don't know that its target is readable
+         * (it may never be taken), and decoding it could fault.  The common
+         * case hits a writer of CF before any exit.
          * N.B.: indirect branches: we'll hit lahf first, which reads CF,
          *   which will stop us from replacing, which is what we want
          */
-        if (instr_is_exit_cti(in)) {
-            /* FIXME: what if branch is never taken and points to
-             * bogus memory, or we walk beyond interrupt or some
-             * non-cti that we normally stop at?
-             */
-            byte *target;
-            /* FIXME: shadowing eflags */
-            int eflags;
-            instr_t tinst;
-            if (!opnd_is_near_pc(instr_get_target(in)))
-                break;
-            target = (byte *) opnd_get_pc(instr_get_target(in));
-            loginst(dcontext, 3, in, "looking at target");
-            instr_init(dcontext, &tinst);
-            do {
-                instr_reset(dcontext, &tinst);
-                target = decode_cti(dcontext, target, &tinst);
-                ASSERT(instr_valid(&tinst));
-                eflags = instr_get_eflags(&tinst);
-                if ((eflags & EFLAGS_READ_CF) != 0) {
-                    loginst(dcontext, 3, in,
-                            "reads CF => cannot replace inc with add");
-                    return false;
-                }
-                /* if writes but doesn't read, ok */
-                if ((eflags & EFLAGS_WRITE_CF) != 0) {
-                    ok_to_replace = true;
-                    break;
-                }
-                /* stop at 1st cti, don't try to recurse,
-                 * common case should hit a writer of CF
-                 * prior to 1st cti
-                 */
-            } while (!instr_is_cti(&tinst));
-            instr_free(dcontext, &tinst);
-            /* for cbr, exit and fall-through must be ok */
-            if (!instr_is_cbr(in))
-                break;
-            else /* continue for fall-through */
-                ok_to_replace = false;
-        }
+        if (instr_is_exit_cti(in))
+            break;
     }
     if (!ok_to_replace) {
         LOG(THREAD, LOG_OPTS, 3, "no write to CF => cannot replace inc with add\n");
@@ -4498,6 +4628,9 @@ is_dead_reg(dcontext_t *dcontext, instr_t *start_inst, int reg)
 void
 replace_inst(dcontext_t *dcontext, instrlist_t *ilist, instr_t *old, instr_t *new)
 {
+    /* new takes over old's place in the app's code */
+    if (instr_get_translation(new) == NULL)
+        instr_set_translation(new, instr_get_translation(old));
     instrlist_preinsert(ilist, old, new);
     instrlist_remove(ilist, old);
     instr_destroy(dcontext, old);
@@ -33,8 +33,8 @@
 /* DRSyms DynamoRIO Extension 
  *
  * Symbol lookup support (Issue 44).
- * Currently only supports Windows PDB symbols: no Cygwin support or Linux
- * support yet.
+ * Supports Windows PDB symbols and, on Linux, ELF .symtab/.dynsym symbols
+ * (no line information there yet).  No Cygwin support.
  * This API will eventually support both sideline (via a separate
  * process) and online use.  Today only online use is supported.
  */
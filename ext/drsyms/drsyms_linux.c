@@ -0,0 +1,665 @@
+/* **********************************************************
+ * Copyright (c) 2010 VMware, Inc.  All rights reserved.
+ * **********************************************************/
+
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * 
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * 
+ * * Neither the name of VMware, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL VMWARE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* DRSyms DynamoRIO Extension */
+
+/* Symbol lookup for Linux
+ *
+ * Reads an ELF module's .symtab, or its .dynsym if it has been stripped,
+ * into a compact index the first time the module is queried.  The index is
+ * a single allocation holding no pointers: a header, the defined function
+ * and object symbols sorted by address, their indices sorted by name, and
+ * just the names those symbols need.  It can thus be written out and
+ * mapped back in as is.  Address lookups binary search it, with a small
+ * direct-mapped cache in front for the runs of nearby addresses that stack
+ * walks and profile dumps ask about; name lookups binary search the name
+ * order.
+ *
+ * There is no line information yet: lookups that find a symbol return
+ * DRSYM_ERROR_LINE_NOT_AVAILABLE, as on Windows when a pdb has no lines.
+ */
+
+/* We use the DR API's mutex and heap whether as a client utility library
+ * or (via DR standalone API) in a symbol server process
+ */
+#include "dr_api.h"
+
+#include <elf.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h> /* vsnprintf */
+#include <stdlib.h> /* qsort */
+#include <string.h>
+
+/* We use the Container Extension's hashtable */
+#include "hashtable.h"
+
+#include "drsyms.h"
+
+/* Our index and lookups are un-synchronized so we provide our own synch */
+void *symbol_lock;
+
+/* Hashtable for mapping module paths to symbol indices */
+#define MODTABLE_HASH_BITS 8
+static hashtable_t modtable;
+
+/* For debugging */
+static bool verbose = false;
+
+#undef NOTIFY /* from DrMem utils.h */
+#define NOTIFY(...) do { \
+    if (verbose) { \
+        dr_fprintf(STDERR, __VA_ARGS__); \
+    } \
+} while (0)
+
+#ifndef PAGE_SIZE
+# define PAGE_SIZE 4096
+#endif
+#define ALIGN_BACKWARD(x, alignment) (((ptr_uint_t)x) & (~((alignment)-1)))
+
+#define BUFFER_SIZE_BYTES(buf)      sizeof(buf)
+#define BUFFER_SIZE_ELEMENTS(buf)   (BUFFER_SIZE_BYTES(buf) / sizeof(buf[0]))
+#define BUFFER_LAST_ELEMENT(buf)    buf[BUFFER_SIZE_ELEMENTS(buf) - 1]
+#define NULL_TERMINATE_BUFFER(buf)  BUFFER_LAST_ELEMENT(buf) = 0
+
+/***************************************************************************/
+/* symbol index */
+
+#define SYMINDEX_MAGIC 0x53594d31 /* "SYM1" */
+
+/* Offsets are from the module base, which is the page holding the lowest
+ * PT_LOAD segment.  A module spanning more than 4GB is not supported.
+ */
+typedef struct _sym_entry_t {
+    uint start;
+    uint size; /* 0 if the symbol table did not say */
+    uint name; /* offset into the index's strings */
+} sym_entry_t;
+
+typedef struct _symindex_t {
+    uint magic;
+    uint num_syms;
+    uint strings_size;
+    uint total_size; /* of the whole index, in bytes */
+    /* followed by:
+     *   sym_entry_t syms[num_syms];  sorted by start
+     *   uint by_name[num_syms];      indices into syms, sorted by name
+     *   char strings[strings_size];
+     */
+} symindex_t;
+
+#define INDEX_SYMS(idx) ((sym_entry_t *)((idx) + 1))
+#define INDEX_BY_NAME(idx) ((uint *)(INDEX_SYMS(idx) + (idx)->num_syms))
+#define INDEX_STRINGS(idx) ((char *)(INDEX_BY_NAME(idx) + (idx)->num_syms))
+
+/* Address lookup cache: slot is picked by the address's 64-byte granule */
+#define ADDR_CACHE_BITS 6
+#define ADDR_CACHE_SIZE (1 << ADDR_CACHE_BITS)
+#define ADDR_CACHE_SLOT(offs) (((offs) >> 6) & (ADDR_CACHE_SIZE - 1))
+#define ADDR_CACHE_EMPTY ((uint)-1)
+
+typedef struct _module_syms_t {
+    symindex_t *index; /* NULL if the module has no symbols we can read */
+    /* index of the symbol that held the last address hashing to each slot */
+    uint addr_cache[ADDR_CACHE_SIZE];
+} module_syms_t;
+
+static void
+modtable_entry_free(void *p)
+{
+    module_syms_t *mod = (module_syms_t *) p;
+    if (mod->index != NULL)
+        dr_global_free(mod->index, mod->index->total_size);
+    dr_global_free(mod, sizeof(*mod));
+}
+
+/* The ELF header fields we need, from either class */
+typedef struct _elf_info_t {
+    bool is_64;
+    uint64 phoff;
+    uint phnum, phentsize;
+    uint64 shoff;
+    uint shnum, shentsize;
+} elf_info_t;
+
+typedef struct _elf_section_t {
+    uint type;
+    uint link;
+    uint64 offset;
+    uint64 size;
+    uint64 entsize;
+} elf_section_t;
+
+static bool
+read_at(file_t f, uint64 offs, void *buf, size_t size)
+{
+    return (dr_file_seek(f, (int64) offs, DR_SEEK_SET) &&
+            dr_read_file(f, buf, size) == (ssize_t) size);
+}
+
+static void *
+read_alloc(file_t f, uint64 offs, size_t size)
+{
+    void *buf = dr_global_alloc(size);
+    if (!read_at(f, offs, buf, size)) {
+        dr_global_free(buf, size);
+        return NULL;
+    }
+    return buf;
+}
+
+static bool
+read_elf_header(file_t f, elf_info_t *info)
+{
+    union {
+        Elf32_Ehdr h32;
+        Elf64_Ehdr h64;
+    } ehdr;
+    if (!read_at(f, 0, &ehdr, sizeof(ehdr.h32)) ||
+        memcmp(ehdr.h32.e_ident, ELFMAG, SELFMAG) != 0)
+        return false;
+    info->is_64 = (ehdr.h32.e_ident[EI_CLASS] == ELFCLASS64);
+    if (info->is_64) {
+        if (!read_at(f, 0, &ehdr, sizeof(ehdr.h64)))
+            return false;
+        info->phoff = ehdr.h64.e_phoff;
+        info->phnum = ehdr.h64.e_phnum;
+        info->phentsize = ehdr.h64.e_phentsize;
+        info->shoff = ehdr.h64.e_shoff;
+        info->shnum = ehdr.h64.e_shnum;
+        info->shentsize = ehdr.h64.e_shentsize;
+    } else {
+        info->phoff = ehdr.h32.e_phoff;
+        info->phnum = ehdr.h32.e_phnum;
+        info->phentsize = ehdr.h32.e_phentsize;
+        info->shoff = ehdr.h32.e_shoff;
+        info->shnum = ehdr.h32.e_shnum;
+        info->shentsize = ehdr.h32.e_shentsize;
+    }
+    return true;
+}
+
+/* Returns the lowest PT_LOAD address, page-aligned, or -1 on error */
+static uint64
+read_module_base(file_t f, elf_info_t *info)
+{
+    uint64 base = (uint64) -1;
+    uint i;
+    for (i = 0; i < info->phnum; i++) {
+        union {
+            Elf32_Phdr p32;
+            Elf64_Phdr p64;
+        } phdr;
+        uint type;
+        uint64 vaddr;
+        if (!read_at(f, info->phoff + (uint64)i * info->phentsize, &phdr,
+                     info->is_64 ? sizeof(phdr.p64) : sizeof(phdr.p32)))
+            return (uint64) -1;
+        type = info->is_64 ? phdr.p64.p_type : phdr.p32.p_type;
+        vaddr = info->is_64 ? phdr.p64.p_vaddr : phdr.p32.p_vaddr;
+        if (type == PT_LOAD && vaddr < base)
+            base = vaddr;
+    }
+    return (base == (uint64) -1) ? base : ALIGN_BACKWARD(base, PAGE_SIZE);
+}
+
+static bool
+read_section(file_t f, elf_info_t *info, uint i, elf_section_t *sec)
+{
+    union {
+        Elf32_Shdr s32;
+        Elf64_Shdr s64;
+    } shdr;
+    if (!read_at(f, info->shoff + (uint64)i * info->shentsize, &shdr,
+                 info->is_64 ? sizeof(shdr.s64) : sizeof(shdr.s32)))
+        return false;
+    if (info->is_64) {
+        sec->type = shdr.s64.sh_type;
+        sec->link = shdr.s64.sh_link;
+        sec->offset = shdr.s64.sh_offset;
+        sec->size = shdr.s64.sh_size;
+        sec->entsize = shdr.s64.sh_entsize;
+    } else {
+        sec->type = shdr.s32.sh_type;
+        sec->link = shdr.s32.sh_link;
+        sec->offset = shdr.s32.sh_offset;
+        sec->size = shdr.s32.sh_size;
+        sec->entsize = shdr.s32.sh_entsize;
+    }
+    return true;
+}
+
+/* Finds .symtab, else .dynsym, and its string table */
+static bool
+find_symbol_sections(file_t f, elf_info_t *info, elf_section_t *symtab,
+                     elf_section_t *strtab)
+{
+    uint i;
+    bool found = false;
+    memset(symtab, 0, sizeof(*symtab));
+    for (i = 0; i < info->shnum; i++) {
+        elf_section_t sec;
+        if (!read_section(f, info, i, &sec))
+            return false;
+        if (sec.type == SHT_SYMTAB || (sec.type == SHT_DYNSYM && !found)) {
+            *symtab = sec;
+            found = true;
+        }
+    }
+    if (!found || symtab->link >= info->shnum ||
+        symtab->entsize < (info->is_64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym)))
+        return false;
+    return read_section(f, info, symtab->link, strtab);
+}
+
+/* qsort has no context argument: these are only used under symbol_lock */
+static sym_entry_t *sort_syms;
+static const char *sort_strings;
+
+static int
+sym_cmp_addr(const void *a, const void *b)
+{
+    const sym_entry_t *sa = (const sym_entry_t *) a;
+    const sym_entry_t *sb = (const sym_entry_t *) b;
+    if (sa->start != sb->start)
+        return (sa->start < sb->start) ? -1 : 1;
+    /* at one address, sized symbols first, then by name for stability */
+    if (sa->size != sb->size)
+        return (sa->size > sb->size) ? -1 : 1;
+    return strcmp(sort_strings + sa->name, sort_strings + sb->name);
+}
+
+static int
+sym_cmp_name(const void *a, const void *b)
+{
+    const sym_entry_t *sa = &sort_syms[*(const uint *) a];
+    const sym_entry_t *sb = &sort_syms[*(const uint *) b];
+    return strcmp(sort_strings + sa->name, sort_strings + sb->name);
+}
+
+/* Builds the index from the raw symbol and string tables */
+static symindex_t *
+build_index(elf_info_t *info, byte *symdata, elf_section_t *symtab,
+            const char *strdata, size_t strsize, uint64 base)
+{
+    uint num_raw = (uint) (symtab->size / symtab->entsize);
+    uint num = 0, strings_size = 0, i, total;
+    sym_entry_t *raw;
+    symindex_t *idx;
+    sym_entry_t *syms;
+    uint *by_name;
+    char *strings;
+
+    /* first pass: keep defined functions and objects, pointing at the raw
+     * string table for now
+     */
+    raw = (num_raw == 0) ? NULL : dr_global_alloc(num_raw * sizeof(*raw));
+    for (i = 0; i < num_raw; i++) {
+        byte *s = symdata + (size_t)i * symtab->entsize;
+        uint name, shndx, type;
+        uint64 value, size;
+        if (info->is_64) {
+            Elf64_Sym *sym = (Elf64_Sym *) s;
+            name = sym->st_name;
+            shndx = sym->st_shndx;
+            type = ELF64_ST_TYPE(sym->st_info);
+            value = sym->st_value;
+            size = sym->st_size;
+        } else {
+            Elf32_Sym *sym = (Elf32_Sym *) s;
+            name = sym->st_name;
+            shndx = sym->st_shndx;
+            type = ELF32_ST_TYPE(sym->st_info);
+            value = sym->st_value;
+            size = sym->st_size;
+        }
+        if (shndx == SHN_UNDEF || shndx == SHN_ABS ||
+            (type != STT_FUNC && type != STT_OBJECT) ||
+            name == 0 || name >= strsize || value < base ||
+            value - base > UINT_MAX || size > UINT_MAX)
+            continue;
+        raw[num].start = (uint) (value - base);
+        raw[num].size = (uint) size;
+        raw[num].name = name;
+        strings_size += (uint) strlen(strdata + name) + 1;
+        num++;
+    }
+
+    total = sizeof(*idx) + num * (sizeof(sym_entry_t) + sizeof(uint)) + strings_size;
+    idx = dr_global_alloc(total);
+    idx->magic = SYMINDEX_MAGIC;
+    idx->num_syms = num;
+    idx->strings_size = strings_size;
+    idx->total_size = total;
+    syms = INDEX_SYMS(idx);
+    by_name = INDEX_BY_NAME(idx);
+    strings = INDEX_STRINGS(idx);
+
+    sort_strings = strdata;
+    qsort(raw, num, sizeof(*raw), sym_cmp_addr);
+    /* second pass: copy out just the names we keep */
+    strings_size = 0;
+    for (i = 0; i < num; i++) {
+        size_t len = strlen(strdata + raw[i].name) + 1;
+        syms[i] = raw[i];
+        syms[i].name = strings_size;
+        memcpy(strings + strings_size, strdata + raw[i].name, len);
+        strings_size += (uint) len;
+        by_name[i] = i;
+    }
+    if (raw != NULL)
+        dr_global_free(raw, num_raw * sizeof(*raw));
+
+    sort_syms = syms;
+    sort_strings = strings;
+    qsort(by_name, num, sizeof(*by_name), sym_cmp_name);
+    return idx;
+}
+
+static symindex_t *
+load_module(const char *path)
+{
+    file_t f;
+    elf_info_t info;
+    elf_section_t symtab, strtab;
+    uint64 base;
+    byte *symdata = NULL;
+    char *strdata = NULL;
+    symindex_t *idx = NULL;
+
+    f = dr_open_file(path, DR_FILE_READ);
+    if (f == INVALID_FILE)
+        return NULL;
+    if (!read_elf_header(f, &info) ||
+        (base = read_module_base(f, &info)) == (uint64) -1 ||
+        !find_symbol_sections(f, &info, &symtab, &strtab) ||
+        strtab.size == 0) {
+        NOTIFY("%s: no ELF symbol table\n", path);
+        dr_close_file(f);
+        return NULL;
+    }
+    symdata = read_alloc(f, symtab.offset, (size_t) symtab.size);
+    strdata = read_alloc(f, strtab.offset, (size_t) strtab.size);
+    if (symdata != NULL && strdata != NULL) {
+        /* in case the last string is unterminated */
+        strdata[strtab.size - 1] = '\0';
+        idx = build_index(&info, symdata, &symtab, strdata, (size_t) strtab.size,
+                          base);
+        NOTIFY("loaded %u symbols from %s\n", idx->num_syms, path);
+    }
+    if (symdata != NULL)
+        dr_global_free(symdata, (size_t) symtab.size);
+    if (strdata != NULL)
+        dr_global_free(strdata, (size_t) strtab.size);
+    dr_close_file(f);
+    return idx;
+}
+
+static module_syms_t *
+lookup_or_load(const char *modpath)
+{
+    module_syms_t *mod = (module_syms_t *) hashtable_lookup(&modtable, (void *)modpath);
+    if (mod == NULL) {
+        /* remember failures too, so we don't re-read the file every time */
+        mod = dr_global_alloc(sizeof(*mod));
+        mod->index = load_module(modpath);
+        memset(mod->addr_cache, 0xff, sizeof(mod->addr_cache));
+        hashtable_add(&modtable, (void *)modpath, (void *)mod);
+    }
+    return (mod->index == NULL) ? NULL : mod;
+}
+
+/* Returns the end of syms[i]: its size if known, else the start of the
+ * next symbol past it, skipping aliases at the same address
+ */
+static uint
+sym_end(symindex_t *idx, uint i)
+{
+    sym_entry_t *syms = INDEX_SYMS(idx);
+    uint j;
+    if (syms[i].size != 0)
+        return syms[i].start + syms[i].size;
+    for (j = i + 1; j < idx->num_syms; j++) {
+        if (syms[j].start > syms[i].start)
+            return syms[j].start;
+    }
+    return syms[i].start + 1;
+}
+
+/* Returns the index of the symbol containing offs, or -1 */
+static int
+find_addr(module_syms_t *mod, uint offs)
+{
+    symindex_t *idx = mod->index;
+    sym_entry_t *syms = INDEX_SYMS(idx);
+    uint slot = ADDR_CACHE_SLOT(offs);
+    uint i = mod->addr_cache[slot];
+    int lo, hi;
+    if (i != ADDR_CACHE_EMPTY && syms[i].start <= offs && offs < sym_end(idx, i))
+        return (int) i;
+    /* last symbol starting at or before offs */
+    lo = 0;
+    hi = (int) idx->num_syms - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (syms[mid].start <= offs)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    if (hi < 0)
+        return -1;
+    /* a sized symbol at the same start sorts first */
+    while (hi > 0 && syms[hi - 1].start == syms[hi].start)
+        hi--;
+    if (offs >= sym_end(idx, (uint) hi))
+        return -1;
+    mod->addr_cache[slot] = (uint) hi;
+    return hi;
+}
+
+/* Returns the index of the symbol with that name, or -1 */
+static int
+find_name(symindex_t *idx, const char *name)
+{
+    sym_entry_t *syms = INDEX_SYMS(idx);
+    uint *by_name = INDEX_BY_NAME(idx);
+    char *strings = INDEX_STRINGS(idx);
+    int lo = 0, hi = (int) idx->num_syms - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(name, strings + syms[by_name[mid]].name);
+        if (cmp == 0)
+            return (int) by_name[mid];
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+/***************************************************************************/
+
+DR_EXPORT
+drsym_error_t
+drsym_init(int shmid)
+{
+    /* there is no sideline symbol server on Linux */
+    if (shmid != 0)
+        return DRSYM_ERROR_NOT_IMPLEMENTED;
+
+    symbol_lock = dr_mutex_create();
+    hashtable_init_ex(&modtable, MODTABLE_HASH_BITS, HASH_STRING,
+                      true/*strdup*/, false/*!synch: using symbol_lock*/,
+                      modtable_entry_free, NULL, NULL);
+    return DRSYM_SUCCESS;
+}
+
+DR_EXPORT
+drsym_error_t
+drsym_exit(void)
+{
+    hashtable_delete(&modtable);
+    dr_mutex_destroy(symbol_lock);
+    return DRSYM_SUCCESS;
+}
+
+DR_EXPORT
+drsym_error_t
+drsym_lookup_address(const char *modpath, size_t modoffs, drsym_info_t *out INOUT)
+{
+    module_syms_t *mod;
+    sym_entry_t *sym;
+    const char *name;
+    int i;
+
+    if (out == NULL)
+        return DRSYM_ERROR_INVALID_PARAMETER;
+    /* If we add fields in the future we would dispatch on out->struct_size */
+    if (out->struct_size != sizeof(*out))
+        return DRSYM_ERROR_INVALID_SIZE;
+
+    dr_mutex_lock(symbol_lock);
+    mod = lookup_or_load(modpath);
+    if (mod == NULL) {
+        dr_mutex_unlock(symbol_lock);
+        return DRSYM_ERROR_LOAD_FAILED;
+    }
+    i = (modoffs > UINT_MAX) ? -1 : find_addr(mod, (uint) modoffs);
+    if (i < 0) {
+        dr_mutex_unlock(symbol_lock);
+        return DRSYM_ERROR_SYMBOL_NOT_FOUND;
+    }
+    sym = &INDEX_SYMS(mod->index)[i];
+    name = INDEX_STRINGS(mod->index) + sym->name;
+    out->start_offs = sym->start;
+    out->end_offs = sym_end(mod->index, (uint) i);
+    strncpy(out->name, name, out->name_size);
+    out->name[out->name_size - 1] = '\0';
+    /* Should we return an error when name gets truncated? */
+    out->name_available_size = strlen(name)*sizeof(char);
+    out->file = NULL;
+    out->line = 0;
+    out->line_offs = 0;
+    dr_mutex_unlock(symbol_lock);
+    return DRSYM_ERROR_LINE_NOT_AVAILABLE;
+}
+
+DR_EXPORT
+drsym_error_t
+drsym_lookup_symbol(const char *modpath, const char *symbol, size_t *modoffs OUT)
+{
+    module_syms_t *mod;
+    const char *bang;
+    int i;
+
+    if (modoffs == NULL || symbol == NULL)
+        return DRSYM_ERROR_INVALID_PARAMETER;
+
+    dr_mutex_lock(symbol_lock);
+    mod = lookup_or_load(modpath);
+    if (mod == NULL) {
+        dr_mutex_unlock(symbol_lock);
+        return DRSYM_ERROR_LOAD_FAILED;
+    }
+    /* accept the "modname!symname" format used on Windows */
+    bang = strchr(symbol, '!');
+    if (bang != NULL)
+        symbol = bang + 1;
+    i = find_name(mod->index, symbol);
+    if (i < 0) {
+        NOTIFY("%s not found in %s\n", symbol, modpath);
+        dr_mutex_unlock(symbol_lock);
+        return DRSYM_ERROR_SYMBOL_NOT_FOUND;
+    }
+    *modoffs = INDEX_SYMS(mod->index)[i].start;
+    dr_mutex_unlock(symbol_lock);
+    return DRSYM_SUCCESS;
+}
+
+DR_EXPORT
+drsym_error_t
+drsym_enumerate_symbols(const char *modpath, drsym_enumerate_cb callback, void *data)
+{
+    module_syms_t *mod;
+    drsym_error_t res = DRSYM_SUCCESS;
+    dr_mutex_lock(symbol_lock);
+    mod = lookup_or_load(modpath);
+    if (mod == NULL)
+        res = DRSYM_ERROR_LOAD_FAILED;
+    else {
+        symindex_t *idx = mod->index;
+        sym_entry_t *syms = INDEX_SYMS(idx);
+        uint i;
+        for (i = 0; i < idx->num_syms; i++) {
+            if (!(*callback)(INDEX_STRINGS(idx) + syms[i].name, syms[i].start, data))
+                break;
+        }
+    }
+    dr_mutex_unlock(symbol_lock);
+    return res;
+}
+
+/***************************************************************************/
+
+/* The console routines work around a Windows-only problem (i#261) */
+
+DR_EXPORT
+bool
+drsym_using_console(void)
+{
+    return false;
+}
+
+DR_EXPORT
+bool
+drsym_write_to_console(const char *fmt, ...)
+{
+    bool res = true;
+    /* mirroring DR's MAX_LOG_LEN */
+# define MAX_MSG_LEN 768
+    char msg[MAX_MSG_LEN];
+    va_list ap;
+    int len;
+    va_start(ap, fmt);
+    len = vsnprintf(msg, BUFFER_SIZE_ELEMENTS(msg), fmt, ap);
+    /* Let user know if message was truncated */
+    if (len < 0 || len >= BUFFER_SIZE_ELEMENTS(msg))
+        res = false;
+    NULL_TERMINATE_BUFFER(msg);
+    dr_fprintf(STDERR, "%s", msg);
+    va_end(ap);
+    return res;
+}
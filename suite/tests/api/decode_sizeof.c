@@ -0,0 +1,97 @@
+/* Code Manipulation API test:
+ * decode_sizeof.c
+ *
+ * Runs decode_sizeof() over a binary file containing nothing but code,
+ * starting at every byte offset, and then times a linear walk over the
+ * file to report instructions/sec.  Debug builds run with -checklevel 1,
+ * where every decode_sizeof() call is cross-checked against the original
+ * branch-driven length decoder, so a mismatch asserts.
+ */
+
+#include "configure.h"
+#include "dr_api.h"
+#include <assert.h>
+
+#define VERBOSE 0
+
+#define BUF_SIZE (128*1024)
+#define TIMING_ITERS 200
+
+static byte buf[BUF_SIZE + 32]; /* slack so a trailing instr can't overflow */
+
+static int
+size_at(void *drcontext, byte *pc)
+{
+    int num_prefixes;
+    int sz;
+#ifdef X64
+    uint rip_rel_pos;
+    sz = decode_sizeof(drcontext, pc, &num_prefixes, &rip_rel_pos);
+    assert(rip_rel_pos == 0 || (int)rip_rel_pos < sz);
+#else
+    sz = decode_sizeof(drcontext, pc, &num_prefixes);
+#endif
+    assert(num_prefixes <= sz || sz == 0);
+    return sz;
+}
+
+static void
+check_all_offsets(void *drcontext, byte *end)
+{
+    byte *pc;
+    for (pc = buf; pc < end; pc++)
+        size_at(drcontext, pc);
+}
+
+static uint64
+time_linear_walk(void *drcontext, byte *end)
+{
+#if VERBOSE
+    uint64 start = dr_get_milliseconds();
+    uint64 elapsed;
+#endif
+    uint64 count = 0;
+    int i;
+    for (i = 0; i < TIMING_ITERS; i++) {
+        byte *pc = buf;
+        while (pc < end) {
+            int sz = size_at(drcontext, pc);
+            /* If invalid, try next byte */
+            pc += (sz == 0) ? 1 : sz;
+            count++;
+        }
+    }
+#if VERBOSE
+    elapsed = dr_get_milliseconds() - start;
+    dr_printf("%u instrs in %u ms: %u instrs/sec\n", (uint)count, (uint)elapsed,
+              (uint)(elapsed == 0 ? 0 : (count * 1000) / elapsed));
+#endif
+    return count;
+}
+
+int
+main(int argc, char *argv[])
+{
+    file_t f;
+    ssize_t len;
+    void *drcontext = dr_standalone_init();
+    if (argc != 2) {
+        dr_fprintf(STDERR, "Usage: %s <objfile>\n", argv[0]);
+        return 1;
+    }
+    f = dr_open_file(argv[1], DR_FILE_READ | DR_FILE_ALLOW_LARGE);
+    if (f == INVALID_FILE) {
+        dr_fprintf(STDERR, "Error opening %s\n", argv[1]);
+        return 1;
+    }
+    len = dr_read_file(f, buf, BUF_SIZE);
+    dr_close_file(f);
+    assert(len > 0);
+
+    check_all_offsets(drcontext, buf + len);
+    if (time_linear_walk(drcontext, buf + len) == 0)
+        dr_printf("no instrs decoded\n");
+
+    dr_printf("all done\n");
+    return 0;
+}
@@ -0,0 +1,129 @@
+/* Code Manipulation API test:
+ * encode_bench.c
+ *
+ * Encodes a mix of common instruction shapes over and over to exercise the
+ * encoder's template memo, then encodes the same instrs again after
+ * instrlist_encode()'s offset pass has cached their raw bits, where
+ * re-encoding should be a plain copy.  Both passes must produce identical
+ * bytes.  With VERBOSE set it reports instrs/sec for each pass.
+ */
+
+#include "configure.h"
+#include "dr_api.h"
+#include <assert.h>
+#include <string.h>
+
+#define VERBOSE 0
+
+#define TIMING_ITERS 20000
+#define MAX_INSTRS 32
+
+static byte fresh_buf[MAX_INSTRS * 20];
+static byte cached_buf[MAX_INSTRS * 20];
+
+static int
+build_instrs(void *dc, instr_t **instrs)
+{
+    int n = 0;
+    instrs[n++] = INSTR_CREATE_mov_ld(dc, opnd_create_reg(REG_XAX),
+                                      OPND_CREATE_MEMPTR(REG_XBX, 0x10));
+    instrs[n++] = INSTR_CREATE_mov_st(dc, OPND_CREATE_MEMPTR(REG_XSP, 0x8),
+                                      opnd_create_reg(REG_XCX));
+    instrs[n++] = INSTR_CREATE_mov_st(dc, OPND_CREATE_MEM32(REG_XDX, 0x12345),
+                                      OPND_CREATE_INT32(42));
+    instrs[n++] = INSTR_CREATE_mov_imm(dc, opnd_create_reg(REG_EDX),
+                                       OPND_CREATE_INT32(0x7fff1234));
+    instrs[n++] = INSTR_CREATE_add(dc, opnd_create_reg(REG_XAX),
+                                   OPND_CREATE_INT8(1));
+    instrs[n++] = INSTR_CREATE_add(dc, opnd_create_reg(REG_ECX),
+                                   OPND_CREATE_INT32(0x10000));
+    instrs[n++] = INSTR_CREATE_cmp(dc, opnd_create_reg(REG_XAX),
+                                   opnd_create_reg(REG_XBX));
+    instrs[n++] = INSTR_CREATE_cmp(dc, OPND_CREATE_MEM8(REG_XSI, -4),
+                                   OPND_CREATE_INT8(0x7f));
+    instrs[n++] = INSTR_CREATE_lea(dc, opnd_create_reg(REG_XDI),
+                                   opnd_create_base_disp(REG_XSI, REG_XCX, 4,
+                                                         0x40, OPSZ_lea));
+    instrs[n++] = INSTR_CREATE_movzx(dc, opnd_create_reg(REG_EAX),
+                                     OPND_CREATE_MEM8(REG_XBP, -1));
+    instrs[n++] = INSTR_CREATE_xchg(dc, opnd_create_reg(REG_XAX),
+                                    opnd_create_reg(REG_XDX));
+    instrs[n++] = INSTR_CREATE_push(dc, opnd_create_reg(REG_XBP));
+    instrs[n++] = INSTR_CREATE_pop(dc, opnd_create_reg(REG_XBP));
+    instrs[n++] = INSTR_CREATE_push_imm(dc, OPND_CREATE_INT32(0x1234));
+    instrs[n++] = INSTR_CREATE_nop(dc);
+    instrs[n++] = INSTR_CREATE_pushf(dc);
+    instrs[n++] = INSTR_CREATE_popf(dc);
+    assert(n <= MAX_INSTRS);
+    return n;
+}
+
+static uint
+encode_all(void *dc, instr_t **instrs, int num, byte *buf)
+{
+    byte *pc = buf;
+    int i;
+    for (i = 0; i < num; i++) {
+        pc = instr_encode(dc, instrs[i], pc);
+        assert(pc != NULL);
+    }
+    return (uint) (pc - buf);
+}
+
+static uint
+time_encodes(void *dc, instr_t **instrs, int num, byte *buf, const char *what)
+{
+#if VERBOSE
+    uint64 start = dr_get_milliseconds();
+    uint64 elapsed;
+    uint64 count = (uint64) num * TIMING_ITERS;
+#endif
+    uint len = 0;
+    int i;
+    for (i = 0; i < TIMING_ITERS; i++)
+        len = encode_all(dc, instrs, num, buf);
+#if VERBOSE
+    elapsed = dr_get_milliseconds() - start;
+    dr_printf("%s: %u instrs in %u ms: %u instrs/sec\n", what, (uint)count,
+              (uint)elapsed, (uint)(elapsed == 0 ? 0 : (count * 1000) / elapsed));
+#endif
+    return len;
+}
+
+int
+main(int argc, char *argv[])
+{
+    void *dc = dr_standalone_init();
+    instrlist_t *ilist = instrlist_create(dc);
+    instr_t *instrs[MAX_INSTRS];
+    uint fresh_len, cached_len;
+    int num, i;
+
+    num = build_instrs(dc, instrs);
+    /* half the instrs are meta: those must get their bits cached as well */
+    for (i = 0; i < num; i += 2)
+        instr_set_ok_to_mangle(instrs[i], false);
+    for (i = 0; i < num; i++)
+        instrlist_append(ilist, instrs[i]);
+
+    /* no raw bits yet, so every encode looks up its template */
+    fresh_len = time_encodes(dc, instrs, num, fresh_buf, "template");
+
+    /* a plain length query caches only the app instrs ... */
+    for (i = 0; i < num; i++) {
+        instr_length(dc, instrs[i]);
+        assert(instr_raw_bits_valid(instrs[i]) == instr_ok_to_mangle(instrs[i]));
+    }
+    /* ... while encoding the list caches the meta ones too */
+    instrlist_encode(dc, ilist, cached_buf, true);
+    for (i = 0; i < num; i++)
+        assert(instr_raw_bits_valid(instrs[i]));
+    cached_len = time_encodes(dc, instrs, num, cached_buf, "raw bits");
+
+    assert(fresh_len == cached_len);
+    assert(memcmp(fresh_buf, cached_buf, fresh_len) == 0);
+
+    instrlist_clear_and_destroy(dc, ilist);
+    dr_printf("all done\n");
+    return 0;
+}
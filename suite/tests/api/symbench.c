@@ -0,0 +1,114 @@
+/* Symbol Access Library test:
+ * symbench.c
+ *
+ * Loads this executable's own symbols through drsyms, then looks every
+ * symbol up by name and by address, checking each round trip, and runs
+ * batches of address lookups in address order (the pattern of a profile
+ * dump, which the address cache serves) and in a scattered order (which
+ * falls through to the binary search).  With VERBOSE set it reports
+ * lookups/sec for each batch.
+ */
+
+#include "configure.h"
+#include "dr_api.h"
+#include "drsyms.h"
+#include <assert.h>
+#include <string.h>
+
+#define VERBOSE 0
+
+#define TIMING_ITERS 200
+#define MAX_SYMS 4096
+#define MAX_NAME 256
+
+static const char *exe = "/proc/self/exe";
+static size_t offs[MAX_SYMS];
+static int num_syms;
+
+/* drsyms holds its lock across the callback, so just record the offset */
+static bool
+record_symbol(const char *name, size_t modoffs, void *data)
+{
+    if (num_syms >= MAX_SYMS)
+        return false;
+    offs[num_syms++] = modoffs;
+    return true;
+}
+
+static void
+lookup(size_t modoffs, drsym_info_t *sym)
+{
+    drsym_error_t res;
+    sym->struct_size = sizeof(*sym);
+    sym->name_size = MAX_NAME;
+    res = drsym_lookup_address(exe, modoffs, sym);
+    assert(res == DRSYM_SUCCESS || res == DRSYM_ERROR_LINE_NOT_AVAILABLE);
+    assert(sym->start_offs <= modoffs && modoffs < sym->end_offs);
+}
+
+static void
+check_round_trip(size_t modoffs)
+{
+    char buf[sizeof(drsym_info_t) + MAX_NAME];
+    drsym_info_t *sym = (drsym_info_t *) buf;
+    size_t found;
+    drsym_error_t res;
+    char buf2[sizeof(drsym_info_t) + MAX_NAME];
+    drsym_info_t *sym2 = (drsym_info_t *) buf2;
+    lookup(modoffs, sym);
+    res = drsym_lookup_symbol(exe, sym->name, &found);
+    assert(res == DRSYM_SUCCESS);
+    /* a static in another file may share the name: it must still resolve */
+    lookup(found, sym2);
+    assert(strcmp(sym->name, sym2->name) == 0);
+}
+
+static void
+time_lookups(const char *what, uint stride)
+{
+#if VERBOSE
+    uint64 start = dr_get_milliseconds();
+    uint64 elapsed;
+    uint64 count = (uint64) num_syms * TIMING_ITERS;
+#endif
+    char buf[sizeof(drsym_info_t) + MAX_NAME];
+    int i, j;
+    for (i = 0; i < TIMING_ITERS; i++) {
+        for (j = 0; j < num_syms; j++)
+            lookup(offs[(j * stride) % num_syms], (drsym_info_t *) buf);
+    }
+#if VERBOSE
+    elapsed = dr_get_milliseconds() - start;
+    dr_printf("%s: %u lookups in %u ms: %u lookups/sec\n", what, (uint)count,
+              (uint)elapsed, (uint)(elapsed == 0 ? 0 : (count * 1000) / elapsed));
+#endif
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t main_offs;
+    drsym_error_t res;
+    int i;
+
+    dr_standalone_init();
+    res = drsym_init(0);
+    assert(res == DRSYM_SUCCESS);
+    res = drsym_enumerate_symbols(exe, record_symbol, NULL);
+    assert(res == DRSYM_SUCCESS && num_syms > 0);
+    res = drsym_lookup_symbol(exe, "symbench!main", &main_offs);
+    assert(res == DRSYM_SUCCESS);
+    check_round_trip(main_offs);
+    for (i = 0; i < num_syms; i++)
+        check_round_trip(offs[i]);
+
+    /* enumeration is in address order */
+    time_lookups("sequential", 1);
+    /* a stride coprime with most symbol counts scatters the lookups */
+    time_lookups("scattered", 7919);
+
+    res = drsym_exit();
+    assert(res == DRSYM_SUCCESS);
+    dr_printf("all done\n");
+    return 0;
+}
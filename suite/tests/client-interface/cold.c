@@ -0,0 +1,23 @@
+/* Runs enough bbs for cold.dll.c's cold path to be taken many times. */
+
+#include <stdio.h>
+
+static int
+step(int x)
+{
+    if (x & 1)
+        return 3 * x + 1;
+    return x / 2;
+}
+
+int
+main()
+{
+    int i, n, steps = 0;
+    for (i = 1; i < 20000; i++) {
+        for (n = i; n != 1; n = step(n))
+            steps++;
+    }
+    fprintf(stderr, "%d steps\n", steps);
+    return 0;
+}
@@ -0,0 +1,74 @@
+/* Cold code layout test.
+ *
+ * Counts every bb execution and, on every 256th, takes a slow path marked
+ * with instr_set_cold().  DR moves the slow path past the fragment's exits
+ * and drops the jmp the hot path uses to skip it, so both layouts are run:
+ * the moved one in bbs and traces, and the in-place one in the bbs DR builds
+ * for traces.  Either way the slow path must run exactly once per 256 bbs.
+ * Compare the cold code and hot path i-cache line stats in the global log
+ * with -no_move_cold_code.
+ */
+
+#include "dr_api.h"
+
+#define MINSERT instrlist_meta_preinsert
+
+/* we don't want msgboxes for regressions */
+#define ASSERT(x) \
+    ((void)((!(x)) ? \
+        (dr_fprintf(STDERR, "ASSERT FAILURE: %s:%d: %s\n", \
+                    __FILE__,  __LINE__, #x), \
+         dr_abort(), 0) : 0))
+
+static uint hot_count;
+static uint cold_count;
+
+static dr_emit_flags_t
+bb_event(void *drcontext, void *tag, instrlist_t *bb, bool for_trace, bool translating)
+{
+    instr_t *where = instrlist_first(bb);
+    instr_t *cold = INSTR_CREATE_label(drcontext);
+    instr_t *back = INSTR_CREATE_label(drcontext);
+    instr_t *instr;
+
+    dr_save_arith_flags(drcontext, bb, where, SPILL_SLOT_1);
+    MINSERT(bb, where, INSTR_CREATE_inc(drcontext,
+                                        OPND_CREATE_ABSMEM(&hot_count, OPSZ_4)));
+    MINSERT(bb, where, INSTR_CREATE_test(drcontext,
+                                         OPND_CREATE_ABSMEM(&hot_count, OPSZ_4),
+                                         OPND_CREATE_INT32(0xff)));
+    MINSERT(bb, where, INSTR_CREATE_jcc(drcontext, OP_jz, opnd_create_instr(cold)));
+    MINSERT(bb, where, INSTR_CREATE_jmp_short(drcontext, opnd_create_instr(back)));
+
+    instr_set_cold(cold, true);
+    MINSERT(bb, where, cold);
+    instr = INSTR_CREATE_inc(drcontext, OPND_CREATE_ABSMEM(&cold_count, OPSZ_4));
+    instr_set_cold(instr, true);
+    MINSERT(bb, where, instr);
+    instr = INSTR_CREATE_jmp(drcontext, opnd_create_instr(back));
+    instr_set_cold(instr, true);
+    MINSERT(bb, where, instr);
+
+    MINSERT(bb, where, back);
+    dr_restore_arith_flags(drcontext, bb, where, SPILL_SLOT_1);
+    return DR_EMIT_DEFAULT;
+}
+
+static void
+exit_event(void)
+{
+    ASSERT(hot_count > 256);
+    if (cold_count == hot_count / 256)
+        dr_fprintf(STDERR, "cold path count matches\n");
+    else {
+        dr_fprintf(STDERR, "cold path ran %u times for %u bbs\n",
+                   cold_count, hot_count);
+    }
+}
+
+DR_EXPORT void
+dr_init(client_id_t id)
+{
+    dr_register_bb_event(bb_event);
+    dr_register_exit_event(exit_event);
+}
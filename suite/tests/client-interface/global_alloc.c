@@ -0,0 +1,6 @@
+/* The work is all in the client: see global_alloc.dll.c. */
+
+int main()
+{
+    return 0;
+}
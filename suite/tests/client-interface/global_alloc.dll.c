@@ -0,0 +1,137 @@
+/* Global heap stress test.
+ *
+ * Several client threads allocate and free global heap blocks of the
+ * common fixed sizes at once, which is what DR's per-thread heap magazines
+ * are for.  Half of each batch is handed to whichever thread next passes by
+ * the mailbox, so blocks are often freed by a thread other than the one
+ * that allocated them.  Every block is filled and checked before it's
+ * freed.  Meant to be run both with the default -heap_magazine_size and
+ * with 0; compare the heap magazine stats and the per-category heap
+ * accounting in the global log.
+ *
+ * With VERBOSE set it reports allocs/sec.
+ */
+
+#include "dr_api.h"
+
+#define VERBOSE 0
+
+#define NUM_THREADS 4
+#define ROUNDS 2000
+#define BATCH 64
+#define MAILBOX_SIZE 256
+
+/* we don't want msgboxes for regressions */
+#define ASSERT(x) \
+    ((void)((!(x)) ? \
+        (dr_fprintf(STDERR, "ASSERT FAILURE: %s:%d: %s\n", \
+                    __FILE__,  __LINE__, #x), \
+         dr_abort(), 0) : 0))
+
+static const size_t sizes[] = { 8, 12, 16, 24, 40, 64, 100, 128, 200, 256, 512 };
+#define NUM_SIZES (sizeof(sizes)/sizeof(sizes[0]))
+
+typedef struct {
+    byte *p;
+    size_t size;
+} block_t;
+
+static void *lock;
+static block_t mailbox[MAILBOX_SIZE];
+static uint mailbox_count;
+static uint num_done;
+#if VERBOSE
+static uint64 start_time;
+#endif
+
+static void
+fill(byte *p, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++)
+        p[i] = (byte) (size + i);
+}
+
+static void
+check_and_free(byte *p, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++)
+        ASSERT(p[i] == (byte) (size + i));
+    dr_global_free(p, size);
+}
+
+static void
+thread_func(void *arg)
+{
+    uint seed = (uint)(ptr_uint_t) arg;
+    block_t batch[BATCH];
+    uint round, i;
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < BATCH; i++) {
+            seed = seed * 1103515245 + 12345;
+            batch[i].size = sizes[(seed >> 16) % NUM_SIZES];
+            batch[i].p = dr_global_alloc(batch[i].size);
+            fill(batch[i].p, batch[i].size);
+        }
+        /* free the even blocks here, in reverse, and pass the odd ones on */
+        for (i = BATCH; i > 0; i -= 2)
+            check_and_free(batch[i-2].p, batch[i-2].size);
+        dr_mutex_lock(lock);
+        for (i = 1; i < BATCH; i += 2) {
+            if (mailbox_count < MAILBOX_SIZE)
+                mailbox[mailbox_count++] = batch[i];
+            else
+                check_and_free(batch[i].p, batch[i].size);
+        }
+        /* take someone else's share (or our own) to free */
+        for (i = 0; i < BATCH/2 && mailbox_count > 0; i++) {
+            mailbox_count--;
+            check_and_free(mailbox[mailbox_count].p, mailbox[mailbox_count].size);
+        }
+        dr_mutex_unlock(lock);
+    }
+    dr_mutex_lock(lock);
+    num_done++;
+    dr_mutex_unlock(lock);
+}
+
+static void
+exit_event(void)
+{
+    uint done;
+    do {
+        dr_mutex_lock(lock);
+        done = num_done;
+        dr_mutex_unlock(lock);
+        if (done < NUM_THREADS)
+            dr_sleep(10);
+    } while (done < NUM_THREADS);
+#if VERBOSE
+    {
+        uint64 elapsed = dr_get_milliseconds() - start_time;
+        uint64 count = (uint64) NUM_THREADS * ROUNDS * BATCH;
+        dr_fprintf(STDERR, "%u allocs in %u ms: %u allocs/sec\n", (uint)count,
+                   (uint)elapsed, (uint)(elapsed == 0 ? 0 : (count * 1000) / elapsed));
+    }
+#endif
+    while (mailbox_count > 0) {
+        mailbox_count--;
+        check_and_free(mailbox[mailbox_count].p, mailbox[mailbox_count].size);
+    }
+    dr_mutex_destroy(lock);
+    dr_fprintf(STDERR, "global alloc stress passed\n");
+}
+
+DR_EXPORT
+void dr_init(client_id_t id)
+{
+    uint i;
+    lock = dr_mutex_create();
+    dr_register_exit_event(exit_event);
+#if VERBOSE
+    start_time = dr_get_milliseconds();
+#endif
+    for (i = 0; i < NUM_THREADS; i++)
+        dr_create_client_thread(thread_func, (void *)(ptr_uint_t)(i + 1));
+}
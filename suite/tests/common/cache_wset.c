@@ -0,0 +1,59 @@
+/* Large-footprint code cache test.
+ *
+ * Calls a small hot set of functions between visits to a much larger set of
+ * cold ones, so a small finite bb cache keeps replacing fragments.  Meant to
+ * be run with a capped private bb cache that is not allowed to grow, once
+ * with FIFO replacement and once with -cache_second_chance; compare
+ * "Fragments regenerated, in-cache replacement" in the two runs' stats.
+ *
+ * With VERBOSE set it also reports calls/sec.
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+#include "many_funcs.h"
+
+#define VERBOSE 0
+
+#define ROUNDS 40
+#define HOT_EVERY 4
+
+/* 4 * 512 = 2048 distinct functions */
+MANY_FUNCS_512(1) MANY_FUNCS_512(2) MANY_FUNCS_512(3) MANY_FUNCS_512(4)
+
+static many_func_t funcs[] = {
+    MANY_FUNC_PTRS_512(1) MANY_FUNC_PTRS_512(2) MANY_FUNC_PTRS_512(3)
+    MANY_FUNC_PTRS_512(4)
+};
+#define NUM_FUNCS (sizeof(funcs)/sizeof(funcs[0]))
+#define NUM_HOT 32
+
+int
+main(void)
+{
+    unsigned int checksum = 0;
+    unsigned int r, i, h;
+#if VERBOSE
+    struct timeval start, end;
+    double usecs;
+    gettimeofday(&start, NULL);
+#endif
+    for (r = 0; r < ROUNDS; r++) {
+        for (i = NUM_HOT; i < NUM_FUNCS; i++) {
+            checksum += (*funcs[i])(r + i);
+            if (i % HOT_EVERY == 0) {
+                for (h = 0; h < NUM_HOT; h++)
+                    checksum += (*funcs[h])(r + h);
+            }
+        }
+    }
+#if VERBOSE
+    gettimeofday(&end, NULL);
+    usecs = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec);
+    fprintf(stderr, "%.0f calls/sec\n",
+            ROUNDS * (NUM_FUNCS - NUM_HOT) * (1.0 + (double)NUM_HOT / HOT_EVERY) *
+            1000000.0 / usecs);
+#endif
+    printf("checksum %u\n", checksum);
+    return 0;
+}
@@ -0,0 +1,106 @@
+/* Indirect-call benchmark for IBL target prediction.
+ *
+ * Dispatches through per-object ops tables the way kernel VFS and
+ * networking code does: most objects share one or two ops tables, with a
+ * long tail of rarely-used ones.  Under -speculate_last_exit the dominant
+ * targets should be compared inline at trace exits, leaving the hashtable
+ * lookup for the tail.  With VERBOSE set it reports calls/sec.
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#define VERBOSE 0
+
+#define NUM_OBJECTS 1024
+#define ITERS 2000
+
+typedef struct _ops_t {
+    int (*read)(int);
+    int (*write)(int);
+} ops_t;
+
+typedef struct _object_t {
+    const ops_t *ops;
+    int data;
+} object_t;
+
+#define OPS(name, r, w) \
+    static int name##_read(int x) { return x + r; } \
+    static int name##_write(int x) { return x ^ w; } \
+    static const ops_t name##_ops = { name##_read, name##_write };
+
+OPS(ext, 1, 0x11)
+OPS(tmp, 2, 0x22)
+OPS(proc, 3, 0x33)
+OPS(sock, 4, 0x44)
+OPS(pipe, 5, 0x55)
+OPS(dev, 6, 0x66)
+
+static object_t objects[NUM_OBJECTS];
+
+static void
+init_objects(void)
+{
+    int i;
+    for (i = 0; i < NUM_OBJECTS; i++) {
+        /* 80% ext, 12% tmp, the rest spread over the tail */
+        int pick = (i * 37) % 100;
+        if (pick < 80)
+            objects[i].ops = &ext_ops;
+        else if (pick < 92)
+            objects[i].ops = &tmp_ops;
+        else if (pick < 95)
+            objects[i].ops = &proc_ops;
+        else if (pick < 97)
+            objects[i].ops = &sock_ops;
+        else if (pick < 99)
+            objects[i].ops = &pipe_ops;
+        else
+            objects[i].ops = &dev_ops;
+        objects[i].data = i;
+    }
+}
+
+/* not inlined so that each call site stays a single indirect call */
+static int __attribute__((noinline))
+do_read(object_t *obj)
+{
+    return obj->ops->read(obj->data);
+}
+
+static int __attribute__((noinline))
+do_write(object_t *obj, int val)
+{
+    return obj->ops->write(val);
+}
+
+int
+main(void)
+{
+    int i, j;
+    unsigned int sum = 0;
+#if VERBOSE
+    struct timeval start, end;
+    double usecs;
+#endif
+
+    init_objects();
+#if VERBOSE
+    gettimeofday(&start, NULL);
+#endif
+    for (i = 0; i < ITERS; i++) {
+        for (j = 0; j < NUM_OBJECTS; j++) {
+            int val = do_read(&objects[j]);
+            sum += do_write(&objects[j], val);
+        }
+    }
+#if VERBOSE
+    gettimeofday(&end, NULL);
+    usecs = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec);
+    fprintf(stderr, "%.0f indirect calls/sec\n",
+            2.0 * ITERS * NUM_OBJECTS * 1000000.0 / usecs);
+#endif
+    printf("checksum %u\n", sum);
+    return 0;
+}
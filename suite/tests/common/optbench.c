@@ -0,0 +1,75 @@
+/* Trace optimizer test.
+ *
+ * Spins in a hot loop around a frame-building routine full of the patterns
+ * the optimization passes rewrite: leave, inc, and repeated xor zeroing,
+ * both where the flags are dead and where a later instr reads them.  Meant
+ * to be run with each -peephole/-remove_unnecessary_zeroing style option
+ * and with -optimize_bbs; the checksum must not change.  Compare the
+ * per-pass stats in the global log across runs.
+ *
+ * With VERBOSE set it also reports iterations/sec.
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#define VERBOSE 0
+
+#define ITERS 2000000
+
+#ifdef X64
+# define XSP "%%rsp"
+# define XBP "%%rbp"
+#else
+# define XSP "%%esp"
+# define XBP "%%ebp"
+#endif
+
+static unsigned int
+kernel(unsigned int x)
+{
+    unsigned int res;
+    __asm__ __volatile__(
+        /* step over the x64 red zone before building a frame */
+        "sub $128, "XSP"                \n\t"
+        "push "XBP"                     \n\t"
+        "mov "XSP", "XBP"               \n\t"
+        "xor %%eax, %%eax               \n\t"
+        "xor %%eax, %%eax               \n\t" /* redundant, flags dead */
+        "add %1, %%eax                  \n\t"
+        "xor %%edx, %%edx               \n\t"
+        "xor %%edx, %%edx               \n\t" /* redundant, but CF is read */
+        "adc $0, %%edx                  \n\t"
+        "inc %%eax                      \n\t"
+        "add %%edx, %%eax               \n\t"
+        "leave                          \n\t"
+        "add $128, "XSP"                \n\t"
+        "mov %%eax, %0                  \n\t"
+        : "=r" (res) : "r" (x) : "eax", "edx", "cc", "memory");
+    return res;
+}
+
+int
+main(void)
+{
+    unsigned int checksum = 0;
+    unsigned int i;
+#if VERBOSE
+    struct timeval start, end;
+    double usecs;
+    gettimeofday(&start, NULL);
+#endif
+    for (i = 0; i < ITERS; i++) {
+        if ((i & 7) == 0)
+            checksum ^= kernel(i);
+        else
+            checksum += kernel(checksum);
+    }
+#if VERBOSE
+    gettimeofday(&end, NULL);
+    usecs = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec);
+    fprintf(stderr, "%.0f iterations/sec\n", ITERS * 1000000.0 / usecs);
+#endif
+    printf("checksum %u\n", checksum);
+    return 0;
+}
@@ -0,0 +1,78 @@
+/* Code cache huge page test.
+ *
+ * Calls 512 functions of about 2KB of straight-line code each in a scattered
+ * order, so the bbs for one sweep span some 250 4KB pages of code
+ * cache: far more than the iTLB holds.  Meant to be run with and without
+ * -cache_huge_pages; the checksum must not change.  Compare the iTLB misses
+ * of the two runs with
+ *   perf stat -e iTLB-load-misses,iTLB-loads
+ *
+ * With VERBOSE set it also reports calls/sec.
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#define VERBOSE 0
+
+#define SWEEPS 200
+#define NUM_FUNCS 512
+/* odd, so stepping by it visits every function once per sweep */
+#define STRIDE 167
+
+#define FUNC(a, b, c)                                                   \
+    static unsigned int                                                 \
+    f##a##b##c(unsigned int x)                                          \
+    {                                                                   \
+        __asm__ __volatile__(                                           \
+            ".rept 256                  \n\t"                           \
+            "add %1, %0                 \n\t"                           \
+            "rol $3, %0                 \n\t"                           \
+            ".endr                      \n\t"                           \
+            : "+r" (x) : "i" (a*64 + b*8 + c) : "cc");                  \
+        return x;                                                       \
+    }
+#define FUNC8(a, b) \
+    FUNC(a, b, 0) FUNC(a, b, 1) FUNC(a, b, 2) FUNC(a, b, 3) \
+    FUNC(a, b, 4) FUNC(a, b, 5) FUNC(a, b, 6) FUNC(a, b, 7)
+#define FUNC64(a) \
+    FUNC8(a, 0) FUNC8(a, 1) FUNC8(a, 2) FUNC8(a, 3) \
+    FUNC8(a, 4) FUNC8(a, 5) FUNC8(a, 6) FUNC8(a, 7)
+
+FUNC64(0) FUNC64(1) FUNC64(2) FUNC64(3)
+FUNC64(4) FUNC64(5) FUNC64(6) FUNC64(7)
+
+#define REF8(a, b) \
+    f##a##b##0, f##a##b##1, f##a##b##2, f##a##b##3, \
+    f##a##b##4, f##a##b##5, f##a##b##6, f##a##b##7,
+#define REF64(a) \
+    REF8(a, 0) REF8(a, 1) REF8(a, 2) REF8(a, 3) \
+    REF8(a, 4) REF8(a, 5) REF8(a, 6) REF8(a, 7)
+
+static unsigned int (*const funcs[NUM_FUNCS])(unsigned int) = {
+    REF64(0) REF64(1) REF64(2) REF64(3)
+    REF64(4) REF64(5) REF64(6) REF64(7)
+};
+
+int
+main(void)
+{
+    unsigned int checksum = 0;
+    unsigned int i, j;
+#if VERBOSE
+    struct timeval start, end;
+    double usecs;
+    gettimeofday(&start, NULL);
+#endif
+    for (i = 0; i < SWEEPS; i++) {
+        for (j = 0; j < NUM_FUNCS; j++)
+            checksum = funcs[(j * STRIDE) % NUM_FUNCS](checksum);
+    }
+#if VERBOSE
+    gettimeofday(&end, NULL);
+    usecs = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec);
+    fprintf(stderr, "%.0f calls/sec\n", SWEEPS * NUM_FUNCS * 1000000.0 / usecs);
+#endif
+    printf("checksum %u\n", checksum);
+    return 0;
+}
@@ -0,0 +1,96 @@
+/* Signal translation test.
+ *
+ * Fills the bb cache with a few thousand distinct blocks and only then
+ * starts a hot loop, so the loop's fragments sit far from the start of
+ * their cache unit.  An interval timer fires SIGALRM as often as the kernel
+ * allows while the loop runs, and each signal that arrives in the cache has
+ * its fragment looked up by cache pc; that lookup used to walk every
+ * fragment header below the interrupted pc.  The checksum must not change.
+ *
+ * With VERBOSE set it also reports signals/sec and iterations/sec.
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define VERBOSE 0
+
+#define ITERS 50000000
+
+static volatile int num_signals;
+
+static void
+handler(int sig)
+{
+    num_signals++;
+}
+
+/* Each jne ends a bb, so this builds one small fragment per repetition. */
+static unsigned int
+fill_cache(unsigned int x)
+{
+    __asm__ __volatile__(
+        ".rept 4096                     \n\t"
+        "add $1, %0                     \n\t"
+        "cmp $0, %0                     \n\t"
+        "jne 1f                         \n\t"
+        "nop                            \n\t"
+        "1:                             \n\t"
+        ".endr                          \n\t"
+        : "+r" (x) : : "cc");
+    return x;
+}
+
+int
+main(void)
+{
+    struct sigaction act;
+    struct itimerval t;
+    unsigned int checksum;
+    unsigned int i;
+#if VERBOSE
+    struct timeval start, end;
+    double usecs;
+#endif
+
+    checksum = fill_cache(0);
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = handler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &act, NULL);
+
+    t.it_interval.tv_sec = 0;
+    t.it_interval.tv_usec = 100;
+    t.it_value = t.it_interval;
+    setitimer(ITIMER_REAL, &t, NULL);
+
+#if VERBOSE
+    gettimeofday(&start, NULL);
+#endif
+    for (i = 0; i < ITERS; i++) {
+        if ((i & 3) == 0)
+            checksum ^= i;
+        else
+            checksum += i >> 2;
+    }
+#if VERBOSE
+    gettimeofday(&end, NULL);
+#endif
+
+    memset(&t, 0, sizeof(t));
+    setitimer(ITIMER_REAL, &t, NULL);
+
+#if VERBOSE
+    usecs = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec);
+    fprintf(stderr, "%.0f signals/sec, %.0f iterations/sec\n",
+            num_signals * 1000000.0 / usecs, ITERS * 1000000.0 / usecs);
+#endif
+    printf("checksum %u\n", checksum);
+    if (num_signals > 0)
+        printf("got signals\n");
+    return 0;
+}
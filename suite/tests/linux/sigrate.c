@@ -0,0 +1,78 @@
+/* Signal delivery rate test.
+ *
+ * Runs a hot loop while an interval timer fires SIGALRM as often as the
+ * kernel allows, so that most signals arrive while the loop is in the code
+ * cache.  Meant to be run both with and without -signal_checks_inline, which
+ * trades unlinking the interrupted fragment for a check of the pending flag
+ * at every fragment entry; the checksum must not change.  Compare the
+ * signal stats in the global log across runs.
+ *
+ * With VERBOSE set it also reports signals/sec and iterations/sec.
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define VERBOSE 0
+
+#define ITERS 50000000
+
+static volatile int num_signals;
+
+static void
+handler(int sig)
+{
+    num_signals++;
+}
+
+int
+main(void)
+{
+    struct sigaction act;
+    struct itimerval t;
+    unsigned int checksum = 0;
+    unsigned int i;
+#if VERBOSE
+    struct timeval start, end;
+    double usecs;
+#endif
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = handler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &act, NULL);
+
+    t.it_interval.tv_sec = 0;
+    t.it_interval.tv_usec = 100;
+    t.it_value = t.it_interval;
+    setitimer(ITIMER_REAL, &t, NULL);
+
+#if VERBOSE
+    gettimeofday(&start, NULL);
+#endif
+    for (i = 0; i < ITERS; i++) {
+        if ((i & 3) == 0)
+            checksum ^= i;
+        else
+            checksum += i >> 2;
+    }
+#if VERBOSE
+    gettimeofday(&end, NULL);
+#endif
+
+    memset(&t, 0, sizeof(t));
+    setitimer(ITIMER_REAL, &t, NULL);
+
+#if VERBOSE
+    usecs = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec);
+    fprintf(stderr, "%.0f signals/sec, %.0f iterations/sec\n",
+            num_signals * 1000000.0 / usecs, ITERS * 1000000.0 / usecs);
+#endif
+    printf("checksum %u\n", checksum);
+    if (num_signals > 0)
+        printf("got signals\n");
+    return 0;
+}
@@ -0,0 +1,42 @@
+/* Generates many distinct small functions, for tests that need a large code
+ * footprint or many indirect branch targets.
+ *
+ * MANY_FUNCS_64(n) defines the 64 functions f<n>00 .. f<n>77, and
+ * MANY_FUNC_PTRS_64(n) lists pointers to them for an initializer; the
+ * _512 versions define f<n>100 .. f<n>877.  n must not start with 0.
+ * f<n>(x) returns x * 3 + n, so calling every function once sums the same
+ * whichever argument each call gets, while a call that reaches the wrong
+ * function changes the sum.
+ */
+
+#ifndef MANY_FUNCS_H
+#define MANY_FUNCS_H
+
+typedef int (*many_func_t)(int);
+
+#define MANY_FUNCS_1(n) static int f##n(int x) { return x * 3 + n; }
+#define MANY_FUNCS_8(n) \
+    MANY_FUNCS_1(n##0) MANY_FUNCS_1(n##1) MANY_FUNCS_1(n##2) MANY_FUNCS_1(n##3) \
+    MANY_FUNCS_1(n##4) MANY_FUNCS_1(n##5) MANY_FUNCS_1(n##6) MANY_FUNCS_1(n##7)
+#define MANY_FUNCS_64(n) \
+    MANY_FUNCS_8(n##0) MANY_FUNCS_8(n##1) MANY_FUNCS_8(n##2) MANY_FUNCS_8(n##3) \
+    MANY_FUNCS_8(n##4) MANY_FUNCS_8(n##5) MANY_FUNCS_8(n##6) MANY_FUNCS_8(n##7)
+#define MANY_FUNCS_512(n) \
+    MANY_FUNCS_64(n##1) MANY_FUNCS_64(n##2) MANY_FUNCS_64(n##3) MANY_FUNCS_64(n##4) \
+    MANY_FUNCS_64(n##5) MANY_FUNCS_64(n##6) MANY_FUNCS_64(n##7) MANY_FUNCS_64(n##8)
+
+#define MANY_FUNC_PTRS_1(n) f##n,
+#define MANY_FUNC_PTRS_8(n) \
+    MANY_FUNC_PTRS_1(n##0) MANY_FUNC_PTRS_1(n##1) MANY_FUNC_PTRS_1(n##2) \
+    MANY_FUNC_PTRS_1(n##3) MANY_FUNC_PTRS_1(n##4) MANY_FUNC_PTRS_1(n##5) \
+    MANY_FUNC_PTRS_1(n##6) MANY_FUNC_PTRS_1(n##7)
+#define MANY_FUNC_PTRS_64(n) \
+    MANY_FUNC_PTRS_8(n##0) MANY_FUNC_PTRS_8(n##1) MANY_FUNC_PTRS_8(n##2) \
+    MANY_FUNC_PTRS_8(n##3) MANY_FUNC_PTRS_8(n##4) MANY_FUNC_PTRS_8(n##5) \
+    MANY_FUNC_PTRS_8(n##6) MANY_FUNC_PTRS_8(n##7)
+#define MANY_FUNC_PTRS_512(n) \
+    MANY_FUNC_PTRS_64(n##1) MANY_FUNC_PTRS_64(n##2) MANY_FUNC_PTRS_64(n##3) \
+    MANY_FUNC_PTRS_64(n##4) MANY_FUNC_PTRS_64(n##5) MANY_FUNC_PTRS_64(n##6) \
+    MANY_FUNC_PTRS_64(n##7) MANY_FUNC_PTRS_64(n##8)
+
+#endif /* MANY_FUNCS_H */
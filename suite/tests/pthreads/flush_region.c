@@ -0,0 +1,122 @@
+/* Region flush test and stall benchmark.
+ *
+ * One thread repeatedly maps a page, writes a tiny function into it, calls
+ * it, and unmaps it, so every iteration flushes the fragments of that page.
+ * The other threads spin in code that never touches the page.  With
+ * -flush_nostall the spinning threads should keep running through each
+ * flush; with the default flush they are all stopped at their next cache
+ * exit until the flush completes.
+ *
+ * With VERBOSE set it reports flushes/sec and how much work the spinning
+ * threads got done while the flushes ran.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define VERBOSE 0
+
+#define NUM_SPINNERS 4
+#define NUM_FLUSHES 500
+
+static volatile int done;
+
+typedef struct {
+    int id;
+    unsigned long iters;
+} spinner_data_t;
+
+static double
+usecs_since(struct timeval *start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000000.0 + (now.tv_usec - start->tv_usec);
+}
+
+/* Indirect calls so the spinners keep exiting to the ibl and would hit any
+ * flush synch point that stops them.
+ */
+static int inc(int x) { return x + 1; }
+static int dec(int x) { return x - 1; }
+static int (*volatile ops[2])(int) = { inc, dec };
+
+static void *
+spinner(void *arg)
+{
+    spinner_data_t *data = (spinner_data_t *) arg;
+    int x = 0;
+    while (!done) {
+        x = (*ops[data->iters & 1])(x);
+        data->iters++;
+    }
+    if (x != 0 && x != 1)
+        fprintf(stderr, "spinner %d: bad value %d\n", data->id, x);
+    return NULL;
+}
+
+/* mov eax, imm32; ret */
+static int
+run_generated(int val)
+{
+    unsigned char *pc = mmap(NULL, 4096, PROT_READ|PROT_WRITE|PROT_EXEC,
+                             MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    int res;
+    if (pc == MAP_FAILED) {
+        fprintf(stderr, "mmap failed\n");
+        exit(1);
+    }
+    pc[0] = 0xb8;
+    memcpy(pc + 1, &val, sizeof(val));
+    pc[5] = 0xc3;
+    res = ((int (*)(void)) pc)();
+    munmap(pc, 4096);
+    return res;
+}
+
+int
+main(int argc, char **argv)
+{
+    pthread_t threads[NUM_SPINNERS];
+    spinner_data_t data[NUM_SPINNERS];
+    struct timeval start;
+    double usecs;
+    int i, bad = 0;
+
+    for (i = 0; i < NUM_SPINNERS; i++) {
+        data[i].id = i;
+        data[i].iters = 0;
+        if (pthread_create(&threads[i], NULL, spinner, &data[i]) != 0) {
+            fprintf(stderr, "%s: cannot make thread\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NUM_FLUSHES; i++) {
+        if (run_generated(i) != i)
+            bad++;
+    }
+    usecs = usecs_since(&start);
+
+    done = 1;
+    for (i = 0; i < NUM_SPINNERS; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            fprintf(stderr, "%s: thread join failed\n", argv[0]);
+            exit(1);
+        }
+    }
+#if VERBOSE
+    fprintf(stderr, "%.0f flushes/sec\n", NUM_FLUSHES * 1000000.0 / usecs);
+    for (i = 0; i < NUM_SPINNERS; i++) {
+        fprintf(stderr, "spinner %d: %.0f iters/sec during flushes\n",
+                i, data[i].iters * 1000000.0 / usecs);
+    }
+#endif
+    printf("%d flushes, %d bad results\n", NUM_FLUSHES, bad);
+    return 0;
+}
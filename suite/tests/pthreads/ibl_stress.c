@@ -0,0 +1,129 @@
+/* IBL-miss-heavy stress test and throughput benchmark for thread-shared
+ * IBT tables.
+ *
+ * Every thread makes indirect calls through the same table of NUM_TARGETS
+ * distinct functions, each thread walking it in a different order, so all
+ * threads miss in the shared IBT tables at once and race to add the same
+ * targets while the tables resize underneath them.  Run with
+ * -shared_bb_ibt_tables -shared_trace_ibt_tables, and with a small initial
+ * table size to force resizes during the fill.
+ *
+ * With VERBOSE set it also reports per-phase calls/sec: the first round is
+ * dominated by IBL misses (table fills), later rounds by IBL hits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "many_funcs.h"
+
+#define VERBOSE 0
+
+#define NUM_THREADS 8
+#define ROUNDS 200
+
+/* 512 distinct indirect call (and return) targets */
+MANY_FUNCS_512(1)
+
+static many_func_t targets[] = {
+    MANY_FUNC_PTRS_512(1)
+};
+#define NUM_TARGETS (sizeof(targets)/sizeof(targets[0]))
+
+static pthread_barrier_t start_barrier;
+
+typedef struct {
+    int id;
+    long sum;
+    double miss_usecs;
+    double hit_usecs;
+} thread_data_t;
+
+static double
+usecs_since(struct timeval *start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000000.0 + (now.tv_usec - start->tv_usec);
+}
+
+/* Visits every target once, in an order that depends on stride. */
+static long
+one_round(unsigned int stride, unsigned int offset)
+{
+    long sum = 0;
+    unsigned int i;
+    for (i = 0; i < NUM_TARGETS; i++)
+        sum += (*targets[(i * stride + offset) % NUM_TARGETS])(i);
+    return sum;
+}
+
+static void *
+thread_func(void *arg)
+{
+    thread_data_t *data = (thread_data_t *) arg;
+    /* odd strides are coprime with NUM_TARGETS, a power of 2, so each
+     * round calls every target exactly once
+     */
+    unsigned int stride = 2 * data->id + 1;
+    unsigned int offset = data->id * 37;
+    struct timeval start;
+    long first;
+    int r;
+
+    pthread_barrier_wait(&start_barrier);
+    gettimeofday(&start, NULL);
+    first = one_round(stride, offset);
+    data->miss_usecs = usecs_since(&start);
+
+    gettimeofday(&start, NULL);
+    data->sum = first;
+    for (r = 1; r < ROUNDS; r++) {
+        long sum = one_round(stride, offset);
+        if (sum != first)
+            fprintf(stderr, "thread %d: round %d mismatch\n", data->id, r);
+    }
+    data->hit_usecs = usecs_since(&start);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    pthread_t threads[NUM_THREADS];
+    thread_data_t data[NUM_THREADS];
+    int i;
+
+    pthread_barrier_init(&start_barrier, NULL, NUM_THREADS);
+    for (i = 0; i < NUM_THREADS; i++) {
+        data[i].id = i;
+        if (pthread_create(&threads[i], NULL, thread_func, &data[i]) != 0) {
+            fprintf(stderr, "%s: cannot make thread\n", argv[0]);
+            exit(1);
+        }
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            fprintf(stderr, "%s: thread join failed\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    /* every order visits every target once, so all sums must agree */
+    for (i = 1; i < NUM_THREADS; i++) {
+        if (data[i].sum != data[0].sum)
+            fprintf(stderr, "thread %d sum mismatch\n", i);
+    }
+#if VERBOSE
+    for (i = 0; i < NUM_THREADS; i++) {
+        fprintf(stderr, "thread %d: fill %.0f calls/sec, steady %.0f calls/sec\n",
+                i, NUM_TARGETS * 1000000.0 / data[i].miss_usecs,
+                NUM_TARGETS * (ROUNDS - 1) * 1000000.0 / data[i].hit_usecs);
+    }
+#endif
+    printf("%d threads made %d indirect calls each\n", NUM_THREADS,
+           (int)(NUM_TARGETS * ROUNDS));
+    pthread_barrier_destroy(&start_barrier);
+    return 0;
+}
@@ -40,6 +40,7 @@
 # * out = file where output of background process will be sent
 # * nudge = arguments to nudgeunix
 # * clear = dir to clear ahead of time
+# * startup = file to write the time from launch to the first output line to
 
 # intra-arg space=@@ and inter-arg space=@
 string(REGEX REPLACE "@@" " " cmd "${cmd}")
@@ -57,6 +58,19 @@ if (NOT "${clear}" STREQUAL "")
   endif ()
 endif ()
 
+if (NOT "${startup}" STREQUAL "")
+  find_program(DATE "date")
+  if (NOT DATE)
+    message(FATAL_ERROR "cannot find 'date'")
+  endif (NOT DATE)
+  execute_process(COMMAND "${DATE}" "+%s%N"
+    OUTPUT_VARIABLE start_ns OUTPUT_STRIP_TRAILING_WHITESPACE)
+  # poll finely so the measurement is not dominated by our own sleeps
+  set(poll_secs 0.01)
+else ()
+  set(poll_secs 0.1)
+endif ()
+
 # run in the background
 execute_process(COMMAND ${cmd}
   RESULT_VARIABLE cmd_result
@@ -78,15 +92,36 @@ else (UNIX)
 endif (UNIX)
 
 while (NOT EXISTS "${out}")
-  execute_process(COMMAND "${SLEEP}" 0.1)
+  execute_process(COMMAND "${SLEEP}" ${poll_secs})
 endwhile ()
 file(READ "${out}" output)
 # we require that all runall tests write at least one line up front
 while (NOT "${output}" MATCHES "\n")
-  execute_process(COMMAND "${SLEEP}" 0.1)
+  execute_process(COMMAND "${SLEEP}" ${poll_secs})
   file(READ "${out}" output)
 endwhile()
 
+if (NOT "${startup}" STREQUAL "")
+  execute_process(COMMAND "${DATE}" "+%s%N"
+    OUTPUT_VARIABLE end_ns OUTPUT_STRIP_TRAILING_WHITESPACE)
+  # cmake math is 32-bit so keep only the low 1000 seconds, in microseconds
+  string(LENGTH "${start_ns}" ns_len)
+  math(EXPR ns_skip "${ns_len} - 12")
+  string(SUBSTRING "${start_ns}" ${ns_skip} 9 start_us)
+  string(SUBSTRING "${end_ns}" ${ns_skip} 9 end_us)
+  # no leading zeros, lest they be read as octal
+  string(REGEX REPLACE "^0+([0-9])" "\\1" start_us "${start_us}")
+  string(REGEX REPLACE "^0+([0-9])" "\\1" end_us "${end_us}")
+  math(EXPR startup_us "${end_us} - ${start_us}")
+  if (startup_us LESS 0)
+    # the window wrapped
+    math(EXPR startup_us "${startup_us} + 1000000000")
+  endif ()
+  math(EXPR startup_ms "${startup_us} / 1000")
+  # kept out of the test output, which must match the .expect file
+  file(WRITE "${startup}" "startup: ${startup_ms} ms\n")
+endif ()
+
 if ("${nudge}" MATCHES "<use-persisted>")
   # ensure using pcaches, instead of nudging
   file(READ "/proc/${pid}/maps" maps)